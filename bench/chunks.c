@@ -0,0 +1,118 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "chunk.h"
+#include "compiler.h"
+#include "memory.h"
+#include "vm.h"
+#include "workload.h"
+
+// Prints how many bytes each program's chunk takes before and after
+// finalizeChunk() packs it: the generated shapes at their smallest and
+// largest sizes, then any files named on the command line.
+//
+// Usage: bin/chunks [FILE...]
+
+typedef struct {
+  size_t before;
+  size_t after;
+} Sizes;
+
+static Sizes total;
+
+// The bytes a chunk holds while it's being written: its growing arrays at
+// their capacities, slack included.
+static size_t growingSize(Chunk* chunk) {
+  return (size_t)chunk->capacity * (sizeof(uint8_t) + sizeof(int)) +
+         sizeof(Handler) * (size_t)chunk->handlerCapacity +
+         sizeof(Value) * (size_t)chunk->constants.capacity;
+}
+
+// compile() hands back the chunk already packed, so it's written again
+// into growing arrays, as the compiler wrote it, and packed from there.
+static Sizes measure(Chunk* compiled) {
+  Chunk chunk;
+  initChunk(&chunk);
+  for (int i = 0; i < compiled->count; i++) {
+    writeChunk(&chunk, compiled->code[i], getLine(compiled, i));
+  }
+  for (int i = 0; i < compiled->handlerCount; i++) {
+    addHandler(&chunk, compiled->handlers[i]);
+  }
+  for (int i = 0; i < compiled->constants.count; i++) {
+    addConstant(&chunk, compiled->constants.values[i]);
+  }
+
+  Sizes sizes;
+  sizes.before = growingSize(&chunk);
+  finalizeChunk(&chunk);
+  sizes.after = chunk.packedSize;
+  freeChunk(&chunk);
+  return sizes;
+}
+
+static void report(const char* name, const char* source, const char* path) {
+  Chunk chunk;
+  initChunk(&chunk);
+  if (!compile(source, path, &chunk)) {
+    freeChunk(&chunk);
+    fprintf(stderr, "Could not compile %s.\n", name);
+    exit(65);
+  }
+
+  Sizes sizes = measure(&chunk);
+  freeChunk(&chunk);
+  printf("%-28s %10zu %10zu  %5.1f%%\n", name, sizes.before, sizes.after,
+         100.0 * (1.0 - (double)sizes.after / (double)sizes.before));
+  total.before += sizes.before;
+  total.after += sizes.after;
+}
+
+static void reportShape(const Shape* shape, int size) {
+  size_t length;
+  char* program = generateWorkload(shape, size, 1, &length);
+  char name[64];
+  snprintf(name, sizeof(name), "%s %d", shape->name, size);
+  report(name, program, NULL);
+  free(program);
+}
+
+static char* readFile(const char* path) {
+  FILE* file = fopen(path, "rb");
+  if (file == NULL) {
+    fprintf(stderr, "Could not open file \"%s\".\n", path);
+    exit(74);
+  }
+
+  fseek(file, 0L, SEEK_END);
+  size_t size = (size_t)ftell(file);
+  rewind(file);
+
+  char* buffer = malloc(size + 1);
+  if (buffer == NULL || fread(buffer, 1, size, file) < size) {
+    fprintf(stderr, "Could not read file \"%s\".\n", path);
+    exit(74);
+  }
+  buffer[size] = '\0';
+  fclose(file);
+  return buffer;
+}
+
+int main(int argc, const char* argv[]) {
+  initVM();
+  printf("%-28s %10s %10s  %6s\n", "program", "before", "packed", "saved");
+  for (const Shape* shape = shapes; shape->name != NULL; shape++) {
+    reportShape(shape, shape->minSize);
+    reportShape(shape, shape->maxSize);
+  }
+  for (int i = 1; i < argc; i++) {
+    char* source = readFile(argv[i]);
+    report(argv[i], source, argv[i]);
+    free(source);
+  }
+
+  printf("%-28s %10zu %10zu  %5.1f%%\n", "total", total.before, total.after,
+         100.0 * (1.0 - (double)total.after / (double)total.before));
+  freeVM();
+  return 0;
+}
@@ -0,0 +1,29 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "workload.h"
+
+static void usage() {
+  fprintf(stderr, "Usage: generate SHAPE SIZE [SEED]\nShapes:");
+  for (const Shape* shape = shapes; shape->name != NULL; shape++) {
+    fprintf(stderr, " %s", shape->name);
+  }
+  fprintf(stderr, "\n");
+  exit(64);
+}
+
+// Writes one generated program to stdout.
+int main(int argc, const char* argv[]) {
+  if (argc < 3 || argc > 4) usage();
+
+  const Shape* shape = findShape(argv[1]);
+  int size = atoi(argv[2]);
+  if (shape == NULL || size <= 0) usage();
+  uint32_t seed = argc == 4 ? (uint32_t)strtoul(argv[3], NULL, 10) : 1;
+
+  size_t length;
+  char* program = generateWorkload(shape, size, seed, &length);
+  fwrite(program, 1, length, stdout);
+  free(program);
+  return 0;
+}
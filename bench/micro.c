@@ -0,0 +1,370 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <math.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "chunk.h"
+#include "document.h"
+#include "scanner.h"
+#include "value.h"
+#include "vm.h"
+
+// A sample is timed over enough iterations to take at least
+// SAMPLE_TIME, so the clock's resolution and overhead don't show.
+#define SAMPLE_TIME 0.002
+#define WARM_UP_TIME 0.05
+#define DEFAULT_SAMPLES 30
+
+// Opcode benchmarks run a chunk of OPCODE_REPEAT copies of the
+// instructions under test, so dispatch into and out of run() is spread
+// thin.
+#define OPCODE_REPEAT 1024
+
+// Ways to write a chunk or its constants are timed at a steady state: the
+// arrays are emptied, not freed, once they hold RESET_COUNT entries, so
+// their growth is paid only while warming up.
+#define RESET_COUNT 4096
+
+typedef struct {
+  const char* name;
+  // Returns how many operations one iteration of `run` performs.
+  double (*setup)();
+  void (*run)(long iterations);
+  void (*teardown)();
+} Benchmark;
+
+static volatile uint64_t sink;
+static int devNull;
+static int savedStdout;
+
+static double now() {
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return (double)time.tv_sec + (double)time.tv_nsec * 1e-9;
+}
+
+// Scanning a mix of every kind of token. One operation is one token.
+
+static const char* scanSource =
+    "// Sums the squares of the odd numbers in a file.\n"
+    "sum(for (line in lines(open(\"data/test.lox\")))\n"
+    "  try (len(line) * 2 + 1) % 3 == 0 and !false or 0x1f >= 12.5\n"
+    "  catch (error) \"skipped ${error} at ${len(line)}\") +\n"
+    "{\"key\": [1, 2, 3], \"other\": nil}[\"key\"][0] << 2 | ~7 ^ 3\n";
+
+static double setupScan() {
+  initScanner(scanSource);
+  int tokens = 0;
+  while (scanToken().type != TOKEN_EOF) tokens++;
+  return tokens;
+}
+
+static void runScan(long iterations) {
+  for (long i = 0; i < iterations; i++) {
+    initScanner(scanSource);
+    Token token;
+    do {
+      token = scanToken();
+    } while (token.type != TOKEN_EOF);
+    sink += (uint64_t)token.line;
+  }
+}
+
+// Appending bytes and constants to a chunk.
+
+static Chunk chunk;
+
+static double setupChunk() {
+  initChunk(&chunk);
+  return 1;
+}
+
+static void teardownChunk() {
+  freeChunk(&chunk);
+}
+
+static void runWriteChunk(long iterations) {
+  for (long i = 0; i < iterations; i++) {
+    if (chunk.count == RESET_COUNT) chunk.count = 0;
+    writeChunk(&chunk, (uint8_t)i, 1);
+  }
+}
+
+static void runAddConstant(long iterations) {
+  for (long i = 0; i < iterations; i++) {
+    if (chunk.constants.count == RESET_COUNT) chunk.constants.count = 0;
+    sink += (uint64_t)addConstant(&chunk, NUMBER_VAL((double)i));
+  }
+}
+
+// A push and the pop that undoes it count as one operation.
+
+static void runPushPop(long iterations) {
+  for (long i = 0; i < iterations; i++) {
+    push(NUMBER_VAL((double)i));
+    sink += (uint64_t)AS_NUMBER(pop());
+  }
+}
+
+static double setupNothing() {
+  return 1;
+}
+
+// Editing a document of DOCUMENT_LINES lines. Typing a character and
+// deleting it again are two operations; the document ends each iteration
+// as it began. "+type" edits one spot, as typing does, and "+jump" a new
+// spot each time, so the edit has to find its place among all the tokens.
+
+#define DOCUMENT_LINES 100000
+
+static Document document;
+
+static double setupDocument() {
+  static const char line[] =
+      "  {\"key\": \"value ${n + 1}\", \"n\": [1, 2.5]},\n";
+  int lineLength = (int)sizeof(line) - 1;
+  char* source = malloc((size_t)lineLength * DOCUMENT_LINES + 3);
+  if (source == NULL) exit(1);
+  char* end = source;
+  *end++ = '[';
+  for (int i = 0; i < DOCUMENT_LINES; i++) {
+    memcpy(end, line, (size_t)lineLength);
+    end += lineLength;
+  }
+  *end++ = ']';
+  *end = '\0';
+
+  initDocument(&document, source, NULL);
+  free(source);
+  return 2;
+}
+
+static void teardownDocument() {
+  freeDocument(&document);
+}
+
+static void typeAt(int offset) {
+  TokenRange range = editDocument(&document, offset, offset, "x", 1);
+  sink += (uint64_t)range.added;
+  range = editDocument(&document, offset, offset + 1, "", 0);
+  sink += (uint64_t)range.added;
+}
+
+static void runTypeDocument(long iterations) {
+  for (long i = 0; i < iterations; i++) typeAt(documentLength(&document) / 2);
+}
+
+static void runJumpDocument(long iterations) {
+  uint32_t offset = 1;
+  for (long i = 0; i < iterations; i++) {
+    offset = offset * 1664525u + 1013904223u;
+    typeAt((int)(offset % (uint32_t)documentLength(&document)));
+  }
+}
+
+// Opcode handlers. Each benchmark's chunk pushes one value to work on,
+// then repeats an instruction sequence that leaves one value behind. The
+// result the chunk returns is printed, so stdout goes to /dev/null for
+// the run.
+
+static void buildOpcodeChunk(Value start, const uint8_t* code, int length) {
+  initChunk(&chunk);
+  writeChunk(&chunk, OP_CONSTANT, 1);
+  writeChunk(&chunk, (uint8_t)addConstant(&chunk, start), 1);
+  for (int i = 0; i < OPCODE_REPEAT; i++) {
+    for (int j = 0; j < length; j++) writeChunk(&chunk, code[j], 1);
+  }
+  writeChunk(&chunk, OP_RETURN, 1);
+  finalizeChunk(&chunk);
+}
+
+static void runOpcodes(long iterations) {
+  fflush(stdout);
+  dup2(devNull, STDOUT_FILENO);
+  for (long i = 0; i < iterations; i++) {
+    if (interpretChunk(&chunk) != INTERPRET_OK) exit(70);
+  }
+  fflush(stdout);
+  dup2(savedStdout, STDOUT_FILENO);
+}
+
+#define OPCODE_BENCHMARK(name, start, ...)                                  \
+  static double setup##name() {                                             \
+    static const uint8_t code[] = {__VA_ARGS__};                            \
+    buildOpcodeChunk(start, code, (int)sizeof(code));                       \
+    return OPCODE_REPEAT;                                                   \
+  }
+
+// x stays put, so none of these drift into infinities or denormals.
+OPCODE_BENCHMARK(Not, BOOL_VAL(true), OP_NOT)
+OPCODE_BENCHMARK(Negate, NUMBER_VAL(1), OP_NEGATE)
+OPCODE_BENCHMARK(GetLocal, NUMBER_VAL(0), OP_GET_LOCAL, 0, OP_POP_N, 1)
+OPCODE_BENCHMARK(Add, NUMBER_VAL(0), OP_GET_LOCAL, 0, OP_ADD)
+OPCODE_BENCHMARK(Multiply, NUMBER_VAL(1), OP_GET_LOCAL, 0, OP_MULTIPLY)
+OPCODE_BENCHMARK(Less, NUMBER_VAL(1), OP_GET_LOCAL, 0, OP_GET_LOCAL, 0,
+                 OP_LESS, OP_POP_N, 1)
+
+#undef OPCODE_BENCHMARK
+
+static Benchmark benchmarks[] = {
+  {"scanToken",               setupScan,     runScan,        NULL},
+  {"writeChunk",              setupChunk,    runWriteChunk,  teardownChunk},
+  {"addConstant",             setupChunk,    runAddConstant, teardownChunk},
+  {"push+pop",                setupNothing,  runPushPop,     NULL},
+  {"editDocument+type",       setupDocument, runTypeDocument,
+                                                             teardownDocument},
+  {"editDocument+jump",       setupDocument, runJumpDocument,
+                                                             teardownDocument},
+  {"OP_NOT",                  setupNot,      runOpcodes,     teardownChunk},
+  {"OP_NEGATE",               setupNegate,   runOpcodes,     teardownChunk},
+  {"OP_GET_LOCAL+POP_N",      setupGetLocal, runOpcodes,     teardownChunk},
+  {"OP_GET_LOCAL+ADD",        setupAdd,      runOpcodes,     teardownChunk},
+  {"OP_GET_LOCAL+MULTIPLY",   setupMultiply, runOpcodes,     teardownChunk},
+  {"OP_GET_LOCAL*2+LESS+POP_N",
+                              setupLess,     runOpcodes,     teardownChunk},
+  {NULL,                      NULL,          NULL,           NULL},
+};
+
+// Two-sided 95% points of Student's t for 1 to 30 degrees of freedom.
+static const double tTable[] = {
+  12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+  2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+  2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042,
+};
+
+static double tCritical(int freedom) {
+  if (freedom <= 30) return tTable[freedom - 1];
+  return 1.96;
+}
+
+static double timeIterations(Benchmark* benchmark, long iterations) {
+  double start = now();
+  benchmark->run(iterations);
+  return now() - start;
+}
+
+// Doubles the iteration count until a sample takes SAMPLE_TIME.
+static long calibrate(Benchmark* benchmark) {
+  long iterations = 1;
+  while (timeIterations(benchmark, iterations) < SAMPLE_TIME) {
+    iterations *= 2;
+  }
+  return iterations;
+}
+
+static int compareDoubles(const void* a, const void* b) {
+  double left = *(const double*)a;
+  double right = *(const double*)b;
+  return (left > right) - (left < right);
+}
+
+static void measure(Benchmark* benchmark, int sampleCount) {
+  double opsPerIteration = benchmark->setup();
+
+  double warmUpEnd = now() + WARM_UP_TIME;
+  while (now() < warmUpEnd) benchmark->run(1);
+  long iterations = calibrate(benchmark);
+
+  double* samples = malloc(sizeof(double) * (size_t)sampleCount);
+  if (samples == NULL) exit(1);
+  double total = 0;
+  for (int i = 0; i < sampleCount; i++) {
+    double elapsed = timeIterations(benchmark, iterations);
+    samples[i] = elapsed * 1e9 / ((double)iterations * opsPerIteration);
+    total += samples[i];
+  }
+  if (benchmark->teardown != NULL) benchmark->teardown();
+
+  double mean = total / sampleCount;
+  double squares = 0;
+  for (int i = 0; i < sampleCount; i++) {
+    squares += (samples[i] - mean) * (samples[i] - mean);
+  }
+  double deviation = sampleCount > 1 ? sqrt(squares / (sampleCount - 1)) : 0;
+  double interval = sampleCount > 1
+      ? tCritical(sampleCount - 1) * deviation / sqrt(sampleCount)
+      : 0;
+
+  qsort(samples, (size_t)sampleCount, sizeof(double), compareDoubles);
+  printf("%-26s %10.2f ns/op  +- %6.2f (%4.1f%%)  median %9.2f  "
+         "min %9.2f\n",
+         benchmark->name, mean, interval, mean > 0 ? interval / mean * 100 : 0,
+         samples[sampleCount / 2], samples[0]);
+  free(samples);
+}
+
+static void usage() {
+  fprintf(stderr,
+          "Usage: micro [--cpu N] [--samples N] [name...]\n"
+          "Runs the benchmarks whose names contain one of the names given, "
+          "or all of them.\n");
+  exit(64);
+}
+
+static bool selected(Benchmark* benchmark, int argc, const char* argv[],
+                     int first) {
+  if (first == argc) return true;
+  for (int i = first; i < argc; i++) {
+    if (strstr(benchmark->name, argv[i]) != NULL) return true;
+  }
+  return false;
+}
+
+// Reports ns/op for interpreter internals with a 95% confidence interval
+// over independent samples, after warming each one up.
+int main(int argc, const char* argv[]) {
+  int cpu = -1;
+  int sampleCount = DEFAULT_SAMPLES;
+  int first = 1;
+  while (first < argc && strncmp(argv[first], "--", 2) == 0) {
+    if (strcmp(argv[first], "--cpu") == 0 && first + 1 < argc) {
+      cpu = atoi(argv[first + 1]);
+    } else if (strcmp(argv[first], "--samples") == 0 && first + 1 < argc) {
+      sampleCount = atoi(argv[first + 1]);
+      if (sampleCount < 1) usage();
+    } else {
+      usage();
+    }
+    first += 2;
+  }
+
+  if (cpu >= 0) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+      perror("micro: cannot pin to that CPU");
+      return 71;
+    }
+  }
+
+  devNull = open("/dev/null", O_WRONLY);
+  savedStdout = dup(STDOUT_FILENO);
+  if (devNull < 0 || savedStdout < 0) {
+    perror("micro");
+    return 74;
+  }
+
+  initVM();
+  if (cpu >= 0) {
+    printf("%d samples each, pinned to CPU %d\n", sampleCount, cpu);
+  } else {
+    printf("%d samples each, not pinned\n", sampleCount);
+  }
+  for (Benchmark* benchmark = benchmarks; benchmark->name != NULL;
+       benchmark++) {
+    if (selected(benchmark, argc, argv, first)) {
+      measure(benchmark, sampleCount);
+    }
+  }
+  freeVM();
+
+  close(devNull);
+  close(savedStdout);
+  return 0;
+}
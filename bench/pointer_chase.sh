@@ -0,0 +1,56 @@
+#!/bin/sh
+# Times a pointer-chasing walk over a large heap with and without
+# --huge-pages. The heap is a list of 2^BITS one-element lists, each
+# holding the index of the next one along a full-period linear
+# congruential sequence, so every step lands somewhere unpredictable in
+# the heap. Each mode also runs with no steps, to take the time spent
+# building the heap out of the result.
+#
+# Usage: bench/pointer_chase.sh CLOX [BITS] [RUNS]
+
+set -e
+
+CLOX=${1:?usage: $0 CLOX [BITS] [RUNS]}
+BITS=${2:-22}
+RUNS=${3:-3}
+SIZE=$((1 << BITS))
+DIR=$(mktemp -d)
+trap 'rm -rf "$DIR"' EXIT
+
+program() {
+  cat > "$DIR/chase.lox" <<LOX
+sum(for (chain in [[for (i in range($SIZE)) [(i * 1103515245 + 12345) % $SIZE]]])
+    for (z in [0])
+      for (s in [0])
+        for (i in range($1)) s = chain[s][z])
+LOX
+}
+
+now() {
+  date +%s%N
+}
+
+# Prints the fastest of $RUNS runs in milliseconds.
+best() {
+  fastest=
+  for run in $(seq "$RUNS"); do
+    start=$(now)
+    "$CLOX" "$@" "$DIR/chase.lox" > /dev/null
+    elapsed=$((($(now) - start) / 1000000))
+    if [ -z "$fastest" ] || [ "$elapsed" -lt "$fastest" ]; then
+      fastest=$elapsed
+    fi
+  done
+  echo "$fastest"
+}
+
+echo "Chasing $SIZE steps through $SIZE lists, best of $RUNS runs."
+for mode in "" --huge-pages; do
+  program 0
+  build=$(best $mode)
+  program "$SIZE"
+  total=$(best $mode)
+  chase=$((total - build))
+  printf '%-14s build %6d ms  chase %6d ms  %6d ns/step\n' \
+    "${mode:-default}" "$build" "$chase" $((chase * 1000000 / SIZE))
+done
@@ -0,0 +1,243 @@
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "chunk.h"
+#include "compiler.h"
+#include "scanner.h"
+#include "vm.h"
+#include "workload.h"
+
+// Each phase is run until it has had this long, or MAX_RUNS times, and
+// the best run counts.
+#define MIN_RUNS 3
+#define MAX_RUNS 20
+#define BUDGET 0.25
+
+// Between the two largest sizes a phase's time may grow as the size to
+// this power before it counts as non-linear. Times under MIN_TIME are
+// left alone, being more noise than work.
+#define MAX_EXPONENT 1.5
+#define MIN_TIME 0.0005
+
+#define BAR_WIDTH 30
+
+typedef enum {
+  PHASE_SCAN,
+  PHASE_COMPILE,
+  PHASE_RUN,
+  PHASE_COUNT,
+} Phase;
+
+static const char* phaseNames[] = {"scan", "compile", "run"};
+
+typedef struct {
+  int size;
+  size_t bytes;
+  int tokens;
+  double times[PHASE_COUNT];
+} Sample;
+
+static int devNull;
+static int savedStdout;
+
+static double now() {
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return (double)time.tv_sec + (double)time.tv_nsec * 1e-9;
+}
+
+// The VM prints constants and results as it goes. That output would
+// swamp the table, so it's sent to /dev/null while a program runs.
+static void silence() {
+  fflush(stdout);
+  dup2(devNull, STDOUT_FILENO);
+}
+
+static void restore() {
+  fflush(stdout);
+  dup2(savedStdout, STDOUT_FILENO);
+}
+
+static int scanAll(const char* source) {
+  initScanner(source);
+  int tokens = 0;
+  for (;;) {
+    Token token = scanToken();
+    if (token.type == TOKEN_EOF) return tokens;
+    if (token.type == TOKEN_ERROR) {
+      fprintf(stderr, "Scan error: %.*s\n", token.length, token.start);
+      exit(70);
+    }
+    tokens++;
+  }
+}
+
+static double timeScan(const char* source, int* tokens) {
+  double start = now();
+  *tokens = scanAll(source);
+  return now() - start;
+}
+
+static double timeCompile(const char* source, const char* name) {
+  Chunk chunk;
+  initChunk(&chunk);
+  double start = now();
+  bool compiled = compile(source, name, &chunk);
+  double elapsed = now() - start;
+  freeChunk(&chunk);
+  if (!compiled) exit(65);
+  return elapsed;
+}
+
+static double timeRun(const char* source, const char* name) {
+  Chunk chunk;
+  initChunk(&chunk);
+  if (!compile(source, name, &chunk)) exit(65);
+
+  silence();
+  double start = now();
+  InterpretResult result = interpretChunk(&chunk);
+  double elapsed = now() - start;
+  restore();
+
+  freeChunk(&chunk);
+  if (result != INTERPRET_OK) {
+    fprintf(stderr, "%s: the generated program failed.\n", name);
+    exit(70);
+  }
+  return elapsed;
+}
+
+static double best(Phase phase, const char* source, const char* name,
+                   int* tokens) {
+  double fastest = INFINITY;
+  double spent = 0;
+  for (int run = 0; run < MAX_RUNS; run++) {
+    if (run >= MIN_RUNS && spent >= BUDGET) break;
+
+    double elapsed = 0;
+    switch (phase) {
+      case PHASE_SCAN: elapsed = timeScan(source, tokens); break;
+      case PHASE_COMPILE: elapsed = timeCompile(source, name); break;
+      case PHASE_RUN: elapsed = timeRun(source, name); break;
+      default: break;
+    }
+    spent += elapsed;
+    if (elapsed < fastest) fastest = elapsed;
+  }
+  return fastest;
+}
+
+static void printBar(double rate, double peak) {
+  int width = peak > 0 ? (int)(rate / peak * BAR_WIDTH + 0.5) : 0;
+  printf(" |");
+  for (int i = 0; i < BAR_WIDTH; i++) putchar(i < width ? '#' : ' ');
+  printf("|");
+}
+
+// The power the phase's time grew by between the last two sizes, or 0
+// if they were too quick to say.
+static double exponent(Sample* samples, int count, Phase phase) {
+  Sample* small = &samples[count - 2];
+  Sample* large = &samples[count - 1];
+  if (small->times[phase] < MIN_TIME || large->times[phase] < MIN_TIME) {
+    return 0;
+  }
+  return log(large->times[phase] / small->times[phase]) /
+         log((double)large->bytes / (double)small->bytes);
+}
+
+// Prints a table of the shape's sizes with each phase's throughput, and
+// returns whether every phase stayed near linear.
+static bool measureShape(const Shape* shape, uint32_t seed) {
+  Sample samples[16];
+  int count = 0;
+
+  for (int size = shape->minSize; size <= shape->maxSize && count < 16;
+       size *= 4) {
+    size_t bytes;
+    char* source = generateWorkload(shape, size, seed, &bytes);
+    Sample* sample = &samples[count++];
+    sample->size = size;
+    sample->bytes = bytes;
+    for (int phase = 0; phase < PHASE_COUNT; phase++) {
+      sample->times[phase] = best((Phase)phase, source, shape->name,
+                                  &sample->tokens);
+    }
+    free(source);
+  }
+
+  printf("\n%s (size in %s)\n", shape->name, shape->unit);
+  for (int phase = 0; phase < PHASE_COUNT; phase++) {
+    double peak = 0;
+    for (int i = 0; i < count; i++) {
+      double rate = samples[i].bytes / samples[i].times[phase];
+      if (rate > peak) peak = rate;
+    }
+
+    printf("  %s\n", phaseNames[phase]);
+    for (int i = 0; i < count; i++) {
+      Sample* sample = &samples[i];
+      double rate = sample->bytes / sample->times[phase];
+      printf("    %8d %9zu bytes %8d tokens %10.3f ms %8.1f MB/s",
+             sample->size, sample->bytes, sample->tokens,
+             sample->times[phase] * 1e3, rate / 1e6);
+      printBar(rate, peak);
+      printf("\n");
+    }
+  }
+
+  bool linear = true;
+  if (count < 2) return linear;
+  for (int phase = 0; phase < PHASE_COUNT; phase++) {
+    double power = exponent(samples, count, phase);
+    if (power > MAX_EXPONENT) {
+      printf("  ! %s grows as size^%.2f\n", phaseNames[phase], power);
+      linear = false;
+    }
+  }
+  return linear;
+}
+
+// Times scanning, compiling and running generated programs of growing
+// size, one shape at a time, and fails if a phase scales worse than
+// MAX_EXPONENT.
+int main(int argc, const char* argv[]) {
+  uint32_t seed = 1;
+  const Shape* only = NULL;
+  for (int i = 1; i < argc; i++) {
+    const Shape* shape = findShape(argv[i]);
+    if (shape != NULL) {
+      only = shape;
+    } else {
+      seed = (uint32_t)strtoul(argv[i], NULL, 10);
+    }
+  }
+
+  devNull = open("/dev/null", O_WRONLY);
+  savedStdout = dup(STDOUT_FILENO);
+  if (devNull < 0 || savedStdout < 0) {
+    perror("scaling");
+    return 74;
+  }
+
+  initVM();
+  bool linear = true;
+  for (const Shape* shape = shapes; shape->name != NULL; shape++) {
+    if (only != NULL && shape != only) continue;
+    if (!measureShape(shape, seed)) linear = false;
+  }
+  freeVM();
+
+  close(devNull);
+  close(savedStdout);
+  if (!linear) {
+    printf("\nSome phases scale worse than linearly.\n");
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,670 @@
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "compiler.h"
+#include "json.h"
+#include "memory.h"
+#include "number.h"
+#include "object.h"
+#include "sort.h"
+#include "table.h"
+#include "value.h"
+#include "vm.h"
+
+// Whole operations on inputs too large for bench/micro.c's ns/op loop.
+// Each input is built once, outside the timing, and the best of `runs`
+// counts.
+#define DEFAULT_RUNS 3
+
+#define SORT_SIZE 10000000
+#define FEW_DISTINCT 16
+
+// A power of two fills the table's entries exactly.
+#define MAP_SIZE (1 << 20)
+
+// The lines workload writes a file this large to $TMPDIR, or /tmp, unless
+// --lines-mb says otherwise.
+#define LINES_SIZE (2048L * 1024 * 1024)
+#define LINE_MIN 16
+#define LINE_MAX 112
+#define PATH_SIZE 4096
+
+#define JSON_RECORDS 400000
+// Each line is a string object, and garbage is only collected under a
+// quota, so the lines workload runs with one.
+#define LINES_QUOTA (256L * 1024 * 1024)
+
+typedef struct {
+  const char* name;
+  void (*run)(int runs);
+} Workload;
+
+static volatile uint64_t sink;
+static long linesSize = LINES_SIZE;
+static uint64_t randomState = 1;
+
+static double now() {
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return (double)time.tv_sec + (double)time.tv_nsec * 1e-9;
+}
+
+// SplitMix64, so inputs are the same on every run and every machine.
+static uint64_t nextRandom() {
+  uint64_t z = (randomState += 0x9e3779b97f4a7c15ULL);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+static void* allocateOrExit(size_t size) {
+  void* result = malloc(size);
+  if (result == NULL) {
+    fprintf(stderr, "throughput: out of memory\n");
+    exit(1);
+  }
+  return result;
+}
+
+static void report(const char* name, double seconds, double count,
+                   const char* unit) {
+  printf("  %-22s %9.1f ms  %8.1f ns/%s\n", name, seconds * 1e3,
+         seconds * 1e9 / count, unit);
+}
+
+// sort() on SORT_SIZE values. Lists of only numbers or only integers
+// take the radix path. One list among the numbers sends the same inputs
+// down the introsort path, where it sorts last and leaves sorted inputs
+// sorted.
+
+typedef enum {
+  ORDER_RANDOM,
+  ORDER_SORTED,
+  ORDER_REVERSED,
+  ORDER_FEW_DISTINCT,
+} Order;
+
+static const char* orderNames[] = {
+  "random", "sorted", "reversed", "few distinct",
+};
+
+static void fillNumbers(Value* values, int count, Order order,
+                        bool integers) {
+  for (int i = 0; i < count; i++) {
+    int64_t integer;
+    switch (order) {
+      case ORDER_RANDOM: integer = (int64_t)(nextRandom() >> 11); break;
+      case ORDER_SORTED: integer = i; break;
+      case ORDER_REVERSED: integer = count - i; break;
+      case ORDER_FEW_DISTINCT:
+        integer = (int64_t)(nextRandom() % FEW_DISTINCT);
+        break;
+    }
+    values[i] = integers ? INT_VAL(integer)
+                         : NUMBER_VAL((double)integer / 7.0);
+  }
+}
+
+static double timeSort(Value* values, const Value* input, int count,
+                       int runs) {
+  double fastest = INFINITY;
+  for (int run = 0; run < runs; run++) {
+    memcpy(values, input, sizeof(Value) * (size_t)count);
+    double start = now();
+    if (!sortValues(values, count)) exit(70);
+    double elapsed = now() - start;
+    if (elapsed < fastest) fastest = elapsed;
+  }
+  return fastest;
+}
+
+static void runSort(int runs) {
+  Value* input = allocateOrExit(sizeof(Value) * SORT_SIZE);
+  Value* values = allocateOrExit(sizeof(Value) * SORT_SIZE);
+  Value list = OBJ_VAL(newList(0));
+
+  printf("sort() on %d values\n", SORT_SIZE);
+  for (int path = 0; path < 3; path++) {
+    printf(" %s\n", path == 0 ? "radix, doubles"
+                  : path == 1 ? "radix, integers"
+                              : "introsort, doubles and one list");
+    for (int order = ORDER_RANDOM; order <= ORDER_FEW_DISTINCT; order++) {
+      if (path == 1 && order != ORDER_RANDOM) continue;
+      fillNumbers(input, SORT_SIZE, (Order)order, path == 1);
+      if (path == 2) input[SORT_SIZE - 1] = list;
+      double elapsed = timeSort(values, input, SORT_SIZE, runs);
+      report(orderNames[order], elapsed, SORT_SIZE, "element");
+    }
+  }
+
+  free(values);
+  free(input);
+}
+
+// A map's table with MAP_SIZE random number keys: inserting them, looking
+// them all up again in another order, overwriting each, and iterating the
+// entries, as keys() and values() do. Memory is what the table allocated
+// per entry, and overwriting must not add to it.
+
+static void shuffle(Value* values, int count) {
+  for (int i = count - 1; i > 0; i--) {
+    int j = (int)(nextRandom() % (uint64_t)(i + 1));
+    Value temp = values[i];
+    values[i] = values[j];
+    values[j] = temp;
+  }
+}
+
+static void runMap(int runs) {
+  Value* keys = allocateOrExit(sizeof(Value) * MAP_SIZE);
+  Value* lookups = allocateOrExit(sizeof(Value) * MAP_SIZE);
+  for (int i = 0; i < MAP_SIZE; i++) {
+    keys[i] = NUMBER_VAL((double)(nextRandom() >> 11) / 7.0);
+  }
+  memcpy(lookups, keys, sizeof(Value) * MAP_SIZE);
+  shuffle(lookups, MAP_SIZE);
+
+  double insert = INFINITY;
+  double lookup = INFINITY;
+  double update = INFINITY;
+  double iterate = INFINITY;
+  size_t bytes = 0;
+  for (int run = 0; run < runs; run++) {
+    Table table;
+    initTable(&table);
+    size_t allocated = vm.bytesAllocated;
+
+    double start = now();
+    for (int i = 0; i < MAP_SIZE; i++) {
+      tableSet(&table, keys[i], INT_VAL(i));
+    }
+    double elapsed = now() - start;
+    if (elapsed < insert) insert = elapsed;
+    bytes = vm.bytesAllocated - allocated;
+
+    start = now();
+    for (int i = 0; i < MAP_SIZE; i++) {
+      Value value;
+      if (!tableGet(&table, lookups[i], &value)) exit(70);
+      sink += (uint64_t)AS_INT(value);
+    }
+    elapsed = now() - start;
+    if (elapsed < lookup) lookup = elapsed;
+
+    allocated = vm.bytesAllocated;
+    start = now();
+    for (int i = 0; i < MAP_SIZE; i++) {
+      if (tableSet(&table, lookups[i], INT_VAL(i))) exit(70);
+    }
+    elapsed = now() - start;
+    if (elapsed < update) update = elapsed;
+    if (vm.bytesAllocated != allocated) {
+      fprintf(stderr, "throughput: overwriting entries grew the map\n");
+      exit(70);
+    }
+
+    start = now();
+    for (int i = 0; i < table.count; i++) {
+      sink += (uint64_t)AS_INT(table.entries[i].value);
+    }
+    elapsed = now() - start;
+    if (elapsed < iterate) iterate = elapsed;
+
+    freeTable(&table);
+  }
+
+  printf("map with %d number keys\n", MAP_SIZE);
+  report("insert", insert, MAP_SIZE, "entry");
+  report("lookup", lookup, MAP_SIZE, "entry");
+  report("update", update, MAP_SIZE, "entry");
+  report("iterate", iterate, MAP_SIZE, "entry");
+  printf("  %-22s %9.1f MB  %8.1f bytes/entry\n", "memory", bytes / 1e6,
+         (double)bytes / MAP_SIZE);
+
+  free(lookups);
+  free(keys);
+}
+
+// Iterating the lines of a linesSize file the way scripts do, with
+// sum(for (line in open(path)) len(line)), under LINES_QUOTA. The file is
+// read once before timing, so the timed runs read it from the page cache.
+
+static long writeLines(FILE* file, long* lines) {
+  char line[LINE_MAX + 1];
+  long bytes = 0;
+  long characters = 0;
+  *lines = 0;
+  while (bytes < linesSize) {
+    int length = LINE_MIN + (int)(nextRandom() % (LINE_MAX - LINE_MIN));
+    for (int i = 0; i < length; i++) {
+      line[i] = (char)('a' + nextRandom() % 26);
+    }
+    line[length] = '\n';
+    if (fwrite(line, 1, (size_t)length + 1, file) != (size_t)length + 1) {
+      return -1;
+    }
+    bytes += length + 1;
+    characters += length;
+    (*lines)++;
+  }
+  return characters;
+}
+
+// Runs `source`, which must leave an integer, with nothing printed.
+static int64_t runScript(const char* source) {
+  Chunk chunk;
+  initChunk(&chunk);
+  if (!compile(source, "throughput", &chunk)) exit(65);
+  vm.echo = false;
+  InterpretResult result = interpretChunk(&chunk);
+  vm.echo = true;
+  freeChunk(&chunk);
+  if (result != INTERPRET_OK) {
+    fprintf(stderr, "throughput: the script failed: %s\n", vm.error);
+    exit(70);
+  }
+  Value value = pop();
+  if (!IS_INT(value)) exit(70);
+  return AS_INT(value);
+}
+
+static void runLines(int runs) {
+  const char* directory = getenv("TMPDIR");
+  char path[PATH_SIZE];
+  snprintf(path, sizeof(path), "%s/clox-lines-XXXXXX",
+           directory != NULL ? directory : "/tmp");
+  int fd = mkstemp(path);
+  FILE* file = fd < 0 ? NULL : fdopen(fd, "w");
+  long lines;
+  long characters = file == NULL ? -1 : writeLines(file, &lines);
+  if (file == NULL || fclose(file) != 0 || characters < 0) {
+    perror("throughput: can't write the lines file");
+    if (fd >= 0) unlink(path);
+    exit(74);
+  }
+
+  char source[PATH_SIZE + 64];
+  snprintf(source, sizeof(source),
+           "sum(for (line in open(\"%s\")) len(line))", path);
+  setMemoryLimit(LINES_QUOTA);
+  if (runScript(source) != characters) exit(70);
+
+  double fastest = INFINITY;
+  for (int run = 0; run < runs; run++) {
+    double start = now();
+    sink += (uint64_t)runScript(source);
+    double elapsed = now() - start;
+    if (elapsed < fastest) fastest = elapsed;
+  }
+  setMemoryLimit(0);
+  unlink(path);
+
+  printf("lines of a %.0f MB file, %ld lines, under a %ld MB quota\n",
+         linesSize / 1e6, lines, LINES_QUOTA / (1024 * 1024));
+  report("sum of lengths", fastest, (double)lines, "line");
+  printf("  %-22s %9.1f MB/s %8.2f M lines/s\n", "throughput",
+         linesSize / fastest / 1e6, lines / fastest / 1e6);
+}
+
+// json() and stringify() on an array of JSON_RECORDS records, next to a
+// plain recursive-descent parser that reads a byte at a time and builds
+// the same values, so the difference is json()'s structural index.
+
+typedef struct {
+  char* chars;
+  size_t count;
+  size_t capacity;
+} Buffer;
+
+static void append(Buffer* buffer, const char* format, ...) {
+  for (;;) {
+    va_list args;
+    va_start(args, format);
+    size_t room = buffer->capacity - buffer->count;
+    int length = vsnprintf(buffer->chars + buffer->count, room, format, args);
+    va_end(args);
+    if ((size_t)length < room) {
+      buffer->count += (size_t)length;
+      return;
+    }
+
+    buffer->capacity = buffer->capacity * 2 + (size_t)length + 1;
+    char* chars = realloc(buffer->chars, buffer->capacity);
+    if (chars == NULL) {
+      fprintf(stderr, "throughput: out of memory\n");
+      exit(1);
+    }
+    buffer->chars = chars;
+  }
+}
+
+static const char* tagNames[] = {"red", "green", "blue", "amber", "violet"};
+
+static void writeRecords(Buffer* buffer) {
+  append(buffer, "[\n");
+  for (int i = 0; i < JSON_RECORDS; i++) {
+    uint64_t bits = nextRandom();
+    append(buffer,
+           "  {\"id\": %d, \"name\": \"user %d\", "
+           "\"email\": \"u%d@example.com\", \"score\": %d.%02d, "
+           "\"active\": %s, \"tags\": [\"%s\", \"%s\"], "
+           "\"address\": {\"city\": \"City %d\", \"zip\": \"%05d\"}, "
+           "\"note\": %s}%s\n",
+           i, i, i, (int)(bits % 1000), (int)((bits >> 10) % 100),
+           bits & 0x100000 ? "true" : "false",
+           tagNames[(bits >> 21) % 5], tagNames[(bits >> 24) % 5],
+           (int)((bits >> 27) % 100), (int)((bits >> 34) % 100000),
+           bits & 0x8000000000ULL ? "\"said \\\"hi\\\"\\n\"" : "null",
+           i + 1 < JSON_RECORDS ? "," : "");
+  }
+  append(buffer, "]\n");
+}
+
+typedef struct {
+  Obj* owner;
+  const char* current;
+  const char* end;
+  int depth;
+} Reader;
+
+static void skipSpace(Reader* reader) {
+  while (reader->current < reader->end &&
+         (*reader->current == ' ' || *reader->current == '\t' ||
+          *reader->current == '\n' || *reader->current == '\r')) {
+    reader->current++;
+  }
+}
+
+static bool match(Reader* reader, char c) {
+  skipSpace(reader);
+  if (reader->current == reader->end || *reader->current != c) return false;
+  reader->current++;
+  return true;
+}
+
+// Handles the escapes writeRecords() uses, which don't include \u.
+static bool readString(Reader* reader, Value* value) {
+  const char* start = ++reader->current;
+  bool escaped = false;
+  while (reader->current < reader->end && *reader->current != '"') {
+    if (*reader->current == '\\') {
+      escaped = true;
+      reader->current++;
+    }
+    reader->current++;
+  }
+  if (reader->current >= reader->end) return false;
+  size_t length = (size_t)(reader->current++ - start);
+
+  if (!escaped) {
+    *value = OBJ_VAL(newStringView(reader->owner, start, (int)length));
+    return true;
+  }
+
+  char* buffer = ALLOCATE(char, length);
+  size_t count = 0;
+  bool valid = true;
+  for (size_t i = 0; i < length; i++) {
+    if (start[i] != '\\') {
+      buffer[count++] = start[i];
+      continue;
+    }
+    switch (start[++i]) {
+      case '"': buffer[count++] = '"'; break;
+      case '\\': buffer[count++] = '\\'; break;
+      case '/': buffer[count++] = '/'; break;
+      case 'n': buffer[count++] = '\n'; break;
+      case 't': buffer[count++] = '\t'; break;
+      default: valid = false; break;
+    }
+  }
+  if (valid) *value = OBJ_VAL(copyString(buffer, (int)count));
+  FREE_ARRAY(char, buffer, length);
+  return valid;
+}
+
+static bool readNumber(Reader* reader, Value* value) {
+  const char* start = reader->current;
+  bool integer = true;
+  while (reader->current < reader->end) {
+    char c = *reader->current;
+    if (c == '.' || c == 'e' || c == 'E' || c == '+') {
+      integer = false;
+    } else if (c != '-' && (c < '0' || c > '9')) {
+      break;
+    }
+    reader->current++;
+  }
+
+  size_t length = (size_t)(reader->current - start);
+  size_t sign = start[0] == '-' ? 1 : 0;
+  if (integer && length > sign && length - sign <= 18) {
+    int64_t result = 0;
+    for (size_t i = sign; i < length; i++) {
+      result = result * 10 + (start[i] - '0');
+    }
+    *value = INT_VAL(sign ? -result : result);
+    return true;
+  }
+
+  double number;
+  if (!parseNumber(start, length, &number)) return false;
+  *value = NUMBER_VAL(number);
+  return true;
+}
+
+static bool readWord(Reader* reader, const char* word, Value value,
+                     Value* result) {
+  size_t length = strlen(word);
+  if ((size_t)(reader->end - reader->current) < length ||
+      memcmp(reader->current, word, length) != 0) {
+    return false;
+  }
+  reader->current += length;
+  *result = value;
+  return true;
+}
+
+static bool readValue(Reader* reader, Value* value);
+
+static bool readObject(Reader* reader, Value* value) {
+  ObjMap* map = newMap();
+  *value = OBJ_VAL(map);
+  if (match(reader, '}')) return true;
+
+  do {
+    Value key;
+    Value element;
+    skipSpace(reader);
+    if (reader->current == reader->end || *reader->current != '"' ||
+        !readString(reader, &key) || !match(reader, ':') ||
+        !readValue(reader, &element)) {
+      return false;
+    }
+    tableSet(&map->table, key, element);
+  } while (match(reader, ','));
+  return match(reader, '}');
+}
+
+static bool readArray(Reader* reader, Value* value) {
+  ObjList* list = newList(0);
+  *value = OBJ_VAL(list);
+  if (match(reader, ']')) return true;
+
+  do {
+    Value element;
+    if (!readValue(reader, &element)) return false;
+    writeValueArray(&list->items, element);
+  } while (match(reader, ','));
+  return match(reader, ']');
+}
+
+static bool readValue(Reader* reader, Value* value) {
+  skipSpace(reader);
+  if (reader->current == reader->end) return false;
+
+  switch (*reader->current) {
+    case '{':
+    case '[': {
+      if (++reader->depth > MAX_DEPTH) return false;
+      bool success = *reader->current++ == '{'
+          ? readObject(reader, value)
+          : readArray(reader, value);
+      reader->depth--;
+      return success;
+    }
+    case '"': return readString(reader, value);
+    case 't': return readWord(reader, "true", BOOL_VAL(true), value);
+    case 'f': return readWord(reader, "false", BOOL_VAL(false), value);
+    case 'n': return readWord(reader, "null", BOOL_VAL(false), value);
+    default: return readNumber(reader, value);
+  }
+}
+
+static bool readJson(ObjString* document, Value* result) {
+  Reader reader;
+  reader.owner = (Obj*)document;
+  reader.current = document->chars;
+  reader.end = document->chars + document->length;
+  reader.depth = 0;
+  if (!readValue(&reader, result)) return false;
+  skipSpace(&reader);
+  return reader.current == reader.end;
+}
+
+static bool parseDocument(ObjString* document, Value* result) {
+  return parseJson((Obj*)document, document->chars, (size_t)document->length,
+                   result);
+}
+
+// Parses `document` `runs` times with `parse`. The values it builds are
+// only reachable from here, so collecting garbage frees them.
+static double timeParse(bool (*parse)(ObjString*, Value*),
+                        ObjString* document, int runs) {
+  double fastest = INFINITY;
+  for (int run = 0; run < runs; run++) {
+    Value value;
+    double start = now();
+    if (!parse(document, &value)) exit(70);
+    double elapsed = now() - start;
+    if (elapsed < fastest) fastest = elapsed;
+    collectGarbage();
+  }
+  return fastest;
+}
+
+static ObjString* stringify(Value value) {
+  Value result;
+  if (!stringifyJson(value, &result)) exit(70);
+  return AS_STRING(result);
+}
+
+static void runJson(int runs) {
+  Buffer buffer = {NULL, 0, 0};
+  writeRecords(&buffer);
+  ObjString* document = copyString(buffer.chars, (int)buffer.count);
+  free(buffer.chars);
+  document->obj.pins++;
+
+  // Both parsers must build values that stringify the same.
+  Value parsed;
+  Value read;
+  if (!parseDocument(document, &parsed) || !readJson(document, &read)) {
+    exit(70);
+  }
+  ObjString* expected = stringify(read);
+  ObjString* actual = stringify(parsed);
+  if (expected->length != actual->length ||
+      memcmp(expected->chars, actual->chars, (size_t)actual->length) != 0) {
+    fprintf(stderr, "throughput: the parsers disagree\n");
+    exit(70);
+  }
+
+  AS_OBJ(parsed)->pins++;
+  collectGarbage();
+  double stringifying = INFINITY;
+  for (int run = 0; run < runs; run++) {
+    double start = now();
+    sink += (uint64_t)stringify(parsed)->length;
+    double elapsed = now() - start;
+    if (elapsed < stringifying) stringifying = elapsed;
+    collectGarbage();
+  }
+  AS_OBJ(parsed)->pins--;
+  collectGarbage();
+
+  double json = timeParse(parseDocument, document, runs);
+  double reference = timeParse(readJson, document, runs);
+  document->obj.pins--;
+  collectGarbage();
+
+  double megabytes = (double)buffer.count / 1e6;
+  printf("JSON array of %d records, %.1f MB\n", JSON_RECORDS, megabytes);
+  report("json()", json, JSON_RECORDS, "record");
+  report("recursive descent", reference, JSON_RECORDS, "record");
+  report("stringify()", stringifying, JSON_RECORDS, "record");
+  printf("  %-22s %9.1f MB/s %8.2fx recursive descent\n", "json() rate",
+         megabytes / json, reference / json);
+}
+
+static Workload workloads[] = {
+  {"sort",  runSort},
+  {"map",   runMap},
+  {"lines", runLines},
+  {"json",  runJson},
+  {NULL,    NULL},
+};
+
+static void usage() {
+  fprintf(stderr,
+          "Usage: throughput [--runs N] [--lines-mb N] [name...]\n"
+          "Runs the workloads named, or all of them.\n");
+  exit(64);
+}
+
+static bool selected(Workload* workload, int argc, const char* argv[],
+                     int first) {
+  if (first == argc) return true;
+  for (int i = first; i < argc; i++) {
+    if (strcmp(workload->name, argv[i]) == 0) return true;
+  }
+  return false;
+}
+
+int main(int argc, const char* argv[]) {
+  int runs = DEFAULT_RUNS;
+  int first = 1;
+  while (first < argc && strncmp(argv[first], "--", 2) == 0) {
+    if (strcmp(argv[first], "--runs") == 0 && first + 1 < argc) {
+      runs = atoi(argv[first + 1]);
+      if (runs < 1) usage();
+    } else if (strcmp(argv[first], "--lines-mb") == 0 && first + 1 < argc) {
+      linesSize = atol(argv[first + 1]) * 1024 * 1024;
+      if (linesSize < 1) usage();
+    } else {
+      usage();
+    }
+    first += 2;
+  }
+
+  for (int i = first; i < argc; i++) {
+    Workload* workload = workloads;
+    while (workload->name != NULL && strcmp(workload->name, argv[i]) != 0) {
+      workload++;
+    }
+    if (workload->name == NULL) usage();
+  }
+
+  initVM();
+  printf("Best of %d runs\n", runs);
+  for (Workload* workload = workloads; workload->name != NULL; workload++) {
+    if (selected(workload, argc, argv, first)) workload->run(runs);
+  }
+  freeVM();
+  return 0;
+}
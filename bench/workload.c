@@ -0,0 +1,185 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "workload.h"
+
+// Programs are built into one growing buffer. Every choice comes from a
+// xorshift generator, so a shape, size and seed always give the same
+// program.
+static char* buffer;
+static size_t count;
+static size_t capacity;
+static uint32_t state;
+
+static uint32_t nextRandom() {
+  state ^= state << 13;
+  state ^= state >> 17;
+  state ^= state << 5;
+  return state;
+}
+
+static void emit(const char* format, ...) {
+  va_list args;
+  va_start(args, format);
+  int length = vsnprintf(NULL, 0, format, args);
+  va_end(args);
+
+  if (count + (size_t)length + 1 > capacity) {
+    while (count + (size_t)length + 1 > capacity) {
+      capacity = capacity < 256 ? 256 : capacity * 2;
+    }
+    buffer = realloc(buffer, capacity);
+    if (buffer == NULL) exit(1);
+  }
+
+  va_start(args, format);
+  vsnprintf(buffer + count, capacity - count, format, args);
+  va_end(args);
+  count += (size_t)length;
+}
+
+static const char* randomOperator() {
+  static const char* operators[] = {"+", "-", "*"};
+  return operators[nextRandom() % 3];
+}
+
+// Breaks long programs into lines of a few units each.
+static void separate(int index) {
+  emit(index % 8 == 7 ? "\n  " : " ");
+}
+
+// A loop's body can't jump more than 64KB, so long programs are cut
+// into groups of GROUP_SIZE units, one sum(for (x in [1]) ...) each.
+// Every loop takes three constants, which keeps the groups few.
+#define GROUP_SIZE 8192
+#define TRY_GROUP_SIZE 1024
+
+static void openGroup(int index) {
+  if (index > 0) emit(") +\n");
+  emit("sum(for (x in [1])\n  ");
+}
+
+// x + x * x - ..., one long run of binary operators over a local, so it
+// needs no constants beyond each group's [1].
+static void expression(int size) {
+  for (int i = 0; i < size; i++) {
+    if (i % GROUP_SIZE == 0) {
+      openGroup(i);
+      emit("x");
+    } else {
+      separate(i);
+      emit("%s x", randomOperator());
+    }
+  }
+  emit(")\n");
+}
+
+// ((((x + x) * x) - x) ...), nested `size` parentheses deep.
+static void nesting(int size) {
+  emit("sum(for (x in [1]) ");
+  for (int i = 0; i < size; i++) emit("(");
+  emit("x");
+  for (int i = 0; i < size; i++) {
+    emit(" %s x)", randomOperator());
+    if (i % 16 == 15) emit("\n");
+  }
+  emit(")\n");
+}
+
+// x + 12 + 3.25 + ..., each literal a constant of its own.
+static void constants(int size) {
+  emit("sum(for (x in [1])\n  x");
+  for (int i = 0; i < size; i++) {
+    separate(i);
+    if (nextRandom() % 2 == 0) {
+      emit("+ %u", nextRandom() % 100000);
+    } else {
+      emit("+ %u.%02u", nextRandom() % 1000, nextRandom() % 100);
+    }
+  }
+  emit(")\n");
+}
+
+// Loop and catch variables are Lox's only declarations. A loop costs
+// three constants, so this declares `size` differently named catch
+// variables instead, one try each.
+static void bindings(int size) {
+  for (int i = 0; i < size; i++) {
+    char name[16];
+    int length = 3 + (int)(nextRandom() % 8);
+    for (int j = 0; j < length; j++) {
+      name[j] = (char)('a' + nextRandom() % 26);
+    }
+    snprintf(name + length, sizeof(name) - (size_t)length, "%d", i);
+
+    if (i % TRY_GROUP_SIZE == 0) {
+      openGroup(i);
+    } else {
+      emit(" +\n  ");
+    }
+    emit("(try x catch (%s) %s)", name, name);
+  }
+  emit(")\n");
+}
+
+// len("..."), one literal of `size` characters over many lines.
+static void strings(int size) {
+  emit("len(\"");
+  for (int i = 0; i < size; i++) {
+    uint32_t choice = nextRandom() % 64;
+    if (choice == 0) {
+      emit("\n");
+    } else if (choice < 10) {
+      emit(" ");
+    } else {
+      emit("%c", 'a' + (int)(choice % 26));
+    }
+  }
+  emit("\")\n");
+}
+
+// `size` lines of comments ahead of a one-token program.
+static void comments(int size) {
+  for (int i = 0; i < size; i++) {
+    emit("//");
+    int words = 2 + (int)(nextRandom() % 10);
+    for (int j = 0; j < words; j++) {
+      int length = 1 + (int)(nextRandom() % 9);
+      emit(" ");
+      for (int k = 0; k < length; k++) emit("%c", 'a' + nextRandom() % 26);
+    }
+    emit("\n");
+  }
+  emit("true\n");
+}
+
+const Shape shapes[] = {
+  {"expression", "terms",      1024,  262144, expression},
+  {"nesting",    "levels",     64,    4096,   nesting},
+  {"constants",  "constants",  15,    240,    constants},
+  {"bindings",   "bindings",   64,    4096,   bindings},
+  {"strings",    "chars",      4096,  4194304, strings},
+  {"comments",   "lines",      256,   65536,  comments},
+  {NULL,         NULL,         0,     0,      NULL},
+};
+
+const Shape* findShape(const char* name) {
+  for (const Shape* shape = shapes; shape->name != NULL; shape++) {
+    if (strcmp(shape->name, name) == 0) return shape;
+  }
+  return NULL;
+}
+
+// Returns a NUL-terminated program the caller frees.
+char* generateWorkload(const Shape* shape, int size, uint32_t seed,
+                       size_t* length) {
+  buffer = NULL;
+  count = 0;
+  capacity = 0;
+  state = seed == 0 ? 1 : seed;
+  shape->generate(size);
+  *length = count;
+  return buffer;
+}
@@ -0,0 +1,26 @@
+#ifndef clox_workload_h
+#define clox_workload_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+// A family of generated programs that grow along one axis. `size` counts
+// that axis's units: terms, nesting levels, constants, bindings, string
+// characters or comment lines. Sizes run from `minSize` to `maxSize`,
+// four times larger each step; constants stop short of the 256 a chunk
+// can hold.
+typedef struct {
+    const char* name;
+    const char* unit;
+    int minSize;
+    int maxSize;
+    void (*generate)(int size);
+} Shape;
+
+extern const Shape shapes[];
+
+const Shape* findShape(const char* name);
+char* generateWorkload(const Shape* shape, int size, uint32_t seed,
+                       size_t* length);
+
+#endif
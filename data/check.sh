@@ -0,0 +1,58 @@
+#!/bin/sh
+# Runs each script in data/ that has a .expected file beside it and
+# compares everything it prints, errors included, with that file. Leading
+# comments in a script can ask for arguments to clox, a ulimit to run it
+# under, or an exit status other than 0:
+#
+#   // clox: --memory-limit 8
+#   // ulimit: -v 1000000
+#   // exit: 70
+#
+# Run it from the top of the tree, where scripts find the files they open.
+#
+# Usage: data/check.sh CLOX [NAME...]
+
+CLOX=${1:?usage: $0 CLOX [NAME...]}
+shift
+DIR=$(mktemp -d)
+trap 'rm -rf "$DIR"' EXIT
+
+# Prints the value of a `// name: value` comment in a script.
+directive() {
+  sed -n "s|^// $1: ||p" "$2" | head -n 1
+}
+
+passed=0
+failed=0
+if [ $# -eq 0 ]; then
+  set -- $(for expected in data/*.expected; do
+    basename "$expected" .expected
+  done)
+fi
+
+for name in "$@"; do
+  script=data/$name.lox
+  args=$(directive clox "$script")
+  limit=$(directive ulimit "$script")
+  expectedStatus=$(directive exit "$script")
+
+  (
+    if [ -n "$limit" ]; then ulimit $limit; fi
+    exec "$CLOX" $args "$script"
+  ) > "$DIR/actual" 2>&1
+  status=$?
+
+  if [ "$status" -ne "${expectedStatus:-0}" ]; then
+    echo "FAIL $name: exited with $status, not ${expectedStatus:-0}"
+    failed=$((failed + 1))
+  elif ! diff -u "data/$name.expected" "$DIR/actual" > "$DIR/diff"; then
+    echo "FAIL $name: output differs"
+    cat "$DIR/diff"
+    failed=$((failed + 1))
+  else
+    passed=$((passed + 1))
+  fi
+done
+
+echo "$passed passed, $failed failed."
+[ "$failed" -eq 0 ]
@@ -0,0 +1,45 @@
+#ifndef clox_bitmask_h
+#define clox_bitmask_h
+
+#include "common.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Text scanners classify their input 64 bytes at a time into masks with
+// one bit per byte, then walk the set bits instead of branching on every
+// byte.
+#define BLOCK_SIZE 64
+
+static inline uint64_t matchByte(const char* bytes, char c) {
+  uint64_t mask = 0;
+#ifdef __SSE2__
+  const __m128i target = _mm_set1_epi8(c);
+  for (int i = 0; i < BLOCK_SIZE; i += 16) {
+    __m128i chunk = _mm_loadu_si128((const __m128i*)(bytes + i));
+    mask |= (uint64_t)(uint16_t)_mm_movemask_epi8(
+        _mm_cmpeq_epi8(chunk, target)) << i;
+  }
+#else
+  for (int i = 0; i < BLOCK_SIZE; i++) {
+    if (bytes[i] == c) mask |= (uint64_t)1 << i;
+  }
+#endif
+  return mask;
+}
+
+// Sets each bit to the parity of the bits at or below it. Applied to
+// quote bits, this marks every byte from an opening quote up to, but not
+// including, its closing quote.
+static inline uint64_t prefixXor(uint64_t bits) {
+  bits ^= bits << 1;
+  bits ^= bits << 2;
+  bits ^= bits << 4;
+  bits ^= bits << 8;
+  bits ^= bits << 16;
+  bits ^= bits << 32;
+  return bits;
+}
+
+#endif
@@ -0,0 +1,14 @@
+#ifndef clox_cache_h
+#define clox_cache_h
+
+#include <sys/stat.h>
+
+#include "chunk.h"
+#include "common.h"
+
+bool loadCachedChunk(const char* path, const struct stat* source,
+                     Chunk* chunk);
+void saveCachedChunk(const char* path, const struct stat* source,
+                     Chunk* chunk);
+
+#endif
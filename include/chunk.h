@@ -6,25 +6,95 @@
 
 typedef enum {
     OP_CONSTANT,
+    OP_TRUE,
+    OP_FALSE,
+    OP_POP_N,
+    OP_SWAP,
+    OP_GET_LOCAL,
+    OP_SET_LOCAL,
+    OP_EQUAL,
+    OP_GREATER,
+    OP_LESS,
     OP_ADD,
     OP_SUBTRACT,
     OP_MULTIPLY,
+    OP_ADD_INT,
+    OP_SUBTRACT_INT,
+    OP_MULTIPLY_INT,
     OP_DIVIDE,
+    OP_INT_DIVIDE,
+    OP_MODULO,
+    OP_NOT,
     OP_NEGATE,
+    OP_BIT_AND,
+    OP_BIT_OR,
+    OP_BIT_XOR,
+    OP_SHIFT_LEFT,
+    OP_SHIFT_RIGHT,
+    OP_BIT_NOT,
+    OP_BUILD_LIST,
+    OP_BUILD_MAP,
+    OP_BUILD_STRING,
+    OP_LIST_APPEND,
+    OP_GET_INDEX,
+    OP_SET_INDEX,
+    OP_NATIVE,
+    OP_HOST_NATIVE,
+    OP_FOR_RANGE,
+    OP_FOR_ITER,
+    OP_GENERATOR,
+    OP_YIELD,
+    OP_GENERATOR_END,
+    OP_IMPORT,
+    OP_JUMP_IF_FALSE,
+    OP_LOOP,
     OP_RETURN,
 } OpCode;
 
+// A range of code protected by `try`. An error raised by an instruction
+// in [start, end), in the frame whose code begins at `body`, drops that
+// frame back to `depth` slots and continues at `handler`. Entries are
+// ordered innermost first, and nothing is executed on entering a range.
+typedef struct {
+    int start;
+    int end;
+    int handler;
+    int depth;
+    int body;
+} Handler;
+
+// Instructions from `start` up to the next run's start are on `line`.
+typedef struct {
+    int start;
+    int line;
+} LineRun;
+
+// While it's being written, a chunk grows separate arrays, with a line
+// for every byte. finalizeChunk() packs it into the single allocation
+// `packed`, with lines stored as runs, and nothing is added after that.
 typedef struct {
     int count;
     int capacity;
     uint8_t* code;
     int* lines;
+    int lineRunCount;
+    LineRun* lineRuns;
+    int handlerCount;
+    int handlerCapacity;
+    Handler* handlers;
     ValueArray constants;
+    void* packed;
+    size_t packedSize;
+    // The module the chunk belongs to, or NULL for a script's.
+    Obj* owner;
 } Chunk;
 
 void initChunk(Chunk* chunk);
 void freeChunk(Chunk* chunk);
 void writeChunk(Chunk* chunk, uint8_t byte, int line);
 int addConstant(Chunk* chunk, Value value);
+void addHandler(Chunk* chunk, Handler handler);
+void finalizeChunk(Chunk* chunk);
+int getLine(Chunk* chunk, int offset);
 
 #endif
@@ -0,0 +1,261 @@
+#ifndef clox_h
+#define clox_h
+
+// The interface for programs that embed clox, built as libclox.a and
+// libclox.so. Nothing else in the library is visible outside it.
+//
+// Each CloxVM is independent: its own stack, objects and modules. Any
+// number may exist at once. The API is thread-safe but not concurrent:
+// every call holds one recursive mutex for the whole library, so calls
+// from different threads, on any VMs, take turns, and a thread in the
+// middle of a run holds up every other thread until it returns. A native
+// may only call back into the VM that called it.
+//
+// Values are exchanged on the VM's stack. Indexes count up from 0 at the
+// first value the caller can see, or down from -1 at the top. A native
+// sees its arguments at 0 to argCount - 1.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__GNUC__)
+#define CLOX_API __attribute__((visibility("default")))
+#else
+#define CLOX_API
+#endif
+
+#define CLOX_VERSION 1
+
+typedef struct CloxVM CloxVM;
+typedef struct CloxScript CloxScript;
+typedef struct CloxDocument CloxDocument;
+
+typedef enum {
+    CLOX_OK,
+    CLOX_COMPILE_ERROR,
+    CLOX_RUNTIME_ERROR,
+    CLOX_SUSPENDED,
+} CloxResult;
+
+typedef enum {
+    CLOX_NONE,
+    CLOX_BOOL,
+    CLOX_NUMBER,
+    CLOX_INT,
+    CLOX_STRING,
+    CLOX_LIST,
+    CLOX_MAP,
+    CLOX_OTHER,
+    CLOX_VIEW,
+} CloxType;
+
+typedef enum {
+    CLOX_VIEW_DOUBLE,
+    CLOX_VIEW_INT64,
+    CLOX_VIEW_INT32,
+    CLOX_VIEW_UINT8,
+} CloxViewType;
+
+typedef struct CloxView CloxView;
+
+// Flags for cloxNewVM().
+// CLOX_PRINT prints constants, results and errors as the clox command
+// does, rather than leaving results on the stack and errors for
+// cloxError(). CLOX_RELOAD picks up edits to imported modules as a
+// script runs. CLOX_HUGE_PAGES backs the heap with transparent huge
+// pages; the heap is shared, so only the first VM's choice counts.
+#define CLOX_PRINT      (1 << 0)
+#define CLOX_RELOAD     (1 << 1)
+#define CLOX_HUGE_PAGES (1 << 2)
+
+// Pushes one result and returns true, or returns cloxRaise().
+typedef bool (*CloxNativeFn)(CloxVM* vm, int argCount, void* data);
+
+typedef struct {
+    size_t bytesAllocated;
+    size_t objectCount;
+    size_t stackCapacity;
+    int stackSize;
+} CloxStats;
+
+CLOX_API int cloxVersion();
+
+CLOX_API CloxVM* cloxNewVM(int flags);
+CLOX_API void cloxFreeVM(CloxVM* vm);
+
+// A compiled script belongs to its VM and is freed before it. Returns
+// NULL if the source doesn't compile.
+CLOX_API CloxScript* cloxCompile(CloxVM* vm, const char* source,
+                                 const char* path);
+CLOX_API void cloxFreeScript(CloxVM* vm, CloxScript* script);
+
+// Runs a script, leaving its result on top of the stack. On an error the
+// stack is as it was before the run. A script that was suspended must
+// not be freed until its run finishes; cloxEval() sees to its own.
+CLOX_API CloxResult cloxRun(CloxVM* vm, CloxScript* script);
+CLOX_API CloxResult cloxEval(CloxVM* vm, const char* source,
+                             const char* path);
+
+// A source file open in an editor. Each edit re-lexes only the tokens it
+// could have changed, and a check compiles again only once an edit has
+// changed the tokens, not just moved them. Offsets count bytes from the
+// start of the text. A document belongs to its VM and is freed before it.
+typedef enum {
+    CLOX_TOKEN_PUNCTUATION,
+    CLOX_TOKEN_KEYWORD,
+    CLOX_TOKEN_IDENTIFIER,
+    CLOX_TOKEN_STRING,
+    // A string's text up to an interpolation's "${".
+    CLOX_TOKEN_INTERPOLATION,
+    CLOX_TOKEN_NUMBER,
+    CLOX_TOKEN_ERROR,
+    CLOX_TOKEN_EOF,
+} CloxTokenKind;
+
+// An error token has no text: `message` says what's wrong, and `start` is
+// where the scan stopped. It's NULL for other tokens.
+typedef struct {
+    CloxTokenKind kind;
+    int start;
+    int length;
+    int line;
+    const char* message;
+} CloxToken;
+
+// The tokens an edit replaced: `removed` old ones from `first` on gave
+// way to `added` new ones.
+typedef struct {
+    int first;
+    int removed;
+    int added;
+} CloxTokenRange;
+
+// `path` is what the document's imports are resolved against, or NULL.
+CLOX_API CloxDocument* cloxNewDocument(CloxVM* vm, const char* source,
+                                       const char* path);
+CLOX_API void cloxFreeDocument(CloxVM* vm, CloxDocument* document);
+// Replaces the text from `start` up to `end` with `length` chars. Fails,
+// changing nothing, unless 0 <= start <= end <= the text's length.
+// `range` may be NULL.
+CLOX_API bool cloxEditDocument(CloxVM* vm, CloxDocument* document,
+                               int start, int end, const char* chars,
+                               int length, CloxTokenRange* range);
+CLOX_API int cloxDocumentLength(CloxVM* vm, CloxDocument* document);
+// The last token is always CLOX_TOKEN_EOF.
+CLOX_API int cloxDocumentTokenCount(CloxVM* vm, CloxDocument* document);
+CLOX_API bool cloxDocumentToken(CloxVM* vm, CloxDocument* document,
+                                int index, CloxToken* token);
+// Returns false if the document doesn't compile, with the first error
+// for cloxError().
+CLOX_API bool cloxCheckDocument(CloxVM* vm, CloxDocument* document);
+
+// The message for the last compile or runtime error, with its line.
+CLOX_API const char* cloxError(CloxVM* vm);
+// Why the last edit to an imported module was ignored, since it didn't
+// compile, or "" if none has been. Only with CLOX_RELOAD, and not
+// CLOX_PRINT, which prints it instead.
+CLOX_API const char* cloxReloadError(CloxVM* vm);
+
+// Makes `name` callable from scripts compiled afterwards. `arity` is -1
+// for one or more arguments. Fails for the name of a built-in native.
+// Scripts call it by name, so a VM that imports a module another VM
+// cached only needs to have registered the natives the module calls.
+CLOX_API bool cloxRegisterNative(CloxVM* vm, const char* name, int arity,
+                                 CloxNativeFn function, void* data);
+CLOX_API bool cloxRaise(CloxVM* vm, const char* message);
+
+// A native that has to wait on the host returns cloxSuspend() instead of
+// pushing a result. The run returns CLOX_SUSPENDED with its place, stack
+// and frames kept in the VM, and the native's arguments still at 0 to
+// argCount - 1. Once the result is ready, push it and call cloxResume()
+// to go on from the call, or call cloxResumeError() to raise an error
+// there. Both return as cloxRun() does, and may suspend again.
+//
+// Other VMs can be used in the meantime, so one thread can keep a script
+// in flight in each of many VMs. A suspended VM runs nothing else until
+// it's resumed. Only a native called by the outermost script can
+// suspend, not one called from an imported module or from a run another
+// native started.
+CLOX_API bool cloxSuspend(CloxVM* vm);
+CLOX_API bool cloxIsSuspended(CloxVM* vm);
+CLOX_API CloxResult cloxResume(CloxVM* vm);
+CLOX_API CloxResult cloxResumeError(CloxVM* vm, const char* message);
+
+// A script reading a stream with nothing to read, or writing one that's
+// full, suspends its run the same way rather than wait inside the
+// library. cloxWaitFd() gives the descriptor it's waiting on, and sets
+// `events` to CLOX_READABLE or CLOX_WRITABLE; wait for that, with poll()
+// or an event loop, and call cloxResume() without pushing anything. It's
+// -1 unless the run is suspended on a stream. Runs other than the
+// outermost get an error instead, as a native suspending them does.
+#define CLOX_READABLE (1 << 0)
+#define CLOX_WRITABLE (1 << 1)
+
+CLOX_API int cloxWaitFd(CloxVM* vm, int* events);
+
+CLOX_API int cloxStackSize(CloxVM* vm);
+CLOX_API bool cloxPushBool(CloxVM* vm, bool value);
+CLOX_API bool cloxPushNumber(CloxVM* vm, double value);
+CLOX_API bool cloxPushInt(CloxVM* vm, int64_t value);
+CLOX_API bool cloxPushString(CloxVM* vm, const char* chars, int length);
+// Pushes element `item` of the list or view at `index`.
+CLOX_API bool cloxPushItem(CloxVM* vm, int index, int item);
+CLOX_API void cloxPop(CloxVM* vm, int count);
+
+// Moves `count` values in one call. The pops store the top `count` values
+// with the topmost last, and fail without popping anything unless every
+// one is a number (for cloxPopNumbers(), which also takes ints) or an int.
+CLOX_API bool cloxPushNumbers(CloxVM* vm, const double* values, int count);
+CLOX_API bool cloxPushInts(CloxVM* vm, const int64_t* values, int count);
+CLOX_API bool cloxPopNumbers(CloxVM* vm, double* values, int count);
+CLOX_API bool cloxPopInts(CloxVM* vm, int64_t* values, int count);
+
+// Pushes a read-only view of `length` elements at `data`, which scripts
+// index, iterate, len() and sum() like a list without it being copied.
+// Ints read as ints and doubles as numbers. The memory is pinned: it
+// must stay valid and unchanged until cloxReleaseView(), or until the VM
+// is freed. A script that still holds the view afterwards gets an error
+// if it uses it.
+CLOX_API CloxView* cloxPushView(CloxVM* vm, CloxViewType type,
+                                const void* data, int length);
+CLOX_API void cloxReleaseView(CloxVM* vm, CloxView* view);
+
+// Copies up to `capacity` elements of the list or view at `index` into
+// `buffer`. Returns its full length, so a larger one means the buffer was
+// short, or -1 if it isn't a list or view or an element copied isn't a
+// number (or, for cloxReadInts(), an int). A negative capacity, or a
+// NULL buffer with room for any, is -1 too. A capacity of 0 asks only
+// for the length.
+CLOX_API int cloxReadNumbers(CloxVM* vm, int index, double* buffer,
+                             int capacity);
+CLOX_API int cloxReadInts(CloxVM* vm, int index, int64_t* buffer,
+                          int capacity);
+
+// The readers return false, 0 or NULL for a value of another type. A
+// string's characters stay valid while it's on the stack, or else until
+// the next cloxToString() on the same VM.
+CLOX_API CloxType cloxType(CloxVM* vm, int index);
+CLOX_API bool cloxToBool(CloxVM* vm, int index);
+CLOX_API double cloxToNumber(CloxVM* vm, int index);
+CLOX_API int64_t cloxToInt(CloxVM* vm, int index);
+CLOX_API const char* cloxToString(CloxVM* vm, int index, int* length);
+// The length of a string, list, view or map.
+CLOX_API int cloxLength(CloxVM* vm, int index);
+
+// Caps the bytes the VM's objects may take up, or lifts the cap for 0.
+// Nearing it collects whatever scripts can no longer reach; going over
+// it raises "Out of memory." in the script, which a try can catch. Only
+// scripts are held to it: what the compiler and the calls here allocate
+// counts, but is never refused. Views not yet released, the last string
+// read with cloxToString() and the constants of scripts not yet freed
+// are kept. If the system itself runs out of memory, garbage is collected
+// even without a cap, and the script gets the same error if that didn't
+// free enough. A megabyte is set aside for that, but an allocation too
+// large for it that fails while compiling, loading a module or running a
+// native, the program's or a built-in one, ends the process.
+CLOX_API void cloxSetMemoryLimit(CloxVM* vm, size_t bytes);
+
+CLOX_API void cloxStats(CloxVM* vm, CloxStats* stats);
+
+#endif
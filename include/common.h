@@ -5,7 +5,16 @@
 #include <stddef.h>
 #include <stdint.h>
 
+// Release builds (-DNDEBUG) leave out the disassembly and the trace.
+#ifndef NDEBUG
 #define DEBUG_PRINT_CODE
 #define DEBUG_TRACE_EXECUTION
+#endif
+
+#define UINT8_COUNT (UINT8_MAX + 1)
+
+// How deeply nested lists and maps may get before code that walks them
+// recursively gives up rather than overflow the C stack.
+#define MAX_DEPTH 512
 
 #endif
@@ -3,6 +3,16 @@
 
 #include "vm.h"
 
-bool compile(const char* source, Chunk* chunk);
+#include "scanner.h"
+
+// The first error a compile ran into, and the token it was found at.
+typedef struct {
+    Token token;
+    char message[ERROR_MAX];
+} CompileError;
+
+bool compile(const char* source, const char* path, Chunk* chunk);
+bool compileTokens(TokenSource source, const char* path, Chunk* chunk,
+                   CompileError* error);
 
 #endif
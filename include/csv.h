@@ -0,0 +1,11 @@
+#ifndef clox_csv_h
+#define clox_csv_h
+
+#include "common.h"
+#include "object.h"
+#include "value.h"
+
+bool parseCsv(Obj* owner, const char* data, size_t length, bool columns,
+              Value* result);
+
+#endif
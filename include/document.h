@@ -0,0 +1,79 @@
+#ifndef clox_document_h
+#define clox_document_h
+
+#include "common.h"
+#include "scanner.h"
+#include "vm.h"
+
+// A token as the document keeps it: by offset into the text rather than
+// by pointer, since the text moves as it's edited. `depth` is how many
+// interpolations were open where its scan began.
+typedef struct {
+    int start;
+    int end;
+    int line;
+    uint8_t type;
+    uint8_t depth;
+    const char* message;
+} LexToken;
+
+// A run of consecutive tokens. Their offsets and lines are relative to
+// the page's, so an edit only has to move the pages after it, not every
+// token after it.
+typedef struct {
+    LexToken* tokens;
+    int count;
+    int first;
+    int offset;
+    int line;
+} TokenPage;
+
+// The source of a file open in an editor, with its tokens kept up to date
+// as it changes. The text lives in a gap buffer that follows the edits
+// around, and the tokens in pages.
+typedef struct {
+    char* text;
+    int textCapacity;
+    int gapStart;
+    int gapEnd;
+    int lineCount;
+
+    TokenPage* pages;
+    int pageCount;
+    int pageCapacity;
+    int tokenCount;
+    LexToken* scratch;
+    int scratchCapacity;
+
+    // `changed` is set when an edit changes a token other than by moving
+    // it, so the next check has to compile again. Until then the last
+    // check's error stands.
+    const char* path;
+    bool changed;
+    bool hadError;
+    int errorToken;
+    int errorLine;
+    char error[ERROR_MAX];
+} Document;
+
+// The tokens an edit replaced: `removed` old ones from `first` on gave
+// way to `added` new ones.
+typedef struct {
+    int first;
+    int removed;
+    int added;
+} TokenRange;
+
+void initDocument(Document* document, const char* source, const char* path);
+void freeDocument(Document* document);
+TokenRange editDocument(Document* document, int start, int end,
+                        const char* chars, int length);
+int documentLength(Document* document);
+int documentTokenCount(Document* document);
+Token documentToken(Document* document, int index);
+// The token with its offsets into the text, rather than pointers that
+// only last until the next edit.
+LexToken documentLexToken(Document* document, int index);
+bool checkDocument(Document* document);
+
+#endif
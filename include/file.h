@@ -0,0 +1,11 @@
+#ifndef clox_file_h
+#define clox_file_h
+
+#include "common.h"
+#include "object.h"
+
+ObjFile* openFile(const char* path);
+void closeFile(ObjFile* file);
+bool nextLine(ObjFile* file, int64_t* position, Value* line);
+
+#endif
@@ -0,0 +1,22 @@
+#ifndef clox_heap_h
+#define clox_heap_h
+
+#include "common.h"
+
+// With huge pages on, reallocate() carves memory out of regions aligned
+// to and advised for transparent huge pages instead of calling malloc(),
+// so a large heap spans far fewer TLB entries. Requests up to
+// HEAP_MEDIUM_MAX bytes share regions through per-size free lists; bigger
+// ones get an aligned mapping of their own.
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+#define HEAP_REGION_SIZE (64 * 1024 * 1024)
+#define HEAP_MEDIUM_MAX (256 * 1024)
+
+void initHeap(bool hugePages);
+void freeHeap();
+bool usingHugePages();
+void* heapReallocate(void* pointer, size_t oldSize, size_t newSize);
+void* mapHugePages(size_t size);
+void adviseHugePages(void* start, size_t size);
+
+#endif
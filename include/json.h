@@ -0,0 +1,11 @@
+#ifndef clox_json_h
+#define clox_json_h
+
+#include "common.h"
+#include "object.h"
+#include "value.h"
+
+bool parseJson(Obj* owner, const char* data, size_t length, Value* result);
+bool stringifyJson(Value value, Value* result);
+
+#endif
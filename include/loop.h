@@ -0,0 +1,19 @@
+#ifndef clox_loop_h
+#define clox_loop_h
+
+#include "common.h"
+#include "object.h"
+#include "value.h"
+
+ObjStream* openStream(const char* path);
+ObjStream* connectStream(const char* path);
+ObjStream* openTimer(int64_t milliseconds, int64_t count);
+void closeStream(ObjStream* stream);
+bool writeStream(ObjStream* stream, const char* chars, size_t length);
+bool nextStreamLine(ObjStream* stream, Value* line, bool* done);
+
+ObjPoll* openPoll(ObjList* streams);
+void closePoll(ObjPoll* poll);
+bool nextEvent(ObjPoll* poll, Value* event, bool* done);
+
+#endif
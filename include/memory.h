@@ -3,6 +3,11 @@
 
 #include "common.h"
 
+#define ALLOCATE(type, count) \
+    (type*)reallocate(NULL, 0, sizeof(type) * (count))
+
+#define FREE(type, pointer) reallocate(pointer, sizeof(type), 0)
+
 #define GROW_CAPACITY(capacity) \
     ((capacity) < 8 ? 8 : (capacity) * 2)
 
@@ -14,5 +19,11 @@
     reallocate(pointer, sizeof(type) * (oldCount), 0)
 
 void* reallocate(void* pointer, size_t oldSize, size_t newSize);
+void* allocateAligned(size_t alignment, size_t size);
+void collectGarbage();
+void setMemoryLimit(size_t limit);
+bool checkMemory();
+bool reserveMemory(size_t bytes);
+void freeObjects();
 
 #endif
@@ -0,0 +1,11 @@
+#ifndef clox_module_h
+#define clox_module_h
+
+#include "common.h"
+#include "object.h"
+
+bool resolveModule(const char* importer, const char* name, int length,
+                   char* path);
+bool loadModule(ObjModule* module);
+
+#endif
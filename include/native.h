@@ -0,0 +1,27 @@
+#ifndef clox_native_h
+#define clox_native_h
+
+#include "common.h"
+#include "value.h"
+#include "vm.h"
+
+// A native reads its arguments from `args` and stores its return value in
+// `result`. Returning false means it has already reported a runtime error.
+typedef bool (*NativeFn)(int argCount, Value* args, Value* result);
+
+typedef struct {
+    const char* name;
+    int arity;  // -1 accepts one or more arguments.
+    NativeFn function;
+} Native;
+
+extern Native natives[];
+
+int findNative(const char* name, int length);
+
+// Natives registered through the embedding API with the VM that's
+// compiling or running. They live in clox.c.
+int findHostNative(const char* name, int length, int* arity);
+InterpretResult callHostNative(ObjString* name, int argCount, Value* result);
+
+#endif
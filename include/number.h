@@ -0,0 +1,14 @@
+#ifndef clox_number_h
+#define clox_number_h
+
+#include "common.h"
+
+// Longest output of formatNumber() or formatInteger(), including the
+// terminator.
+#define NUMBER_BUFFER_SIZE 32
+
+bool parseNumber(const char* start, size_t length, double* number);
+int formatInteger(int64_t integer, char* buffer);
+int formatNumber(double number, char* buffer);
+
+#endif
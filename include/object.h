@@ -0,0 +1,214 @@
+#ifndef clox_object_h
+#define clox_object_h
+
+#include "chunk.h"
+#include "common.h"
+#include "table.h"
+#include "value.h"
+
+#define OBJ_TYPE(value)     (AS_OBJ(value)->type)
+
+#define IS_FILE(value)      isObjType(value, OBJ_FILE)
+#define IS_GENERATOR(value) isObjType(value, OBJ_GENERATOR)
+#define IS_LIST(value)      isObjType(value, OBJ_LIST)
+#define IS_MAP(value)       isObjType(value, OBJ_MAP)
+#define IS_MODULE(value)    isObjType(value, OBJ_MODULE)
+#define IS_POLL(value)      isObjType(value, OBJ_POLL)
+#define IS_STREAM(value)    isObjType(value, OBJ_STREAM)
+#define IS_STRING(value)    isObjType(value, OBJ_STRING)
+#define IS_VIEW(value)      isObjType(value, OBJ_VIEW)
+
+#define AS_FILE(value)      ((ObjFile*)AS_OBJ(value))
+#define AS_GENERATOR(value) ((ObjGenerator*)AS_OBJ(value))
+#define AS_LIST(value)      ((ObjList*)AS_OBJ(value))
+#define AS_MAP(value)       ((ObjMap*)AS_OBJ(value))
+#define AS_MODULE(value)    ((ObjModule*)AS_OBJ(value))
+#define AS_POLL(value)      ((ObjPoll*)AS_OBJ(value))
+#define AS_STREAM(value)    ((ObjStream*)AS_OBJ(value))
+#define AS_STRING(value)    ((ObjString*)AS_OBJ(value))
+#define AS_VIEW(value)      ((ObjView*)AS_OBJ(value))
+
+// The loop slots a generator takes from its creator: the first loop's
+// iterable (or range counter), its position (or range end) and its
+// variable.
+#define GENERATOR_CAPTURE 3
+
+typedef enum {
+    OBJ_FILE,
+    OBJ_GENERATOR,
+    OBJ_LIST,
+    OBJ_MAP,
+    OBJ_MODULE,
+    OBJ_POLL,
+    OBJ_STREAM,
+    OBJ_STRING,
+    OBJ_VIEW,
+} ObjType;
+
+// An object with pins is never collected, since something the collector
+// can't see refers to it: a chunk's constants, or the embedding program.
+// Each of them takes and drops a pin of its own.
+struct Obj {
+    ObjType type;
+    bool marked;
+    int pins;
+    struct Obj* next;
+};
+
+// The contents of a file, mapped read-only when possible. Strings read
+// from it are views into `data`.
+typedef struct {
+    Obj obj;
+    const char* data;
+    size_t length;
+    size_t capacity;
+    bool mapped;
+} ObjFile;
+
+typedef enum {
+    GENERATOR_SUSPENDED,
+    GENERATOR_RUNNING,
+    GENERATOR_DONE,
+} GeneratorState;
+
+// A suspended generator is just its instruction pointer and the handful
+// of stack slots its loops were using. Resuming copies the slots back
+// onto the stack as a frame; yielding copies them out again.
+typedef struct ObjGenerator {
+    Obj obj;
+    GeneratorState state;
+    Chunk* chunk;
+    uint8_t* body;
+    uint8_t* ip;
+    ValueArray window;
+
+    // Where to go back to, valid while the generator is running.
+    struct ObjGenerator* caller;
+    Chunk* callerChunk;
+    int callerBase;
+    int variable;
+    uint8_t* resumeIp;
+    uint8_t* exitIp;
+} ObjGenerator;
+
+struct ObjList {
+    Obj obj;
+    ValueArray items;
+};
+
+struct ObjMap {
+    Obj obj;
+    Table table;
+};
+
+typedef enum {
+    MODULE_UNLOADED,
+    MODULE_COMPILED,
+    MODULE_RUNNING,
+    MODULE_LOADED,
+} ModuleState;
+
+// A source file compiled at most once per process. Its body runs the
+// first time it's imported, and the value it produces is shared by every
+// importer after that.
+typedef struct {
+    Obj obj;
+    ObjString* path;
+    ModuleState state;
+    Chunk chunk;
+    Value value;
+} ObjModule;
+
+// A descriptor that is read without blocking: a pipe, socket or timer.
+// Bytes that have arrived but don't yet make up a whole line wait in
+// `buffer` between `start` and `count`. A timer instead counts the
+// expirations not yet taken in `ticks`, and closes once it has fired
+// `limit` times. A FIFO only closes once a writer has hung up.
+typedef struct {
+    Obj obj;
+    int fd;
+    bool timer;
+    bool fifo;
+    bool closed;
+    char* buffer;
+    size_t start;
+    size_t count;
+    size_t capacity;
+    int64_t ticks;
+    int64_t fired;
+    int64_t limit;
+} ObjStream;
+
+// An event loop over several streams. Iterating it yields lines from
+// whichever streams have them, waiting in epoll only when none do.
+typedef struct {
+    Obj obj;
+    int epoll;
+    ObjStream** streams;
+    int count;
+    int next;
+} ObjPoll;
+
+// A string either owns its NUL-terminated characters or, when `owner` is
+// set, is a view into memory that object keeps alive. Views are not
+// NUL-terminated, so always go by `length`.
+struct ObjString {
+    Obj obj;
+    int length;
+    char* chars;
+    uint32_t hash;
+    Obj* owner;
+};
+
+typedef enum {
+    VIEW_DOUBLE,
+    VIEW_INT64,
+    VIEW_INT32,
+    VIEW_UINT8,
+} ViewType;
+
+// A read-only array in the embedding program's memory, which scripts
+// index and iterate like a list without it being copied. The program
+// keeps `data` alive and unchanged until it releases the view; `data` is
+// NULL after that, and using the view is an error.
+typedef struct {
+    Obj obj;
+    ViewType type;
+    const void* data;
+    int length;
+} ObjView;
+
+ObjFile* newFile();
+ObjGenerator* newGenerator(Chunk* chunk, uint8_t* ip);
+void appendWindow(ObjGenerator* generator, Value* values, int count);
+ObjList* newList(int count);
+void appendList(ObjList* list, Value* values, int count);
+ObjList* sliceList(ObjList* list, int start, int end);
+void reverseList(ObjList* list);
+void fillList(ObjList* list, Value value);
+ObjMap* newMap();
+ObjModule* newModule(ObjString* path);
+ObjPoll* newPoll(int count);
+ObjStream* newStream(int fd);
+ObjString* takeString(char* chars, int length);
+ObjString* copyString(const char* chars, int length);
+ObjString* newStringView(Obj* owner, const char* chars, int length);
+ObjView* newView(ViewType type, const void* data, int length);
+bool checkView(ObjView* view);
+void printObject(Value value);
+
+static inline bool isObjType(Value value, ObjType type) {
+  return IS_OBJ(value) && AS_OBJ(value)->type == type;
+}
+
+static inline Value viewElement(ObjView* view, int index) {
+  switch (view->type) {
+    case VIEW_DOUBLE: return NUMBER_VAL(((const double*)view->data)[index]);
+    case VIEW_INT64: return INT_VAL(((const int64_t*)view->data)[index]);
+    case VIEW_INT32: return INT_VAL(((const int32_t*)view->data)[index]);
+    case VIEW_UINT8: return INT_VAL(((const uint8_t*)view->data)[index]);
+  }
+  return INT_VAL(0);
+}
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef clox_reload_h
+#define clox_reload_h
+
+#include "common.h"
+#include "object.h"
+
+typedef struct {
+    int descriptor;
+    char* directory;
+    int length;
+} Watch;
+
+// A VM's own inotify instance and the directories it watches, so each
+// VM reloads the modules it has loaded. `notify` is -1 when it isn't
+// reloading.
+typedef struct {
+    int notify;
+    Watch* watches;
+    int watchCount;
+    int watchCapacity;
+} Reloader;
+
+void initReload();
+bool startReload();
+void stopReload();
+void watchModule(ObjModule* module);
+void checkReload();
+
+#endif
@@ -0,0 +1,10 @@
+#ifndef clox_sort_h
+#define clox_sort_h
+
+#include "common.h"
+#include "value.h"
+
+int compareValues(Value a, Value b);
+bool sortValues(Value* values, int count);
+
+#endif
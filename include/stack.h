@@ -0,0 +1,18 @@
+#ifndef clox_stack_h
+#define clox_stack_h
+
+#include "common.h"
+
+// Slots the stack starts with, the most it may grow to, and how many
+// must be free above the top whenever a frame is entered. A frame's own
+// pushes are bounded by its expression nesting, so they stay within the
+// headroom; a frame that goes past it hits the guard page instead.
+#define STACK_INITIAL (16 * 1024)
+#define STACK_LIMIT (64 * 1024 * 1024)
+#define STACK_HEADROOM 1024
+
+void initStack();
+void freeStack();
+bool ensureStack(int count);
+
+#endif
@@ -0,0 +1,28 @@
+#ifndef clox_table_h
+#define clox_table_h
+
+#include "common.h"
+#include "value.h"
+
+typedef struct {
+    Value key;
+    Value value;
+} Entry;
+
+// Entries live in a dense array in insertion order. The open-addressed
+// index only stores positions into that array, so iterating a table is a
+// linear scan and each index slot costs four bytes.
+typedef struct {
+    int count;
+    int capacity;
+    Entry* entries;
+    int indexCapacity;
+    int32_t* index;
+} Table;
+
+void initTable(Table* table);
+void freeTable(Table* table);
+bool tableGet(Table* table, Value key, Value* value);
+bool tableSet(Table* table, Value key, Value value);
+
+#endif
@@ -3,7 +3,45 @@
 
 #include "common.h"
 
-typedef double Value;
+typedef struct Obj Obj;
+typedef struct ObjList ObjList;
+typedef struct ObjMap ObjMap;
+typedef struct ObjString ObjString;
+
+typedef enum {
+    VAL_BOOL,
+    VAL_NUMBER,
+    VAL_INT,
+    VAL_OBJ,
+} ValueType;
+
+typedef struct {
+    ValueType type;
+    union {
+        bool boolean;
+        double number;
+        int64_t integer;
+        Obj* obj;
+    } as;
+} Value;
+
+#define IS_BOOL(value)      ((value).type == VAL_BOOL)
+#define IS_NUMBER(value)    ((value).type == VAL_NUMBER)
+#define IS_INT(value)       ((value).type == VAL_INT)
+#define IS_OBJ(value)       ((value).type == VAL_OBJ)
+#define IS_NUMERIC(value)   (IS_NUMBER(value) || IS_INT(value))
+
+#define AS_BOOL(value)      ((value).as.boolean)
+#define AS_NUMBER(value)    ((value).as.number)
+#define AS_INT(value)       ((value).as.integer)
+#define AS_OBJ(value)       ((value).as.obj)
+#define TO_DOUBLE(value) \
+    (IS_INT(value) ? (double)AS_INT(value) : AS_NUMBER(value))
+
+#define BOOL_VAL(value)     ((Value){VAL_BOOL, {.boolean = value}})
+#define NUMBER_VAL(value)   ((Value){VAL_NUMBER, {.number = value}})
+#define INT_VAL(value)      ((Value){VAL_INT, {.integer = value}})
+#define OBJ_VAL(object)     ((Value){VAL_OBJ, {.obj = (Obj*)object}})
 
 typedef struct {
     int capacity;
@@ -11,8 +49,10 @@ typedef struct {
     Value* values;
 } ValueArray;
 
+bool valuesEqual(Value a, Value b);
 void initValueArray(ValueArray* array);
 void writeValueArray(ValueArray* array, Value value);
+void reserveValueArray(ValueArray* array, int count);
 void freeValueArray(ValueArray* array);
 void printValue(Value value);
 
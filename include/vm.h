@@ -1,28 +1,98 @@
 #ifndef clox_vm_h
 #define clox_vm_h
 
+#include <setjmp.h>
+
 #include "chunk.h"
+#include "object.h"
+#include "reload.h"
+#include "table.h"
 #include "value.h"
 
-#define STACK_MAX 256
+#define ERROR_MAX 1024
+
+// What a jump back into run() through `overflow` is for.
+#define JUMP_STACK_OVERFLOW 1
+#define JUMP_OUT_OF_MEMORY 2
+
+// What run() does when a stream has to wait for its descriptor.
+typedef enum {
+    // Polls the descriptor and goes on: the clox internals run on their
+    // own, as the benchmarks do, with no lock to hold up.
+    WAIT_BLOCK,
+    // Returns INTERPRET_SUSPENDED to go on with resumeChunk() once the
+    // descriptor is ready: an embedded VM's outermost run.
+    WAIT_SUSPEND,
+    // Raises an error: any other run of an embedded VM, which would wait
+    // holding the library's lock.
+    WAIT_REFUSE,
+} WaitMode;
 
 typedef struct {
     Chunk* chunk;
     uint8_t* ip;
-    Value stack[STACK_MAX];
+    Value* stack;
+    Value* stackLimit;
     Value* stackTop;
+    Value* frameBase;
+    ObjGenerator* generator;
+    Obj* objects;
+    Table modules;
+    int importDepth;
+    // The innermost run() to jump back to, or NULL where nothing may be
+    // jumped over: outside a run, loading a module, or in a native. An
+    // allocation that fails for good there exits instead.
+    sigjmp_buf* overflow;
+    char error[ERROR_MAX];
+    int errorLine;
+    char trace[ERROR_MAX];
+    // Whether run() prints constants, results and errors as the clox
+    // command does. Otherwise a result is left on the stack and an error
+    // in `error`, `trace` and `errorLine`.
+    bool echo;
+    size_t bytesAllocated;
+    size_t objectCount;
+    // The quota on bytesAllocated, or 0 for none, and the size at which
+    // the next collection runs. Without a quota garbage is collected only
+    // once an allocation has failed.
+    size_t memoryLimit;
+    size_t nextGC;
+    // Set when an allocation failed, or only succeeded by spending the
+    // reserve memory.c keeps, until a collection can set it aside again.
+    bool memoryExhausted;
+    // The descriptor a stream is waiting on, and whether for POLLIN or
+    // POLLOUT, or -1 when nothing is waiting. The instruction that waited,
+    // `waitLength` bytes long, runs again once the descriptor is ready,
+    // and `waitProgress` is how many bytes a write had sent by then.
+    WaitMode waitMode;
+    int waitFd;
+    short waitEvents;
+    int waitLength;
+    size_t waitProgress;
+    Reloader reload;
+    // Why the last edit to a module was ignored, when run() isn't
+    // printing it.
+    char reloadError[ERROR_MAX + 32];
 } VM;
 
 typedef enum {
     INTERPRET_OK,
     INTERPRET_COMPILE_ERROR,
     INTERPRET_RUNTIME_ERROR,
+    // A host native suspended the run, or a stream is waiting on its
+    // descriptor. It goes on with resumeChunk().
+    INTERPRET_SUSPENDED,
 } InterpretResult;
 
+extern VM vm;
+
 void initVM();
 void freeVM();
-InterpretResult interpret(const char* source);
+InterpretResult interpret(const char* source, const char* path);
+InterpretResult interpretChunk(Chunk* chunk);
+InterpretResult resumeChunk(bool raising);
 void push(Value value);
 Value pop();
+void runtimeError(const char* format, ...);
 
 #endif
@@ -0,0 +1,387 @@
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "memory.h"
+#include "native.h"
+#include "object.h"
+
+#define CACHE_VERSION 4
+
+#define FNV_OFFSET 14695981039346656037u
+#define FNV_PRIME 1099511628211u
+
+// A compiled module is cached next to its source as "<path>c". The cache
+// is only used while the source's size and modification time still
+// match, and only by a build with the same instruction set: OP_RETURN is
+// the last opcode, so its value changes whenever one is added. The
+// checksum covers everything after the header, so a cache that was cut
+// short or damaged is compiled again.
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t opcodes;
+    uint32_t pathLength;
+    int64_t size;
+    int64_t modified;
+    int64_t modifiedNanos;
+    uint64_t checksum;
+    int32_t codeCount;
+    int32_t lineRunCount;
+    int32_t handlerCount;
+    int32_t constantCount;
+} CacheHeader;
+
+typedef enum {
+    CONSTANT_NUMBER,
+    CONSTANT_INT,
+    CONSTANT_STRING,
+} ConstantTag;
+
+typedef struct {
+    const uint8_t* data;
+    size_t length;
+    size_t position;
+} Reader;
+
+typedef struct {
+    FILE* file;
+    uint64_t checksum;
+} Writer;
+
+static uint64_t addChecksum(uint64_t checksum, const void* bytes,
+                            size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    checksum = (checksum ^ ((const uint8_t*)bytes)[i]) * FNV_PRIME;
+  }
+  return checksum;
+}
+
+static void initHeader(CacheHeader* header, const char* path,
+                       const struct stat* source) {
+  memset(header, 0, sizeof(CacheHeader));
+  memcpy(header->magic, "LOXC", 4);
+  header->version = CACHE_VERSION;
+  header->opcodes = OP_RETURN;
+  header->pathLength = (uint32_t)strlen(path);
+  header->size = (int64_t)source->st_size;
+  header->modified = (int64_t)source->st_mtim.tv_sec;
+  header->modifiedNanos = (int64_t)source->st_mtim.tv_nsec;
+}
+
+static bool readBytes(Reader* reader, void* bytes, size_t count) {
+  if (reader->length - reader->position < count) return false;
+  memcpy(bytes, reader->data + reader->position, count);
+  reader->position += count;
+  return true;
+}
+
+static bool readConstant(Reader* reader, Value* value) {
+  uint8_t tag;
+  if (!readBytes(reader, &tag, 1)) return false;
+
+  switch (tag) {
+    case CONSTANT_NUMBER: {
+      double number;
+      if (!readBytes(reader, &number, sizeof(number))) return false;
+      *value = NUMBER_VAL(number);
+      return true;
+    }
+    case CONSTANT_INT: {
+      int64_t integer;
+      if (!readBytes(reader, &integer, sizeof(integer))) return false;
+      *value = INT_VAL(integer);
+      return true;
+    }
+    case CONSTANT_STRING: {
+      int32_t length;
+      if (!readBytes(reader, &length, sizeof(length)) || length < 0 ||
+          reader->length - reader->position < (size_t)length) {
+        return false;
+      }
+      const char* chars = (const char*)reader->data + reader->position;
+      reader->position += length;
+      *value = OBJ_VAL(copyString(chars, length));
+      return true;
+    }
+  }
+  return false;
+}
+
+static int nativeCount() {
+  int count = 0;
+  while (natives[count].name != NULL) count++;
+  return count;
+}
+
+// The bytes an instruction takes up with its operands, or 0 for an
+// unknown opcode.
+static int instructionLength(uint8_t instruction) {
+  switch (instruction) {
+    case OP_CONSTANT:
+    case OP_POP_N:
+    case OP_GET_LOCAL:
+    case OP_SET_LOCAL:
+    case OP_BUILD_LIST:
+    case OP_BUILD_MAP:
+    case OP_BUILD_STRING:
+    case OP_LIST_APPEND:
+    case OP_IMPORT:
+      return 2;
+    case OP_NATIVE:
+    case OP_HOST_NATIVE:
+    case OP_GENERATOR:
+    case OP_JUMP_IF_FALSE:
+    case OP_LOOP:
+      return 3;
+    case OP_FOR_RANGE:
+    case OP_FOR_ITER:
+      return 4;
+    default:
+      return instruction <= OP_RETURN ? 1 : 0;
+  }
+}
+
+static bool isTarget(const bool* starts, int count, int target) {
+  return target >= 0 && target <= count && starts[target];
+}
+
+// The header only shows the cache was written for this source, not that
+// it's whole, so run() isn't handed code that could read outside the
+// chunk. Every operand must name a constant of the right type or a real
+// native, and every jump and handler must land on an instruction, or on
+// the end of the code.
+static bool checkCode(Chunk* chunk) {
+  int count = chunk->count;
+  bool* starts = ALLOCATE(bool, count + 1);
+  memset(starts, 0, sizeof(bool) * (count + 1));
+  int constants = chunk->constants.count;
+  int natives = nativeCount();
+  bool valid = true;
+
+  for (int offset = 0; valid && offset < count;) {
+    uint8_t* code = chunk->code + offset;
+    int length = instructionLength(code[0]);
+    starts[offset] = true;
+    if (length == 0 || length > count - offset) {
+      valid = false;
+    } else if (code[0] == OP_CONSTANT) {
+      valid = code[1] < constants;
+    } else if (code[0] == OP_IMPORT || code[0] == OP_HOST_NATIVE) {
+      valid = code[1] < constants &&
+              IS_STRING(chunk->constants.values[code[1]]);
+    } else if (code[0] == OP_NATIVE) {
+      valid = code[1] < natives;
+    }
+    offset += length;
+  }
+  starts[count] = true;
+
+  for (int offset = 0; valid && offset < count;) {
+    uint8_t* code = chunk->code + offset;
+    offset += instructionLength(code[0]);
+    switch (code[0]) {
+      case OP_GENERATOR:
+      case OP_JUMP_IF_FALSE:
+        valid = isTarget(starts, count, offset + ((code[1] << 8) | code[2]));
+        break;
+      case OP_LOOP:
+        valid = isTarget(starts, count, offset - ((code[1] << 8) | code[2]));
+        break;
+      case OP_FOR_RANGE:
+      case OP_FOR_ITER:
+        valid = isTarget(starts, count, offset + ((code[2] << 8) | code[3]));
+        break;
+      default:
+        break;
+    }
+  }
+
+  for (int i = 0; valid && i < chunk->handlerCount; i++) {
+    Handler* handler = &chunk->handlers[i];
+    valid = isTarget(starts, count, handler->start) &&
+            isTarget(starts, count, handler->end) &&
+            handler->start <= handler->end &&
+            handler->handler < count &&
+            isTarget(starts, count, handler->handler) &&
+            isTarget(starts, count, handler->body) &&
+            handler->depth >= 0;
+  }
+
+  FREE_ARRAY(bool, starts, count + 1);
+  return valid;
+}
+
+static bool readChunk(Reader* reader, const char* path,
+                      const struct stat* source, Chunk* chunk) {
+  CacheHeader expected;
+  CacheHeader header;
+  initHeader(&expected, path, source);
+  if (!readBytes(reader, &header, sizeof(header)) ||
+      memcmp(header.magic, expected.magic, 4) != 0 ||
+      header.version != expected.version ||
+      header.opcodes != expected.opcodes ||
+      header.pathLength != expected.pathLength ||
+      header.size != expected.size ||
+      header.modified != expected.modified ||
+      header.modifiedNanos != expected.modifiedNanos ||
+      header.codeCount < 0 || header.lineRunCount < 0 ||
+      header.handlerCount < 0 || header.constantCount < 0 ||
+      header.checksum != addChecksum(FNV_OFFSET,
+                                     reader->data + reader->position,
+                                     reader->length - reader->position)) {
+    return false;
+  }
+
+  // The path is checked too, since resolved imports are stored as
+  // absolute paths.
+  if (reader->length - reader->position < header.pathLength ||
+      memcmp(reader->data + reader->position, path, header.pathLength) != 0) {
+    return false;
+  }
+  reader->position += header.pathLength;
+
+  size_t codeSize = (size_t)header.codeCount +
+      (size_t)header.lineRunCount * sizeof(LineRun);
+  if (reader->length - reader->position < codeSize) return false;
+  const uint8_t* code = reader->data + reader->position;
+  const uint8_t* lineRuns = code + header.codeCount;
+  LineRun run = {0, 0};
+  for (int i = 0, next = 0; i < header.codeCount; i++) {
+    if (next < header.lineRunCount) {
+      LineRun nextRun;
+      memcpy(&nextRun, lineRuns + next * sizeof(LineRun), sizeof(LineRun));
+      if (nextRun.start == i) {
+        run = nextRun;
+        next++;
+      }
+    }
+    writeChunk(chunk, code[i], run.line);
+  }
+  reader->position += codeSize;
+
+  for (int i = 0; i < header.handlerCount; i++) {
+    Handler handler;
+    if (!readBytes(reader, &handler, sizeof(handler))) return false;
+    addHandler(chunk, handler);
+  }
+
+  for (int i = 0; i < header.constantCount; i++) {
+    Value value;
+    if (!readConstant(reader, &value)) return false;
+    addConstant(chunk, value);
+  }
+  return reader->position == reader->length && checkCode(chunk);
+}
+
+// Fills `chunk` from the cache for the module at `path`. Returns false,
+// leaving `chunk` empty, if there's no usable cache.
+bool loadCachedChunk(const char* path, const struct stat* source,
+                     Chunk* chunk) {
+  char cachePath[PATH_MAX];
+  if (snprintf(cachePath, PATH_MAX, "%sc", path) >= PATH_MAX) return false;
+
+  FILE* file = fopen(cachePath, "rb");
+  if (file == NULL) return false;
+
+  fseek(file, 0L, SEEK_END);
+  long size = ftell(file);
+  rewind(file);
+  if (size < 0) {
+    fclose(file);
+    return false;
+  }
+
+  uint8_t* data = ALLOCATE(uint8_t, size);
+  bool success = fread(data, 1, size, file) == (size_t)size;
+  fclose(file);
+
+  if (success) {
+    Reader reader = {data, (size_t)size, 0};
+    success = readChunk(&reader, path, source, chunk);
+    if (success) {
+      finalizeChunk(chunk);
+    } else {
+      freeChunk(chunk);
+    }
+  }
+
+  FREE_ARRAY(uint8_t, data, size);
+  return success;
+}
+
+static bool writeBytes(Writer* writer, const void* bytes, size_t count) {
+  writer->checksum = addChecksum(writer->checksum, bytes, count);
+  return fwrite(bytes, 1, count, writer->file) == count;
+}
+
+static bool writeConstant(Writer* writer, Value value) {
+  uint8_t tag;
+  if (IS_NUMBER(value)) {
+    tag = CONSTANT_NUMBER;
+    return writeBytes(writer, &tag, 1) &&
+           writeBytes(writer, &value.as.number, sizeof(double));
+  }
+  if (IS_INT(value)) {
+    tag = CONSTANT_INT;
+    return writeBytes(writer, &tag, 1) &&
+           writeBytes(writer, &value.as.integer, sizeof(int64_t));
+  }
+  if (IS_STRING(value)) {
+    ObjString* string = AS_STRING(value);
+    int32_t length = string->length;
+    tag = CONSTANT_STRING;
+    return writeBytes(writer, &tag, 1) &&
+           writeBytes(writer, &length, sizeof(length)) &&
+           writeBytes(writer, string->chars, length);
+  }
+  return false;
+}
+
+// Caching is best-effort: any failure just leaves no cache behind. The
+// file is written under a temporary name and renamed into place, so a
+// concurrent reader never sees half of it. The header is written again
+// at the end, once the checksum is known. `chunk` must be finalized.
+void saveCachedChunk(const char* path, const struct stat* source,
+                     Chunk* chunk) {
+  char cachePath[PATH_MAX];
+  char tempPath[PATH_MAX];
+  if (snprintf(cachePath, PATH_MAX, "%sc", path) >= PATH_MAX ||
+      snprintf(tempPath, PATH_MAX, "%sc.%d", path, (int)getpid())
+          >= PATH_MAX) {
+    return;
+  }
+
+  FILE* file = fopen(tempPath, "wb");
+  if (file == NULL) return;
+
+  CacheHeader header;
+  initHeader(&header, path, source);
+  header.codeCount = chunk->count;
+  header.lineRunCount = chunk->lineRunCount;
+  header.handlerCount = chunk->handlerCount;
+  header.constantCount = chunk->constants.count;
+
+  Writer writer = {file, FNV_OFFSET};
+  bool success = fwrite(&header, sizeof(header), 1, file) == 1 &&
+      writeBytes(&writer, path, header.pathLength) &&
+      writeBytes(&writer, chunk->code, chunk->count) &&
+      writeBytes(&writer, chunk->lineRuns,
+                 sizeof(LineRun) * chunk->lineRunCount);
+  if (success && chunk->handlerCount > 0) {
+    success = writeBytes(&writer, chunk->handlers,
+                         sizeof(Handler) * chunk->handlerCount);
+  }
+  for (int i = 0; success && i < chunk->constants.count; i++) {
+    success = writeConstant(&writer, chunk->constants.values[i]);
+  }
+
+  header.checksum = writer.checksum;
+  success = success && fseek(file, 0L, SEEK_SET) == 0 &&
+      fwrite(&header, sizeof(header), 1, file) == 1;
+  if (fclose(file) != 0) success = false;
+  if (!success || rename(tempPath, cachePath) != 0) unlink(tempPath);
+}
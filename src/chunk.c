@@ -1,21 +1,45 @@
 #include <stdlib.h>
+#include <string.h>
 
 #include "chunk.h"
 #include "memory.h"
+#include "object.h"
+
+#define CACHE_LINE_SIZE 64
 
 void initChunk(Chunk* chunk) {
   chunk->count = 0;
   chunk->capacity = 0;
   chunk->code = NULL;
   chunk->lines = NULL;
+  chunk->lineRunCount = 0;
+  chunk->lineRuns = NULL;
+  chunk->handlerCount = 0;
+  chunk->handlerCapacity = 0;
+  chunk->handlers = NULL;
   initValueArray(&chunk->constants);
+  chunk->packed = NULL;
+  chunk->packedSize = 0;
+  chunk->owner = NULL;
 }
 
 void freeChunk(Chunk* chunk) {
-  FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);
-  FREE_ARRAY(int, chunk->lines, chunk->capacity);
-  freeValueArray(&chunk->constants);
+  for (int i = 0; i < chunk->constants.count; i++) {
+    Value value = chunk->constants.values[i];
+    if (IS_OBJ(value)) AS_OBJ(value)->pins--;
+  }
+
+  Obj* owner = chunk->owner;
+  if (chunk->packed != NULL) {
+    reallocate(chunk->packed, chunk->packedSize, 0);
+  } else {
+    FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);
+    FREE_ARRAY(int, chunk->lines, chunk->capacity);
+    FREE_ARRAY(Handler, chunk->handlers, chunk->handlerCapacity);
+    freeValueArray(&chunk->constants);
+  }
   initChunk(chunk);
+  chunk->owner = owner;
 }
 
 void writeChunk(Chunk* chunk, uint8_t byte, int line) {
@@ -32,7 +56,100 @@ void writeChunk(Chunk* chunk, uint8_t byte, int line) {
   chunk->count++;
 }
 
+// Chunks aren't objects, so the collector can't tell which of their
+// constants are still in use. They're kept until freeChunk().
 int addConstant(Chunk* chunk, Value value) {
+  if (IS_OBJ(value)) AS_OBJ(value)->pins++;
   writeValueArray(&chunk->constants, value);
   return chunk->constants.count - 1;
 }
+
+void addHandler(Chunk* chunk, Handler handler) {
+  if (chunk->handlerCapacity < chunk->handlerCount + 1) {
+    int oldCapacity = chunk->handlerCapacity;
+    chunk->handlerCapacity = GROW_CAPACITY(oldCapacity);
+    chunk->handlers = GROW_ARRAY(Handler, chunk->handlers,
+                                 oldCapacity, chunk->handlerCapacity);
+  }
+
+  chunk->handlers[chunk->handlerCount++] = handler;
+}
+
+static int countLineRuns(Chunk* chunk) {
+  int count = 0;
+  for (int i = 0; i < chunk->count; i++) {
+    if (i == 0 || chunk->lines[i] != chunk->lines[i - 1]) count++;
+  }
+  return count;
+}
+
+// Packs the finished chunk into one exact-size allocation aligned to a
+// cache line, releasing the slack the growing arrays left. Constants come
+// first since values need the strictest alignment, then the handler
+// table, the line runs and the code.
+void finalizeChunk(Chunk* chunk) {
+  if (chunk->packed != NULL) return;
+
+  int lineRunCount = countLineRuns(chunk);
+  size_t constantsSize = sizeof(Value) * chunk->constants.count;
+  size_t handlersSize = sizeof(Handler) * chunk->handlerCount;
+  size_t lineRunsSize = sizeof(LineRun) * lineRunCount;
+  size_t size = constantsSize + handlersSize + lineRunsSize + chunk->count;
+  size = (size + CACHE_LINE_SIZE - 1) & ~(size_t)(CACHE_LINE_SIZE - 1);
+
+  uint8_t* packed = allocateAligned(CACHE_LINE_SIZE, size);
+  Value* constants = (Value*)packed;
+  Handler* handlers = (Handler*)(packed + constantsSize);
+  LineRun* lineRuns = (LineRun*)(packed + constantsSize + handlersSize);
+  uint8_t* code = packed + constantsSize + handlersSize + lineRunsSize;
+
+  if (constantsSize > 0) {
+    memcpy(constants, chunk->constants.values, constantsSize);
+  }
+  if (handlersSize > 0) memcpy(handlers, chunk->handlers, handlersSize);
+  int run = 0;
+  for (int i = 0; i < chunk->count; i++) {
+    if (i == 0 || chunk->lines[i] != chunk->lines[i - 1]) {
+      lineRuns[run].start = i;
+      lineRuns[run].line = chunk->lines[i];
+      run++;
+    }
+  }
+  if (chunk->count > 0) memcpy(code, chunk->code, chunk->count);
+
+  int constantCount = chunk->constants.count;
+  FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);
+  FREE_ARRAY(int, chunk->lines, chunk->capacity);
+  FREE_ARRAY(Handler, chunk->handlers, chunk->handlerCapacity);
+  freeValueArray(&chunk->constants);
+
+  chunk->capacity = chunk->count;
+  chunk->code = code;
+  chunk->lines = NULL;
+  chunk->lineRunCount = lineRunCount;
+  chunk->lineRuns = lineRuns;
+  chunk->handlerCapacity = chunk->handlerCount;
+  chunk->handlers = handlers;
+  chunk->constants.count = constantCount;
+  chunk->constants.capacity = constantCount;
+  chunk->constants.values = constants;
+  chunk->packed = packed;
+  chunk->packedSize = size;
+}
+
+int getLine(Chunk* chunk, int offset) {
+  if (chunk->lines != NULL) return chunk->lines[offset];
+
+  // Find the last run starting at or before `offset`.
+  int low = 0;
+  int high = chunk->lineRunCount - 1;
+  while (low < high) {
+    int middle = low + (high - low + 1) / 2;
+    if (chunk->lineRuns[middle].start <= offset) {
+      low = middle;
+    } else {
+      high = middle - 1;
+    }
+  }
+  return chunk->lineRuns[low].line;
+}
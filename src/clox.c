@@ -0,0 +1,895 @@
+// PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP is a GNU extension.
+#define _GNU_SOURCE
+
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "clox.h"
+#include "compiler.h"
+#include "document.h"
+#include "heap.h"
+#include "memory.h"
+#include "native.h"
+#include "object.h"
+#include "reload.h"
+#include "scanner.h"
+#include "stack.h"
+#include "vm.h"
+
+#define HOST_NATIVES_MAX UINT8_COUNT
+
+typedef struct {
+    char* name;
+    int length;
+    int arity;
+    CloxNativeFn function;
+    void* data;
+} HostNative;
+
+// What cloxRun() puts back once its script is done. A suspended run
+// keeps it in its handle until cloxResume() finishes the script.
+typedef struct {
+    int top;
+    int frameBase;
+    ObjGenerator* generator;
+    Chunk* chunk;
+    uint8_t* ip;
+} Caller;
+
+// The interpreter keeps its state in the global `vm`. A handle holds a
+// VM's state while another one is in there, and they're swapped on the
+// way into the library, so a program using one VM pays nothing for it.
+struct CloxVM {
+    VM state;
+    // The slot index 0 refers to: the bottom of the stack, or a native's
+    // first argument while it runs.
+    int base;
+    int running;
+    // Set by cloxSuspend() for the native returning. While the run is
+    // suspended, `base` is that native's first argument.
+    bool suspending;
+    bool suspended;
+    int pendingNative;
+    int pendingArgCount;
+    int pendingBase;
+    Caller caller;
+    // The script cloxEval() compiled for a suspended run, freed with it.
+    CloxScript* evalScript;
+    HostNative* natives;
+    int nativeCount;
+    int nativeCapacity;
+    char message[ERROR_MAX * 2 + 32];
+    char reloadMessage[ERROR_MAX + 32];
+    // The string cloxToString() last returned, kept until its next call.
+    ObjString* string;
+};
+
+struct CloxScript {
+    Chunk chunk;
+};
+
+// The document borrows its path, so the handle keeps a copy.
+struct CloxDocument {
+    Document document;
+    char* path;
+};
+
+// One call into the library at a time, from any thread. A native calling
+// back in already holds the lock.
+static pthread_mutex_t lock = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
+static CloxVM* active = NULL;
+static int vmCount = 0;
+
+static void suspendActive() {
+  if (active == NULL) return;
+  // Swapping out a VM in the middle of a run would lose its place.
+  if (active->running > 0) {
+    fprintf(stderr, "clox: a native called into a VM other than its own.\n");
+    abort();
+  }
+  active->state = vm;
+  active = NULL;
+}
+
+static void enter(CloxVM* handle) {
+  pthread_mutex_lock(&lock);
+  if (active == handle) return;
+  suspendActive();
+  vm = handle->state;
+  active = handle;
+}
+
+static void leave() {
+  pthread_mutex_unlock(&lock);
+}
+
+static Value* slot(CloxVM* handle, int index) {
+  Value* value = index < 0 ? vm.stackTop + index
+                           : vm.stack + handle->base + index;
+  if (value < vm.stack + handle->base || value >= vm.stackTop) return NULL;
+  return value;
+}
+
+int cloxVersion() {
+  return CLOX_VERSION;
+}
+
+CloxVM* cloxNewVM(int flags) {
+  pthread_mutex_lock(&lock);
+  CloxVM* handle = malloc(sizeof(CloxVM));
+  if (handle == NULL) {
+    pthread_mutex_unlock(&lock);
+    return NULL;
+  }
+
+  suspendActive();
+  if (vmCount++ == 0) initHeap((flags & CLOX_HUGE_PAGES) != 0);
+  initVM();
+  vm.echo = (flags & CLOX_PRINT) != 0;
+
+  handle->base = 0;
+  handle->running = 0;
+  handle->suspending = false;
+  handle->suspended = false;
+  handle->evalScript = NULL;
+  handle->natives = NULL;
+  handle->nativeCount = 0;
+  handle->nativeCapacity = 0;
+  handle->message[0] = '\0';
+  handle->reloadMessage[0] = '\0';
+  handle->string = NULL;
+  active = handle;
+
+  if ((flags & CLOX_RELOAD) != 0) {
+    if (!startReload()) {
+      snprintf(handle->message, sizeof(handle->message),
+               "Could not watch for changes.");
+      if (vm.echo) fprintf(stderr, "%s\n", handle->message);
+    }
+  }
+
+  pthread_mutex_unlock(&lock);
+  return handle;
+}
+
+void cloxFreeVM(CloxVM* handle) {
+  enter(handle);
+  for (int i = 0; i < handle->nativeCount; i++) {
+    FREE_ARRAY(char, handle->natives[i].name, handle->natives[i].length + 1);
+  }
+  FREE_ARRAY(HostNative, handle->natives, handle->nativeCapacity);
+  if (handle->evalScript != NULL) {
+    freeChunk(&handle->evalScript->chunk);
+    free(handle->evalScript);
+  }
+  freeVM();
+  if (--vmCount == 0) freeHeap();
+
+  active = NULL;
+  free(handle);
+  leave();
+}
+
+CloxScript* cloxCompile(CloxVM* handle, const char* source,
+                        const char* path) {
+  enter(handle);
+  CloxScript* script = malloc(sizeof(CloxScript));
+  if (script == NULL) {
+    snprintf(handle->message, sizeof(handle->message), "Out of memory.");
+    leave();
+    return NULL;
+  }
+
+  initChunk(&script->chunk);
+  CompileError error;
+  initScanner(source);
+  if (!compileTokens(scanToken, path, &script->chunk, &error)) {
+    snprintf(handle->message, sizeof(handle->message), "[line %d] %s",
+             error.token.line, error.message);
+    if (vm.echo) fprintf(stderr, "%s\n", handle->message);
+    freeChunk(&script->chunk);
+    free(script);
+    script = NULL;
+  }
+  leave();
+  return script;
+}
+
+void cloxFreeScript(CloxVM* handle, CloxScript* script) {
+  if (script == NULL) return;
+  enter(handle);
+  freeChunk(&script->chunk);
+  free(script);
+  leave();
+}
+
+CloxDocument* cloxNewDocument(CloxVM* handle, const char* source,
+                              const char* path) {
+  enter(handle);
+  CloxDocument* document = malloc(sizeof(CloxDocument));
+  char* pathCopy = path == NULL ? NULL : strdup(path);
+  if (document == NULL || (path != NULL && pathCopy == NULL)) {
+    free(document);
+    free(pathCopy);
+    snprintf(handle->message, sizeof(handle->message), "Out of memory.");
+    leave();
+    return NULL;
+  }
+
+  document->path = pathCopy;
+  initDocument(&document->document, source, pathCopy);
+  leave();
+  return document;
+}
+
+void cloxFreeDocument(CloxVM* handle, CloxDocument* document) {
+  if (document == NULL) return;
+  enter(handle);
+  freeDocument(&document->document);
+  free(document->path);
+  free(document);
+  leave();
+}
+
+bool cloxEditDocument(CloxVM* handle, CloxDocument* document, int start,
+                      int end, const char* chars, int length,
+                      CloxTokenRange* range) {
+  enter(handle);
+  bool valid = start >= 0 && start <= end && length >= 0 &&
+               end <= documentLength(&document->document);
+  if (valid) {
+    TokenRange edited = editDocument(&document->document, start, end, chars,
+                                     length);
+    if (range != NULL) {
+      range->first = edited.first;
+      range->removed = edited.removed;
+      range->added = edited.added;
+    }
+  }
+  leave();
+  return valid;
+}
+
+int cloxDocumentLength(CloxVM* handle, CloxDocument* document) {
+  enter(handle);
+  int length = documentLength(&document->document);
+  leave();
+  return length;
+}
+
+int cloxDocumentTokenCount(CloxVM* handle, CloxDocument* document) {
+  enter(handle);
+  int count = documentTokenCount(&document->document);
+  leave();
+  return count;
+}
+
+static CloxTokenKind tokenKind(TokenType type) {
+  switch (type) {
+    case TOKEN_IDENTIFIER: return CLOX_TOKEN_IDENTIFIER;
+    case TOKEN_STRING: return CLOX_TOKEN_STRING;
+    case TOKEN_INTERPOLATION: return CLOX_TOKEN_INTERPOLATION;
+    case TOKEN_NUMBER:
+    case TOKEN_INTEGER: return CLOX_TOKEN_NUMBER;
+    case TOKEN_ERROR: return CLOX_TOKEN_ERROR;
+    case TOKEN_EOF: return CLOX_TOKEN_EOF;
+    default:
+      // The keywords come last in TokenType, before the error and EOF.
+      return type >= TOKEN_AND ? CLOX_TOKEN_KEYWORD
+                               : CLOX_TOKEN_PUNCTUATION;
+  }
+}
+
+bool cloxDocumentToken(CloxVM* handle, CloxDocument* document, int index,
+                       CloxToken* token) {
+  enter(handle);
+  bool valid = index >= 0 && index < documentTokenCount(&document->document);
+  if (valid) {
+    LexToken lexed = documentLexToken(&document->document, index);
+    token->kind = tokenKind((TokenType)lexed.type);
+    token->start = lexed.start;
+    token->length = lexed.end - lexed.start;
+    token->line = lexed.line;
+    token->message = lexed.message;
+  }
+  leave();
+  return valid;
+}
+
+bool cloxCheckDocument(CloxVM* handle, CloxDocument* document) {
+  enter(handle);
+  Document* checked = &document->document;
+  bool success = checkDocument(checked);
+  if (!success) {
+    snprintf(handle->message, sizeof(handle->message), "[line %d] %s",
+             checked->errorLine, checked->error);
+  }
+  leave();
+  return success;
+}
+
+// Puts back what the run's caller had, unless the run was suspended. A
+// failed run leaves the stack as it found it.
+static CloxResult finishRun(CloxVM* handle, Caller* caller,
+                            InterpretResult result) {
+  if (result == INTERPRET_SUSPENDED) {
+    handle->caller = *caller;
+    handle->suspended = true;
+    return CLOX_SUSPENDED;
+  }
+
+  if (result == INTERPRET_RUNTIME_ERROR) {
+    snprintf(handle->message, sizeof(handle->message),
+             "%s\n%s[line %d] in script", vm.error, vm.trace, vm.errorLine);
+    vm.stackTop = vm.stack + caller->top;
+  }
+  vm.frameBase = vm.stack + caller->frameBase;
+  vm.generator = caller->generator;
+  vm.chunk = caller->chunk;
+  vm.ip = caller->ip;
+  // What a run that ran out of memory left behind is freed before the
+  // program goes on, while the stack is all there is to keep.
+  if (vm.memoryExhausted && handle->running == 0) collectGarbage();
+  return result == INTERPRET_OK ? CLOX_OK : CLOX_RUNTIME_ERROR;
+}
+
+// Runs the chunk, or goes on with the suspended one if `chunk` is NULL.
+// Only the outermost run may suspend to wait on a stream; the others
+// would wait holding the lock.
+static InterpretResult runChunk(CloxVM* handle, Chunk* chunk, bool raising) {
+  handle->running++;
+  WaitMode waitMode = vm.waitMode;
+  vm.waitMode = handle->running == 1 ? WAIT_SUSPEND : WAIT_REFUSE;
+  InterpretResult result = chunk != NULL ? interpretChunk(chunk)
+                                         : resumeChunk(raising);
+  vm.waitMode = waitMode;
+  handle->running--;
+  return result;
+}
+
+// Runs the script in a frame of its own above whatever the caller has
+// pushed.
+CloxResult cloxRun(CloxVM* handle, CloxScript* script) {
+  enter(handle);
+  if (handle->suspended) {
+    snprintf(handle->message, sizeof(handle->message),
+             "The VM is suspended.");
+    leave();
+    return CLOX_RUNTIME_ERROR;
+  }
+  if (!ensureStack(0)) {
+    snprintf(handle->message, sizeof(handle->message), "%s", vm.error);
+    leave();
+    return CLOX_RUNTIME_ERROR;
+  }
+
+  Caller caller;
+  caller.top = (int)(vm.stackTop - vm.stack);
+  caller.frameBase = (int)(vm.frameBase - vm.stack);
+  caller.generator = vm.generator;
+  caller.chunk = vm.chunk;
+  caller.ip = vm.ip;
+
+  vm.frameBase = vm.stackTop;
+  vm.generator = NULL;
+  InterpretResult result = runChunk(handle, &script->chunk, false);
+  CloxResult status = finishRun(handle, &caller, result);
+  leave();
+  return status;
+}
+
+CloxResult cloxEval(CloxVM* handle, const char* source, const char* path) {
+  CloxScript* script = cloxCompile(handle, source, path);
+  if (script == NULL) return CLOX_COMPILE_ERROR;
+  CloxResult result = cloxRun(handle, script);
+  if (result == CLOX_SUSPENDED) {
+    handle->evalScript = script;
+  } else {
+    cloxFreeScript(handle, script);
+  }
+  return result;
+}
+
+bool cloxSuspend(CloxVM* handle) {
+  enter(handle);
+  // Only the outermost run's place is all in the VM. An import or a run
+  // started by a native has more of it on the C stack.
+  if (handle->running != 1 || vm.importDepth > 0) {
+    runtimeError("Only a native called from the outermost script can "
+                 "suspend it.");
+  } else {
+    handle->suspending = true;
+  }
+  leave();
+  return false;
+}
+
+bool cloxIsSuspended(CloxVM* handle) {
+  pthread_mutex_lock(&lock);
+  bool suspended = handle->suspended;
+  pthread_mutex_unlock(&lock);
+  return suspended;
+}
+
+// Finishes the suspended native's call with the result it pushed, or
+// raises `message` there, and runs on from it. A stream that was waiting
+// on its descriptor tries again instead.
+static CloxResult resume(CloxVM* handle, const char* message) {
+  enter(handle);
+  if (!handle->suspended) {
+    snprintf(handle->message, sizeof(handle->message),
+             "The VM is not suspended.");
+    leave();
+    return CLOX_RUNTIME_ERROR;
+  }
+
+  int args = handle->base;
+  bool raising = message != NULL;
+  if (raising) {
+    runtimeError("%s", message);
+  } else if (vm.waitFd >= 0) {
+    // Nothing was pushed for a stream.
+  } else if (vm.stackTop - vm.stack != args + handle->pendingArgCount + 1) {
+    runtimeError("Native %s must push one result.",
+                 handle->natives[handle->pendingNative].name);
+    raising = true;
+  } else {
+    Value result = pop();
+    vm.stackTop = vm.stack + args;
+    push(result);
+  }
+
+  if (vm.waitFd < 0) handle->base = handle->pendingBase;
+  handle->suspended = false;
+  Caller caller = handle->caller;
+  InterpretResult result = runChunk(handle, NULL, raising);
+  CloxResult status = finishRun(handle, &caller, result);
+
+  if (status != CLOX_SUSPENDED && handle->evalScript != NULL) {
+    freeChunk(&handle->evalScript->chunk);
+    free(handle->evalScript);
+    handle->evalScript = NULL;
+  }
+  leave();
+  return status;
+}
+
+CloxResult cloxResume(CloxVM* handle) {
+  return resume(handle, NULL);
+}
+
+CloxResult cloxResumeError(CloxVM* handle, const char* message) {
+  return resume(handle, message);
+}
+
+int cloxWaitFd(CloxVM* handle, int* events) {
+  enter(handle);
+  int fd = handle->suspended ? vm.waitFd : -1;
+  if (events != NULL) {
+    *events = vm.waitEvents == POLLOUT ? CLOX_WRITABLE : CLOX_READABLE;
+  }
+  leave();
+  return fd;
+}
+
+const char* cloxError(CloxVM* handle) {
+  return handle->message;
+}
+
+const char* cloxReloadError(CloxVM* handle) {
+  enter(handle);
+  snprintf(handle->reloadMessage, sizeof(handle->reloadMessage), "%s",
+           vm.reloadError);
+  leave();
+  return handle->reloadMessage;
+}
+
+bool cloxRegisterNative(CloxVM* handle, const char* name, int arity,
+                        CloxNativeFn function, void* data) {
+  int length = (int)strlen(name);
+  enter(handle);
+  int existing;
+  if (findNative(name, length) != -1 ||
+      findHostNative(name, length, &existing) != -1 ||
+      handle->nativeCount == HOST_NATIVES_MAX) {
+    leave();
+    return false;
+  }
+
+  if (handle->nativeCapacity < handle->nativeCount + 1) {
+    int oldCapacity = handle->nativeCapacity;
+    handle->nativeCapacity = GROW_CAPACITY(oldCapacity);
+    handle->natives = GROW_ARRAY(HostNative, handle->natives,
+                                 oldCapacity, handle->nativeCapacity);
+  }
+
+  HostNative* native = &handle->natives[handle->nativeCount++];
+  native->name = ALLOCATE(char, length + 1);
+  memcpy(native->name, name, length + 1);
+  native->length = length;
+  native->arity = arity;
+  native->function = function;
+  native->data = data;
+  leave();
+  return true;
+}
+
+int findHostNative(const char* name, int length, int* arity) {
+  if (active == NULL) return -1;
+  for (int i = 0; i < active->nativeCount; i++) {
+    HostNative* native = &active->natives[i];
+    if (native->length == length && memcmp(native->name, name, length) == 0) {
+      *arity = native->arity;
+      return i;
+    }
+  }
+  return -1;
+}
+
+// The arguments are the top `argCount` slots. The native pushes its
+// result above them, or suspends the run and leaves them for resume().
+// It's found by name, since the chunk may have been compiled, and
+// cached, by a VM that registered its natives in another order.
+InterpretResult callHostNative(ObjString* name, int argCount,
+                               Value* result) {
+  int arity;
+  int index = findHostNative(name->chars, name->length, &arity);
+  if (index == -1) {
+    runtimeError("Unknown function.");
+    return INTERPRET_RUNTIME_ERROR;
+  }
+
+  HostNative* native = &active->natives[index];
+  if ((arity == -1 && argCount < 1) || (arity != -1 && argCount != arity)) {
+    runtimeError("Wrong number of arguments.");
+    return INTERPRET_RUNTIME_ERROR;
+  }
+
+  int base = active->base;
+  int args = (int)(vm.stackTop - vm.stack) - argCount;
+  active->base = args;
+  active->suspending = false;
+  vm.error[0] = '\0';
+  // Nothing may jump back into run() over the embedding program's code.
+  sigjmp_buf* overflow = vm.overflow;
+  vm.overflow = NULL;
+  bool success = native->function(active, argCount, native->data);
+  vm.overflow = overflow;
+  if (!success && active->suspending) {
+    active->suspending = false;
+    active->pendingNative = index;
+    active->pendingArgCount = argCount;
+    active->pendingBase = base;
+    return INTERPRET_SUSPENDED;
+  }
+
+  active->base = base;
+  if (!success) {
+    if (vm.error[0] == '\0') runtimeError("Native %s failed.", native->name);
+    return INTERPRET_RUNTIME_ERROR;
+  }
+
+  if (vm.stackTop - vm.stack != args + argCount + 1) {
+    runtimeError("Native %s must push one result.", native->name);
+    return INTERPRET_RUNTIME_ERROR;
+  }
+  *result = pop();
+  return INTERPRET_OK;
+}
+
+bool cloxRaise(CloxVM* handle, const char* message) {
+  enter(handle);
+  runtimeError("%s", message);
+  leave();
+  return false;
+}
+
+int cloxStackSize(CloxVM* handle) {
+  enter(handle);
+  int size = (int)(vm.stackTop - vm.stack) - handle->base;
+  leave();
+  return size;
+}
+
+static bool pushValue(CloxVM* handle, Value value) {
+  enter(handle);
+  bool success = ensureStack(1);
+  if (success) push(value);
+  leave();
+  return success;
+}
+
+bool cloxPushBool(CloxVM* handle, bool value) {
+  return pushValue(handle, BOOL_VAL(value));
+}
+
+bool cloxPushNumber(CloxVM* handle, double value) {
+  return pushValue(handle, NUMBER_VAL(value));
+}
+
+bool cloxPushInt(CloxVM* handle, int64_t value) {
+  return pushValue(handle, INT_VAL(value));
+}
+
+bool cloxPushString(CloxVM* handle, const char* chars, int length) {
+  enter(handle);
+  bool success = ensureStack(1);
+  if (success) push(OBJ_VAL(copyString(chars, length)));
+  leave();
+  return success;
+}
+
+bool cloxPushItem(CloxVM* handle, int index, int item) {
+  enter(handle);
+  Value* target = slot(handle, index);
+  bool success = false;
+  if (target != NULL && IS_LIST(*target)) {
+    success = item >= 0 && item < AS_LIST(*target)->items.count;
+  } else if (target != NULL && IS_VIEW(*target)) {
+    success = item >= 0 && item < AS_VIEW(*target)->length;
+  }
+  if (success) success = ensureStack(1);
+  if (success) {
+    // ensureStack() may have moved the stack.
+    target = slot(handle, index);
+    push(IS_LIST(*target) ? AS_LIST(*target)->items.values[item]
+                          : viewElement(AS_VIEW(*target), item));
+  }
+  leave();
+  return success;
+}
+
+void cloxPop(CloxVM* handle, int count) {
+  enter(handle);
+  int size = (int)(vm.stackTop - vm.stack) - handle->base;
+  vm.stackTop -= count < size ? count : size;
+  leave();
+}
+
+bool cloxPushNumbers(CloxVM* handle, const double* values, int count) {
+  enter(handle);
+  bool success = count >= 0 && ensureStack(count);
+  if (success) {
+    for (int i = 0; i < count; i++) vm.stackTop[i] = NUMBER_VAL(values[i]);
+    vm.stackTop += count;
+  }
+  leave();
+  return success;
+}
+
+bool cloxPushInts(CloxVM* handle, const int64_t* values, int count) {
+  enter(handle);
+  bool success = count >= 0 && ensureStack(count);
+  if (success) {
+    for (int i = 0; i < count; i++) vm.stackTop[i] = INT_VAL(values[i]);
+    vm.stackTop += count;
+  }
+  leave();
+  return success;
+}
+
+bool cloxPopNumbers(CloxVM* handle, double* values, int count) {
+  enter(handle);
+  Value* first = vm.stackTop - count;
+  bool success = count >= 0 && first >= vm.stack + handle->base;
+  for (int i = 0; success && i < count; i++) {
+    if (!IS_NUMERIC(first[i])) success = false;
+  }
+  if (success) {
+    for (int i = 0; i < count; i++) values[i] = TO_DOUBLE(first[i]);
+    vm.stackTop = first;
+  }
+  leave();
+  return success;
+}
+
+bool cloxPopInts(CloxVM* handle, int64_t* values, int count) {
+  enter(handle);
+  Value* first = vm.stackTop - count;
+  bool success = count >= 0 && first >= vm.stack + handle->base;
+  for (int i = 0; success && i < count; i++) {
+    if (!IS_INT(first[i])) success = false;
+  }
+  if (success) {
+    for (int i = 0; i < count; i++) values[i] = AS_INT(first[i]);
+    vm.stackTop = first;
+  }
+  leave();
+  return success;
+}
+
+CloxView* cloxPushView(CloxVM* handle, CloxViewType type, const void* data,
+                       int length) {
+  enter(handle);
+  ObjView* view = NULL;
+  if (data != NULL && length >= 0 && ensureStack(1)) {
+    // CloxViewType lists the element types in ViewType's order.
+    view = newView((ViewType)type, data, length);
+    view->obj.pins++;
+    push(OBJ_VAL(view));
+  }
+  leave();
+  return (CloxView*)view;
+}
+
+void cloxReleaseView(CloxVM* handle, CloxView* view) {
+  enter(handle);
+  ObjView* object = (ObjView*)view;
+  if (object->data != NULL) object->obj.pins--;
+  object->data = NULL;
+  object->length = 0;
+  leave();
+}
+
+// Copies from a list, or from a view of the same element type with one
+// memcpy().
+int cloxReadNumbers(CloxVM* handle, int index, double* buffer,
+                    int capacity) {
+  if (capacity < 0 || (buffer == NULL && capacity > 0)) return -1;
+  enter(handle);
+  Value* value = slot(handle, index);
+  int length = -1;
+  if (value != NULL && IS_LIST(*value)) {
+    ValueArray* items = &AS_LIST(*value)->items;
+    length = items->count;
+    int count = capacity < length ? capacity : length;
+    for (int i = 0; i < count; i++) {
+      if (!IS_NUMERIC(items->values[i])) {
+        length = -1;
+        break;
+      }
+      buffer[i] = TO_DOUBLE(items->values[i]);
+    }
+  } else if (value != NULL && IS_VIEW(*value)) {
+    ObjView* view = AS_VIEW(*value);
+    length = view->length;
+    int count = capacity < length ? capacity : length;
+    if (view->type == VIEW_DOUBLE && count > 0) {
+      memcpy(buffer, view->data, sizeof(double) * (size_t)count);
+    } else {
+      for (int i = 0; i < count; i++) {
+        buffer[i] = TO_DOUBLE(viewElement(view, i));
+      }
+    }
+  }
+  leave();
+  return length;
+}
+
+int cloxReadInts(CloxVM* handle, int index, int64_t* buffer, int capacity) {
+  if (capacity < 0 || (buffer == NULL && capacity > 0)) return -1;
+  enter(handle);
+  Value* value = slot(handle, index);
+  int length = -1;
+  if (value != NULL && IS_LIST(*value)) {
+    ValueArray* items = &AS_LIST(*value)->items;
+    length = items->count;
+    int count = capacity < length ? capacity : length;
+    for (int i = 0; i < count; i++) {
+      if (!IS_INT(items->values[i])) {
+        length = -1;
+        break;
+      }
+      buffer[i] = AS_INT(items->values[i]);
+    }
+  } else if (value != NULL && IS_VIEW(*value) &&
+             AS_VIEW(*value)->type != VIEW_DOUBLE) {
+    ObjView* view = AS_VIEW(*value);
+    length = view->length;
+    int count = capacity < length ? capacity : length;
+    if (view->type == VIEW_INT64 && count > 0) {
+      memcpy(buffer, view->data, sizeof(int64_t) * (size_t)count);
+    } else {
+      for (int i = 0; i < count; i++) {
+        buffer[i] = AS_INT(viewElement(view, i));
+      }
+    }
+  }
+  leave();
+  return length;
+}
+
+CloxType cloxType(CloxVM* handle, int index) {
+  enter(handle);
+  Value* value = slot(handle, index);
+  CloxType type = CLOX_NONE;
+  if (value != NULL) {
+    switch (value->type) {
+      case VAL_BOOL: type = CLOX_BOOL; break;
+      case VAL_NUMBER: type = CLOX_NUMBER; break;
+      case VAL_INT: type = CLOX_INT; break;
+      case VAL_OBJ:
+        switch (OBJ_TYPE(*value)) {
+          case OBJ_STRING: type = CLOX_STRING; break;
+          case OBJ_LIST: type = CLOX_LIST; break;
+          case OBJ_MAP: type = CLOX_MAP; break;
+          case OBJ_VIEW: type = CLOX_VIEW; break;
+          default: type = CLOX_OTHER; break;
+        }
+        break;
+    }
+  }
+  leave();
+  return type;
+}
+
+bool cloxToBool(CloxVM* handle, int index) {
+  enter(handle);
+  Value* value = slot(handle, index);
+  bool result = value != NULL && IS_BOOL(*value) && AS_BOOL(*value);
+  leave();
+  return result;
+}
+
+// Ints read as numbers too, as they do in arithmetic.
+double cloxToNumber(CloxVM* handle, int index) {
+  enter(handle);
+  Value* value = slot(handle, index);
+  double result = value != NULL && IS_NUMERIC(*value)
+      ? TO_DOUBLE(*value) : 0;
+  leave();
+  return result;
+}
+
+int64_t cloxToInt(CloxVM* handle, int index) {
+  enter(handle);
+  Value* value = slot(handle, index);
+  int64_t result = value != NULL && IS_INT(*value) ? AS_INT(*value) : 0;
+  leave();
+  return result;
+}
+
+const char* cloxToString(CloxVM* handle, int index, int* length) {
+  enter(handle);
+  Value* value = slot(handle, index);
+  const char* chars = NULL;
+  // The characters are promised until the next call, even if the string
+  // is popped in between.
+  if (handle->string != NULL) handle->string->obj.pins--;
+  handle->string = NULL;
+  if (value != NULL && IS_STRING(*value)) {
+    handle->string = AS_STRING(*value);
+    handle->string->obj.pins++;
+    chars = AS_STRING(*value)->chars;
+    if (length != NULL) *length = AS_STRING(*value)->length;
+  }
+  leave();
+  return chars;
+}
+
+int cloxLength(CloxVM* handle, int index) {
+  enter(handle);
+  Value* value = slot(handle, index);
+  int length = 0;
+  if (value != NULL) {
+    if (IS_STRING(*value)) {
+      length = AS_STRING(*value)->length;
+    } else if (IS_LIST(*value)) {
+      length = AS_LIST(*value)->items.count;
+    } else if (IS_MAP(*value)) {
+      length = AS_MAP(*value)->table.count;
+    } else if (IS_VIEW(*value)) {
+      length = AS_VIEW(*value)->length;
+    }
+  }
+  leave();
+  return length;
+}
+
+void cloxSetMemoryLimit(CloxVM* handle, size_t bytes) {
+  enter(handle);
+  setMemoryLimit(bytes);
+  leave();
+}
+
+void cloxStats(CloxVM* handle, CloxStats* stats) {
+  enter(handle);
+  stats->bytesAllocated = vm.bytesAllocated;
+  stats->objectCount = vm.objectCount;
+  stats->stackCapacity = (size_t)(vm.stackLimit - vm.stack);
+  stats->stackSize = (int)(vm.stackTop - vm.stack) - handle->base;
+  leave();
+}
@@ -1,21 +1,35 @@
+#include <errno.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "chunk.h"
 #include "common.h"
 #include "compiler.h"
-#include "debug.h"
+#include "memory.h"
+#include "module.h"
+#include "native.h"
+#include "object.h"
 #include "scanner.h"
 
 #ifdef DEBUG_PRINT_CODE
 #include "debug.h"
 #endif
 
+// Each level of nesting is a recursive call, so past MAX_NESTING the
+// compiler gives up rather than overflow the C stack. That's still deeper
+// than the value stack's first mapping, which only grows when a frame is
+// entered. Each generator nested in another's body holds a Compiler.
+#define MAX_NESTING 32768
+#define MAX_GENERATOR_NESTING 128
+
 typedef struct parser {
   Token current;
   Token previous;
   bool hadError;
   bool panicMode;
+  int nesting;
 } Parser;
 
 typedef enum precedence {
@@ -25,6 +39,10 @@ typedef enum precedence {
   PREC_AND,
   PREC_EQUALITY,
   PREC_COMPARISON,
+  PREC_BIT_OR,
+  PREC_BIT_XOR,
+  PREC_BIT_AND,
+  PREC_SHIFT,
   PREC_TERM,
   PREC_FACTOR,
   PREC_UNARY,
@@ -32,7 +50,7 @@ typedef enum precedence {
   PREC_PRIMARY,
 } Precedence;
 
-typedef void (*ParseFn)();
+typedef void (*ParseFn)(bool canAssign);
 
 typedef struct parserule {
   ParseFn prefix;
@@ -40,28 +58,104 @@ typedef struct parserule {
   Precedence precedence;
 } ParseRule;
 
+typedef struct {
+  Token name;
+  int slot;
+} Local;
+
+// Lox is still expression-only, so local slots are positions in the
+// current frame: the whole stack at top level, or a generator's window.
+// `stackDepth` counts the slots held by enclosing expressions at the
+// current point of compilation, which is where the next hidden or named
+// slot will live. `body` is the offset of the frame's first instruction.
+typedef struct compiler {
+  struct compiler* enclosing;
+  Local locals[UINT8_COUNT];
+  int localCount;
+  int stackDepth;
+  int body;
+  int depth;
+} Compiler;
+
+// A place in the code that may yet be cut out into a handler block.
+// `block` is the index of the block holding it, or -1 while it's still
+// in the chunk.
+typedef struct {
+  int block;
+  int offset;
+} Position;
+
+// The handler of a `try` is compiled where it appears, then cut out of
+// the chunk and laid out after the end of the program, so code that
+// raises no error never has to jump over it.
+typedef struct {
+  uint8_t* code;
+  int* lines;
+  int count;
+  Position origin;        // The start of the `try` the handler belongs to.
+  Position continuation;  // Where the handler's value goes on from.
+  int start;              // The block's place in the chunk once laid out.
+  int end;
+} HandlerBlock;
+
+// Blocks are numbered in the order their `try`s close, so the blocks cut
+// while the protected expression was compiled, which the range protects
+// too, are the ones from `firstBlock` up to `endBlock`.
+typedef struct {
+  Position start;
+  Position end;
+  Position body;
+  int block;
+  int depth;
+  int firstBlock;
+  int endBlock;
+} TryRange;
+
+// Where each element produced by a comprehension goes.
+typedef enum {
+  SINK_LIST,
+  SINK_SUM,
+  SINK_YIELD,
+} Sink;
+
 Parser parser;
+TokenSource nextToken;
+CompileError* compileError;
+Compiler* current = NULL;
 Chunk* compilingChunk;
+const char* compilingPath;
+HandlerBlock* handlerBlocks = NULL;
+int handlerBlockCount = 0;
+int handlerBlockCapacity = 0;
+TryRange* tryRanges = NULL;
+int tryRangeCount = 0;
+int tryRangeCapacity = 0;
 
 static Chunk* currentChunk() {
   return compilingChunk;
 }
 
+// Reports the error, or keeps it in `compileError` if there is one.
 static void errorAt(Token* token, const char* message) {
   if (parser.panicMode) return;
   parser.panicMode = true;
-  fprintf(stderr, "[line %d] Error", token->line);
+  parser.hadError = true;
 
+  CompileError printed;
+  CompileError* error = compileError != NULL ? compileError : &printed;
+  error->token = *token;
   if (token->type == TOKEN_EOF) {
-    fprintf(stderr, " at end");
+    snprintf(error->message, ERROR_MAX, "Error at end: %s", message);
   } else if (token->type == TOKEN_ERROR) {
-    // Nothing
+    snprintf(error->message, ERROR_MAX, "Error: %s", message);
   } else {
-    fprintf(stderr, " at '%.*s'", token->length, token->start);
+    snprintf(error->message, ERROR_MAX, "Error at '%.*s': %s",
+             token->length, token->start, message);
   }
 
-  fprintf(stderr, ": %s\n", message);
-  parser.hadError = true;
+  if (compileError == NULL) {
+    fprintf(stderr, "[line %d] %s\n", token->line, error->message);
+  }
 }
 
 static void error(const char* message) {
@@ -76,7 +170,7 @@ static void advance() {
   parser.previous = parser.current;
 
   for (;;) {
-    parser.current = scanToken();
+    parser.current = nextToken();
     if (parser.current.type != TOKEN_ERROR) break;
 
     errorAtCurrent(parser.current.start);
@@ -92,6 +186,16 @@ static void consume(TokenType type, const char* message) {
   errorAtCurrent(message);
 }
 
+static bool check(TokenType type) {
+  return parser.current.type == type;
+}
+
+static bool match(TokenType type) {
+  if (!check(type)) return false;
+  advance();
+  return true;
+}
+
 static void emitByte(uint8_t byte) {
   writeChunk(currentChunk(), byte, parser.previous.line);
 }
@@ -101,6 +205,44 @@ static void emitBytes(uint8_t byte1, uint8_t byte2) {
   emitByte(byte2);
 }
 
+static void emitLoop(int loopStart) {
+  emitByte(OP_LOOP);
+
+  int offset = currentChunk()->count - loopStart + 2;
+  if (offset > UINT16_MAX) error("Loop body too large.");
+
+  emitByte((offset >> 8) & 0xff);
+  emitByte(offset & 0xff);
+}
+
+static int emitJump(uint8_t instruction) {
+  emitByte(instruction);
+  emitByte(0xff);
+  emitByte(0xff);
+  return currentChunk()->count - 2;
+}
+
+// Emits a loop instruction that works on the stack slots starting at
+// `slot` and jumps past the loop once it finishes.
+static int emitLoopJump(uint8_t instruction, uint8_t slot) {
+  emitBytes(instruction, slot);
+  emitByte(0xff);
+  emitByte(0xff);
+  return currentChunk()->count - 2;
+}
+
+static void patchJump(int offset) {
+  // -2 to adjust for the bytecode for the jump offset itself.
+  int jump = currentChunk()->count - offset - 2;
+
+  if (jump > UINT16_MAX) {
+    error("Too much code to jump over.");
+  }
+
+  currentChunk()->code[offset] = (jump >> 8) & 0xff;
+  currentChunk()->code[offset + 1] = jump & 0xff;
+}
+
 static void emitReturn() {
   emitByte(OP_RETURN);
 }
@@ -119,8 +261,154 @@ static void emitConstant(Value value) {
   emitBytes(OP_CONSTANT, makeConstant(value));
 }
 
+static void initCompiler(Compiler* compiler) {
+  compiler->enclosing = current;
+  compiler->localCount = 0;
+  compiler->stackDepth = 0;
+  compiler->body = currentChunk()->count;
+  compiler->depth = current == NULL ? 0 : current->depth + 1;
+  current = compiler;
+}
+
+static Position here() {
+  Position position = {-1, currentChunk()->count};
+  return position;
+}
+
+// Positions that start something move into a block cut from `start`;
+// positions that end something only move if they are past it, since the
+// end of the code before a handler is also where the handler starts.
+static void movePosition(Position* position, int start, bool isEnd,
+                         int block) {
+  if (position->block != -1) return;
+  if (position->offset > start || (!isEnd && position->offset == start)) {
+    position->block = block;
+    position->offset -= start;
+  }
+}
+
+// Cuts everything from `start` to the end of the chunk into a new
+// handler block, taking along the blocks and ranges compiled inside it.
+// Those are the ones from `firstBlock` and `firstRange` on; everything
+// older ends before `start`, so each cut costs only what it takes along.
+static int cutHandler(int start, Position origin, Position continuation,
+                      int firstBlock, int firstRange) {
+  if (handlerBlockCapacity < handlerBlockCount + 1) {
+    int oldCapacity = handlerBlockCapacity;
+    handlerBlockCapacity = GROW_CAPACITY(oldCapacity);
+    handlerBlocks = GROW_ARRAY(HandlerBlock, handlerBlocks,
+                               oldCapacity, handlerBlockCapacity);
+  }
+
+  Chunk* chunk = currentChunk();
+  int index = handlerBlockCount++;
+  HandlerBlock* block = &handlerBlocks[index];
+  block->count = chunk->count - start;
+  block->code = ALLOCATE(uint8_t, block->count);
+  block->lines = ALLOCATE(int, block->count);
+  memcpy(block->code, chunk->code + start, block->count);
+  memcpy(block->lines, chunk->lines + start, sizeof(int) * block->count);
+  block->origin = origin;
+  block->continuation = continuation;
+  chunk->count = start;
+
+  for (int i = firstBlock; i < index; i++) {
+    movePosition(&handlerBlocks[i].origin, start, false, index);
+    movePosition(&handlerBlocks[i].continuation, start, true, index);
+  }
+  for (int i = firstRange; i < tryRangeCount; i++) {
+    movePosition(&tryRanges[i].start, start, false, index);
+    movePosition(&tryRanges[i].end, start, true, index);
+    movePosition(&tryRanges[i].body, start, false, index);
+  }
+  return index;
+}
+
+static void addTryRange(Position start, Position end, int block,
+                        int depth, int firstBlock, int endBlock) {
+  if (tryRangeCapacity < tryRangeCount + 1) {
+    int oldCapacity = tryRangeCapacity;
+    tryRangeCapacity = GROW_CAPACITY(oldCapacity);
+    tryRanges = GROW_ARRAY(TryRange, tryRanges,
+                           oldCapacity, tryRangeCapacity);
+  }
+
+  TryRange* range = &tryRanges[tryRangeCount++];
+  range->start = start;
+  range->end = end;
+  range->body.block = -1;
+  range->body.offset = current->body;
+  range->block = block;
+  range->depth = depth;
+  range->firstBlock = firstBlock;
+  range->endBlock = endBlock;
+}
+
+static int placedOffset(Position position) {
+  if (position.block == -1) return position.offset;
+  return handlerBlocks[position.block].start + position.offset;
+}
+
+static void addPlacedHandler(TryRange* range, int start, int end) {
+  Handler handler;
+  handler.start = start;
+  handler.end = end;
+  handler.handler = handlerBlocks[range->block].start;
+  handler.depth = range->depth;
+  handler.body = placedOffset(range->body);
+  addHandler(currentChunk(), handler);
+}
+
+// Lays the handler blocks out after the end of the program, each ending
+// in a jump back to where its `try` would have gone on. A block is cut
+// before any block holding it, so placing them in reverse puts every
+// continuation behind the jump to it. Then the ranges become the chunk's
+// handler table, innermost first. A range also protects the blocks cut
+// from inside it, since their code no longer lies between its ends.
+static void placeHandlers() {
+  Chunk* chunk = currentChunk();
+  for (int i = handlerBlockCount - 1; i >= 0; i--) {
+    HandlerBlock* block = &handlerBlocks[i];
+    block->start = chunk->count;
+    for (int j = 0; j < block->count; j++) {
+      writeChunk(chunk, block->code[j], block->lines[j]);
+    }
+
+    int line = block->lines[block->count - 1];
+    int offset = chunk->count + 3 - placedOffset(block->continuation);
+    if (offset > UINT16_MAX) error("Too much code to jump over.");
+    writeChunk(chunk, OP_LOOP, line);
+    writeChunk(chunk, (offset >> 8) & 0xff, line);
+    writeChunk(chunk, offset & 0xff, line);
+    block->end = chunk->count;
+  }
+
+  for (int i = 0; i < tryRangeCount; i++) {
+    TryRange* range = &tryRanges[i];
+    addPlacedHandler(range, placedOffset(range->start),
+                     placedOffset(range->end));
+    for (int j = range->firstBlock; j < range->endBlock; j++) {
+      addPlacedHandler(range, handlerBlocks[j].start, handlerBlocks[j].end);
+    }
+  }
+
+  for (int i = 0; i < handlerBlockCount; i++) {
+    FREE_ARRAY(uint8_t, handlerBlocks[i].code, handlerBlocks[i].count);
+    FREE_ARRAY(int, handlerBlocks[i].lines, handlerBlocks[i].count);
+  }
+  FREE_ARRAY(HandlerBlock, handlerBlocks, handlerBlockCapacity);
+  FREE_ARRAY(TryRange, tryRanges, tryRangeCapacity);
+  handlerBlocks = NULL;
+  handlerBlockCount = 0;
+  handlerBlockCapacity = 0;
+  tryRanges = NULL;
+  tryRangeCount = 0;
+  tryRangeCapacity = 0;
+}
+
 static void endCompiler() {
   emitReturn();
+  placeHandlers();
   #ifdef DEBUG_PRINT_CODE
     if (!parser.hadError) {
       disassembleChunk(currentChunk(), "code");
@@ -129,41 +417,543 @@ static void endCompiler() {
 }
 
 static void expression();
+static void comprehension(Sink sink);
 static ParseRule* getRule(TokenType type);
 static void parsePrecedence(Precedence precedence);
 
-static void binary() {
+static void binary(bool canAssign) {
+  (void)canAssign;
   TokenType operatorType = parser.previous.type;
   ParseRule* rule = getRule(operatorType);
+  current->stackDepth++;
   parsePrecedence((Precedence)(rule->precedence + 1));
+  current->stackDepth--;
 
   switch (operatorType) {
+    case TOKEN_BANG_EQUAL:      emitBytes(OP_EQUAL, OP_NOT); break;
+    case TOKEN_EQUAL_EQUAL:     emitByte(OP_EQUAL); break;
+    case TOKEN_GREATER:         emitByte(OP_GREATER); break;
+    case TOKEN_GREATER_EQUAL:   emitBytes(OP_LESS, OP_NOT); break;
+    case TOKEN_LESS:            emitByte(OP_LESS); break;
+    case TOKEN_LESS_EQUAL:      emitBytes(OP_GREATER, OP_NOT); break;
     case TOKEN_PLUS:            emitByte(OP_ADD); break;
     case TOKEN_MINUS:           emitByte(OP_SUBTRACT); break;
     case TOKEN_STAR:            emitByte(OP_MULTIPLY); break;
     case TOKEN_SLASH:           emitByte(OP_DIVIDE); break;
+    case TOKEN_TILDE_SLASH:     emitByte(OP_INT_DIVIDE); break;
+    case TOKEN_PERCENT:         emitByte(OP_MODULO); break;
+    case TOKEN_AMPERSAND:       emitByte(OP_BIT_AND); break;
+    case TOKEN_PIPE:            emitByte(OP_BIT_OR); break;
+    case TOKEN_CARET:           emitByte(OP_BIT_XOR); break;
+    case TOKEN_LESS_LESS:       emitByte(OP_SHIFT_LEFT); break;
+    case TOKEN_GREATER_GREATER: emitByte(OP_SHIFT_RIGHT); break;
     default:
       return;
   }
 }
 
-static void grouping() {
+static uint8_t argumentList() {
+  int argCount = 0;
+  if (!check(TOKEN_RIGHT_PAREN)) {
+    do {
+      expression();
+      if (argCount == 255) {
+        error("Can't have more than 255 arguments.");
+      }
+      argCount++;
+      current->stackDepth++;
+    } while (match(TOKEN_COMMA));
+  }
+  consume(TOKEN_RIGHT_PAREN, "Expect ')' after arguments.");
+
+  current->stackDepth -= argCount;
+  return (uint8_t)argCount;
+}
+
+// A call to a native the embedding program registered. It's called by
+// name and checked again when it runs, since a module may be cached by
+// one VM and run by another that registered different natives.
+static void hostCall() {
+  int arity;
+  if (findHostNative(parser.previous.start, parser.previous.length,
+                     &arity) == -1) {
+    error("Unknown function.");
+    return;
+  }
+  uint8_t name = makeConstant(OBJ_VAL(copyString(parser.previous.start,
+                                                 parser.previous.length)));
+
+  consume(TOKEN_LEFT_PAREN, "Expect '(' after function name.");
+  int argCount = argumentList();
+  if ((arity == -1 && argCount < 1) || (arity != -1 && argCount != arity)) {
+    error("Wrong number of arguments.");
+    return;
+  }
+
+  emitBytes(OP_HOST_NATIVE, name);
+  emitByte((uint8_t)argCount);
+}
+
+static void call(bool canAssign) {
+  (void)canAssign;
+  int native = findNative(parser.previous.start, parser.previous.length);
+  if (native == -1) {
+    hostCall();
+    return;
+  }
+
+  consume(TOKEN_LEFT_PAREN, "Expect '(' after function name.");
+
+  // sum(for ...) folds the comprehension into a running total instead of
+  // building the list the native would add up.
+  if (strcmp(natives[native].name, "sum") == 0 && match(TOKEN_FOR)) {
+    comprehension(SINK_SUM);
+    consume(TOKEN_RIGHT_PAREN, "Expect ')' after comprehension.");
+    return;
+  }
+
+  int argCount = argumentList();
+
+  int arity = natives[native].arity;
+  if ((arity == -1 && argCount < 1) || (arity != -1 && argCount != arity)) {
+    error("Wrong number of arguments.");
+    return;
+  }
+
+  emitBytes(OP_NATIVE, (uint8_t)native);
+  emitByte((uint8_t)argCount);
+}
+
+static void generator();
+
+static void grouping(bool canAssign) {
+  (void)canAssign;
+  if (match(TOKEN_FOR)) {
+    generator();
+    consume(TOKEN_RIGHT_PAREN, "Expect ')' after generator.");
+    return;
+  }
+
   expression();
   consume(TOKEN_RIGHT_PAREN, "Expect ')' after expression.");
 }
 
-static void number() {
+static void subscript(bool canAssign) {
+  current->stackDepth++;
+  expression();
+  consume(TOKEN_RIGHT_BRACKET, "Expect ']' after index.");
+
+  if (canAssign && match(TOKEN_EQUAL)) {
+    current->stackDepth++;
+    expression();
+    current->stackDepth--;
+    emitByte(OP_SET_INDEX);
+  } else {
+    emitByte(OP_GET_INDEX);
+  }
+  current->stackDepth--;
+}
+
+// Claims the next stack slot for a value the loop keeps there. `name` is
+// NULL for hidden slots the code cannot refer to.
+static uint8_t addSlot(Token* name) {
+  if (current->stackDepth >= UINT8_COUNT) {
+    error("Too many values on the stack in one expression.");
+    return 0;
+  }
+
+  if (name != NULL) {
+    if (current->localCount == UINT8_COUNT) {
+      error("Too many loop variables in one expression.");
+      return 0;
+    }
+
+    Local* local = &current->locals[current->localCount++];
+    local->name = *name;
+    local->slot = current->stackDepth;
+  }
+
+  return (uint8_t)current->stackDepth++;
+}
+
+static bool identifiersEqual(Token* a, Token* b) {
+  if (a->length != b->length) return false;
+  return memcmp(a->start, b->start, a->length) == 0;
+}
+
+static int resolveLocal(Token* name) {
+  for (int i = current->localCount - 1; i >= 0; i--) {
+    Local* local = &current->locals[i];
+    if (identifiersEqual(name, &local->name)) {
+      return local->slot;
+    }
+  }
+
+  return -1;
+}
+
+static bool isRange(Token* name) {
+  return name->length == 5 && memcmp(name->start, "range", 5) == 0;
+}
+
+static void forClause(uint8_t result, Sink sink);
+
+static void emitSink(uint8_t result, Sink sink) {
+  switch (sink) {
+    case SINK_LIST:
+      emitBytes(OP_LIST_APPEND, result);
+      break;
+    case SINK_SUM:
+      emitBytes(OP_GET_LOCAL, result);
+      emitByte(OP_ADD);
+      emitBytes(OP_SET_LOCAL, result);
+      emitBytes(OP_POP_N, 1);
+      break;
+    case SINK_YIELD:
+      emitByte(OP_YIELD);
+      break;
+  }
+}
+
+// Compiles what follows a comprehension clause: another `for` or `if`
+// clause, or the expression whose value is handed to the sink. Every
+// clause lands in one loop nest, so chaining stages never builds an
+// intermediate list.
+static void comprehensionElement(uint8_t result, Sink sink) {
+  if (match(TOKEN_FOR)) {
+    forClause(result, sink);
+  } else if (match(TOKEN_IF)) {
+    consume(TOKEN_LEFT_PAREN, "Expect '(' after 'if'.");
+    expression();
+    consume(TOKEN_RIGHT_PAREN, "Expect ')' after condition.");
+
+    int skipJump = emitJump(OP_JUMP_IF_FALSE);
+    comprehensionElement(result, sink);
+    patchJump(skipJump);
+  } else {
+    expression();
+    emitSink(result, sink);
+  }
+}
+
+// Compiles the `(name in iterable)` header of a for clause and pushes the
+// loop's three slots. The loop keeps its state there, so iterating
+// allocates nothing: a range keeps [counter, end, variable] and runs on
+// OP_FOR_RANGE, anything else keeps [iterable, position, variable] and
+// runs on OP_FOR_ITER. Returns the loop instruction to use.
+static uint8_t forHeader(Token* name) {
+  consume(TOKEN_LEFT_PAREN, "Expect '(' after 'for'.");
+  consume(TOKEN_IDENTIFIER, "Expect loop variable name.");
+  *name = parser.previous;
+  consume(TOKEN_IN, "Expect 'in' after loop variable.");
+
+  uint8_t loopInstruction = OP_FOR_ITER;
+  if (check(TOKEN_IDENTIFIER) && isRange(&parser.current) &&
+      resolveLocal(&parser.current) == -1) {
+    advance();
+    consume(TOKEN_LEFT_PAREN, "Expect '(' after 'range'.");
+    int argCount = argumentList();
+    if (argCount == 1) {
+      // range(end) counts up from zero.
+      emitConstant(INT_VAL(0));
+      emitByte(OP_SWAP);
+    } else if (argCount != 2) {
+      error("Wrong number of arguments.");
+    }
+    loopInstruction = OP_FOR_RANGE;
+  } else {
+    expression();
+    emitConstant(INT_VAL(0));
+  }
+  consume(TOKEN_RIGHT_PAREN, "Expect ')' after loop iterable.");
+
+  // The variable's slot is written by the loop instruction before the
+  // element first reads it.
+  emitConstant(INT_VAL(0));
+  return loopInstruction;
+}
+
+// Claims the three slots forHeader() pushed and compiles the loop over
+// them, then pops them.
+static void forLoop(Token* name, uint8_t loopInstruction,
+                    uint8_t result, Sink sink) {
+  int depth = current->stackDepth;
+  int localCount = current->localCount;
+
+  uint8_t base = addSlot(NULL);
+  addSlot(NULL);
+  addSlot(name);
+
+  int loopStart = currentChunk()->count;
+  int exitJump = emitLoopJump(loopInstruction, base);
+
+  comprehensionElement(result, sink);
+
+  emitLoop(loopStart);
+  patchJump(exitJump);
+  emitBytes(OP_POP_N, 3);
+
+  current->localCount = localCount;
+  current->stackDepth = depth;
+}
+
+static void forClause(uint8_t result, Sink sink) {
+  Token name;
+  uint8_t loopInstruction = forHeader(&name);
+  forLoop(&name, loopInstruction, result, sink);
+}
+
+// Compiles `(for (name in iterable) element)` into a generator. The
+// first header runs right away, in the creator's frame, and its slots
+// seed the generator's window. Everything after it is compiled out of
+// line with its own frame and runs a step at a time as the generator is
+// resumed.
+static void generator() {
+  if (current->depth == MAX_GENERATOR_NESTING) {
+    error("Generators nested too deeply.");
+    return;
+  }
+
+  Token name;
+  uint8_t loopInstruction = forHeader(&name);
+  int bodyJump = emitJump(OP_GENERATOR);
+
+  // A Compiler is large, and on the C stack it would be there all
+  // through the header's iterable, however deeply that nests.
+  Compiler* compiler = ALLOCATE(Compiler, 1);
+  initCompiler(compiler);
+  forLoop(&name, loopInstruction, 0, SINK_YIELD);
+  emitByte(OP_GENERATOR_END);
+  current = compiler->enclosing;
+  FREE(Compiler, compiler);
+
+  patchJump(bodyJump);
+}
+
+// Compiles a comprehension whose first clause is the `for` just
+// consumed. Its result lives in the slot the comprehension's value ends
+// up in: a list being filled, or a running total.
+static void comprehension(Sink sink) {
+  int depth = current->stackDepth;
+
+  if (sink == SINK_LIST) {
+    emitBytes(OP_BUILD_LIST, 0);
+  } else {
+    emitConstant(INT_VAL(0));
+  }
+  uint8_t result = addSlot(NULL);
+  forClause(result, sink);
+
+  current->stackDepth = depth;
+}
+
+static void list(bool canAssign) {
+  (void)canAssign;
+  if (match(TOKEN_FOR)) {
+    comprehension(SINK_LIST);
+    consume(TOKEN_RIGHT_BRACKET, "Expect ']' after list comprehension.");
+    return;
+  }
+
+  int count = 0;
+  if (!check(TOKEN_RIGHT_BRACKET)) {
+    do {
+      expression();
+      if (count == 255) {
+        error("Can't have more than 255 elements in a list literal.");
+      }
+      count++;
+      current->stackDepth++;
+    } while (match(TOKEN_COMMA));
+  }
+  consume(TOKEN_RIGHT_BRACKET, "Expect ']' after list elements.");
+
+  current->stackDepth -= count;
+  emitBytes(OP_BUILD_LIST, (uint8_t)count);
+}
+
+static void integer(bool canAssign) {
+  (void)canAssign;
+  errno = 0;
+  long long value = strtoll(parser.previous.start, NULL, 10);
+  if (errno == ERANGE) {
+    // Too large for 64 bits, so it can only be represented approximately.
+    emitConstant(NUMBER_VAL(strtod(parser.previous.start, NULL)));
+    return;
+  }
+
+  emitConstant(INT_VAL((int64_t)value));
+}
+
+static void map(bool canAssign) {
+  (void)canAssign;
+  int count = 0;
+  if (!check(TOKEN_RIGHT_BRACE)) {
+    do {
+      expression();
+      current->stackDepth++;
+      consume(TOKEN_COLON, "Expect ':' after map key.");
+      expression();
+      current->stackDepth++;
+      if (count == 255) {
+        error("Can't have more than 255 entries in a map literal.");
+      }
+      count++;
+    } while (match(TOKEN_COMMA));
+  }
+  consume(TOKEN_RIGHT_BRACE, "Expect '}' after map entries.");
+
+  current->stackDepth -= count * 2;
+  emitBytes(OP_BUILD_MAP, (uint8_t)count);
+}
+
+static void literal(bool canAssign) {
+  (void)canAssign;
+  switch (parser.previous.type) {
+    case TOKEN_FALSE: emitByte(OP_FALSE); break;
+    case TOKEN_TRUE: emitByte(OP_TRUE); break;
+    default: return;
+  }
+}
+
+static void number(bool canAssign) {
+  (void)canAssign;
   double value = strtod(parser.previous.start, NULL);
-  emitConstant(value);
+  emitConstant(NUMBER_VAL(value));
+}
+
+static void string(bool canAssign) {
+  (void)canAssign;
+  emitConstant(OBJ_VAL(copyString(parser.previous.start + 1,
+                                  parser.previous.length - 2)));
+}
+
+// A string with `${...}` inside arrives as one TOKEN_INTERPOLATION per
+// piece before an expression, then a closing TOKEN_STRING. Every piece
+// goes on the stack and a single instruction joins them.
+static void interpolation(bool canAssign) {
+  (void)canAssign;
+  int count = 0;
+  do {
+    // Each piece starts with '"' or '}' and ends with "${".
+    if (parser.previous.length > 3) {
+      emitConstant(OBJ_VAL(copyString(parser.previous.start + 1,
+                                      parser.previous.length - 3)));
+      count++;
+      current->stackDepth++;
+    }
+
+    expression();
+    count++;
+    current->stackDepth++;
+  } while (match(TOKEN_INTERPOLATION));
+
+  consume(TOKEN_STRING, "Expect end of string after interpolation.");
+  if (parser.previous.length > 2) {
+    emitConstant(OBJ_VAL(copyString(parser.previous.start + 1,
+                                    parser.previous.length - 2)));
+    count++;
+    current->stackDepth++;
+  }
+
+  if (count > 255) error("Too many pieces in string interpolation.");
+  current->stackDepth -= count;
+  emitBytes(OP_BUILD_STRING, (uint8_t)count);
+}
+
+// Compiles `import "name"`. The module is found now, so a missing one is
+// a compile error, but it isn't compiled or run until the import is
+// first evaluated.
+static void import(bool canAssign) {
+  (void)canAssign;
+  consume(TOKEN_STRING, "Expect module name after 'import'.");
+  char path[PATH_MAX];
+  if (!resolveModule(compilingPath, parser.previous.start + 1,
+                     parser.previous.length - 2, path)) {
+    error("Could not find module.");
+    return;
+  }
+
+  emitBytes(OP_IMPORT,
+            makeConstant(OBJ_VAL(copyString(path, (int)strlen(path)))));
+}
+
+// Generators run in their own frame, so they can't see the loop
+// variables of the expression that created them.
+static bool isEnclosingLocal(Token* name) {
+  for (Compiler* compiler = current->enclosing; compiler != NULL;
+       compiler = compiler->enclosing) {
+    for (int i = compiler->localCount - 1; i >= 0; i--) {
+      if (identifiersEqual(name, &compiler->locals[i].name)) return true;
+    }
+  }
+
+  return false;
+}
+
+static void variable(bool canAssign) {
+  int slot = resolveLocal(&parser.previous);
+  if (slot == -1) {
+    if (isEnclosingLocal(&parser.previous)) {
+      error("Can't use an enclosing loop variable inside a generator.");
+      return;
+    }
+
+    call(canAssign);
+    return;
+  }
+
+  if (canAssign && match(TOKEN_EQUAL)) {
+    expression();
+    emitBytes(OP_SET_LOCAL, (uint8_t)slot);
+  } else {
+    emitBytes(OP_GET_LOCAL, (uint8_t)slot);
+  }
 }
 
-static void unary() {
+// Compiles `try expression catch (name) handler`. Nothing is emitted
+// around the protected expression; its range goes in the handler table.
+// An error inside it cuts the stack back to where the `try` began and
+// pushes the message, which becomes `name`. The handler's value then
+// takes the message's slot, where the protected value would have been.
+static void tryCatch(bool canAssign) {
+  (void)canAssign;
+  int depth = current->stackDepth;
+  Position start = here();
+  int firstBlock = handlerBlockCount;
+  expression();
+  Position end = here();
+  int endBlock = handlerBlockCount;
+  int firstRange = tryRangeCount;
+
+  consume(TOKEN_CATCH, "Expect 'catch' after try expression.");
+  consume(TOKEN_LEFT_PAREN, "Expect '(' after 'catch'.");
+  consume(TOKEN_IDENTIFIER, "Expect error variable name.");
+  Token name = parser.previous;
+  consume(TOKEN_RIGHT_PAREN, "Expect ')' after error variable.");
+
+  int localCount = current->localCount;
+  uint8_t slot = addSlot(&name);
+  expression();
+  emitBytes(OP_SET_LOCAL, slot);
+  emitBytes(OP_POP_N, 1);
+  current->localCount = localCount;
+  current->stackDepth = depth;
+
+  int block = cutHandler(end.offset, start, end, endBlock, firstRange);
+  addTryRange(start, end, block, depth, firstBlock, endBlock);
+}
+
+static void unary(bool canAssign) {
+  (void)canAssign;
   TokenType operatorType = parser.previous.type;
 
   parsePrecedence(PREC_UNARY);
 
   switch (operatorType) {
+    case TOKEN_BANG: emitByte(OP_NOT); break;
     case TOKEN_MINUS: emitByte(OP_NEGATE); break;
+    case TOKEN_TILDE: emitByte(OP_BIT_NOT); break;
     default: return;
   }
 }
@@ -172,8 +962,11 @@ static void unary() {
 ParseRule rules[] = {
   [TOKEN_LEFT_PAREN]      = {grouping,  NULL,   PREC_NONE},
   [TOKEN_RIGHT_PAREN]     = {NULL,      NULL,   PREC_NONE},
-  [TOKEN_LEFT_BRACE]      = {NULL,      NULL,   PREC_NONE},
+  [TOKEN_LEFT_BRACE]      = {map,       NULL,   PREC_NONE},
   [TOKEN_RIGHT_BRACE]     = {NULL,      NULL,   PREC_NONE},
+  [TOKEN_LEFT_BRACKET]    = {list,      subscript, PREC_CALL},
+  [TOKEN_RIGHT_BRACKET]   = {NULL,      NULL,   PREC_NONE},
+  [TOKEN_COLON]           = {NULL,      NULL,   PREC_NONE},
   [TOKEN_COMMA]           = {NULL,      NULL,   PREC_NONE},
   [TOKEN_DOT]             = {NULL,      NULL,   PREC_NONE},
   [TOKEN_MINUS]           = {unary,     binary, PREC_TERM},
@@ -181,31 +974,45 @@ ParseRule rules[] = {
   [TOKEN_SEMICOLON]       = {NULL,      NULL,   PREC_NONE},
   [TOKEN_SLASH]           = {NULL,      binary, PREC_FACTOR},
   [TOKEN_STAR]            = {NULL,      binary, PREC_FACTOR},
-  [TOKEN_BANG]            = {NULL,      NULL,   PREC_NONE},
-  [TOKEN_BANG_EQUAL]      = {NULL,      NULL,   PREC_NONE},
+  [TOKEN_PERCENT]         = {NULL,      binary, PREC_FACTOR},
+  [TOKEN_AMPERSAND]       = {NULL,      binary, PREC_BIT_AND},
+  [TOKEN_PIPE]            = {NULL,      binary, PREC_BIT_OR},
+  [TOKEN_CARET]           = {NULL,      binary, PREC_BIT_XOR},
+  [TOKEN_TILDE]           = {unary,     NULL,   PREC_NONE},
+  [TOKEN_TILDE_SLASH]     = {NULL,      binary, PREC_FACTOR},
+  [TOKEN_BANG]            = {unary,     NULL,   PREC_NONE},
+  [TOKEN_BANG_EQUAL]      = {NULL,      binary, PREC_EQUALITY},
   [TOKEN_EQUAL]           = {NULL,      NULL,   PREC_NONE},
-  [TOKEN_EQUAL_EQUAL]     = {NULL,      NULL,   PREC_NONE},
-  [TOKEN_GREATER]         = {NULL,      NULL,   PREC_NONE},
-  [TOKEN_GREATER_EQUAL]   = {NULL,      NULL,   PREC_NONE},
-  [TOKEN_LESS]            = {NULL,      NULL,   PREC_NONE},
-  [TOKEN_LESS_EQUAL]      = {NULL,      NULL,   PREC_NONE},
-  [TOKEN_IDENTIFIER]      = {NULL,      NULL,   PREC_NONE},
-  [TOKEN_STRING]          = {NULL,      NULL,   PREC_NONE},
+  [TOKEN_EQUAL_EQUAL]     = {NULL,      binary, PREC_EQUALITY},
+  [TOKEN_GREATER]         = {NULL,      binary, PREC_COMPARISON},
+  [TOKEN_GREATER_EQUAL]   = {NULL,      binary, PREC_COMPARISON},
+  [TOKEN_GREATER_GREATER] = {NULL,      binary, PREC_SHIFT},
+  [TOKEN_LESS]            = {NULL,      binary, PREC_COMPARISON},
+  [TOKEN_LESS_EQUAL]      = {NULL,      binary, PREC_COMPARISON},
+  [TOKEN_LESS_LESS]       = {NULL,      binary, PREC_SHIFT},
+  [TOKEN_IDENTIFIER]      = {variable,  NULL,   PREC_NONE},
+  [TOKEN_STRING]          = {string,    NULL,   PREC_NONE},
+  [TOKEN_INTERPOLATION]   = {interpolation, NULL, PREC_NONE},
   [TOKEN_NUMBER]          = {number,    NULL,   PREC_NONE},
+  [TOKEN_INTEGER]         = {integer,   NULL,   PREC_NONE},
   [TOKEN_AND]             = {NULL,      NULL,   PREC_NONE},
+  [TOKEN_CATCH]           = {NULL,      NULL,   PREC_NONE},
   [TOKEN_CLASS]           = {NULL,      NULL,   PREC_NONE},
   [TOKEN_ELSE]            = {NULL,      NULL,   PREC_NONE},
-  [TOKEN_FALSE]           = {NULL,      NULL,   PREC_NONE},
+  [TOKEN_FALSE]           = {literal,   NULL,   PREC_NONE},
   [TOKEN_FOR]             = {NULL,      NULL,   PREC_NONE},
   [TOKEN_FUN]             = {NULL,      NULL,   PREC_NONE},
   [TOKEN_IF]              = {NULL,      NULL,   PREC_NONE},
+  [TOKEN_IMPORT]          = {import,    NULL,   PREC_NONE},
+  [TOKEN_IN]              = {NULL,      NULL,   PREC_NONE},
   [TOKEN_NIL]             = {NULL,      NULL,   PREC_NONE},
   [TOKEN_OR]              = {NULL,      NULL,   PREC_NONE},
   [TOKEN_PRINT]           = {NULL,      NULL,   PREC_NONE},
   [TOKEN_RETURN]          = {NULL,      NULL,   PREC_NONE},
   [TOKEN_SUPER]           = {NULL,      NULL,   PREC_NONE},
   [TOKEN_THIS]            = {NULL,      NULL,   PREC_NONE},
-  [TOKEN_TRUE]            = {NULL,      NULL,   PREC_NONE},
+  [TOKEN_TRUE]            = {literal,   NULL,   PREC_NONE},
+  [TOKEN_TRY]             = {tryCatch,  NULL,   PREC_NONE},
   [TOKEN_VAR]             = {NULL,      NULL,   PREC_NONE},
   [TOKEN_WHILE]           = {NULL,      NULL,   PREC_NONE},
   [TOKEN_ERROR]           = {NULL,      NULL,   PREC_NONE},
@@ -213,6 +1020,11 @@ ParseRule rules[] = {
 };
 
 static void parsePrecedence(Precedence precedence) {
+  if (parser.nesting == MAX_NESTING) {
+    errorAtCurrent("Expression nested too deeply.");
+    return;
+  }
+
   advance();
   ParseFn prefixRule = getRule(parser.previous.type)->prefix;
   if (prefixRule == NULL) {
@@ -220,12 +1032,19 @@ static void parsePrecedence(Precedence precedence) {
     return;
   }
 
-  prefixRule();
+  parser.nesting++;
+  bool canAssign = precedence <= PREC_ASSIGNMENT;
+  prefixRule(canAssign);
 
   while (precedence <= getRule(parser.current.type)->precedence) {
     advance();
     ParseFn infixRule = getRule(parser.previous.type)->infix;
-    infixRule();
+    infixRule(canAssign);
+  }
+  parser.nesting--;
+
+  if (canAssign && match(TOKEN_EQUAL)) {
+    error("Invalid assignment target.");
   }
 }
 
@@ -237,16 +1056,33 @@ static void expression() {
   parsePrecedence(PREC_ASSIGNMENT);
 }
 
-bool compile(const char* source, Chunk* chunk) {
+// `path` is the file the source came from, which imports are resolved
+// against, or NULL.
+bool compile(const char* source, const char* path, Chunk* chunk) {
   initScanner(source);
+  return compileTokens(scanToken, path, chunk, NULL);
+}
+
+// Compiles the tokens `source` hands out, up to its TOKEN_EOF. The first
+// error is printed, or stored in `error` instead if that isn't NULL.
+bool compileTokens(TokenSource source, const char* path, Chunk* chunk,
+                   CompileError* error) {
+  nextToken = source;
+  compileError = error;
   compilingChunk = chunk;
+  compilingPath = path;
+  current = NULL;
+  Compiler compiler;
+  initCompiler(&compiler);
 
   parser.hadError = false;
   parser.panicMode = false;
+  parser.nesting = 0;
 
   advance();
   expression();
   consume(TOKEN_EOF, "Expect end of expression.");
   endCompiler();
+  if (!parser.hadError) finalizeChunk(chunk);
   return !parser.hadError;
 }
@@ -0,0 +1,216 @@
+#include <string.h>
+
+#include "bitmask.h"
+#include "csv.h"
+#include "memory.h"
+#include "number.h"
+#include "object.h"
+#include "table.h"
+#include "vm.h"
+
+typedef struct {
+    uint64_t commas;
+    uint64_t quotes;
+    uint64_t newlines;
+} Block;
+
+typedef struct {
+    Obj* owner;
+    const char* data;
+    size_t fieldStart;
+    int line;
+    bool columns;
+
+    // Row mode collects each row into `row` and the rows into `rows`. In
+    // column mode `row` holds the header until the first line ends.
+    ObjList* rows;
+    ObjList* row;
+    ObjList** columnLists;
+    int columnCount;
+    int field;
+} Parser;
+
+static void classify(const char* bytes, Block* block) {
+  block->commas = matchByte(bytes, ',');
+  block->quotes = matchByte(bytes, '"');
+  block->newlines = matchByte(bytes, '\n');
+}
+
+// Strips the quotes from a quoted field. Only fields with doubled quotes
+// inside need a copy; the rest stay views into the input.
+static Value fieldString(Parser* parser, const char* start, size_t length) {
+  if (length >= 2 && start[0] == '"' && start[length - 1] == '"') {
+    start++;
+    length -= 2;
+
+    if (memchr(start, '"', length) != NULL) {
+      char* chars = ALLOCATE(char, length);
+      size_t count = 0;
+      for (size_t i = 0; i < length; i++) {
+        chars[count++] = start[i];
+        if (start[i] == '"' && i + 1 < length && start[i + 1] == '"') i++;
+      }
+
+      ObjString* string = copyString(chars, (int)count);
+      FREE_ARRAY(char, chars, length);
+      return OBJ_VAL(string);
+    }
+  }
+
+  return OBJ_VAL(newStringView(parser->owner, start, (int)length));
+}
+
+// A header naming a column twice is an error, since the second column
+// would replace the first in the result.
+static bool startColumns(Parser* parser) {
+  Table names;
+  initTable(&names);
+  for (int i = 0; i < parser->row->items.count; i++) {
+    Value name = parser->row->items.values[i];
+    if (!tableSet(&names, name, BOOL_VAL(true))) {
+      freeTable(&names);
+      runtimeError("CSV header names the column '%.*s' twice.",
+                   AS_STRING(name)->length, AS_STRING(name)->chars);
+      return false;
+    }
+  }
+  freeTable(&names);
+
+  parser->columnCount = parser->row->items.count;
+  parser->columnLists = ALLOCATE(ObjList*, parser->columnCount);
+  for (int i = 0; i < parser->columnCount; i++) {
+    parser->columnLists[i] = newList(0);
+  }
+  return true;
+}
+
+static bool endField(Parser* parser, size_t end, bool endsRow) {
+  const char* start = parser->data + parser->fieldStart;
+  size_t length = end - parser->fieldStart;
+  parser->fieldStart = end + 1;
+
+  if (endsRow && length > 0 && start[length - 1] == '\r') length--;
+  if (length > INT32_MAX) {
+    runtimeError("CSV field on line %d is too long.", parser->line);
+    return false;
+  }
+
+  // Skip blank lines entirely.
+  if (endsRow && parser->field == 0 && length == 0) {
+    parser->line++;
+    return true;
+  }
+
+  if (parser->columnLists == NULL) {
+    if (parser->row == NULL) parser->row = newList(0);
+    writeValueArray(&parser->row->items, fieldString(parser, start, length));
+    parser->field++;
+
+    if (endsRow) {
+      if (parser->columns) {
+        if (!startColumns(parser)) return false;
+      } else {
+        writeValueArray(&parser->rows->items, OBJ_VAL(parser->row));
+        parser->row = NULL;
+      }
+      parser->field = 0;
+      parser->line++;
+    }
+    return true;
+  }
+
+  if (parser->field >= parser->columnCount) {
+    runtimeError("CSV line %d has more fields than the header.",
+                 parser->line);
+    return false;
+  }
+
+  double number;
+  Value value = parseNumber(start, length, &number)
+      ? NUMBER_VAL(number)
+      : fieldString(parser, start, length);
+  writeValueArray(&parser->columnLists[parser->field]->items, value);
+  parser->field++;
+
+  if (endsRow) {
+    if (parser->field != parser->columnCount) {
+      runtimeError("CSV line %d has fewer fields than the header.",
+                   parser->line);
+      return false;
+    }
+    parser->field = 0;
+    parser->line++;
+  }
+  return true;
+}
+
+// Builds a list of rows, each a list of field strings. With `columns`, the
+// first line names the columns instead and the result maps each name to a
+// list of its values, with numeric fields parsed into numbers.
+bool parseCsv(Obj* owner, const char* data, size_t length, bool columns,
+              Value* result) {
+  Parser parser;
+  parser.owner = owner;
+  parser.data = data;
+  parser.fieldStart = 0;
+  parser.line = 1;
+  parser.columns = columns;
+  parser.rows = newList(0);
+  parser.row = NULL;
+  parser.columnLists = NULL;
+  parser.columnCount = 0;
+  parser.field = 0;
+
+  bool success = true;
+  uint64_t inQuotes = 0;
+  for (size_t offset = 0; offset < length && success; offset += BLOCK_SIZE) {
+    const char* bytes = data + offset;
+    char tail[BLOCK_SIZE];
+    if (length - offset < BLOCK_SIZE) {
+      memset(tail, 0, BLOCK_SIZE);
+      memcpy(tail, bytes, length - offset);
+      bytes = tail;
+    }
+
+    Block block;
+    classify(bytes, &block);
+    uint64_t quoted = prefixXor(block.quotes) ^ inQuotes;
+    inQuotes = (uint64_t)((int64_t)quoted >> 63);
+
+    uint64_t structural = (block.commas | block.newlines) & ~quoted;
+    while (structural != 0) {
+      int bit = __builtin_ctzll(structural);
+      bool endsRow = (block.newlines >> bit) & 1;
+      if (!endField(&parser, offset + bit, endsRow)) {
+        success = false;
+        break;
+      }
+      structural &= structural - 1;
+    }
+  }
+
+  if (success && inQuotes != 0) {
+    runtimeError("CSV line %d has a quoted field that doesn't end.",
+                 parser.line);
+    success = false;
+  }
+
+  // The last line may not end with a newline.
+  if (success && (parser.fieldStart < length || parser.field > 0)) {
+    success = endField(&parser, length, true);
+  }
+
+  if (success && columns) {
+    ObjMap* map = newMap();
+    for (int i = 0; i < parser.columnCount; i++) {
+      tableSet(&map->table, parser.row->items.values[i],
+               OBJ_VAL(parser.columnLists[i]));
+    }
+    *result = OBJ_VAL(map);
+  } else if (success) {
+    *result = OBJ_VAL(parser.rows);
+  }
+
+  FREE_ARRAY(ObjList*, parser.columnLists, parser.columnCount);
+  return success;
+}
@@ -1,6 +1,7 @@
 #include <stdio.h>
 
 #include "debug.h"
+#include "native.h"
 #include "value.h"
 
 void disassembleChunk(Chunk* chunk, const char *name) {
@@ -9,6 +10,12 @@ void disassembleChunk(Chunk* chunk, const char *name) {
   for (int offset = 0; offset < chunk->count;) {
     offset = disassembleInstruction(chunk, offset);
   }
+
+  for (int i = 0; i < chunk->handlerCount; i++) {
+    Handler* handler = &chunk->handlers[i];
+    printf("try %04d-%04d -> %04d (depth %d, body %04d)\n", handler->start,
+           handler->end, handler->handler, handler->depth, handler->body);
+  }
 }
 
 static int constantInstruction(const char* name, Chunk* chunk, int offset) {
@@ -19,6 +26,47 @@ static int constantInstruction(const char* name, Chunk* chunk, int offset) {
   return offset + 2;
 }
 
+static int byteInstruction(const char* name, Chunk* chunk, int offset) {
+  uint8_t slot = chunk->code[offset + 1];
+  printf("%-16s %4d\n", name, slot);
+  return offset + 2;
+}
+
+static int nativeInstruction(const char* name, Chunk* chunk, int offset) {
+  uint8_t native = chunk->code[offset + 1];
+  uint8_t argCount = chunk->code[offset + 2];
+  printf("%-16s (%d args) %4d '%s'\n", name, argCount, native,
+         natives[native].name);
+  return offset + 3;
+}
+
+static int hostNativeInstruction(const char* name, Chunk* chunk,
+                                 int offset) {
+  uint8_t constant = chunk->code[offset + 1];
+  uint8_t argCount = chunk->code[offset + 2];
+  printf("%-16s (%d args) %4d '", name, argCount, constant);
+  printValue(chunk->constants.values[constant]);
+  printf("'\n");
+  return offset + 3;
+}
+
+static int jumpInstruction(const char* name, int sign,
+                           Chunk* chunk, int offset) {
+  uint16_t jump = (uint16_t)(chunk->code[offset + 1] << 8);
+  jump |= chunk->code[offset + 2];
+  printf("%-16s %4d -> %d\n", name, offset,
+         offset + 3 + sign * jump);
+  return offset + 3;
+}
+
+static int loopInstruction(const char* name, Chunk* chunk, int offset) {
+  uint8_t slot = chunk->code[offset + 1];
+  uint16_t jump = (uint16_t)(chunk->code[offset + 2] << 8);
+  jump |= chunk->code[offset + 3];
+  printf("%-16s %4d %4d -> %d\n", name, slot, offset, offset + 4 + jump);
+  return offset + 4;
+}
+
 static int simpleInstruction(const char* name, int offset) {
   printf("%s\n", name);
   return offset + 1;
@@ -26,27 +74,101 @@ static int simpleInstruction(const char* name, int offset) {
 
 int disassembleInstruction(Chunk* chunk, int offset) {
   printf("%04d ", offset);
-  if (offset > 0 &&
-      chunk->lines[offset] == chunk->lines[offset - 1]) {
+  int line = getLine(chunk, offset);
+  if (offset > 0 && line == getLine(chunk, offset - 1)) {
     printf("   | ");
   } else {
-    printf("%4d ", chunk->lines[offset]);
+    printf("%4d ", line);
   }
   
   uint8_t instruction = chunk->code[offset];
   switch (instruction) {
     case OP_CONSTANT:
       return constantInstruction("OP_CONSTANT", chunk, offset);
+    case OP_TRUE:
+      return simpleInstruction("OP_TRUE", offset);
+    case OP_FALSE:
+      return simpleInstruction("OP_FALSE", offset);
+    case OP_POP_N:
+      return byteInstruction("OP_POP_N", chunk, offset);
+    case OP_SWAP:
+      return simpleInstruction("OP_SWAP", offset);
+    case OP_GET_LOCAL:
+      return byteInstruction("OP_GET_LOCAL", chunk, offset);
+    case OP_SET_LOCAL:
+      return byteInstruction("OP_SET_LOCAL", chunk, offset);
+    case OP_EQUAL:
+      return simpleInstruction("OP_EQUAL", offset);
+    case OP_GREATER:
+      return simpleInstruction("OP_GREATER", offset);
+    case OP_LESS:
+      return simpleInstruction("OP_LESS", offset);
     case OP_ADD:
       return simpleInstruction("OP_ADD", offset);
     case OP_SUBTRACT:
       return simpleInstruction("OP_SUBTRACT", offset);
     case OP_MULTIPLY:
       return simpleInstruction("OP_MULTIPLY", offset);
+    case OP_ADD_INT:
+      return simpleInstruction("OP_ADD_INT", offset);
+    case OP_SUBTRACT_INT:
+      return simpleInstruction("OP_SUBTRACT_INT", offset);
+    case OP_MULTIPLY_INT:
+      return simpleInstruction("OP_MULTIPLY_INT", offset);
     case OP_DIVIDE:
       return simpleInstruction("OP_DIVIDE", offset);
+    case OP_INT_DIVIDE:
+      return simpleInstruction("OP_INT_DIVIDE", offset);
+    case OP_MODULO:
+      return simpleInstruction("OP_MODULO", offset);
+    case OP_NOT:
+      return simpleInstruction("OP_NOT", offset);
     case OP_NEGATE:
       return simpleInstruction("OP_NEGATE", offset);
+    case OP_BIT_AND:
+      return simpleInstruction("OP_BIT_AND", offset);
+    case OP_BIT_OR:
+      return simpleInstruction("OP_BIT_OR", offset);
+    case OP_BIT_XOR:
+      return simpleInstruction("OP_BIT_XOR", offset);
+    case OP_SHIFT_LEFT:
+      return simpleInstruction("OP_SHIFT_LEFT", offset);
+    case OP_SHIFT_RIGHT:
+      return simpleInstruction("OP_SHIFT_RIGHT", offset);
+    case OP_BIT_NOT:
+      return simpleInstruction("OP_BIT_NOT", offset);
+    case OP_BUILD_LIST:
+      return byteInstruction("OP_BUILD_LIST", chunk, offset);
+    case OP_BUILD_MAP:
+      return byteInstruction("OP_BUILD_MAP", chunk, offset);
+    case OP_BUILD_STRING:
+      return byteInstruction("OP_BUILD_STRING", chunk, offset);
+    case OP_LIST_APPEND:
+      return byteInstruction("OP_LIST_APPEND", chunk, offset);
+    case OP_GET_INDEX:
+      return simpleInstruction("OP_GET_INDEX", offset);
+    case OP_SET_INDEX:
+      return simpleInstruction("OP_SET_INDEX", offset);
+    case OP_NATIVE:
+      return nativeInstruction("OP_NATIVE", chunk, offset);
+    case OP_HOST_NATIVE:
+      return hostNativeInstruction("OP_HOST_NATIVE", chunk, offset);
+    case OP_FOR_RANGE:
+      return loopInstruction("OP_FOR_RANGE", chunk, offset);
+    case OP_FOR_ITER:
+      return loopInstruction("OP_FOR_ITER", chunk, offset);
+    case OP_GENERATOR:
+      return jumpInstruction("OP_GENERATOR", 1, chunk, offset);
+    case OP_YIELD:
+      return simpleInstruction("OP_YIELD", offset);
+    case OP_GENERATOR_END:
+      return simpleInstruction("OP_GENERATOR_END", offset);
+    case OP_IMPORT:
+      return constantInstruction("OP_IMPORT", chunk, offset);
+    case OP_JUMP_IF_FALSE:
+      return jumpInstruction("OP_JUMP_IF_FALSE", 1, chunk, offset);
+    case OP_LOOP:
+      return jumpInstruction("OP_LOOP", -1, chunk, offset);
     case OP_RETURN:
       return simpleInstruction("OP_RETURN", offset);
     default:
@@ -0,0 +1,519 @@
+#include <string.h>
+
+#include "chunk.h"
+#include "compiler.h"
+#include "document.h"
+#include "memory.h"
+
+// How far past the end of a token the scanner may have looked to find
+// where it ends: a number peeks at a '.' and the character after it.
+#define LOOKAHEAD 2
+
+// The most tokens a page holds. Pages are merged with the next one when
+// an edit leaves them under half full.
+#define PAGE_SIZE 256
+
+#define FNV_OFFSET 14695981039346656037u
+#define FNV_PRIME 1099511628211u
+
+// One pass of re-lexing. Old tokens are still numbered and placed as
+// they were before the edit: `old` is the next one the scan may pick up
+// from, and `oldTrivia` is where the whitespace before it begins. Those
+// after the edit have moved by `delta` chars and `lineDelta` lines.
+// Hashing the tokens that go and the ones that replace them tells an
+// edit that only moved tokens from one that changed them.
+typedef struct {
+    int editEnd;
+    int delta;
+    int lineDelta;
+    int old;
+    int oldTrivia;
+    uint64_t removedHash;
+    uint64_t addedHash;
+    TokenRange range;
+} Relex;
+
+int documentLength(Document* document) {
+  return document->textCapacity - 1 - (document->gapEnd - document->gapStart);
+}
+
+int documentTokenCount(Document* document) {
+  return document->tokenCount;
+}
+
+static const char* textAt(Document* document, int offset) {
+  if (offset < document->gapStart) return document->text + offset;
+  return document->text + offset + (document->gapEnd - document->gapStart);
+}
+
+// Returns the page holding the token at `index`.
+static int pageOf(Document* document, int index) {
+  int low = 0;
+  int high = document->pageCount - 1;
+  while (low < high) {
+    int middle = low + (high - low + 1) / 2;
+    if (document->pages[middle].first <= index) {
+      low = middle;
+    } else {
+      high = middle - 1;
+    }
+  }
+  return low;
+}
+
+static LexToken pageToken(TokenPage* page, int slot) {
+  LexToken token = page->tokens[slot];
+  token.start += page->offset;
+  token.end += page->offset;
+  token.line += page->line;
+  return token;
+}
+
+// Returns the token with absolute offsets and line.
+static LexToken tokenAt(Document* document, int index) {
+  TokenPage* page = &document->pages[pageOf(document, index)];
+  return pageToken(page, index - page->first);
+}
+
+LexToken documentLexToken(Document* document, int index) {
+  return tokenAt(document, index);
+}
+
+Token documentToken(Document* document, int index) {
+  LexToken lexed = tokenAt(document, index);
+  Token token;
+  token.type = (TokenType)lexed.type;
+  token.line = lexed.line;
+  if (lexed.type == TOKEN_ERROR) {
+    token.start = lexed.message;
+    token.length = (int)strlen(lexed.message);
+  } else {
+    token.start = textAt(document, lexed.start);
+    token.length = lexed.end - lexed.start;
+  }
+  return token;
+}
+
+// Returns the first token that ends after `offset`, or the last token.
+static int tokenEndingAfter(Document* document, int offset) {
+  int low = 0;
+  int high = document->pageCount - 1;
+  while (low < high) {
+    int middle = low + (high - low) / 2;
+    TokenPage* page = &document->pages[middle];
+    if (page->offset + page->tokens[page->count - 1].end > offset) {
+      high = middle;
+    } else {
+      low = middle + 1;
+    }
+  }
+
+  TokenPage* page = &document->pages[low];
+  int slot = 0;
+  int last = page->count - 1;
+  while (slot < last) {
+    int middle = slot + (last - slot) / 2;
+    if (page->offset + page->tokens[middle].end > offset) {
+      last = middle;
+    } else {
+      slot = middle + 1;
+    }
+  }
+  return page->first + slot;
+}
+
+static int countLines(const char* chars, int length) {
+  int lines = 0;
+  for (int i = 0; i < length; i++) {
+    if (chars[i] == '\n') lines++;
+  }
+  return lines;
+}
+
+static void moveTextGap(Document* document, int offset) {
+  int gap = document->gapEnd - document->gapStart;
+  if (offset < document->gapStart) {
+    memmove(document->text + offset + gap, document->text + offset,
+            document->gapStart - offset);
+  } else {
+    memmove(document->text + document->gapStart,
+            document->text + document->gapEnd, offset - document->gapStart);
+  }
+  document->gapStart = offset;
+  document->gapEnd = offset + gap;
+}
+
+static void reserveText(Document* document, int length) {
+  int gap = document->gapEnd - document->gapStart;
+  if (gap >= length) return;
+
+  int oldCapacity = document->textCapacity;
+  int capacity = oldCapacity;
+  while (capacity - oldCapacity + gap < length) {
+    capacity = GROW_CAPACITY(capacity);
+  }
+  document->text = GROW_ARRAY(char, document->text, oldCapacity, capacity);
+
+  // The text after the gap, and the NUL after it, stays at the end.
+  int tail = oldCapacity - document->gapEnd;
+  memmove(document->text + capacity - tail,
+          document->text + document->gapEnd, tail);
+  document->gapEnd = capacity - tail;
+  document->textCapacity = capacity;
+}
+
+static LexToken* reserveTokens(LexToken* tokens, int* capacity, int count) {
+  if (*capacity >= count) return tokens;
+
+  int oldCapacity = *capacity;
+  while (*capacity < count) *capacity = GROW_CAPACITY(*capacity);
+  return GROW_ARRAY(LexToken, tokens, oldCapacity, *capacity);
+}
+
+static uint64_t hashToken(uint64_t hash, Document* document,
+                          LexToken* token) {
+  const char* chars = token->type == TOKEN_ERROR
+      ? token->message : textAt(document, token->start);
+  int length = token->type == TOKEN_ERROR
+      ? (int)strlen(token->message) : token->end - token->start;
+
+  hash = (hash ^ token->type) * FNV_PRIME;
+  for (int i = 0; i < length; i++) {
+    hash = (hash ^ (uint8_t)chars[i]) * FNV_PRIME;
+  }
+  return (hash ^ (uint64_t)length) * FNV_PRIME;
+}
+
+// Drops the next old token. Once the text has been edited, it's one
+// from after the edit, so it has moved.
+static void dropToken(Document* document, Relex* relex, bool edited) {
+  LexToken token = tokenAt(document, relex->old++);
+  relex->oldTrivia = token.end;
+  if (edited) {
+    token.start += relex->delta;
+    token.end += relex->delta;
+  }
+  relex->removedHash = hashToken(relex->removedHash, document, &token);
+  relex->range.removed++;
+}
+
+// Scans from `from`, where the text's gap is, collecting tokens until
+// the scan lines up with an old token it can pick up from, or runs out
+// of text. A scan that has passed the end of the edit lines up with an
+// old token when it starts right where that token's whitespace does and
+// no interpolation is open on either side. From there on it would find
+// the same tokens again.
+static void relex(Document* document, Relex* relex, int from, int line) {
+  const char* base = document->text + document->gapEnd - from;
+  resumeScanner(base + from, line);
+
+  for (;;) {
+    int position = (int)(scannerPosition() - base);
+    if (position >= relex->editEnd) {
+      while (relex->old < document->tokenCount &&
+             relex->oldTrivia + relex->delta < position) {
+        dropToken(document, relex, true);
+      }
+      if (relex->old < document->tokenCount &&
+          relex->oldTrivia + relex->delta == position &&
+          scannerDepth() == 0 && tokenAt(document, relex->old).depth == 0) {
+        return;
+      }
+    }
+
+    LexToken lexed;
+    lexed.depth = (uint8_t)scannerDepth();
+    Token token = scanToken();
+    lexed.type = (uint8_t)token.type;
+    lexed.line = token.line;
+    lexed.end = (int)(scannerPosition() - base);
+    if (token.type == TOKEN_ERROR) {
+      lexed.start = lexed.end;
+      lexed.message = token.start;
+    } else {
+      lexed.start = (int)(token.start - base);
+      lexed.message = NULL;
+    }
+
+    document->scratch = reserveTokens(document->scratch,
+                                      &document->scratchCapacity,
+                                      relex->range.added + 1);
+    document->scratch[relex->range.added++] = lexed;
+    relex->addedHash = hashToken(relex->addedHash, document, &lexed);
+
+    if (token.type == TOKEN_EOF) {
+      while (relex->old < document->tokenCount) {
+        dropToken(document, relex, true);
+      }
+      return;
+    }
+  }
+}
+
+static void appendPageTokens(LexToken* tokens, int* count, TokenPage* page,
+                             int from, int to, int delta, int lineDelta) {
+  for (int slot = from; slot < to; slot++) {
+    LexToken token = pageToken(page, slot);
+    token.start += delta;
+    token.end += delta;
+    token.line += lineDelta;
+    tokens[(*count)++] = token;
+  }
+}
+
+// Puts the new tokens in place of the removed ones. The pages they touch
+// are packed again; those after only have their positions moved.
+static void spliceTokens(Document* document, Relex* relex) {
+  TokenRange* range = &relex->range;
+  int end = range->first + range->removed;
+  int firstPage = 0;
+  int lastPage = -1;
+  if (document->pageCount > 0) {
+    firstPage = pageOf(document, range->first);
+    lastPage = range->removed == 0 ? firstPage : pageOf(document, end - 1);
+  }
+
+  int count = range->added;
+  if (lastPage >= 0) {
+    count += range->first - document->pages[firstPage].first;
+    count += document->pages[lastPage].first +
+             document->pages[lastPage].count - end;
+    if (count < PAGE_SIZE / 2 && lastPage + 1 < document->pageCount) {
+      count += document->pages[++lastPage].count;
+    }
+  }
+
+  LexToken* tokens = ALLOCATE(LexToken, count);
+  int packed = 0;
+  if (lastPage >= 0) {
+    TokenPage* page = &document->pages[firstPage];
+    appendPageTokens(tokens, &packed, page, 0, range->first - page->first,
+                     0, 0);
+  }
+  memcpy(tokens + packed, document->scratch, sizeof(LexToken) * range->added);
+  packed += range->added;
+  for (int i = firstPage; i <= lastPage; i++) {
+    TokenPage* page = &document->pages[i];
+    int from = end > page->first ? end - page->first : 0;
+    if (from < page->count) {
+      appendPageTokens(tokens, &packed, page, from, page->count,
+                       relex->delta, relex->lineDelta);
+    }
+  }
+
+  int replaced = lastPage - firstPage + 1;
+  int pageCount = (count + PAGE_SIZE - 1) / PAGE_SIZE;
+  for (int i = firstPage; i <= lastPage; i++) {
+    FREE_ARRAY(LexToken, document->pages[i].tokens, PAGE_SIZE);
+  }
+
+  int oldCapacity = document->pageCapacity;
+  int needed = document->pageCount - replaced + pageCount;
+  if (needed > document->pageCapacity) {
+    while (document->pageCapacity < needed) {
+      document->pageCapacity = GROW_CAPACITY(document->pageCapacity);
+    }
+    document->pages = GROW_ARRAY(TokenPage, document->pages, oldCapacity,
+                                 document->pageCapacity);
+  }
+  memmove(document->pages + firstPage + pageCount,
+          document->pages + firstPage + replaced,
+          sizeof(TokenPage) * (document->pageCount - firstPage - replaced));
+  document->pageCount = needed;
+
+  // Spread the tokens evenly, with the page's first token as its base.
+  int next = 0;
+  int index = firstPage == 0 ? 0 : document->pages[firstPage - 1].first +
+                                   document->pages[firstPage - 1].count;
+  for (int i = 0; i < pageCount; i++) {
+    TokenPage* page = &document->pages[firstPage + i];
+    page->count = (count - next) / (pageCount - i);
+    page->first = index;
+    page->offset = tokens[next].start;
+    page->line = tokens[next].line;
+    page->tokens = ALLOCATE(LexToken, PAGE_SIZE);
+    for (int slot = 0; slot < page->count; slot++) {
+      LexToken token = tokens[next++];
+      token.start -= page->offset;
+      token.end -= page->offset;
+      token.line -= page->line;
+      page->tokens[slot] = token;
+    }
+    index += page->count;
+  }
+  FREE_ARRAY(LexToken, tokens, count);
+
+  for (int i = firstPage + pageCount; i < document->pageCount; i++) {
+    TokenPage* page = &document->pages[i];
+    page->first += range->added - range->removed;
+    page->offset += relex->delta;
+    page->line += relex->lineDelta;
+  }
+  document->tokenCount += range->added - range->removed;
+}
+
+static void startRelex(Relex* relex, int first, int oldTrivia) {
+  relex->old = first;
+  relex->oldTrivia = oldTrivia;
+  relex->removedHash = FNV_OFFSET;
+  relex->addedHash = FNV_OFFSET;
+  relex->range.first = first;
+  relex->range.removed = 0;
+  relex->range.added = 0;
+}
+
+// `path` is what imports are resolved against, or NULL. The document
+// only borrows it.
+void initDocument(Document* document, const char* source, const char* path) {
+  int length = (int)strlen(source);
+  document->text = ALLOCATE(char, length + 1);
+  memcpy(document->text, source, length + 1);
+  document->textCapacity = length + 1;
+  document->gapStart = 0;
+  document->gapEnd = 0;
+  document->lineCount = countLines(source, length) + 1;
+
+  document->pages = NULL;
+  document->pageCount = 0;
+  document->pageCapacity = 0;
+  document->tokenCount = 0;
+  document->scratch = NULL;
+  document->scratchCapacity = 0;
+
+  document->path = path;
+  document->changed = true;
+  document->hadError = false;
+  document->errorToken = 0;
+  document->errorLine = 0;
+  document->error[0] = '\0';
+
+  Relex pass;
+  startRelex(&pass, 0, 0);
+  pass.editEnd = length;
+  pass.delta = 0;
+  pass.lineDelta = 0;
+  relex(document, &pass, 0, 1);
+  spliceTokens(document, &pass);
+}
+
+void freeDocument(Document* document) {
+  for (int i = 0; i < document->pageCount; i++) {
+    FREE_ARRAY(LexToken, document->pages[i].tokens, PAGE_SIZE);
+  }
+  FREE_ARRAY(TokenPage, document->pages, document->pageCapacity);
+  FREE_ARRAY(LexToken, document->scratch, document->scratchCapacity);
+  FREE_ARRAY(char, document->text, document->textCapacity);
+  document->pages = NULL;
+  document->scratch = NULL;
+  document->text = NULL;
+}
+
+// Replaces the text from `start` up to `end` with `length` chars and
+// brings the tokens up to date. Re-lexing starts at the first token whose
+// scan could have seen the edit, or further back at one outside any
+// interpolation, where the scanner's state is known. Old tokens that
+// overlap the edit are dropped right away; those after it are left for
+// the re-lex to pick up from.
+TokenRange editDocument(Document* document, int start, int end,
+                        const char* chars, int length) {
+  int first = tokenEndingAfter(document, start - LOOKAHEAD);
+  while (first > 0 && tokenAt(document, first).depth != 0) first--;
+  int kept = end == 0 ? 0 : tokenEndingAfter(document, end - 1) + 1;
+  if (kept < first) kept = first;
+
+  int from = 0;
+  int line = 1;
+  if (first > 0) {
+    LexToken previous = tokenAt(document, first - 1);
+    from = previous.end;
+    line = previous.line;
+  }
+
+  Relex pass;
+  startRelex(&pass, first, from);
+  while (pass.old < kept) dropToken(document, &pass, false);
+
+  moveTextGap(document, start);
+  int lines = countLines(chars, length) -
+              countLines(document->text + document->gapEnd, end - start);
+  document->gapEnd += end - start;
+  reserveText(document, length);
+  memcpy(document->text + document->gapStart, chars, length);
+  document->gapStart += length;
+  document->lineCount += lines;
+
+  pass.editEnd = start + length;
+  pass.delta = length - (end - start);
+  pass.lineDelta = lines;
+  moveTextGap(document, from);
+  relex(document, &pass, from, line);
+  spliceTokens(document, &pass);
+
+  if (pass.range.removed != pass.range.added ||
+      pass.removedHash != pass.addedHash) {
+    document->changed = true;
+  }
+  return pass.range;
+}
+
+static Document* reading;
+static int readIndex;
+
+static Token readToken() {
+  Token token = documentToken(reading, readIndex);
+  if (readIndex < reading->tokenCount - 1) readIndex++;
+  return token;
+}
+
+// Finds the token a compile error was reported at.
+static int findToken(Document* document, Token* token) {
+  int count = document->tokenCount;
+  if (token->type == TOKEN_ERROR) {
+    for (int i = 0; i < count; i++) {
+      LexToken lexed = tokenAt(document, i);
+      if (lexed.type == TOKEN_ERROR && lexed.message == token->start) {
+        return i;
+      }
+    }
+    return count - 1;
+  }
+
+  int offset = (int)(token->start - document->text);
+  if (offset >= document->gapStart) {
+    offset -= document->gapEnd - document->gapStart;
+  }
+
+  int index = tokenEndingAfter(document, offset);
+  while (index < count - 1 && tokenAt(document, index).type == TOKEN_ERROR) {
+    index++;
+  }
+  return index;
+}
+
+// Compiles the document from its tokens, without scanning it again, and
+// records the first error. It's only compiled again once an edit has
+// changed its tokens; after edits that only moved them, the error stays
+// with the same token and just its line is brought up to date.
+bool checkDocument(Document* document) {
+  if (document->changed) {
+    Chunk chunk;
+    initChunk(&chunk);
+    CompileError error;
+    reading = document;
+    readIndex = 0;
+    document->hadError = !compileTokens(readToken, document->path, &chunk,
+                                        &error);
+    freeChunk(&chunk);
+    document->changed = false;
+
+    if (document->hadError) {
+      document->errorToken = findToken(document, &error.token);
+      memcpy(document->error, error.message, ERROR_MAX);
+    }
+  }
+
+  if (document->hadError) {
+    document->errorLine = documentToken(document, document->errorToken).line;
+  }
+  return !document->hadError;
+}
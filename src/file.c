@@ -0,0 +1,103 @@
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "file.h"
+#include "memory.h"
+#include "object.h"
+
+#define READ_BLOCK_SIZE (64 * 1024)
+
+// Pipes, terminals and other files that can't be mapped are read into
+// one heap buffer in large blocks instead.
+static bool readStream(ObjFile* file, int fd) {
+  size_t capacity = 0;
+  size_t length = 0;
+  char* buffer = NULL;
+
+  for (;;) {
+    if (capacity - length < READ_BLOCK_SIZE) {
+      size_t oldCapacity = capacity;
+      capacity = capacity < READ_BLOCK_SIZE ? READ_BLOCK_SIZE : capacity * 2;
+      buffer = GROW_ARRAY(char, buffer, oldCapacity, capacity);
+    }
+
+    ssize_t bytesRead = read(fd, buffer + length, capacity - length);
+    if (bytesRead < 0) {
+      FREE_ARRAY(char, buffer, capacity);
+      return false;
+    }
+    if (bytesRead == 0) break;
+    length += (size_t)bytesRead;
+  }
+
+  file->data = buffer;
+  file->length = length;
+  file->capacity = capacity;
+  file->mapped = false;
+  return true;
+}
+
+// Maps a regular file read-only so its bytes can be handed out as string
+// views without copying. Returns NULL if the file can't be read.
+ObjFile* openFile(const char* path) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) return NULL;
+
+  struct stat info;
+  if (fstat(fd, &info) < 0) {
+    close(fd);
+    return NULL;
+  }
+
+  ObjFile* file = newFile();
+  if (S_ISREG(info.st_mode) && info.st_size > 0) {
+    void* data = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE,
+                      fd, 0);
+    if (data != MAP_FAILED) {
+      madvise(data, (size_t)info.st_size, MADV_SEQUENTIAL);
+      file->data = data;
+      file->length = (size_t)info.st_size;
+      file->capacity = file->length;
+      file->mapped = true;
+      close(fd);
+      return file;
+    }
+  }
+
+  bool success = readStream(file, fd);
+  close(fd);
+  return success ? file : NULL;
+}
+
+void closeFile(ObjFile* file) {
+  if (file->mapped) {
+    munmap((void*)file->data, file->capacity);
+  } else {
+    FREE_ARRAY(char, (char*)file->data, file->capacity);
+  }
+
+  file->data = NULL;
+  file->length = 0;
+  file->capacity = 0;
+}
+
+// Finds the line starting at `position` and returns it as a view into the
+// file, without its line terminator. Returns false at the end of the file.
+bool nextLine(ObjFile* file, int64_t* position, Value* line) {
+  size_t start = (size_t)*position;
+  if (start >= file->length) return false;
+
+  const char* begin = file->data + start;
+  size_t remaining = file->length - start;
+  const char* newline = memchr(begin, '\n', remaining);
+  size_t length = newline == NULL ? remaining : (size_t)(newline - begin);
+
+  *position = (int64_t)(start + length + (newline != NULL));
+  if (length > 0 && begin[length - 1] == '\r') length--;
+
+  *line = OBJ_VAL(newStringView((Obj*)file, begin, (int)length));
+  return true;
+}
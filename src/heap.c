@@ -0,0 +1,187 @@
+// mremap() is Linux-specific.
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "heap.h"
+
+// Sizes up to SMALL_MAX round up to a multiple of SMALL_STEP; medium ones
+// round up to a power of two from MEDIUM_MIN to HEAP_MEDIUM_MAX.
+#define SMALL_STEP 16
+#define SMALL_MAX 1024
+#define SMALL_CLASSES (SMALL_MAX / SMALL_STEP)
+#define MEDIUM_MIN (2 * 1024)
+#define CLASS_COUNT (SMALL_CLASSES + 8)
+#define CACHE_LINE_SIZE 64
+
+typedef struct block {
+  struct block* next;
+} Block;
+
+// Each region starts with a link to the one mapped before it.
+typedef struct region {
+  struct region* next;
+} Region;
+
+static bool enabled = false;
+static Block* freeBlocks[CLASS_COUNT];
+static Region* regions = NULL;
+static char* regionNext = NULL;
+static char* regionEnd = NULL;
+
+static size_t roundUp(size_t size, size_t alignment) {
+  return (size + alignment - 1) & ~(alignment - 1);
+}
+
+void initHeap(bool hugePages) {
+  enabled = hugePages;
+  memset(freeBlocks, 0, sizeof(freeBlocks));
+}
+
+void freeHeap() {
+  while (regions != NULL) {
+    Region* next = regions->next;
+    munmap(regions, HEAP_REGION_SIZE);
+    regions = next;
+  }
+  regionNext = NULL;
+  regionEnd = NULL;
+  memset(freeBlocks, 0, sizeof(freeBlocks));
+}
+
+bool usingHugePages() {
+  return enabled;
+}
+
+void adviseHugePages(void* start, size_t size) {
+  if (enabled) madvise(start, size, MADV_HUGEPAGE);
+}
+
+// Maps `size` bytes, a multiple of the page size, starting on a huge page
+// boundary. It maps a huge page more than needed and trims both ends.
+// Nothing is committed until it's touched.
+void* mapHugePages(size_t size) {
+  size_t padded = size + HUGE_PAGE_SIZE;
+  char* mapping = mmap(NULL, padded, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (mapping == MAP_FAILED) return NULL;
+
+  char* start = (char*)roundUp((uintptr_t)mapping, HUGE_PAGE_SIZE);
+  if (start > mapping) munmap(mapping, (size_t)(start - mapping));
+  munmap(start + size, (size_t)(mapping + padded - (start + size)));
+  madvise(start, size, MADV_HUGEPAGE);
+  return start;
+}
+
+static int sizeClass(size_t size, size_t* classSize) {
+  if (size <= SMALL_MAX) {
+    *classSize = roundUp(size, SMALL_STEP);
+    return (int)(*classSize / SMALL_STEP) - 1;
+  }
+
+  int index = SMALL_CLASSES;
+  size_t rounded = MEDIUM_MIN;
+  while (rounded < size) {
+    rounded *= 2;
+    index++;
+  }
+  *classSize = rounded;
+  return index;
+}
+
+// Bumps a block off the current region. Blocks whose size is a multiple
+// of a cache line are aligned to one, which allocateAligned() relies on.
+static void* carve(size_t size) {
+  size_t alignment = size % CACHE_LINE_SIZE == 0 ? CACHE_LINE_SIZE
+                                                 : SMALL_STEP;
+  char* start = (char*)roundUp((uintptr_t)regionNext, alignment);
+  if (regionNext == NULL || start + size > regionEnd) {
+    Region* region = mapHugePages(HEAP_REGION_SIZE);
+    if (region == NULL) return NULL;
+    region->next = regions;
+    regions = region;
+    start = (char*)region + CACHE_LINE_SIZE;
+    regionEnd = (char*)region + HEAP_REGION_SIZE;
+  }
+
+  regionNext = start + size;
+  return start;
+}
+
+static void* allocate(size_t size) {
+  if (size > HEAP_MEDIUM_MAX) {
+    return mapHugePages(roundUp(size, HUGE_PAGE_SIZE));
+  }
+
+  size_t classSize;
+  int index = sizeClass(size, &classSize);
+  Block* block = freeBlocks[index];
+  if (block == NULL) return carve(classSize);
+  freeBlocks[index] = block->next;
+  return block;
+}
+
+static void release(void* pointer, size_t size) {
+  if (size > HEAP_MEDIUM_MAX) {
+    munmap(pointer, roundUp(size, HUGE_PAGE_SIZE));
+    return;
+  }
+
+  size_t classSize;
+  Block* block = (Block*)pointer;
+  int index = sizeClass(size, &classSize);
+  block->next = freeBlocks[index];
+  freeBlocks[index] = block;
+}
+
+// Grows or shrinks a large mapping in place if it can. Otherwise its
+// pages are moved to a fresh aligned range rather than copied.
+static void* remapLarge(void* pointer, size_t oldSize, size_t newSize) {
+  size_t oldLength = roundUp(oldSize, HUGE_PAGE_SIZE);
+  size_t newLength = roundUp(newSize, HUGE_PAGE_SIZE);
+  if (newLength == oldLength) return pointer;
+
+  void* result = mremap(pointer, oldLength, newLength, 0);
+  if (result != MAP_FAILED) return result;
+
+  void* target = mapHugePages(newLength);
+  if (target == NULL) return NULL;
+  result = mremap(pointer, oldLength, newLength,
+                  MREMAP_MAYMOVE | MREMAP_FIXED, target);
+  if (result == MAP_FAILED) {
+    munmap(target, newLength);
+    return NULL;
+  }
+  return result;
+}
+
+// Has realloc()'s contract: NULL for a failure leaves the block as it
+// was. Blocks carry no header, so `oldSize` must
+// be the size the block was last allocated with.
+void* heapReallocate(void* pointer, size_t oldSize, size_t newSize) {
+  if (newSize == 0) {
+    if (pointer != NULL) release(pointer, oldSize);
+    return NULL;
+  }
+  if (pointer == NULL) return allocate(newSize);
+
+  if (oldSize > HEAP_MEDIUM_MAX && newSize > HEAP_MEDIUM_MAX) {
+    return remapLarge(pointer, oldSize, newSize);
+  }
+  if (oldSize <= HEAP_MEDIUM_MAX && newSize <= HEAP_MEDIUM_MAX) {
+    size_t oldClass;
+    size_t newClass;
+    if (sizeClass(oldSize, &oldClass) == sizeClass(newSize, &newClass)) {
+      return pointer;
+    }
+  }
+
+  void* result = allocate(newSize);
+  if (result == NULL) return NULL;
+  memcpy(result, pointer, oldSize < newSize ? oldSize : newSize);
+  release(pointer, oldSize);
+  return result;
+}
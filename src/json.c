@@ -0,0 +1,612 @@
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "bitmask.h"
+#include "json.h"
+#include "memory.h"
+#include "number.h"
+#include "object.h"
+#include "vm.h"
+
+// Bits alternate between positions with odd and even offsets.
+#define ODD_BITS 0xaaaaaaaaaaaaaaaaULL
+
+typedef struct {
+    Obj* owner;
+    const char* data;
+    size_t length;
+
+    // Offsets of every structural character, opening and closing quote
+    // and scalar start, in document order.
+    uint32_t* indices;
+    size_t count;
+    size_t capacity;
+    size_t next;
+    int depth;
+} Parser;
+
+typedef struct {
+    char* chars;
+    size_t count;
+    size_t capacity;
+} Writer;
+
+// Finds the bytes escaped by a backslash. A run of backslashes escapes
+// the byte after it only when the run has odd length, which subtracting
+// the run starts from alternating bits works out for all runs at once.
+// `carry` tracks whether the first byte of the block is escaped.
+static uint64_t findEscaped(uint64_t backslashes, uint64_t* carry) {
+  if (backslashes == 0) {
+    uint64_t escaped = *carry;
+    *carry = 0;
+    return escaped;
+  }
+
+  uint64_t potential = backslashes & ~*carry;
+  uint64_t maybeEscaped = potential << 1;
+  uint64_t series = (maybeEscaped | ODD_BITS) - potential;
+  uint64_t escapeAndTerminal = series ^ ODD_BITS;
+  uint64_t escaped = escapeAndTerminal ^ (backslashes | *carry);
+  *carry = (escapeAndTerminal & backslashes) >> 63;
+  return escaped;
+}
+
+static bool jsonError(size_t position, const char* message) {
+  runtimeError("Invalid JSON at byte %zu: %s", position, message);
+  return false;
+}
+
+// Stage one: classifies the document a block at a time and records where
+// each token starts. Quoted text is masked out, so its contents can't
+// look like structure.
+static bool buildIndex(Parser* parser) {
+  uint64_t escapeCarry = 0;
+  uint64_t inString = 0;
+  uint64_t scalarCarry = 0;
+
+  for (size_t offset = 0; offset < parser->length; offset += BLOCK_SIZE) {
+    const char* bytes = parser->data + offset;
+    char tail[BLOCK_SIZE];
+    if (parser->length - offset < BLOCK_SIZE) {
+      memset(tail, ' ', BLOCK_SIZE);
+      memcpy(tail, bytes, parser->length - offset);
+      bytes = tail;
+    }
+
+    uint64_t escaped = findEscaped(matchByte(bytes, '\\'), &escapeCarry);
+    uint64_t quotes = matchByte(bytes, '"') & ~escaped;
+    uint64_t quoted = prefixXor(quotes) ^ inString;
+    inString = (uint64_t)((int64_t)quoted >> 63);
+
+    uint64_t operators = matchByte(bytes, '{') | matchByte(bytes, '}') |
+                         matchByte(bytes, '[') | matchByte(bytes, ']') |
+                         matchByte(bytes, ':') | matchByte(bytes, ',');
+    uint64_t whitespace = matchByte(bytes, ' ') | matchByte(bytes, '\t') |
+                          matchByte(bytes, '\n') | matchByte(bytes, '\r');
+    uint64_t scalars = ~(operators | whitespace | quotes | quoted);
+    uint64_t scalarStarts = scalars & ~((scalars << 1) | scalarCarry);
+    scalarCarry = scalars >> 63;
+
+    uint64_t structural = (operators & ~quoted) | quotes | scalarStarts;
+    if (parser->capacity < parser->count + BLOCK_SIZE) {
+      size_t oldCapacity = parser->capacity;
+      parser->capacity = GROW_CAPACITY(oldCapacity) < BLOCK_SIZE
+          ? BLOCK_SIZE : GROW_CAPACITY(oldCapacity);
+      parser->indices = GROW_ARRAY(uint32_t, parser->indices,
+                                   oldCapacity, parser->capacity);
+    }
+    while (structural != 0) {
+      parser->indices[parser->count++] =
+          (uint32_t)(offset + __builtin_ctzll(structural));
+      structural &= structural - 1;
+    }
+  }
+
+  if (inString != 0) {
+    return jsonError(parser->length, "Unterminated string.");
+  }
+  return true;
+}
+
+static int peekChar(Parser* parser) {
+  if (parser->next >= parser->count) return -1;
+  return parser->data[parser->indices[parser->next]];
+}
+
+static size_t peekPosition(Parser* parser) {
+  if (parser->next >= parser->count) return parser->length;
+  return parser->indices[parser->next];
+}
+
+static bool consume(Parser* parser, char c, const char* message) {
+  if (peekChar(parser) != c) {
+    return jsonError(peekPosition(parser), message);
+  }
+  parser->next++;
+  return true;
+}
+
+static int hexDigit(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+static bool readHex(const char* chars, const char* end, uint32_t* code) {
+  if (end - chars < 4) return false;
+  *code = 0;
+  for (int i = 0; i < 4; i++) {
+    int digit = hexDigit(chars[i]);
+    if (digit < 0) return false;
+    *code = *code * 16 + (uint32_t)digit;
+  }
+  return true;
+}
+
+static int encodeUtf8(uint32_t code, char* out) {
+  if (code < 0x80) {
+    out[0] = (char)code;
+    return 1;
+  } else if (code < 0x800) {
+    out[0] = (char)(0xc0 | (code >> 6));
+    out[1] = (char)(0x80 | (code & 0x3f));
+    return 2;
+  } else if (code < 0x10000) {
+    out[0] = (char)(0xe0 | (code >> 12));
+    out[1] = (char)(0x80 | ((code >> 6) & 0x3f));
+    out[2] = (char)(0x80 | (code & 0x3f));
+    return 3;
+  }
+  out[0] = (char)(0xf0 | (code >> 18));
+  out[1] = (char)(0x80 | ((code >> 12) & 0x3f));
+  out[2] = (char)(0x80 | ((code >> 6) & 0x3f));
+  out[3] = (char)(0x80 | (code & 0x3f));
+  return 4;
+}
+
+// Decodes escapes into a new string. No escape decodes to more bytes than
+// it was written with, so the input length bounds the output.
+static bool unescapeString(Parser* parser, const char* chars, size_t length,
+                           Value* value) {
+  char* buffer = ALLOCATE(char, length);
+  const char* end = chars + length;
+  size_t count = 0;
+
+  for (const char* current = chars; current < end; current++) {
+    if (*current != '\\') {
+      buffer[count++] = *current;
+      continue;
+    }
+
+    current++;
+    switch (*current) {
+      case '"': buffer[count++] = '"'; break;
+      case '\\': buffer[count++] = '\\'; break;
+      case '/': buffer[count++] = '/'; break;
+      case 'b': buffer[count++] = '\b'; break;
+      case 'f': buffer[count++] = '\f'; break;
+      case 'n': buffer[count++] = '\n'; break;
+      case 'r': buffer[count++] = '\r'; break;
+      case 't': buffer[count++] = '\t'; break;
+      case 'u': {
+        uint32_t code;
+        if (!readHex(current + 1, end, &code)) goto invalid;
+        current += 4;
+
+        // Characters outside the BMP come as a surrogate pair.
+        if (code >= 0xd800 && code < 0xdc00) {
+          uint32_t low;
+          if (end - current < 3 || current[1] != '\\' || current[2] != 'u' ||
+              !readHex(current + 3, end, &low) ||
+              low < 0xdc00 || low >= 0xe000) {
+            goto invalid;
+          }
+          code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+          current += 6;
+        }
+        count += encodeUtf8(code, buffer + count);
+        break;
+      }
+      default:
+        goto invalid;
+    }
+  }
+
+  *value = OBJ_VAL(copyString(buffer, (int)count));
+  FREE_ARRAY(char, buffer, length);
+  return true;
+
+invalid:
+  FREE_ARRAY(char, buffer, length);
+  return jsonError((size_t)(chars - parser->data),
+                   "Invalid escape in string.");
+}
+
+// Strings without escapes become views into the document.
+static bool parseString(Parser* parser, size_t start, Value* value) {
+  size_t end = parser->indices[parser->next++];
+  const char* chars = parser->data + start + 1;
+  size_t length = end - start - 1;
+  if (length > INT32_MAX) {
+    return jsonError(start, "String is too long.");
+  }
+
+  if (memchr(chars, '\\', length) != NULL) {
+    return unescapeString(parser, chars, length, value);
+  }
+  *value = OBJ_VAL(newStringView(parser->owner, chars, (int)length));
+  return true;
+}
+
+static bool isScalarEnd(char c) {
+  switch (c) {
+    case ' ': case '\t': case '\n': case '\r':
+    case '{': case '}': case '[': case ']': case ':': case ',':
+      return true;
+    default:
+      return false;
+  }
+}
+
+static bool isDigit(char c) {
+  return c >= '0' && c <= '9';
+}
+
+// Follows JSON's number grammar, which is stricter than strtod(): no
+// leading zeros, and a digit on both sides of a decimal point.
+static bool isNumber(const char* chars, size_t length) {
+  size_t i = chars[0] == '-' ? 1 : 0;
+  if (i == length || !isDigit(chars[i])) return false;
+  if (chars[i] == '0') {
+    i++;
+  } else {
+    while (i < length && isDigit(chars[i])) i++;
+  }
+
+  if (i < length && chars[i] == '.') {
+    i++;
+    if (i == length || !isDigit(chars[i])) return false;
+    while (i < length && isDigit(chars[i])) i++;
+  }
+
+  if (i < length && (chars[i] == 'e' || chars[i] == 'E')) {
+    i++;
+    if (i < length && (chars[i] == '+' || chars[i] == '-')) i++;
+    if (i == length || !isDigit(chars[i])) return false;
+    while (i < length && isDigit(chars[i])) i++;
+  }
+  return i == length;
+}
+
+// Lox has no null, so JSON null reads as false.
+static bool parseScalar(Parser* parser, size_t start, Value* value) {
+  const char* chars = parser->data + start;
+  size_t length = 0;
+  while (start + length < parser->length && !isScalarEnd(chars[length])) {
+    length++;
+  }
+
+  if (length == 4 && memcmp(chars, "true", 4) == 0) {
+    *value = BOOL_VAL(true);
+    return true;
+  }
+  if (length == 5 && memcmp(chars, "false", 5) == 0) {
+    *value = BOOL_VAL(false);
+    return true;
+  }
+  if (length == 4 && memcmp(chars, "null", 4) == 0) {
+    *value = BOOL_VAL(false);
+    return true;
+  }
+
+  if (chars[0] != '-' && (chars[0] < '0' || chars[0] > '9')) {
+    return jsonError(start, "Unexpected character.");
+  }
+  if (!isNumber(chars, length)) return jsonError(start, "Invalid number.");
+
+  // Integers that fit in 64 bits stay integers, like integer literals.
+  // Negative ones accumulate downwards, so INT64_MIN fits too.
+  size_t sign = chars[0] == '-' ? 1 : 0;
+  size_t digits = sign;
+  while (digits < length && isDigit(chars[digits])) digits++;
+  if (digits == length) {
+    int64_t integer = 0;
+    bool overflow = false;
+    for (size_t i = sign; i < length && !overflow; i++) {
+      int digit = chars[i] - '0';
+      overflow = __builtin_mul_overflow(integer, 10, &integer) ||
+                 (sign ? __builtin_sub_overflow(integer, digit, &integer)
+                       : __builtin_add_overflow(integer, digit, &integer));
+    }
+    if (!overflow) {
+      *value = INT_VAL(integer);
+      return true;
+    }
+  }
+
+  double number;
+  if (!parseNumber(chars, length, &number)) {
+    return jsonError(start, "Invalid number.");
+  }
+  *value = NUMBER_VAL(number);
+  return true;
+}
+
+static bool parseValue(Parser* parser, Value* value);
+
+static bool parseObject(Parser* parser, Value* value) {
+  ObjMap* map = newMap();
+  *value = OBJ_VAL(map);
+  if (peekChar(parser) == '}') {
+    parser->next++;
+    return true;
+  }
+
+  for (;;) {
+    if (peekChar(parser) != '"') {
+      return jsonError(peekPosition(parser), "Expected string key.");
+    }
+
+    Value key;
+    Value element;
+    if (!parseString(parser, parser->indices[parser->next++], &key)) {
+      return false;
+    }
+    if (!consume(parser, ':', "Expected ':' after key.")) return false;
+    if (!parseValue(parser, &element)) return false;
+    tableSet(&map->table, key, element);
+
+    if (peekChar(parser) == ',') {
+      parser->next++;
+      continue;
+    }
+    if (!consume(parser, '}', "Expected ',' or '}' in object.")) {
+      return false;
+    }
+    break;
+  }
+  return true;
+}
+
+static bool parseArray(Parser* parser, Value* value) {
+  ObjList* list = newList(0);
+  *value = OBJ_VAL(list);
+  if (peekChar(parser) == ']') {
+    parser->next++;
+    return true;
+  }
+
+  for (;;) {
+    Value element;
+    if (!parseValue(parser, &element)) return false;
+    writeValueArray(&list->items, element);
+
+    if (peekChar(parser) == ',') {
+      parser->next++;
+      continue;
+    }
+    return consume(parser, ']', "Expected ',' or ']' in array.");
+  }
+}
+
+// Stage two: walks the index to build maps, lists and values.
+static bool parseValue(Parser* parser, Value* value) {
+  if (parser->next >= parser->count) {
+    return jsonError(parser->length, "Unexpected end of input.");
+  }
+
+  size_t position = parser->indices[parser->next++];
+  switch (parser->data[position]) {
+    case '{':
+    case '[': {
+      if (++parser->depth > MAX_DEPTH) {
+        return jsonError(position, "Nesting is too deep.");
+      }
+      bool success = parser->data[position] == '{'
+          ? parseObject(parser, value)
+          : parseArray(parser, value);
+      parser->depth--;
+      return success;
+    }
+    case '"':
+      return parseString(parser, position, value);
+    case '}': case ']': case ':': case ',':
+      return jsonError(position, "Expected a value.");
+    default:
+      return parseScalar(parser, position, value);
+  }
+}
+
+bool parseJson(Obj* owner, const char* data, size_t length, Value* result) {
+  if (length > UINT32_MAX) {
+    runtimeError("JSON document is too large.");
+    return false;
+  }
+
+  Parser parser;
+  parser.owner = owner;
+  parser.data = data;
+  parser.length = length;
+  parser.indices = NULL;
+  parser.count = 0;
+  parser.capacity = 0;
+  parser.next = 0;
+  parser.depth = 0;
+
+  bool success = buildIndex(&parser) && parseValue(&parser, result);
+  if (success && parser.next < parser.count) {
+    success = jsonError(peekPosition(&parser),
+                        "Unexpected content after value.");
+  }
+
+  FREE_ARRAY(uint32_t, parser.indices, parser.capacity);
+  return success;
+}
+
+static void writeBytes(Writer* writer, const char* bytes, size_t length) {
+  if (writer->capacity < writer->count + length) {
+    size_t oldCapacity = writer->capacity;
+    size_t capacity = oldCapacity;
+    while (capacity < writer->count + length) {
+      capacity = GROW_CAPACITY(capacity);
+    }
+    writer->chars = GROW_ARRAY(char, writer->chars, oldCapacity, capacity);
+    writer->capacity = capacity;
+  }
+
+  memcpy(writer->chars + writer->count, bytes, length);
+  writer->count += length;
+}
+
+// Copies runs of plain characters in one go and escapes the rest.
+static void writeString(Writer* writer, ObjString* string) {
+  writeBytes(writer, "\"", 1);
+
+  const char* chars = string->chars;
+  int run = 0;
+  for (int i = 0; i < string->length; i++) {
+    unsigned char c = (unsigned char)chars[i];
+    if (c >= 0x20 && c != '"' && c != '\\') continue;
+
+    writeBytes(writer, chars + run, i - run);
+    run = i + 1;
+
+    char escape[8];
+    switch (c) {
+      case '"': writeBytes(writer, "\\\"", 2); break;
+      case '\\': writeBytes(writer, "\\\\", 2); break;
+      case '\b': writeBytes(writer, "\\b", 2); break;
+      case '\f': writeBytes(writer, "\\f", 2); break;
+      case '\n': writeBytes(writer, "\\n", 2); break;
+      case '\r': writeBytes(writer, "\\r", 2); break;
+      case '\t': writeBytes(writer, "\\t", 2); break;
+      default:
+        snprintf(escape, sizeof(escape), "\\u%04x", c);
+        writeBytes(writer, escape, 6);
+        break;
+    }
+  }
+
+  writeBytes(writer, chars + run, string->length - run);
+  writeBytes(writer, "\"", 1);
+}
+
+// Doubles are written with the shortest digits that read back exactly,
+// and always with a fraction or exponent so they read back as doubles.
+static bool writeNumber(Writer* writer, double number) {
+  if (!isfinite(number)) {
+    runtimeError("Can't convert NaN or infinity to JSON.");
+    return false;
+  }
+
+  char buffer[NUMBER_BUFFER_SIZE];
+  int length = formatNumber(number, buffer);
+  writeBytes(writer, buffer, length);
+  if (strpbrk(buffer, ".e") == NULL) writeBytes(writer, ".0", 2);
+  return true;
+}
+
+static bool writeValue(Writer* writer, Value value, int depth) {
+  if (depth > MAX_DEPTH) {
+    runtimeError("Value is nested too deeply to convert to JSON.");
+    return false;
+  }
+
+  char buffer[NUMBER_BUFFER_SIZE];
+  switch (value.type) {
+    case VAL_BOOL:
+      if (AS_BOOL(value)) {
+        writeBytes(writer, "true", 4);
+      } else {
+        writeBytes(writer, "false", 5);
+      }
+      return true;
+    case VAL_NUMBER:
+      return writeNumber(writer, AS_NUMBER(value));
+    case VAL_INT: {
+      int length = formatInteger(AS_INT(value), buffer);
+      writeBytes(writer, buffer, length);
+      return true;
+    }
+    case VAL_OBJ:
+      break;
+  }
+
+  switch (OBJ_TYPE(value)) {
+    case OBJ_LIST: {
+      ObjList* list = AS_LIST(value);
+      writeBytes(writer, "[", 1);
+      for (int i = 0; i < list->items.count; i++) {
+        if (i > 0) writeBytes(writer, ",", 1);
+        if (!writeValue(writer, list->items.values[i], depth + 1)) {
+          return false;
+        }
+      }
+      writeBytes(writer, "]", 1);
+      return true;
+    }
+    case OBJ_MAP: {
+      Table* table = &AS_MAP(value)->table;
+      writeBytes(writer, "{", 1);
+      for (int i = 0; i < table->count; i++) {
+        Entry* entry = &table->entries[i];
+        if (!IS_STRING(entry->key)) {
+          runtimeError("JSON object keys must be strings.");
+          return false;
+        }
+
+        if (i > 0) writeBytes(writer, ",", 1);
+        writeString(writer, AS_STRING(entry->key));
+        writeBytes(writer, ":", 1);
+        if (!writeValue(writer, entry->value, depth + 1)) return false;
+      }
+      writeBytes(writer, "}", 1);
+      return true;
+    }
+    case OBJ_STRING:
+      writeString(writer, AS_STRING(value));
+      return true;
+    case OBJ_VIEW: {
+      ObjView* view = AS_VIEW(value);
+      if (!checkView(view)) return false;
+      writeBytes(writer, "[", 1);
+      for (int i = 0; i < view->length; i++) {
+        if (i > 0) writeBytes(writer, ",", 1);
+        if (!writeValue(writer, viewElement(view, i), depth + 1)) {
+          return false;
+        }
+      }
+      writeBytes(writer, "]", 1);
+      return true;
+    }
+    case OBJ_FILE:
+    case OBJ_GENERATOR:
+    case OBJ_MODULE:
+    case OBJ_POLL:
+    case OBJ_STREAM:
+      break;
+  }
+
+  runtimeError("Can only convert bools, numbers, strings, lists and maps "
+               "to JSON.");
+  return false;
+}
+
+bool stringifyJson(Value value, Value* result) {
+  Writer writer;
+  writer.chars = NULL;
+  writer.count = 0;
+  writer.capacity = 0;
+
+  bool success = writeValue(&writer, value, 0);
+  if (success && writer.count > INT32_MAX) {
+    runtimeError("JSON text is too long for a string.");
+    success = false;
+  }
+  if (success) *result = OBJ_VAL(copyString(writer.chars, (int)writer.count));
+
+  FREE_ARRAY(char, writer.chars, writer.capacity);
+  return success;
+}
@@ -0,0 +1,309 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "loop.h"
+#include "memory.h"
+#include "object.h"
+#include "vm.h"
+
+#define READ_CHUNK_SIZE (64 * 1024)
+#define MAX_EVENTS 64
+
+// Opens a pipe, FIFO or device for reading. Nothing waits for a FIFO's
+// writer to turn up, so until one has, reads find it empty rather than at
+// its end.
+ObjStream* openStream(const char* path) {
+  int fd = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+  if (fd < 0) return NULL;
+
+  struct stat info;
+  if (fstat(fd, &info) < 0) {
+    close(fd);
+    return NULL;
+  }
+  ObjStream* stream = newStream(fd);
+  stream->fifo = S_ISFIFO(info.st_mode);
+  return stream;
+}
+
+// Connecting doesn't wait either: a server whose queue of connections is
+// full refuses this one.
+ObjStream* connectStream(const char* path) {
+  struct sockaddr_un address;
+  if (strlen(path) >= sizeof(address.sun_path)) return NULL;
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  strcpy(address.sun_path, path);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0) return NULL;
+  if (connect(fd, (struct sockaddr*)&address, sizeof(address)) < 0) {
+    close(fd);
+    return NULL;
+  }
+  return newStream(fd);
+}
+
+// A timer fires every `milliseconds` and closes after `count` ticks.
+ObjStream* openTimer(int64_t milliseconds, int64_t count) {
+  int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (fd < 0) return NULL;
+
+  struct itimerspec spec;
+  spec.it_interval.tv_sec = milliseconds / 1000;
+  spec.it_interval.tv_nsec = (milliseconds % 1000) * 1000000;
+  spec.it_value = spec.it_interval;
+  if (timerfd_settime(fd, 0, &spec, NULL) < 0) {
+    close(fd);
+    return NULL;
+  }
+
+  ObjStream* stream = newStream(fd);
+  stream->timer = true;
+  stream->limit = count;
+  stream->closed = count == 0;
+  return stream;
+}
+
+void closeStream(ObjStream* stream) {
+  if (stream->fd >= 0) close(stream->fd);
+  FREE_ARRAY(char, stream->buffer, stream->capacity);
+  stream->fd = -1;
+  stream->buffer = NULL;
+  stream->capacity = 0;
+}
+
+// Reads whatever has arrived without waiting for more.
+static bool fillStream(ObjStream* stream) {
+  if (stream->timer) {
+    // Drain the timer even once it's closed, so it stops being readable.
+    uint64_t expirations;
+    ssize_t bytesRead = read(stream->fd, &expirations, sizeof(expirations));
+    if (bytesRead == sizeof(expirations)) {
+      stream->ticks += (int64_t)expirations;
+    } else if (bytesRead < 0 && errno != EAGAIN && errno != EINTR) {
+      runtimeError("Could not read timer: %s.", strerror(errno));
+      return false;
+    }
+    return true;
+  }
+  if (stream->closed) return true;
+
+  if (stream->start > 0) {
+    memmove(stream->buffer, stream->buffer + stream->start,
+            stream->count - stream->start);
+    stream->count -= stream->start;
+    stream->start = 0;
+  }
+
+  for (;;) {
+    if (stream->capacity - stream->count < READ_CHUNK_SIZE / 2) {
+      size_t capacity = stream->capacity < READ_CHUNK_SIZE
+          ? READ_CHUNK_SIZE : stream->capacity * 2;
+      stream->buffer = GROW_ARRAY(char, stream->buffer,
+                                  stream->capacity, capacity);
+      stream->capacity = capacity;
+    }
+
+    size_t space = stream->capacity - stream->count;
+    ssize_t bytesRead = read(stream->fd, stream->buffer + stream->count,
+                             space);
+    if (bytesRead > 0) {
+      stream->count += (size_t)bytesRead;
+      // A short read means the pipe is drained for now.
+      if ((size_t)bytesRead < space) return true;
+    } else if (bytesRead == 0) {
+      // A FIFO reads as empty before its first writer too, but only
+      // reports a hangup once a writer has come and gone.
+      struct pollfd entry = {stream->fd, POLLIN, 0};
+      if (stream->fifo && (poll(&entry, 1, 0) <= 0 ||
+                           (entry.revents & POLLHUP) == 0)) {
+        return true;
+      }
+      stream->closed = true;
+      return true;
+    } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      return true;
+    } else if (errno != EINTR) {
+      runtimeError("Could not read stream: %s.", strerror(errno));
+      return false;
+    }
+  }
+}
+
+// Takes the next whole line, or the unterminated rest once the stream
+// has closed. A timer yields its tick number instead.
+static bool takeLine(ObjStream* stream, Value* line) {
+  if (stream->timer) {
+    if (stream->ticks == 0 || stream->fired == stream->limit) return false;
+    stream->ticks--;
+    stream->fired++;
+    if (stream->fired == stream->limit) stream->closed = true;
+    *line = INT_VAL(stream->fired);
+    return true;
+  }
+
+  char* begin = stream->buffer + stream->start;
+  size_t available = stream->count - stream->start;
+  char* newline = available > 0 ? memchr(begin, '\n', available) : NULL;
+
+  size_t length;
+  if (newline != NULL) {
+    length = (size_t)(newline - begin);
+    stream->start += length + 1;
+  } else if (stream->closed && available > 0) {
+    length = available;
+    stream->start = stream->count;
+  } else {
+    return false;
+  }
+
+  if (length > 0 && begin[length - 1] == '\r') length--;
+  *line = OBJ_VAL(copyString(begin, (int)length));
+  return true;
+}
+
+// Has the run wait until `fd` is ready for `events`, and run the
+// instruction that called this again.
+static bool waitFor(int fd, short events) {
+  vm.waitFd = fd;
+  vm.waitEvents = events;
+  return false;
+}
+
+// Takes the next line from the one stream, or has the run wait for one.
+bool nextStreamLine(ObjStream* stream, Value* line, bool* done) {
+  *done = false;
+  if (takeLine(stream, line)) return true;
+  if (!stream->closed) {
+    if (!fillStream(stream)) return false;
+    if (takeLine(stream, line)) return true;
+  }
+  if (stream->closed) {
+    *done = true;
+    return true;
+  }
+  return waitFor(stream->fd, POLLIN);
+}
+
+// Writes all of `chars`, having the run wait whenever the other end is
+// full. The write goes on from `vm.waitProgress` when it runs again.
+// Sockets are written with MSG_NOSIGNAL so a closed peer is an error
+// rather than a SIGPIPE.
+bool writeStream(ObjStream* stream, const char* chars, size_t length) {
+  size_t sent = vm.waitProgress;
+  vm.waitProgress = 0;
+  while (sent < length) {
+    ssize_t written = send(stream->fd, chars + sent, length - sent,
+                           MSG_NOSIGNAL);
+    if (written < 0 && errno == ENOTSOCK) {
+      written = write(stream->fd, chars + sent, length - sent);
+    }
+
+    if (written >= 0) {
+      sent += (size_t)written;
+    } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      vm.waitProgress = sent;
+      return waitFor(stream->fd, POLLOUT);
+    } else if (errno != EINTR) {
+      runtimeError("Could not write stream: %s.", strerror(errno));
+      return false;
+    }
+  }
+  return true;
+}
+
+// Watches each stream in the list, which must hold only streams and
+// none twice. Each one's epoll data is its index in the list. Sets errno
+// on failure.
+ObjPoll* openPoll(ObjList* streams) {
+  int count = streams->items.count;
+  int epoll = epoll_create1(EPOLL_CLOEXEC);
+  if (epoll < 0) return NULL;
+
+  for (int i = 0; i < count; i++) {
+    ObjStream* stream = AS_STREAM(streams->items.values[i]);
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.u32 = (uint32_t)i;
+    if (!stream->closed &&
+        epoll_ctl(epoll, EPOLL_CTL_ADD, stream->fd, &event) < 0) {
+      int error = errno;
+      close(epoll);
+      errno = error;
+      return NULL;
+    }
+  }
+
+  ObjPoll* poll = newPoll(count);
+  poll->epoll = epoll;
+  for (int i = 0; i < count; i++) {
+    poll->streams[i] = AS_STREAM(streams->items.values[i]);
+  }
+  return poll;
+}
+
+void closePoll(ObjPoll* poll) {
+  if (poll->epoll >= 0) close(poll->epoll);
+  FREE_ARRAY(ObjStream*, poll->streams, poll->count);
+  poll->epoll = -1;
+  poll->streams = NULL;
+  poll->count = 0;
+}
+
+// Yields [index, line] for the next line from any stream. Lines already
+// buffered are handed out round-robin before checking for more, so one
+// busy stream can't starve the others. Done once every stream has closed
+// and drained. With nothing to hand out, the run waits on the epoll
+// descriptor, which is readable once any stream is.
+bool nextEvent(ObjPoll* poll, Value* event, bool* done) {
+  *done = false;
+  for (;;) {
+    bool open = false;
+    for (int i = 0; i < poll->count; i++) {
+      int index = (poll->next + i) % poll->count;
+      ObjStream* stream = poll->streams[index];
+
+      Value line;
+      if (takeLine(stream, &line)) {
+        poll->next = (index + 1) % poll->count;
+        ObjList* pair = newList(2);
+        pair->items.values[0] = INT_VAL(index);
+        pair->items.values[1] = line;
+        *event = OBJ_VAL(pair);
+        return true;
+      }
+      if (!stream->closed) open = true;
+    }
+
+    if (!open) {
+      *done = true;
+      return true;
+    }
+
+    struct epoll_event events[MAX_EVENTS];
+    int count = epoll_wait(poll->epoll, events, MAX_EVENTS, 0);
+    if (count < 0) {
+      if (errno == EINTR) continue;
+      runtimeError("Could not wait for streams: %s.", strerror(errno));
+      return false;
+    }
+    if (count == 0) return waitFor(poll->epoll, POLLIN);
+
+    for (int i = 0; i < count; i++) {
+      ObjStream* stream = poll->streams[events[i].data.u32];
+      if (!fillStream(stream)) return false;
+      if (stream->closed) {
+        epoll_ctl(poll->epoll, EPOLL_CTL_DEL, stream->fd, NULL);
+      }
+    }
+  }
+}
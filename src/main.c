@@ -1,13 +1,31 @@
+#include <errno.h>
+#include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-#include "common.h"
-#include "vm.h"
-#include "chunk.h"
-#include "debug.h"
+#include "clox.h"
 
-static void repl() {
+// A script reading or writing a stream that isn't ready suspends, so
+// nothing waits inside the library. The command has nothing else to do,
+// so it waits here and goes on.
+static CloxResult finish(CloxVM* vm, CloxResult result) {
+  while (result == CLOX_SUSPENDED) {
+    int events;
+    struct pollfd entry;
+    entry.fd = cloxWaitFd(vm, &events);
+    entry.events = events == CLOX_WRITABLE ? POLLOUT : POLLIN;
+    while (poll(&entry, 1, -1) < 0) {
+      if (errno != EINTR) {
+        return cloxResumeError(vm, "Could not wait for stream.");
+      }
+    }
+    result = cloxResume(vm);
+  }
+  return result;
+}
+
+static void repl(CloxVM* vm) {
   char line[1024];
   for (;;) {
     printf("> ");
@@ -17,7 +35,7 @@ static void repl() {
       break;
     }
 
-    interpret(line);
+    finish(vm, cloxEval(vm, line, NULL));
   }
 }
 
@@ -50,27 +68,60 @@ static char* readFile(const char* path) {
   return buffer;
 }
 
-static void runFile(const char* path) {
+static void runFile(CloxVM* vm, const char* path) {
   char* source = readFile(path);
-  InterpretResult result = interpret(source);
+  CloxResult result = finish(vm, cloxEval(vm, source, path));
   free(source);
 
-  if (result == INTERPRET_COMPILE_ERROR) exit(65);
-  if (result == INTERPRET_RUNTIME_ERROR) exit(70);
+  if (result == CLOX_COMPILE_ERROR) exit(65);
+  if (result == CLOX_RUNTIME_ERROR) exit(70);
+}
+
+static void usage() {
+  fprintf(stderr, "Usage: clox [--reload] [--huge-pages] [--memory-limit MB] "
+                  "[path]\n");
+  exit(64);
 }
 
 int main(int argc, const char* argv[]) {
-  initVM();
+  // --reload picks up edits to imported modules while the script runs.
+  // --huge-pages backs the heap and the stack with transparent huge pages.
+  // --memory-limit gives the script a quota, in megabytes.
+  int flags = CLOX_PRINT;
+  size_t memoryLimit = 0;
+  while (argc > 1 && strncmp(argv[1], "--", 2) == 0) {
+    if (strcmp(argv[1], "--reload") == 0) {
+      flags |= CLOX_RELOAD;
+    } else if (strcmp(argv[1], "--huge-pages") == 0) {
+      flags |= CLOX_HUGE_PAGES;
+    } else if (strcmp(argv[1], "--memory-limit") == 0 && argc > 2) {
+      long megabytes = atol(argv[2]);
+      if (megabytes < 1) usage();
+      memoryLimit = (size_t)megabytes * 1024 * 1024;
+      argc--;
+      argv++;
+    } else {
+      usage();
+    }
+    argc--;
+    argv++;
+  }
+
+  if (argc > 2) usage();
+
+  CloxVM* vm = cloxNewVM(flags);
+  if (vm == NULL) {
+    fprintf(stderr, "Not enough memory to start.\n");
+    exit(70);
+  }
+  if (memoryLimit > 0) cloxSetMemoryLimit(vm, memoryLimit);
 
   if (argc == 1) {
-    repl();
-  } else if (argc == 2) {
-    runFile(argv[1]);
+    repl(vm);
   } else {
-    fprintf(stderr, "Usage: clox [path]\n");
-    exit(64);
+    runFile(vm, argv[1]);
   }
 
-  freeVM();
+  cloxFreeVM(vm);
   return 0;
 }
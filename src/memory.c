@@ -1,14 +1,316 @@
 #include <stdlib.h>
 
+#include "file.h"
+#include "heap.h"
+#include "loop.h"
 #include "memory.h"
+#include "object.h"
+#include "vm.h"
+
+#define RESERVE_SIZE (1024 * 1024)
+
+// Memory set aside so that running out doesn't end the process. Callers
+// of reallocate() can't handle a failure, so the first one frees this and
+// tries again. The next check collects garbage, and the script gets "Out
+// of memory." unless that leaves room to set the reserve aside again.
+static void* reserve = NULL;
+
+static bool spendReserve() {
+  if (reserve == NULL) return false;
+  free(reserve);
+  reserve = NULL;
+  vm.memoryExhausted = true;
+  vm.nextGC = 0;
+  return true;
+}
+
+// For an allocation even the reserve didn't make room for, usually a
+// large one. While an instruction runs, it gets the error at once, jumping
+// back into run() the way a stack overflow does. Anywhere that would leave
+// something half done or leak blocks it holds, there's no way to go on:
+// the compiler, module loading and every native, built-in or not.
+static void outOfMemory() {
+  if (vm.overflow == NULL) exit(1);
+  vm.memoryExhausted = true;
+  vm.nextGC = 0;
+  runtimeError("Out of memory.");
+  siglongjmp(*vm.overflow, JUMP_OUT_OF_MEMORY);
+}
+
+static void* resize(void* pointer, size_t oldSize, size_t newSize) {
+  if (usingHugePages()) return heapReallocate(pointer, oldSize, newSize);
 
-void* reallocate(void* pointer, size_t oldSize, size_t newSize) {
   if (newSize == 0) {
     free(pointer);
     return NULL;
   }
+  return realloc(pointer, newSize);
+}
+
+// Never returns NULL for a block it was asked for. A failure leaves
+// `pointer` as it was, so callers that may fail must set their sizes
+// only once the block is theirs.
+void* reallocate(void* pointer, size_t oldSize, size_t newSize) {
+  void* result = resize(pointer, oldSize, newSize);
+  if (result == NULL && newSize > 0) {
+    if (spendReserve()) result = resize(pointer, oldSize, newSize);
+    if (result == NULL) outOfMemory();
+  }
+  vm.bytesAllocated += newSize - oldSize;
+  return result;
+}
+
+static void* allocateBlock(size_t alignment, size_t size) {
+  if (usingHugePages()) return heapReallocate(NULL, 0, size);
+  return aligned_alloc(alignment, size);
+}
 
-  void* result = realloc(pointer, newSize);
-  if (result == NULL) exit(1);
+// `size` must be a multiple of `alignment`. The result is released with
+// reallocate() like any other allocation. The huge page heap already
+// aligns such blocks to a cache line, which is as much as callers ask for.
+void* allocateAligned(size_t alignment, size_t size) {
+  void* result = allocateBlock(alignment, size);
+  if (result == NULL) {
+    if (spendReserve()) result = allocateBlock(alignment, size);
+    if (result == NULL) outOfMemory();
+  }
+  vm.bytesAllocated += size;
   return result;
 }
+
+static void freeObject(Obj* object) {
+  switch (object->type) {
+    case OBJ_FILE:
+      closeFile((ObjFile*)object);
+      FREE(ObjFile, object);
+      break;
+    case OBJ_GENERATOR: {
+      ObjGenerator* generator = (ObjGenerator*)object;
+      freeValueArray(&generator->window);
+      FREE(ObjGenerator, object);
+      break;
+    }
+    case OBJ_LIST: {
+      ObjList* list = (ObjList*)object;
+      freeValueArray(&list->items);
+      FREE(ObjList, object);
+      break;
+    }
+    case OBJ_MAP: {
+      ObjMap* map = (ObjMap*)object;
+      freeTable(&map->table);
+      FREE(ObjMap, object);
+      break;
+    }
+    case OBJ_MODULE:
+      freeChunk(&((ObjModule*)object)->chunk);
+      FREE(ObjModule, object);
+      break;
+    case OBJ_POLL:
+      closePoll((ObjPoll*)object);
+      FREE(ObjPoll, object);
+      break;
+    case OBJ_STREAM:
+      closeStream((ObjStream*)object);
+      FREE(ObjStream, object);
+      break;
+    case OBJ_STRING: {
+      ObjString* string = (ObjString*)object;
+      if (string->owner == NULL) {
+        FREE_ARRAY(char, string->chars, string->length + 1);
+      }
+      FREE(ObjString, object);
+      break;
+    }
+    case OBJ_VIEW:
+      FREE(ObjView, object);
+      break;
+  }
+}
+
+// Objects found reachable but not yet scanned. It's grown with realloc()
+// directly, so it isn't counted against the quota it's helping enforce.
+// If it can't grow, the object is only marked, and `grayOverflowed` has
+// the whole heap scanned again for marked objects.
+static Obj** grayStack = NULL;
+static int grayCount = 0;
+static int grayCapacity = 0;
+static bool grayOverflowed = false;
+
+static void markObject(Obj* object) {
+  if (object == NULL || object->marked) return;
+  object->marked = true;
+
+  if (grayCapacity < grayCount + 1) {
+    int capacity = GROW_CAPACITY(grayCapacity);
+    Obj** stack = realloc(grayStack, sizeof(Obj*) * capacity);
+    if (stack == NULL) {
+      grayOverflowed = true;
+      return;
+    }
+    grayStack = stack;
+    grayCapacity = capacity;
+  }
+  grayStack[grayCount++] = object;
+}
+
+static void markValue(Value value) {
+  if (IS_OBJ(value)) markObject(AS_OBJ(value));
+}
+
+static void markArray(ValueArray* array) {
+  for (int i = 0; i < array->count; i++) markValue(array->values[i]);
+}
+
+static void markTable(Table* table) {
+  for (int i = 0; i < table->count; i++) {
+    markValue(table->entries[i].key);
+    markValue(table->entries[i].value);
+  }
+}
+
+static void blackenObject(Obj* object) {
+  switch (object->type) {
+    case OBJ_GENERATOR: {
+      ObjGenerator* generator = (ObjGenerator*)object;
+      markArray(&generator->window);
+      markObject((Obj*)generator->caller);
+      markObject(generator->chunk->owner);
+      break;
+    }
+    case OBJ_LIST:
+      markArray(&((ObjList*)object)->items);
+      break;
+    case OBJ_MAP:
+      markTable(&((ObjMap*)object)->table);
+      break;
+    case OBJ_MODULE: {
+      ObjModule* module = (ObjModule*)object;
+      markObject((Obj*)module->path);
+      markValue(module->value);
+      break;
+    }
+    case OBJ_POLL: {
+      ObjPoll* poll = (ObjPoll*)object;
+      for (int i = 0; i < poll->count; i++) markObject((Obj*)poll->streams[i]);
+      break;
+    }
+    case OBJ_STRING:
+      markObject(((ObjString*)object)->owner);
+      break;
+    case OBJ_FILE:
+    case OBJ_STREAM:
+    case OBJ_VIEW:
+      break;
+  }
+}
+
+// Everything the running script can still reach is on the stack, in a
+// suspended generator reachable from there, or in a module. A module
+// whose body is running stays too, even if a reload has replaced it.
+// Native C code holds objects only while it runs, so this is only called
+// between instructions, or by a native before it allocates anything.
+void collectGarbage() {
+  for (Value* slot = vm.stack; slot < vm.stackTop; slot++) markValue(*slot);
+  markTable(&vm.modules);
+  markObject((Obj*)vm.generator);
+  for (Obj* object = vm.objects; object != NULL; object = object->next) {
+    if (object->pins > 0 ||
+        (object->type == OBJ_MODULE &&
+         ((ObjModule*)object)->state == MODULE_RUNNING)) {
+      markObject(object);
+    }
+  }
+
+  while (grayCount > 0) blackenObject(grayStack[--grayCount]);
+  // Scanning an object twice only finds it marks nothing new.
+  while (grayOverflowed) {
+    grayOverflowed = false;
+    for (Obj* object = vm.objects; object != NULL; object = object->next) {
+      if (!object->marked) continue;
+      blackenObject(object);
+      while (grayCount > 0) blackenObject(grayStack[--grayCount]);
+    }
+  }
+  free(grayStack);
+  grayStack = NULL;
+  grayCapacity = 0;
+
+  Obj** link = &vm.objects;
+  while (*link != NULL) {
+    Obj* object = *link;
+    if (object->marked) {
+      object->marked = false;
+      link = &object->next;
+    } else {
+      *link = object->next;
+      freeObject(object);
+      vm.objectCount--;
+    }
+  }
+
+  setMemoryLimit(vm.memoryLimit);
+}
+
+// Schedules the next collection for once half the headroom left under
+// the quota has been allocated, or a sixteenth of the quota if that's
+// more, but never later than reaching the quota.
+void setMemoryLimit(size_t limit) {
+  if (reserve == NULL) reserve = malloc(RESERVE_SIZE);
+  vm.memoryExhausted = reserve == NULL;
+  vm.memoryLimit = limit;
+  if (limit == 0) {
+    vm.nextGC = SIZE_MAX;
+    return;
+  }
+
+  size_t headroom = limit > vm.bytesAllocated ? limit - vm.bytesAllocated : 0;
+  size_t step = headroom / 2 > limit / 16 ? headroom / 2 : limit / 16;
+  vm.nextGC = vm.bytesAllocated + step < limit
+      ? vm.bytesAllocated + step : limit;
+}
+
+// Called by run() once allocation has passed `nextGC`, or an allocation
+// has failed. Returns false with an error if what's still reachable is
+// over the quota, or if there isn't room to set the reserve aside again.
+// Without a quota, garbage is collected only after a failure.
+bool checkMemory() {
+  if (vm.memoryLimit > 0 || vm.memoryExhausted) collectGarbage();
+  if (vm.memoryExhausted ||
+      (vm.memoryLimit > 0 && vm.bytesAllocated > vm.memoryLimit)) {
+    runtimeError("Out of memory.");
+    return false;
+  }
+  return true;
+}
+
+// For a native about to make an allocation sized by its arguments,
+// before it has allocated anything else. Raises the error up front if
+// even a collection wouldn't leave room.
+bool reserveMemory(size_t bytes) {
+  if (vm.memoryLimit == 0 || vm.bytesAllocated + bytes <= vm.memoryLimit) {
+    return true;
+  }
+
+  collectGarbage();
+  if (vm.bytesAllocated + bytes <= vm.memoryLimit) return true;
+  runtimeError("Out of memory.");
+  return false;
+}
+
+void freeObjects() {
+  // A module's chunk drops pins on its constants, so it goes before any
+  // of them do.
+  for (Obj* object = vm.objects; object != NULL; object = object->next) {
+    if (object->type == OBJ_MODULE) freeChunk(&((ObjModule*)object)->chunk);
+  }
+
+  Obj* object = vm.objects;
+  while (object != NULL) {
+    Obj* next = object->next;
+    freeObject(object);
+    object = next;
+  }
+  vm.objects = NULL;
+  vm.objectCount = 0;
+}
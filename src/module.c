@@ -0,0 +1,134 @@
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "cache.h"
+#include "compiler.h"
+#include "memory.h"
+#include "module.h"
+#include "reload.h"
+#include "vm.h"
+
+// Checks for "<directory>/<name>.lox" and stores its canonical path.
+static bool findFile(const char* directory, int directoryLength,
+                     const char* name, int length, char* path) {
+  char candidate[PATH_MAX];
+  int written = directoryLength == 0
+      ? snprintf(candidate, PATH_MAX, "%.*s.lox", length, name)
+      : snprintf(candidate, PATH_MAX, "%.*s/%.*s.lox",
+                 directoryLength, directory, length, name);
+  if (written < 0 || written >= PATH_MAX) return false;
+
+  struct stat info;
+  if (stat(candidate, &info) < 0 || !S_ISREG(info.st_mode)) return false;
+  return realpath(candidate, path) != NULL;
+}
+
+// Looks for module `name` next to the file importing it (or in the
+// working directory for code that isn't in a file), then in each
+// directory of the colon-separated LOX_PATH.
+bool resolveModule(const char* importer, const char* name, int length,
+                   char* path) {
+  if (length > 0 && name[0] == '/') {
+    return findFile(NULL, 0, name, length, path);
+  }
+
+  const char* slash = importer == NULL ? NULL : strrchr(importer, '/');
+  bool found = slash == NULL
+      ? findFile(".", 1, name, length, path)
+      : findFile(importer, (int)(slash - importer), name, length, path);
+  if (found) return true;
+
+  const char* searchPath = getenv("LOX_PATH");
+  while (searchPath != NULL && *searchPath != '\0') {
+    const char* end = strchr(searchPath, ':');
+    int directoryLength = end == NULL
+        ? (int)strlen(searchPath) : (int)(end - searchPath);
+    if (directoryLength > 0 &&
+        findFile(searchPath, directoryLength, name, length, path)) {
+      return true;
+    }
+    searchPath = end == NULL ? NULL : end + 1;
+  }
+  return false;
+}
+
+static char* readSource(const char* path, size_t* length) {
+  FILE* file = fopen(path, "rb");
+  if (file == NULL) return NULL;
+
+  fseek(file, 0L, SEEK_END);
+  long size = ftell(file);
+  rewind(file);
+  if (size < 0) {
+    fclose(file);
+    return NULL;
+  }
+
+  char* source = ALLOCATE(char, size + 1);
+  if (fread(source, 1, size, file) < (size_t)size) {
+    FREE_ARRAY(char, source, size + 1);
+    fclose(file);
+    return NULL;
+  }
+  source[size] = '\0';
+  fclose(file);
+
+  *length = (size_t)size + 1;
+  return source;
+}
+
+// Fills the module's chunk from the bytecode cache, or compiles it and
+// refreshes the cache.
+static bool load(ObjModule* module) {
+  const char* path = module->path->chars;
+  struct stat info;
+  if (stat(path, &info) < 0) {
+    runtimeError("Could not open module \"%s\".", path);
+    return false;
+  }
+
+  if (!loadCachedChunk(path, &info, &module->chunk)) {
+    size_t length;
+    char* source = readSource(path, &length);
+    if (source == NULL) {
+      runtimeError("Could not read module \"%s\".", path);
+      return false;
+    }
+
+    // The compile error is printed as the clox command always has, or
+    // else made part of the error for the embedding program.
+    CompileError error;
+    initScanner(source);
+    bool compiled = compileTokens(scanToken, path, &module->chunk,
+                                  vm.echo ? NULL : &error);
+    FREE_ARRAY(char, source, length);
+    if (!compiled) {
+      freeChunk(&module->chunk);
+      if (vm.echo) {
+        runtimeError("Could not compile module \"%s\".", path);
+      } else {
+        runtimeError("Could not compile module \"%s\": [line %d] %s", path,
+                     error.token.line, error.message);
+      }
+      return false;
+    }
+    saveCachedChunk(path, &info, &module->chunk);
+  }
+
+  module->state = MODULE_COMPILED;
+  watchModule(module);
+  return true;
+}
+
+// The compiler can't be left halfway, so running out of memory while
+// loading isn't raised in the importing script.
+bool loadModule(ObjModule* module) {
+  sigjmp_buf* overflow = vm.overflow;
+  vm.overflow = NULL;
+  bool loaded = load(module);
+  vm.overflow = overflow;
+  return loaded;
+}
@@ -0,0 +1,488 @@
+#include <errno.h>
+#include <limits.h>
+#include <string.h>
+
+#include "csv.h"
+#include "file.h"
+#include "json.h"
+#include "loop.h"
+#include "memory.h"
+#include "native.h"
+#include "object.h"
+#include "sort.h"
+#include "table.h"
+#include "vm.h"
+
+static bool checkList(Value value, const char* name) {
+  if (IS_LIST(value)) return true;
+  runtimeError("Argument to '%s' must be a list.", name);
+  return false;
+}
+
+// Converts `value` to an index in [0, limit].
+static bool checkIndex(Value value, int limit, const char* name, int* index) {
+  if (!IS_NUMERIC(value)) {
+    runtimeError("Index passed to '%s' must be a number.", name);
+    return false;
+  }
+
+  double number = TO_DOUBLE(value);
+  if (number < 0 || number > limit || number != (int)number) {
+    runtimeError("Index passed to '%s' is out of bounds.", name);
+    return false;
+  }
+
+  *index = (int)number;
+  return true;
+}
+
+static bool checkMap(Value value, const char* name) {
+  if (IS_MAP(value)) return true;
+  runtimeError("Argument to '%s' must be a map.", name);
+  return false;
+}
+
+static bool lenNative(int argCount, Value* args, Value* result) {
+  (void)argCount;
+  if (IS_LIST(args[0])) {
+    *result = INT_VAL(AS_LIST(args[0])->items.count);
+  } else if (IS_VIEW(args[0])) {
+    if (!checkView(AS_VIEW(args[0]))) return false;
+    *result = INT_VAL(AS_VIEW(args[0])->length);
+  } else if (IS_MAP(args[0])) {
+    *result = INT_VAL(AS_MAP(args[0])->table.count);
+  } else if (IS_STRING(args[0])) {
+    *result = INT_VAL(AS_STRING(args[0])->length);
+  } else {
+    runtimeError("Argument to 'len' must be a list, view, map or string.");
+    return false;
+  }
+  return true;
+}
+
+static bool appendNative(int argCount, Value* args, Value* result) {
+  if (!checkList(args[0], "append")) return false;
+  appendList(AS_LIST(args[0]), args + 1, argCount - 1);
+  *result = args[0];
+  return true;
+}
+
+static bool extendNative(int argCount, Value* args, Value* result) {
+  (void)argCount;
+  if (!checkList(args[0], "extend") || !checkList(args[1], "extend")) {
+    return false;
+  }
+
+  ObjList* source = AS_LIST(args[1]);
+  appendList(AS_LIST(args[0]), source->items.values, source->items.count);
+  *result = args[0];
+  return true;
+}
+
+static bool sliceNative(int argCount, Value* args, Value* result) {
+  (void)argCount;
+  if (!checkList(args[0], "slice")) return false;
+
+  ObjList* list = AS_LIST(args[0]);
+  int start;
+  int end;
+  if (!checkIndex(args[1], list->items.count, "slice", &start) ||
+      !checkIndex(args[2], list->items.count, "slice", &end)) {
+    return false;
+  }
+
+  if (end < start) end = start;
+
+  *result = OBJ_VAL(sliceList(list, start, end));
+  return true;
+}
+
+static bool reverseNative(int argCount, Value* args, Value* result) {
+  (void)argCount;
+  if (!checkList(args[0], "reverse")) return false;
+  reverseList(AS_LIST(args[0]));
+  *result = args[0];
+  return true;
+}
+
+static bool fillNative(int argCount, Value* args, Value* result) {
+  (void)argCount;
+  if (!checkList(args[0], "fill")) return false;
+  fillList(AS_LIST(args[0]), args[1]);
+  *result = args[0];
+  return true;
+}
+
+static bool rangeNative(int argCount, Value* args, Value* result) {
+  if (argCount > 2) {
+    runtimeError("'range' takes one or two arguments.");
+    return false;
+  }
+
+  Value start = argCount == 2 ? args[0] : INT_VAL(0);
+  Value end = args[argCount - 1];
+  if (!IS_INT(start) || !IS_INT(end)) {
+    runtimeError("Arguments to 'range' must be integers.");
+    return false;
+  }
+
+  int64_t count = AS_INT(end) - AS_INT(start);
+  if (count < 0) count = 0;
+  if (count > INT32_MAX) {
+    runtimeError("Range is too large to hold in a list.");
+    return false;
+  }
+
+  if (!reserveMemory(sizeof(Value) * (size_t)count)) return false;
+  ObjList* list = newList((int)count);
+  for (int i = 0; i < count; i++) {
+    list->items.values[i] = INT_VAL(AS_INT(start) + i);
+  }
+  *result = OBJ_VAL(list);
+  return true;
+}
+
+// A view of doubles is summed directly. Other views go element by
+// element, as a list does.
+static bool sumNative(int argCount, Value* args, Value* result) {
+  (void)argCount;
+  ObjView* view = NULL;
+  int count;
+  if (IS_VIEW(args[0])) {
+    view = AS_VIEW(args[0]);
+    if (!checkView(view)) return false;
+    count = view->length;
+    if (view->type == VIEW_DOUBLE) {
+      const double* values = (const double*)view->data;
+      double total = 0;
+      for (int i = 0; i < count; i++) total += values[i];
+      *result = NUMBER_VAL(total);
+      return true;
+    }
+  } else {
+    if (!checkList(args[0], "sum")) return false;
+    count = AS_LIST(args[0])->items.count;
+  }
+
+  int64_t intTotal = 0;
+  double total = 0;
+  bool isInt = true;
+  for (int i = 0; i < count; i++) {
+    Value value = view != NULL ? viewElement(view, i)
+                               : AS_LIST(args[0])->items.values[i];
+    if (!IS_NUMERIC(value)) {
+      runtimeError("Can only sum numbers.");
+      return false;
+    }
+
+    int64_t sum;
+    if (isInt && IS_INT(value) &&
+        !__builtin_add_overflow(intTotal, AS_INT(value), &sum)) {
+      intTotal = sum;
+      continue;
+    }
+
+    if (isInt) {
+      total = (double)intTotal;
+      isInt = false;
+    }
+    total += TO_DOUBLE(value);
+  }
+
+  *result = isInt ? INT_VAL(intTotal) : NUMBER_VAL(total);
+  return true;
+}
+
+// Copies a path argument into `path` with a terminator, since strings
+// may be views without one.
+static bool checkPath(Value value, const char* name, char* path) {
+  if (!IS_STRING(value)) {
+    runtimeError("Argument to '%s' must be a path string.", name);
+    return false;
+  }
+
+  ObjString* string = AS_STRING(value);
+  if (string->length >= PATH_MAX) {
+    runtimeError("Path is too long.");
+    return false;
+  }
+  memcpy(path, string->chars, string->length);
+  path[string->length] = '\0';
+  return true;
+}
+
+static bool openNative(int argCount, Value* args, Value* result) {
+  (void)argCount;
+  char path[PATH_MAX];
+  if (!checkPath(args[0], "open", path)) return false;
+
+  ObjFile* file = openFile(path);
+  if (file == NULL) {
+    runtimeError("Could not open file \"%s\".", path);
+    return false;
+  }
+
+  *result = OBJ_VAL(file);
+  return true;
+}
+
+static bool streamNative(int argCount, Value* args, Value* result) {
+  (void)argCount;
+  char path[PATH_MAX];
+  if (!checkPath(args[0], "stream", path)) return false;
+
+  ObjStream* stream = openStream(path);
+  if (stream == NULL) {
+    runtimeError("Could not open stream \"%s\".", path);
+    return false;
+  }
+
+  *result = OBJ_VAL(stream);
+  return true;
+}
+
+static bool connectNative(int argCount, Value* args, Value* result) {
+  (void)argCount;
+  char path[PATH_MAX];
+  if (!checkPath(args[0], "connect", path)) return false;
+
+  ObjStream* stream = connectStream(path);
+  if (stream == NULL) {
+    runtimeError("Could not connect to socket \"%s\".", path);
+    return false;
+  }
+
+  *result = OBJ_VAL(stream);
+  return true;
+}
+
+static bool timerNative(int argCount, Value* args, Value* result) {
+  (void)argCount;
+  if (!IS_INT(args[0]) || !IS_INT(args[1])) {
+    runtimeError("Arguments to 'timer' must be integers.");
+    return false;
+  }
+  if (AS_INT(args[0]) <= 0 || AS_INT(args[1]) < 0) {
+    runtimeError("Timer interval must be positive and count not negative.");
+    return false;
+  }
+
+  ObjStream* stream = openTimer(AS_INT(args[0]), AS_INT(args[1]));
+  if (stream == NULL) {
+    runtimeError("Could not create timer.");
+    return false;
+  }
+
+  *result = OBJ_VAL(stream);
+  return true;
+}
+
+static bool pollNative(int argCount, Value* args, Value* result) {
+  (void)argCount;
+  if (!checkList(args[0], "poll")) return false;
+
+  // epoll takes each descriptor once, and each event names one index.
+  ObjList* list = AS_LIST(args[0]);
+  Value* streams = list->items.values;
+  for (int i = 0; i < list->items.count; i++) {
+    if (!IS_STREAM(streams[i])) {
+      runtimeError("Can only poll streams.");
+      return false;
+    }
+    for (int j = 0; j < i; j++) {
+      if (AS_OBJ(streams[j]) == AS_OBJ(streams[i])) {
+        runtimeError("poll() lists the same stream at %d and %d.", j, i);
+        return false;
+      }
+    }
+  }
+
+  ObjPoll* poll = openPoll(list);
+  if (poll == NULL) {
+    runtimeError("Could not poll streams: %s.", strerror(errno));
+    return false;
+  }
+
+  *result = OBJ_VAL(poll);
+  return true;
+}
+
+static bool writeNative(int argCount, Value* args, Value* result) {
+  (void)argCount;
+  if (!IS_STREAM(args[0]) || !IS_STRING(args[1])) {
+    runtimeError("Arguments to 'write' must be a stream and a string.");
+    return false;
+  }
+
+  ObjString* string = AS_STRING(args[1]);
+  if (!writeStream(AS_STREAM(args[0]), string->chars, string->length)) {
+    return false;
+  }
+
+  *result = INT_VAL(string->length);
+  return true;
+}
+
+static bool readNative(int argCount, Value* args, Value* result) {
+  (void)argCount;
+  if (!IS_FILE(args[0])) {
+    runtimeError("Argument to 'read' must be a file.");
+    return false;
+  }
+
+  ObjFile* file = AS_FILE(args[0]);
+  if (file->length > INT32_MAX) {
+    runtimeError("File is too large to read as one string.");
+    return false;
+  }
+
+  *result = OBJ_VAL(newStringView((Obj*)file, file->data, (int)file->length));
+  return true;
+}
+
+static bool csvNative(int argCount, Value* args, Value* result) {
+  if (argCount > 2) {
+    runtimeError("'csv' takes one or two arguments.");
+    return false;
+  }
+  if (argCount == 2 && !IS_BOOL(args[1])) {
+    runtimeError("Second argument to 'csv' must be a boolean.");
+    return false;
+  }
+  bool columns = argCount == 2 && AS_BOOL(args[1]);
+
+  if (IS_FILE(args[0])) {
+    ObjFile* file = AS_FILE(args[0]);
+    return parseCsv((Obj*)file, file->data, file->length, columns, result);
+  }
+  if (IS_STRING(args[0])) {
+    // Fields are views, so they share the owner of a string that is
+    // itself a view.
+    ObjString* string = AS_STRING(args[0]);
+    Obj* owner = string->owner != NULL ? string->owner : (Obj*)string;
+    return parseCsv(owner, string->chars, string->length, columns, result);
+  }
+
+  runtimeError("First argument to 'csv' must be a file or string.");
+  return false;
+}
+
+static bool jsonNative(int argCount, Value* args, Value* result) {
+  (void)argCount;
+  if (IS_FILE(args[0])) {
+    ObjFile* file = AS_FILE(args[0]);
+    return parseJson((Obj*)file, file->data, file->length, result);
+  }
+  if (IS_STRING(args[0])) {
+    ObjString* string = AS_STRING(args[0]);
+    Obj* owner = string->owner != NULL ? string->owner : (Obj*)string;
+    return parseJson(owner, string->chars, string->length, result);
+  }
+
+  runtimeError("Argument to 'json' must be a file or string.");
+  return false;
+}
+
+static bool stringifyNative(int argCount, Value* args, Value* result) {
+  (void)argCount;
+  return stringifyJson(args[0], result);
+}
+
+// Raises a runtime error with the given message, for `try` to catch.
+static bool errorNative(int argCount, Value* args, Value* result) {
+  (void)argCount;
+  (void)result;
+  if (!IS_STRING(args[0])) {
+    runtimeError("Argument to 'error' must be a string.");
+    return false;
+  }
+
+  ObjString* message = AS_STRING(args[0]);
+  runtimeError("%.*s", message->length, message->chars);
+  return false;
+}
+
+static bool sortNative(int argCount, Value* args, Value* result) {
+  (void)argCount;
+  if (!checkList(args[0], "sort")) return false;
+  ObjList* list = AS_LIST(args[0]);
+  if (!sortValues(list->items.values, list->items.count)) {
+    runtimeError("Nesting too deep.");
+    return false;
+  }
+  *result = args[0];
+  return true;
+}
+
+static bool getNative(int argCount, Value* args, Value* result) {
+  (void)argCount;
+  if (!checkMap(args[0], "get")) return false;
+  if (!tableGet(&AS_MAP(args[0])->table, args[1], result)) {
+    *result = args[2];
+  }
+  return true;
+}
+
+static bool keysNative(int argCount, Value* args, Value* result) {
+  (void)argCount;
+  if (!checkMap(args[0], "keys")) return false;
+
+  Table* table = &AS_MAP(args[0])->table;
+  ObjList* keys = newList(table->count);
+  for (int i = 0; i < table->count; i++) {
+    keys->items.values[i] = table->entries[i].key;
+  }
+  *result = OBJ_VAL(keys);
+  return true;
+}
+
+static bool valuesNative(int argCount, Value* args, Value* result) {
+  (void)argCount;
+  if (!checkMap(args[0], "values")) return false;
+
+  Table* table = &AS_MAP(args[0])->table;
+  ObjList* values = newList(table->count);
+  for (int i = 0; i < table->count; i++) {
+    values->items.values[i] = table->entries[i].value;
+  }
+  *result = OBJ_VAL(values);
+  return true;
+}
+
+Native natives[] = {
+  {"len",     1,  lenNative},
+  {"append",  -1, appendNative},
+  {"extend",  2,  extendNative},
+  {"slice",   3,  sliceNative},
+  {"reverse", 1,  reverseNative},
+  {"fill",    2,  fillNative},
+  {"connect", 1,  connectNative},
+  {"csv",     -1, csvNative},
+  {"error",   1,  errorNative},
+  {"json",    1,  jsonNative},
+  {"open",    1,  openNative},
+  {"poll",    1,  pollNative},
+  {"range",   -1, rangeNative},
+  {"read",    1,  readNative},
+  {"sort",    1,  sortNative},
+  {"stream",  1,  streamNative},
+  {"stringify", 1, stringifyNative},
+  {"sum",     1,  sumNative},
+  {"timer",   2,  timerNative},
+  {"write",   2,  writeNative},
+  {"get",     3,  getNative},
+  {"keys",    1,  keysNative},
+  {"values",  1,  valuesNative},
+  {NULL,      0,  NULL},
+};
+
+int findNative(const char* name, int length) {
+  for (int i = 0; natives[i].name != NULL; i++) {
+    if ((int)strlen(natives[i].name) == length &&
+        memcmp(natives[i].name, name, length) == 0) {
+      return i;
+    }
+  }
+
+  return -1;
+}
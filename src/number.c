@@ -0,0 +1,422 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "memory.h"
+#include "number.h"
+
+static const double powersOfTen[] = {
+  1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+static bool isDigit(char c) {
+  return c >= '0' && c <= '9';
+}
+
+static bool parseSlow(const char* start, size_t length, double* number) {
+  char buffer[64];
+  char* chars = length < sizeof(buffer) ? buffer : ALLOCATE(char, length + 1);
+  memcpy(chars, start, length);
+  chars[length] = '\0';
+
+  *number = strtod(chars, NULL);
+  if (chars != buffer) FREE_ARRAY(char, chars, length + 1);
+  return true;
+}
+
+// Parses all of `start` as a decimal number. With at most 19 digits and a
+// small exponent, the result is exact after a single multiply or divide
+// by a power of ten. Anything else is checked here but left to strtod.
+bool parseNumber(const char* start, size_t length, double* number) {
+  const char* current = start;
+  const char* end = start + length;
+
+  bool negative = false;
+  if (current < end && (*current == '-' || *current == '+')) {
+    negative = *current == '-';
+    current++;
+  }
+
+  uint64_t mantissa = 0;
+  int digitCount = 0;
+  int exponent = 0;
+  while (current < end && isDigit(*current)) {
+    mantissa = mantissa * 10 + (uint64_t)(*current++ - '0');
+    digitCount++;
+  }
+  if (current < end && *current == '.') {
+    current++;
+    while (current < end && isDigit(*current)) {
+      mantissa = mantissa * 10 + (uint64_t)(*current++ - '0');
+      digitCount++;
+      exponent--;
+    }
+  }
+  if (digitCount == 0) return false;
+
+  if (current < end && (*current == 'e' || *current == 'E')) {
+    current++;
+    bool negativeExponent = false;
+    if (current < end && (*current == '-' || *current == '+')) {
+      negativeExponent = *current == '-';
+      current++;
+    }
+
+    const char* exponentStart = current;
+    int explicitExponent = 0;
+    while (current < end && isDigit(*current)) {
+      if (explicitExponent < 100000) {
+        explicitExponent = explicitExponent * 10 + (*current - '0');
+      }
+      current++;
+    }
+    if (current == exponentStart) return false;
+    exponent += negativeExponent ? -explicitExponent : explicitExponent;
+  }
+  if (current != end) return false;
+
+  if (digitCount > 19 || mantissa > ((uint64_t)1 << 53) ||
+      exponent < -22 || exponent > 22) {
+    return parseSlow(start, length, number);
+  }
+
+  double value = (double)mantissa;
+  value = exponent < 0 ? value / powersOfTen[-exponent]
+                       : value * powersOfTen[exponent];
+  *number = negative ? -value : value;
+  return true;
+}
+
+// A floating-point value as an exact 64-bit significand and a binary
+// exponent, for the digit generation below.
+typedef struct {
+  uint64_t f;
+  int e;
+} DiyFp;
+
+typedef struct {
+  uint64_t f;
+  int e;
+  int k;
+} CachedPower;
+
+// Normalized approximations of 10^k for k = -300, -292, ... 324.
+static const CachedPower cachedPowers[] = {
+  {0xAB70FE17C79AC6CAULL, -1060, -300},
+  {0xFF77B1FCBEBCDC4FULL, -1034, -292},
+  {0xBE5691EF416BD60CULL, -1007, -284},
+  {0x8DD01FAD907FFC3CULL,  -980, -276},
+  {0xD3515C2831559A83ULL,  -954, -268},
+  {0x9D71AC8FADA6C9B5ULL,  -927, -260},
+  {0xEA9C227723EE8BCBULL,  -901, -252},
+  {0xAECC49914078536DULL,  -874, -244},
+  {0x823C12795DB6CE57ULL,  -847, -236},
+  {0xC21094364DFB5637ULL,  -821, -228},
+  {0x9096EA6F3848984FULL,  -794, -220},
+  {0xD77485CB25823AC7ULL,  -768, -212},
+  {0xA086CFCD97BF97F4ULL,  -741, -204},
+  {0xEF340A98172AACE5ULL,  -715, -196},
+  {0xB23867FB2A35B28EULL,  -688, -188},
+  {0x84C8D4DFD2C63F3BULL,  -661, -180},
+  {0xC5DD44271AD3CDBAULL,  -635, -172},
+  {0x936B9FCEBB25C996ULL,  -608, -164},
+  {0xDBAC6C247D62A584ULL,  -582, -156},
+  {0xA3AB66580D5FDAF6ULL,  -555, -148},
+  {0xF3E2F893DEC3F126ULL,  -529, -140},
+  {0xB5B5ADA8AAFF80B8ULL,  -502, -132},
+  {0x87625F056C7C4A8BULL,  -475, -124},
+  {0xC9BCFF6034C13053ULL,  -449, -116},
+  {0x964E858C91BA2655ULL,  -422, -108},
+  {0xDFF9772470297EBDULL,  -396, -100},
+  {0xA6DFBD9FB8E5B88FULL,  -369,  -92},
+  {0xF8A95FCF88747D94ULL,  -343,  -84},
+  {0xB94470938FA89BCFULL,  -316,  -76},
+  {0x8A08F0F8BF0F156BULL,  -289,  -68},
+  {0xCDB02555653131B6ULL,  -263,  -60},
+  {0x993FE2C6D07B7FACULL,  -236,  -52},
+  {0xE45C10C42A2B3B06ULL,  -210,  -44},
+  {0xAA242499697392D3ULL,  -183,  -36},
+  {0xFD87B5F28300CA0EULL,  -157,  -28},
+  {0xBCE5086492111AEBULL,  -130,  -20},
+  {0x8CBCCC096F5088CCULL,  -103,  -12},
+  {0xD1B71758E219652CULL,   -77,   -4},
+  {0x9C40000000000000ULL,   -50,    4},
+  {0xE8D4A51000000000ULL,   -24,   12},
+  {0xAD78EBC5AC620000ULL,     3,   20},
+  {0x813F3978F8940984ULL,    30,   28},
+  {0xC097CE7BC90715B3ULL,    56,   36},
+  {0x8F7E32CE7BEA5C70ULL,    83,   44},
+  {0xD5D238A4ABE98068ULL,   109,   52},
+  {0x9F4F2726179A2245ULL,   136,   60},
+  {0xED63A231D4C4FB27ULL,   162,   68},
+  {0xB0DE65388CC8ADA8ULL,   189,   76},
+  {0x83C7088E1AAB65DBULL,   216,   84},
+  {0xC45D1DF942711D9AULL,   242,   92},
+  {0x924D692CA61BE758ULL,   269,  100},
+  {0xDA01EE641A708DEAULL,   295,  108},
+  {0xA26DA3999AEF774AULL,   322,  116},
+  {0xF209787BB47D6B85ULL,   348,  124},
+  {0xB454E4A179DD1877ULL,   375,  132},
+  {0x865B86925B9BC5C2ULL,   402,  140},
+  {0xC83553C5C8965D3DULL,   428,  148},
+  {0x952AB45CFA97A0B3ULL,   455,  156},
+  {0xDE469FBD99A05FE3ULL,   481,  164},
+  {0xA59BC234DB398C25ULL,   508,  172},
+  {0xF6C69A72A3989F5CULL,   534,  180},
+  {0xB7DCBF5354E9BECEULL,   561,  188},
+  {0x88FCF317F22241E2ULL,   588,  196},
+  {0xCC20CE9BD35C78A5ULL,   614,  204},
+  {0x98165AF37B2153DFULL,   641,  212},
+  {0xE2A0B5DC971F303AULL,   667,  220},
+  {0xA8D9D1535CE3B396ULL,   694,  228},
+  {0xFB9B7CD9A4A7443CULL,   720,  236},
+  {0xBB764C4CA7A44410ULL,   747,  244},
+  {0x8BAB8EEFB6409C1AULL,   774,  252},
+  {0xD01FEF10A657842CULL,   800,  260},
+  {0x9B10A4E5E9913129ULL,   827,  268},
+  {0xE7109BFBA19C0C9DULL,   853,  276},
+  {0xAC2820D9623BF429ULL,   880,  284},
+  {0x80444B5E7AA7CF85ULL,   907,  292},
+  {0xBF21E44003ACDD2DULL,   933,  300},
+  {0x8E679C2F5E44FF8FULL,   960,  308},
+  {0xD433179D9C8CB841ULL,   986,  316},
+  {0x9E19DB92B4E31BA9ULL,  1013,  324},
+};
+
+#define CACHED_POWERS_MIN_EXPONENT -300
+#define CACHED_POWERS_STEP 8
+
+// Products are scaled to land in this binary exponent range, so the
+// integral part of a scaled value fits in 32 bits.
+#define ALPHA -60
+#define GAMMA -32
+
+static DiyFp multiply(DiyFp x, DiyFp y) {
+  unsigned __int128 product = (unsigned __int128)x.f * y.f;
+  uint64_t high = (uint64_t)(product >> 64);
+  uint64_t low = (uint64_t)product;
+  DiyFp result = {high + (low >> 63), x.e + y.e + 64};
+  return result;
+}
+
+static DiyFp normalize(DiyFp x) {
+  int shift = __builtin_clzll(x.f);
+  DiyFp result = {x.f << shift, x.e - shift};
+  return result;
+}
+
+static const CachedPower* cachedPowerFor(int e) {
+  // k = ceil((ALPHA - e - 1) * log10(2)), in fixed point.
+  int f = ALPHA - e - 1;
+  int k = (f * 78913) / (1 << 18) + (f > 0);
+  int index = (-CACHED_POWERS_MIN_EXPONENT + k + CACHED_POWERS_STEP - 1) /
+              CACHED_POWERS_STEP;
+  return &cachedPowers[index];
+}
+
+// Nudges the last digit toward the exact value while it stays inside the
+// rounding interval.
+static void roundDigits(char* digits, int length, uint64_t distance,
+                        uint64_t delta, uint64_t rest, uint64_t tenK) {
+  while (rest < distance && delta - rest >= tenK &&
+         (rest + tenK < distance ||
+          distance - rest > rest + tenK - distance)) {
+    digits[length - 1]--;
+    rest += tenK;
+  }
+}
+
+// Emits digits of `plus` until the remainder falls inside the interval
+// between `minus` and `plus`, which is when enough digits have been
+// written to identify the value.
+static int generateDigits(char* digits, int* exponent, DiyFp minus,
+                          DiyFp value, DiyFp plus) {
+  uint64_t delta = plus.f - minus.f;
+  uint64_t distance = plus.f - value.f;
+
+  int shift = -plus.e;
+  uint64_t one = (uint64_t)1 << shift;
+  uint32_t integral = (uint32_t)(plus.f >> shift);
+  uint64_t fraction = plus.f & (one - 1);
+
+  uint32_t power = 1000000000;
+  int powerDigits = 10;
+  while (powerDigits > 1 && integral < power) {
+    power /= 10;
+    powerDigits--;
+  }
+
+  int length = 0;
+  while (powerDigits > 0) {
+    digits[length++] = (char)('0' + integral / power);
+    integral %= power;
+    powerDigits--;
+
+    uint64_t rest = ((uint64_t)integral << shift) + fraction;
+    if (rest <= delta) {
+      *exponent += powerDigits;
+      roundDigits(digits, length, distance, delta, rest,
+                  (uint64_t)power << shift);
+      return length;
+    }
+    power /= 10;
+  }
+
+  for (;;) {
+    fraction *= 10;
+    delta *= 10;
+    distance *= 10;
+    digits[length++] = (char)('0' + (fraction >> shift));
+    fraction &= one - 1;
+    (*exponent)--;
+    if (fraction <= delta) break;
+  }
+  roundDigits(digits, length, distance, delta, fraction, one);
+  return length;
+}
+
+// Finds the shortest digits that read back as `number` with the Grisu2
+// algorithm: exact 64-bit arithmetic against a cached power of ten, no
+// bignums and no calls into the C library.
+static int shortestDigits(double number, char* digits, int* exponent) {
+  uint64_t bits;
+  memcpy(&bits, &number, sizeof(bits));
+  uint64_t fraction = bits & (((uint64_t)1 << 52) - 1);
+  int biased = (int)(bits >> 52);
+
+  DiyFp value;
+  if (biased == 0) {
+    value.f = fraction;
+    value.e = 1 - 1075;
+  } else {
+    value.f = fraction | ((uint64_t)1 << 52);
+    value.e = biased - 1075;
+  }
+
+  // The values halfway to each neighbouring double. The gap below is
+  // half as wide at a power of two.
+  DiyFp plus = normalize((DiyFp){2 * value.f + 1, value.e - 1});
+  DiyFp minus;
+  if (fraction == 0 && biased > 1) {
+    minus = (DiyFp){4 * value.f - 1, value.e - 2};
+  } else {
+    minus = (DiyFp){2 * value.f - 1, value.e - 1};
+  }
+  minus.f <<= minus.e - plus.e;
+  minus.e = plus.e;
+  value = normalize(value);
+
+  const CachedPower* cached = cachedPowerFor(plus.e);
+  DiyFp power = {cached->f, cached->e};
+  DiyFp scaledValue = multiply(value, power);
+  DiyFp scaledMinus = multiply(minus, power);
+  DiyFp scaledPlus = multiply(plus, power);
+
+  // Shrink the interval by one unit on each side to absorb the error in
+  // the cached power.
+  scaledMinus.f++;
+  scaledPlus.f--;
+  *exponent = -cached->k;
+  return generateDigits(digits, exponent, scaledMinus, scaledValue,
+                        scaledPlus);
+}
+
+static const char digitPairs[] =
+  "0001020304050607080910111213141516171819"
+  "2021222324252627282930313233343536373839"
+  "4041424344454647484950515253545556575859"
+  "6061626364656667686970717273747576777879"
+  "8081828384858687888990919293949596979899";
+
+// Writes an integer two digits at a time from the right.
+int formatInteger(int64_t integer, char* buffer) {
+  char digits[20];
+  int start = sizeof(digits);
+  uint64_t magnitude = integer < 0 ? -(uint64_t)integer : (uint64_t)integer;
+
+  while (magnitude >= 100) {
+    int pair = (int)(magnitude % 100) * 2;
+    magnitude /= 100;
+    digits[--start] = digitPairs[pair + 1];
+    digits[--start] = digitPairs[pair];
+  }
+  if (magnitude >= 10) {
+    int pair = (int)magnitude * 2;
+    digits[--start] = digitPairs[pair + 1];
+    digits[--start] = digitPairs[pair];
+  } else {
+    digits[--start] = (char)('0' + magnitude);
+  }
+
+  int length = 0;
+  if (integer < 0) buffer[length++] = '-';
+  memcpy(buffer + length, digits + start, sizeof(digits) - start);
+  length += (int)sizeof(digits) - start;
+  buffer[length] = '\0';
+  return length;
+}
+
+static int writeExponent(char* buffer, int exponent) {
+  int length = 0;
+  buffer[length++] = 'e';
+  buffer[length++] = exponent < 0 ? '-' : '+';
+  if (exponent < 0) exponent = -exponent;
+  if (exponent >= 100) buffer[length++] = (char)('0' + exponent / 100);
+  if (exponent >= 10) buffer[length++] = (char)('0' + exponent / 10 % 10);
+  buffer[length++] = (char)('0' + exponent % 10);
+  return length;
+}
+
+// Formats a finite number with the fewest significant digits that read
+// back as the same double. Numbers between 1e-6 and 1e21 are written out
+// in full, and the rest in exponent form, as JavaScript does.
+int formatNumber(double number, char* buffer) {
+  int length = 0;
+  if (signbit(number)) {
+    buffer[length++] = '-';
+    number = -number;
+  }
+  if (number == 0) {
+    buffer[length++] = '0';
+    buffer[length] = '\0';
+    return length;
+  }
+
+  char digits[20];
+  int exponent;
+  int count = shortestDigits(number, digits, &exponent);
+
+  // The value is 0.digits * 10^point.
+  int point = count + exponent;
+  if (count <= point && point <= 21) {
+    memcpy(buffer + length, digits, count);
+    length += count;
+    memset(buffer + length, '0', point - count);
+    length += point - count;
+  } else if (0 < point && point <= 21) {
+    memcpy(buffer + length, digits, point);
+    length += point;
+    buffer[length++] = '.';
+    memcpy(buffer + length, digits + point, count - point);
+    length += count - point;
+  } else if (-6 < point && point <= 0) {
+    buffer[length++] = '0';
+    buffer[length++] = '.';
+    memset(buffer + length, '0', -point);
+    length += -point;
+    memcpy(buffer + length, digits, count);
+    length += count;
+  } else {
+    buffer[length++] = digits[0];
+    if (count > 1) {
+      buffer[length++] = '.';
+      memcpy(buffer + length, digits + 1, count - 1);
+      length += count - 1;
+    }
+    length += writeExponent(buffer + length, point - 1);
+  }
+
+  buffer[length] = '\0';
+  return length;
+}
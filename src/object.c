@@ -0,0 +1,306 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "memory.h"
+#include "object.h"
+#include "value.h"
+#include "vm.h"
+
+#define ALLOCATE_OBJ(type, objectType) \
+    (type*)allocateObject(sizeof(type), objectType)
+
+static Obj* allocateObject(size_t size, ObjType type) {
+  Obj* object = (Obj*)reallocate(NULL, 0, size);
+  object->type = type;
+  object->marked = false;
+  object->pins = 0;
+
+  object->next = vm.objects;
+  vm.objects = object;
+  vm.objectCount++;
+  return object;
+}
+
+ObjFile* newFile() {
+  ObjFile* file = ALLOCATE_OBJ(ObjFile, OBJ_FILE);
+  file->data = NULL;
+  file->length = 0;
+  file->capacity = 0;
+  file->mapped = false;
+  return file;
+}
+
+ObjGenerator* newGenerator(Chunk* chunk, uint8_t* ip) {
+  ObjGenerator* generator = ALLOCATE_OBJ(ObjGenerator, OBJ_GENERATOR);
+  generator->state = GENERATOR_SUSPENDED;
+  generator->chunk = chunk;
+  generator->body = ip;
+  generator->ip = ip;
+  initValueArray(&generator->window);
+  generator->caller = NULL;
+  generator->callerChunk = NULL;
+  generator->callerBase = 0;
+  generator->variable = 0;
+  generator->resumeIp = NULL;
+  generator->exitIp = NULL;
+  return generator;
+}
+
+// Saves stack slots into the generator's window. The window is sized to
+// fit exactly, since a program may hold many suspended generators.
+void appendWindow(ObjGenerator* generator, Value* values, int count) {
+  ValueArray* window = &generator->window;
+  if (window->capacity < window->count + count) {
+    int capacity = window->count + count;
+    window->values = GROW_ARRAY(Value, window->values,
+                                window->capacity, capacity);
+    window->capacity = capacity;
+  }
+
+  memcpy(window->values + window->count, values, sizeof(Value) * count);
+  window->count += count;
+}
+
+// Creates a list with room for `count` elements. The elements themselves
+// are left for the caller to fill in.
+ObjList* newList(int count) {
+  ObjList* list = ALLOCATE_OBJ(ObjList, OBJ_LIST);
+  initValueArray(&list->items);
+  reserveValueArray(&list->items, count);
+  list->items.count = count;
+  return list;
+}
+
+void appendList(ObjList* list, Value* values, int count) {
+  if (count == 0) return;
+
+  // `values` may point into the list's own storage, which reserving can
+  // move, so it's found again by offset.
+  Value* items = list->items.values;
+  bool aliased = items != NULL && values >= items &&
+                 values < items + list->items.count;
+  int offset = aliased ? (int)(values - items) : 0;
+  reserveValueArray(&list->items, list->items.count + count);
+  if (aliased) values = list->items.values + offset;
+  memmove(list->items.values + list->items.count, values,
+          sizeof(Value) * count);
+  list->items.count += count;
+}
+
+ObjList* sliceList(ObjList* list, int start, int end) {
+  ObjList* slice = newList(end - start);
+  if (end > start) {
+    memcpy(slice->items.values, list->items.values + start,
+           sizeof(Value) * (end - start));
+  }
+  return slice;
+}
+
+void reverseList(ObjList* list) {
+  if (list->items.count < 2) return;
+
+  Value* low = list->items.values;
+  Value* high = list->items.values + list->items.count - 1;
+  while (low < high) {
+    Value temp = *low;
+    *low++ = *high;
+    *high-- = temp;
+  }
+}
+
+// Writes one element and then doubles the initialized prefix with memcpy,
+// so filling n slots takes O(log n) copies.
+void fillList(ObjList* list, Value value) {
+  int count = list->items.count;
+  if (count == 0) return;
+
+  Value* values = list->items.values;
+  values[0] = value;
+  for (int filled = 1; filled < count; filled *= 2) {
+    int chunk = filled < count - filled ? filled : count - filled;
+    memcpy(values + filled, values, sizeof(Value) * chunk);
+  }
+}
+
+ObjMap* newMap() {
+  ObjMap* map = ALLOCATE_OBJ(ObjMap, OBJ_MAP);
+  initTable(&map->table);
+  return map;
+}
+
+ObjModule* newModule(ObjString* path) {
+  ObjModule* module = ALLOCATE_OBJ(ObjModule, OBJ_MODULE);
+  module->path = path;
+  module->state = MODULE_UNLOADED;
+  initChunk(&module->chunk);
+  // Generators may go on running the chunk after a reload replaces it.
+  module->chunk.owner = (Obj*)module;
+  module->value = BOOL_VAL(false);
+  return module;
+}
+
+// Creates a poll with room for `count` streams, which the caller fills in.
+ObjPoll* newPoll(int count) {
+  ObjPoll* poll = ALLOCATE_OBJ(ObjPoll, OBJ_POLL);
+  poll->epoll = -1;
+  poll->streams = ALLOCATE(ObjStream*, count);
+  poll->count = count;
+  poll->next = 0;
+  return poll;
+}
+
+ObjStream* newStream(int fd) {
+  ObjStream* stream = ALLOCATE_OBJ(ObjStream, OBJ_STREAM);
+  stream->fd = fd;
+  stream->timer = false;
+  stream->fifo = false;
+  stream->closed = false;
+  stream->buffer = NULL;
+  stream->start = 0;
+  stream->count = 0;
+  stream->capacity = 0;
+  stream->ticks = 0;
+  stream->fired = 0;
+  stream->limit = 0;
+  return stream;
+}
+
+static uint32_t hashString(const char* key, int length) {
+  uint32_t hash = 2166136261u;
+  for (int i = 0; i < length; i++) {
+    hash ^= (uint8_t)key[i];
+    hash *= 16777619;
+  }
+  return hash;
+}
+
+// Wraps a NUL-terminated heap buffer of `length + 1` chars without
+// copying it. The string owns the buffer from then on.
+ObjString* takeString(char* chars, int length) {
+  ObjString* string = ALLOCATE_OBJ(ObjString, OBJ_STRING);
+  string->length = length;
+  string->chars = chars;
+  string->hash = hashString(chars, length);
+  string->owner = NULL;
+  return string;
+}
+
+ObjString* copyString(const char* chars, int length) {
+  char* heapChars = ALLOCATE(char, length + 1);
+  memcpy(heapChars, chars, length);
+  heapChars[length] = '\0';
+  return takeString(heapChars, length);
+}
+
+ObjString* newStringView(Obj* owner, const char* chars, int length) {
+  ObjString* string = ALLOCATE_OBJ(ObjString, OBJ_STRING);
+  string->length = length;
+  string->chars = (char*)chars;
+  string->hash = hashString(chars, length);
+  string->owner = owner;
+  return string;
+}
+
+ObjView* newView(ViewType type, const void* data, int length) {
+  ObjView* view = ALLOCATE_OBJ(ObjView, OBJ_VIEW);
+  view->type = type;
+  view->data = data;
+  view->length = length;
+  return view;
+}
+
+// Raises an error for a view the program has taken its memory back from.
+bool checkView(ObjView* view) {
+  if (view->data != NULL) return true;
+  runtimeError("View has been released.");
+  return false;
+}
+
+// The lists and maps being printed, outermost first. One that holds
+// itself, or anything nested past MAX_DEPTH, prints as "[...]" or "{...}".
+static Obj* printing[MAX_DEPTH];
+static int printingCount = 0;
+
+static bool enterPrint(Obj* object) {
+  if (printingCount == MAX_DEPTH) return false;
+  for (int i = 0; i < printingCount; i++) {
+    if (printing[i] == object) return false;
+  }
+  printing[printingCount++] = object;
+  return true;
+}
+
+static void printList(ObjList* list) {
+  if (!enterPrint((Obj*)list)) {
+    printf("[...]");
+    return;
+  }
+
+  printf("[");
+  for (int i = 0; i < list->items.count; i++) {
+    if (i > 0) printf(", ");
+    printValue(list->items.values[i]);
+  }
+  printf("]");
+  printingCount--;
+}
+
+static void printMap(ObjMap* map) {
+  if (!enterPrint((Obj*)map)) {
+    printf("{...}");
+    return;
+  }
+
+  printf("{");
+  for (int i = 0; i < map->table.count; i++) {
+    if (i > 0) printf(", ");
+    printValue(map->table.entries[i].key);
+    printf(": ");
+    printValue(map->table.entries[i].value);
+  }
+  printf("}");
+  printingCount--;
+}
+
+void printObject(Value value) {
+  switch (OBJ_TYPE(value)) {
+    case OBJ_FILE:
+      printf("<file>");
+      break;
+    case OBJ_GENERATOR:
+      printf("<generator>");
+      break;
+    case OBJ_LIST:
+      printList(AS_LIST(value));
+      break;
+    case OBJ_MAP:
+      printMap(AS_MAP(value));
+      break;
+    case OBJ_MODULE:
+      printf("<module %s>", AS_MODULE(value)->path->chars);
+      break;
+    case OBJ_POLL:
+      printf("<poll>");
+      break;
+    case OBJ_STREAM:
+      printf("<stream>");
+      break;
+    case OBJ_STRING:
+      printf("%.*s", AS_STRING(value)->length, AS_STRING(value)->chars);
+      break;
+    case OBJ_VIEW: {
+      ObjView* view = AS_VIEW(value);
+      if (view->data == NULL) {
+        printf("<released view>");
+        break;
+      }
+      printf("[");
+      for (int i = 0; i < view->length; i++) {
+        if (i > 0) printf(", ");
+        printValue(viewElement(view, i));
+      }
+      printf("]");
+      break;
+    }
+  }
+}
@@ -0,0 +1,145 @@
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include "memory.h"
+#include "module.h"
+#include "reload.h"
+#include "table.h"
+#include "vm.h"
+
+void initReload() {
+  vm.reload.notify = -1;
+  vm.reload.watches = NULL;
+  vm.reload.watchCount = 0;
+  vm.reload.watchCapacity = 0;
+  vm.reloadError[0] = '\0';
+}
+
+bool startReload() {
+  vm.reload.notify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  return vm.reload.notify >= 0;
+}
+
+void stopReload() {
+  Reloader* reload = &vm.reload;
+  if (reload->notify >= 0) close(reload->notify);
+  for (int i = 0; i < reload->watchCount; i++) {
+    FREE_ARRAY(char, reload->watches[i].directory,
+               reload->watches[i].length + 1);
+  }
+  FREE_ARRAY(Watch, reload->watches, reload->watchCapacity);
+  initReload();
+}
+
+// Watches the directory the module is in rather than the file itself,
+// since editors often save by writing a new file and renaming it over
+// the old one, which would end a watch on the file.
+void watchModule(ObjModule* module) {
+  Reloader* reload = &vm.reload;
+  if (reload->notify < 0) return;
+
+  const char* path = module->path->chars;
+  int length = (int)(strrchr(path, '/') - path);
+  if (length == 0) length = 1;
+  char directory[PATH_MAX];
+  memcpy(directory, path, length);
+  directory[length] = '\0';
+
+  int descriptor = inotify_add_watch(reload->notify, directory,
+                                     IN_CLOSE_WRITE | IN_MOVED_TO);
+  if (descriptor < 0) return;
+  for (int i = 0; i < reload->watchCount; i++) {
+    if (reload->watches[i].descriptor == descriptor) return;
+  }
+
+  if (reload->watchCapacity < reload->watchCount + 1) {
+    int oldCapacity = reload->watchCapacity;
+    int capacity = GROW_CAPACITY(oldCapacity);
+    reload->watches = GROW_ARRAY(Watch, reload->watches, oldCapacity,
+                                 capacity);
+    reload->watchCapacity = capacity;
+  }
+
+  Watch* watch = &reload->watches[reload->watchCount++];
+  watch->descriptor = descriptor;
+  watch->directory = ALLOCATE(char, length + 1);
+  memcpy(watch->directory, directory, length + 1);
+  watch->length = length;
+}
+
+static Watch* findWatch(int descriptor) {
+  Reloader* reload = &vm.reload;
+  for (int i = 0; i < reload->watchCount; i++) {
+    if (reload->watches[i].descriptor == descriptor) {
+      return &reload->watches[i];
+    }
+  }
+  return NULL;
+}
+
+static ObjModule* findModule(const char* path) {
+  size_t length = strlen(path);
+  Table* modules = &vm.modules;
+  for (int i = 0; i < modules->count; i++) {
+    ObjString* key = AS_STRING(modules->entries[i].key);
+    if ((size_t)key->length == length &&
+        memcmp(key->chars, path, length) == 0) {
+      return AS_MODULE(modules->entries[i].value);
+    }
+  }
+  return NULL;
+}
+
+// Compiles the new version into a fresh module and swaps it in, so the
+// next import runs it. Anything still running the old version keeps its
+// chunk, and values the old version produced stay as they are. If the new
+// source doesn't compile, the old version stays, and the error is
+// printed or kept in `reloadError` for the embedding program.
+static void reloadModule(ObjModule* old) {
+  ObjModule* module = newModule(old->path);
+  if (!loadModule(module)) {
+    snprintf(vm.reloadError, sizeof(vm.reloadError),
+             "%s Keeping the previous version.", vm.error);
+    if (vm.echo) fprintf(stderr, "%s\n", vm.reloadError);
+    return;
+  }
+  tableSet(&vm.modules, OBJ_VAL(old->path), OBJ_VAL(module));
+}
+
+// Reloads every loaded module whose source has changed since the last
+// check. Reading the queue doesn't wait, so when nothing has changed
+// this costs one system call.
+void checkReload() {
+  int notify = vm.reload.notify;
+  if (notify < 0) return;
+
+  char buffer[4096]
+      __attribute__((aligned(__alignof__(struct inotify_event))));
+  for (;;) {
+    ssize_t length = read(notify, buffer, sizeof(buffer));
+    if (length <= 0) return;
+
+    const struct inotify_event* event;
+    for (char* next = buffer; next < buffer + length;
+         next += sizeof(struct inotify_event) + event->len) {
+      event = (const struct inotify_event*)next;
+      Watch* watch = findWatch(event->wd);
+      if (event->len == 0 || watch == NULL) continue;
+
+      char path[PATH_MAX];
+      const char* separator = watch->length == 1 ? "" : "/";
+      if (snprintf(path, PATH_MAX, "%s%s%s", watch->directory, separator,
+                   event->name) >= PATH_MAX) {
+        continue;
+      }
+
+      ObjModule* module = findModule(path);
+      if (module != NULL && module->state != MODULE_UNLOADED) {
+        reloadModule(module);
+      }
+    }
+  }
+}
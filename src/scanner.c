@@ -5,10 +5,17 @@
 #include "common.h"
 #include "scanner.h"
 
+// How many interpolations can be open inside one another.
+#define MAX_INTERPOLATION_DEPTH 8
+
 typedef struct scanner {
   const char* start;
   const char* current;
   int line;
+  // For each open interpolation, the number of unclosed '{' inside it, so
+  // the '}' that ends it can be told apart from one that ends a map.
+  int braces[MAX_INTERPOLATION_DEPTH];
+  int interpolationDepth;
 } Scanner;
 
 Scanner scanner;
@@ -22,11 +29,36 @@ Scanner scanner;
  * - scanner.start is set to 'source'
  * - scanner.current is set to 'source'
  * - scanner.line is set to 1
+ * - scanner.interpolationDepth is set to 0
  */
 void initScanner(const char* source) {
   scanner.start = source;
   scanner.current = source;
   scanner.line = 1;
+  scanner.interpolationDepth = 0;
+}
+
+/**
+ * Starts scanning partway through a source, at a point outside any string
+ * interpolation.
+ *
+ * @param source Where to start scanning.
+ * @param line The line that point is on.
+ */
+void resumeScanner(const char* source, int line) {
+  initScanner(source);
+  scanner.line = line;
+}
+
+// Where the next scan starts, before any whitespace. After an error token
+// it's the only record of how far the scan got.
+const char* scannerPosition() {
+  return scanner.current;
+}
+
+// How many interpolations are open at this point of the scan.
+int scannerDepth() {
+  return scanner.interpolationDepth;
 }
 
 static bool isAlpha(char c) {
@@ -220,7 +252,14 @@ static TokenType checkKeyword(int start, int length,
 static TokenType identifierType() {
   switch (scanner.start[0]) {
     case 'a': return checkKeyword(1, 2, "nd", TOKEN_AND);
-    case 'c': return checkKeyword(1, 4, "lass", TOKEN_CLASS);
+    case 'c':
+      if (scanner.current - scanner.start > 1) {
+        switch (scanner.start[1]) {
+          case 'a': return checkKeyword(2, 3, "tch", TOKEN_CATCH);
+          case 'l': return checkKeyword(2, 3, "ass", TOKEN_CLASS);
+        }
+      }
+    break;
     case 'e': return checkKeyword(1, 3, "lse", TOKEN_ELSE);
     case 'f':
       if (scanner.current - scanner.start > 1) {
@@ -231,7 +270,15 @@ static TokenType identifierType() {
         }
       }
     break;
-    case 'i': return checkKeyword(1, 1, "f", TOKEN_IF);
+    case 'i':
+      if (scanner.current - scanner.start > 1) {
+        switch (scanner.start[1]) {
+          case 'f': return checkKeyword(2, 0, "", TOKEN_IF);
+          case 'm': return checkKeyword(2, 4, "port", TOKEN_IMPORT);
+          case 'n': return checkKeyword(2, 0, "", TOKEN_IN);
+        }
+      }
+    break;
     case 'n': return checkKeyword(1, 2, "il", TOKEN_NIL);
     case 'o': return checkKeyword(1, 1, "r", TOKEN_OR);
     case 'p': return checkKeyword(1, 4, "rint", TOKEN_PRINT);
@@ -241,7 +288,14 @@ static TokenType identifierType() {
       if (scanner.current - scanner.start > 1) {
         switch (scanner.start[1]) {
           case 'h': return checkKeyword(2, 2, "is", TOKEN_THIS);
-          case 'r': return checkKeyword(2, 2, "ue", TOKEN_TRUE);
+          case 'r':
+            if (scanner.current - scanner.start > 2) {
+              switch (scanner.start[2]) {
+                case 'u': return checkKeyword(3, 1, "e", TOKEN_TRUE);
+                case 'y': return checkKeyword(3, 0, "", TOKEN_TRY);
+              }
+            }
+          break;
         }
       }
     break;
@@ -267,13 +321,40 @@ static Token number() {
     advance();
 
     while (isDigit(peek())) advance();
+    return makeToken(TOKEN_NUMBER);
   }
 
-  return makeToken(TOKEN_NUMBER);
+  // Without a fractional part the literal is an integer.
+  return makeToken(TOKEN_INTEGER);
 }
 
+/**
+ * @brief Scans the rest of a string literal, or of one of its pieces.
+ *
+ * Scanning starts after the opening quote, or after the '}' that closes an
+ * interpolation. A `${` ends the piece early as a TOKEN_INTERPOLATION, and
+ * the tokens of the interpolated expression follow it.
+ *
+ * @return [Token] A TOKEN_STRING ending in the closing quote, a
+ * TOKEN_INTERPOLATION ending in `${`, or an error token.
+ *
+ * @side_effects
+ * - Advances `scanner.current` past the piece.
+ * - Opens an interpolation level when returning TOKEN_INTERPOLATION.
+ */
 static Token string() {
   while (peek() != '"' && !isAtEnd()) {
+    if (peek() == '$' && peekNext() == '{') {
+      if (scanner.interpolationDepth == MAX_INTERPOLATION_DEPTH) {
+        return errorToken("Interpolation nested too deeply.");
+      }
+
+      advance();
+      advance();
+      scanner.braces[scanner.interpolationDepth++] = 0;
+      return makeToken(TOKEN_INTERPOLATION);
+    }
+
     if (peek() == '\n') scanner.line++;
     advance();
   }
@@ -297,15 +378,39 @@ Token scanToken() {
   switch (c) {
     case '(': return makeToken(TOKEN_LEFT_PAREN);
     case ')': return makeToken(TOKEN_RIGHT_PAREN);
-    case '{': return makeToken(TOKEN_LEFT_BRACE);
-    case '}': return makeToken(TOKEN_RIGHT_BRACE);
+    case '{':
+      if (scanner.interpolationDepth > 0) {
+        scanner.braces[scanner.interpolationDepth - 1]++;
+      }
+      return makeToken(TOKEN_LEFT_BRACE);
+    case '}':
+      if (scanner.interpolationDepth > 0) {
+        int* braces = &scanner.braces[scanner.interpolationDepth - 1];
+        if (*braces == 0) {
+          // This closes the interpolation, so the string picks up again.
+          scanner.interpolationDepth--;
+          return string();
+        }
+        (*braces)--;
+      }
+      return makeToken(TOKEN_RIGHT_BRACE);
+    case '[': return makeToken(TOKEN_LEFT_BRACKET);
+    case ']': return makeToken(TOKEN_RIGHT_BRACKET);
     case ';': return makeToken(TOKEN_SEMICOLON);
+    case ':': return makeToken(TOKEN_COLON);
     case ',': return makeToken(TOKEN_COMMA);
     case '.': return makeToken(TOKEN_DOT);
     case '-': return makeToken(TOKEN_MINUS);
     case '+': return makeToken(TOKEN_PLUS);
     case '/': return makeToken(TOKEN_SLASH);
     case '*': return makeToken(TOKEN_STAR);
+    case '%': return makeToken(TOKEN_PERCENT);
+    case '&': return makeToken(TOKEN_AMPERSAND);
+    case '|': return makeToken(TOKEN_PIPE);
+    case '^': return makeToken(TOKEN_CARET);
+    case '~':
+      return makeToken(
+        match('/') ? TOKEN_TILDE_SLASH : TOKEN_TILDE);
     case '!':
       return makeToken(
         match('=') ? TOKEN_BANG_EQUAL : TOKEN_BANG);
@@ -313,9 +418,11 @@ Token scanToken() {
       return makeToken(
         match('=') ? TOKEN_EQUAL_EQUAL : TOKEN_EQUAL);
     case '<':
+      if (match('<')) return makeToken(TOKEN_LESS_LESS);
       return makeToken(
         match('=') ? TOKEN_LESS_EQUAL : TOKEN_LESS);
     case '>':
+      if (match('>')) return makeToken(TOKEN_GREATER_GREATER);
       return makeToken(
         match('=') ? TOKEN_GREATER_EQUAL : TOKEN_GREATER);
     case '"': return string();
@@ -0,0 +1,316 @@
+#include <string.h>
+
+#include "memory.h"
+#include "object.h"
+#include "sort.h"
+
+#define INSERTION_SORT_THRESHOLD 16
+#define PARTIAL_INSERTION_LIMIT 8
+#define RADIX_BITS 11
+#define RADIX_SIZE (1 << RADIX_BITS)
+#define RADIX_MASK (RADIX_SIZE - 1)
+#define RADIX_PASSES ((64 + RADIX_BITS - 1) / RADIX_BITS)
+
+// Set once a comparison has gone past MAX_DEPTH, which a list holding
+// itself always does. From then on every value compares equal, so the
+// sort still ends, and sortValues() reports the error.
+static bool tooDeep = false;
+
+static int compare(Value a, Value b, int depth);
+
+static int compareLists(ObjList* left, ObjList* right, int depth) {
+  if (left == right) return 0;
+  if (depth > MAX_DEPTH) {
+    tooDeep = true;
+    return 0;
+  }
+
+  int count = left->items.count < right->items.count
+      ? left->items.count : right->items.count;
+  for (int i = 0; i < count; i++) {
+    int order = compare(left->items.values[i], right->items.values[i],
+                        depth + 1);
+    if (order != 0) return order;
+  }
+  return (left->items.count > right->items.count) -
+         (left->items.count < right->items.count);
+}
+
+static int compareStrings(ObjString* left, ObjString* right) {
+  int length = left->length < right->length ? left->length : right->length;
+  int order = memcmp(left->chars, right->chars, length);
+  if (order != 0) return order;
+  return (left->length > right->length) - (left->length < right->length);
+}
+
+// Orders Booleans before numbers before objects, and objects by type.
+// Numbers compare by value, strings bytewise, lists lexicographically and
+// everything else by identity.
+static int compare(Value a, Value b, int depth) {
+  if (tooDeep) return 0;
+  if (IS_INT(a) && IS_INT(b)) {
+    return (AS_INT(a) > AS_INT(b)) - (AS_INT(a) < AS_INT(b));
+  }
+
+  if (IS_NUMERIC(a) && IS_NUMERIC(b)) {
+    double x = TO_DOUBLE(a);
+    double y = TO_DOUBLE(b);
+    return (x > y) - (x < y);
+  }
+
+  if (a.type != b.type) return a.type < b.type ? -1 : 1;
+  if (IS_BOOL(a)) return AS_BOOL(a) - AS_BOOL(b);
+  if (OBJ_TYPE(a) != OBJ_TYPE(b)) return OBJ_TYPE(a) < OBJ_TYPE(b) ? -1 : 1;
+
+  switch (OBJ_TYPE(a)) {
+    case OBJ_LIST: return compareLists(AS_LIST(a), AS_LIST(b), depth);
+    case OBJ_STRING: return compareStrings(AS_STRING(a), AS_STRING(b));
+    case OBJ_FILE:
+    case OBJ_GENERATOR:
+    case OBJ_MAP:
+    case OBJ_MODULE:
+    case OBJ_POLL:
+    case OBJ_STREAM:
+    case OBJ_VIEW:
+      return (AS_OBJ(a) > AS_OBJ(b)) - (AS_OBJ(a) < AS_OBJ(b));
+  }
+
+  return 0;
+}
+
+int compareValues(Value a, Value b) {
+  return compare(a, b, 0);
+}
+
+static void insertionSort(Value* values, int count) {
+  for (int i = 1; i < count; i++) {
+    Value value = values[i];
+    int j = i;
+    while (j > 0 && compareValues(value, values[j - 1]) < 0) {
+      values[j] = values[j - 1];
+      j--;
+    }
+    values[j] = value;
+  }
+}
+
+// Like insertionSort(), but gives up once it has moved too many elements,
+// leaving the range partially sorted.
+static bool partialInsertionSort(Value* values, int count) {
+  int moved = 0;
+  for (int i = 1; i < count; i++) {
+    Value value = values[i];
+    int j = i;
+    while (j > 0 && compareValues(value, values[j - 1]) < 0) {
+      values[j] = values[j - 1];
+      j--;
+    }
+    values[j] = value;
+
+    moved += i - j;
+    if (moved > PARTIAL_INSERTION_LIMIT) return false;
+  }
+
+  return true;
+}
+
+static void swap(Value* a, Value* b) {
+  Value temp = *a;
+  *a = *b;
+  *b = temp;
+}
+
+static void siftDown(Value* values, int root, int count) {
+  for (;;) {
+    int child = 2 * root + 1;
+    if (child >= count) return;
+    if (child + 1 < count &&
+        compareValues(values[child], values[child + 1]) < 0) {
+      child++;
+    }
+    if (compareValues(values[root], values[child]) >= 0) return;
+    swap(&values[root], &values[child]);
+    root = child;
+  }
+}
+
+static void heapSort(Value* values, int count) {
+  for (int i = count / 2 - 1; i >= 0; i--) siftDown(values, i, count);
+  for (int end = count - 1; end > 0; end--) {
+    swap(&values[0], &values[end]);
+    siftDown(values, 0, end);
+  }
+}
+
+static void sortThree(Value* a, Value* b, Value* c) {
+  if (compareValues(*b, *a) < 0) swap(a, b);
+  if (compareValues(*c, *b) < 0) swap(b, c);
+  if (compareValues(*b, *a) < 0) swap(a, b);
+}
+
+// Introsort: quicksort with a median-of-three (ninther on large ranges)
+// pivot, insertion sort for short ranges, and heapsort once the recursion
+// gets too deep, so adversarial inputs stay O(n log n). When a partition
+// moved nothing the range is probably already sorted, so a bounded
+// insertion sort is tried first, which makes sorted runs linear.
+static void introSort(Value* values, int count, int depthLimit) {
+  while (count > INSERTION_SORT_THRESHOLD) {
+    if (depthLimit-- == 0) {
+      heapSort(values, count);
+      return;
+    }
+
+    int middle = count / 2;
+    if (count > 128) {
+      int step = count / 8;
+      sortThree(&values[0], &values[step], &values[2 * step]);
+      sortThree(&values[middle - step], &values[middle],
+                &values[middle + step]);
+      sortThree(&values[count - 1 - 2 * step], &values[count - 1 - step],
+                &values[count - 1]);
+      sortThree(&values[step], &values[middle],
+                &values[count - 1 - step]);
+    } else {
+      sortThree(&values[0], &values[middle], &values[count - 1]);
+    }
+    swap(&values[0], &values[middle]);
+
+    // Hoare partition around the pivot now in values[0].
+    Value pivot = values[0];
+    int low = 0;
+    int high = count;
+    bool swapped = false;
+    for (;;) {
+      do low++; while (low < count && compareValues(values[low], pivot) < 0);
+      do high--; while (compareValues(pivot, values[high]) < 0);
+      if (low >= high) break;
+      swap(&values[low], &values[high]);
+      swapped = true;
+    }
+    swap(&values[0], &values[high]);
+
+    if (!swapped && partialInsertionSort(values, high) &&
+        partialInsertionSort(values + high + 1, count - high - 1)) {
+      return;
+    }
+
+    // Recurse into the smaller side to bound stack depth.
+    if (high < count - high - 1) {
+      introSort(values, high, depthLimit);
+      values += high + 1;
+      count -= high + 1;
+    } else {
+      introSort(values + high + 1, count - high - 1, depthLimit);
+      count = high;
+    }
+  }
+
+  insertionSort(values, count);
+}
+
+// Maps a double onto an unsigned key whose integer order matches the
+// numeric order: flip every bit of negatives, only the sign bit of
+// positives.
+static uint64_t numberKey(double number) {
+  uint64_t bits;
+  memcpy(&bits, &number, sizeof(bits));
+  uint64_t mask = -(bits >> 63) | 0x8000000000000000ULL;
+  return bits ^ mask;
+}
+
+static double keyNumber(uint64_t key) {
+  uint64_t mask = ((key >> 63) - 1) | 0x8000000000000000ULL;
+  uint64_t bits = key ^ mask;
+  double number;
+  memcpy(&number, &bits, sizeof(number));
+  return number;
+}
+
+// Flipping the sign bit orders two's complement integers as unsigned.
+static uint64_t intKey(int64_t integer) {
+  return (uint64_t)integer ^ 0x8000000000000000ULL;
+}
+
+static int64_t keyInt(uint64_t key) {
+  return (int64_t)(key ^ 0x8000000000000000ULL);
+}
+
+// LSD radix sort over the keys of a list holding only doubles or only
+// integers. The inner loops are branch-free, so the cost does not depend
+// on how the input is ordered.
+static void radixSort(Value* values, int count, bool integers) {
+  uint64_t* keys = ALLOCATE(uint64_t, count);
+  uint64_t* scratch = ALLOCATE(uint64_t, count);
+  size_t* counts = ALLOCATE(size_t, RADIX_SIZE * RADIX_PASSES);
+  memset(counts, 0, sizeof(size_t) * RADIX_SIZE * RADIX_PASSES);
+
+  for (int i = 0; i < count; i++) {
+    uint64_t key = integers ? intKey(AS_INT(values[i]))
+                            : numberKey(AS_NUMBER(values[i]));
+    keys[i] = key;
+    for (int pass = 0; pass < RADIX_PASSES; pass++) {
+      counts[pass * RADIX_SIZE +
+             ((key >> (pass * RADIX_BITS)) & RADIX_MASK)]++;
+    }
+  }
+
+  for (int pass = 0; pass < RADIX_PASSES; pass++) {
+    size_t* bucket = counts + pass * RADIX_SIZE;
+    int shift = pass * RADIX_BITS;
+
+    // Every key sharing one digit means the pass would not move anything.
+    if (bucket[(keys[0] >> shift) & RADIX_MASK] == (size_t)count) continue;
+
+    size_t offset = 0;
+    for (int digit = 0; digit < RADIX_SIZE; digit++) {
+      size_t size = bucket[digit];
+      bucket[digit] = offset;
+      offset += size;
+    }
+
+    for (int i = 0; i < count; i++) {
+      uint64_t key = keys[i];
+      scratch[bucket[(key >> shift) & RADIX_MASK]++] = key;
+    }
+
+    uint64_t* temp = keys;
+    keys = scratch;
+    scratch = temp;
+  }
+
+  for (int i = 0; i < count; i++) {
+    values[i] = integers ? INT_VAL(keyInt(keys[i]))
+                         : NUMBER_VAL(keyNumber(keys[i]));
+  }
+
+  FREE_ARRAY(size_t, counts, RADIX_SIZE * RADIX_PASSES);
+  FREE_ARRAY(uint64_t, scratch, count);
+  FREE_ARRAY(uint64_t, keys, count);
+}
+
+// Returns false if the values hold lists nested too deeply to compare,
+// leaving them in some order.
+bool sortValues(Value* values, int count) {
+  tooDeep = false;
+  if (count <= INSERTION_SORT_THRESHOLD) {
+    insertionSort(values, count);
+    return !tooDeep;
+  }
+
+  bool allNumbers = true;
+  bool allInts = true;
+  for (int i = 0; i < count; i++) {
+    allNumbers &= IS_NUMBER(values[i]);
+    allInts &= IS_INT(values[i]);
+  }
+
+  if (allNumbers || allInts) {
+    radixSort(values, count, allInts);
+    return true;
+  }
+
+  int depthLimit = 0;
+  for (int n = count; n > 1; n >>= 1) depthLimit += 2;
+  introSort(values, count, depthLimit);
+  return !tooDeep;
+}
@@ -0,0 +1,114 @@
+// mremap() is Linux-specific.
+#define _GNU_SOURCE
+
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "heap.h"
+#include "stack.h"
+#include "vm.h"
+
+// Each VM maps a stack of its own, but the fault handler is shared by all
+// of them and installed for the first.
+static size_t pageSize;
+static int stackCount = 0;
+static struct sigaction previousAction;
+
+static size_t mappingSize(size_t capacity) {
+  return capacity * sizeof(Value) + pageSize;
+}
+
+static void protectGuard() {
+  if (mprotect(vm.stackLimit, pageSize, PROT_NONE) != 0) abort();
+}
+
+// A fault on the guard page means a push ran off the end of the stack.
+// It's turned into a runtime error by jumping back into run(). Any other
+// fault is left to the previous handler, so it still crashes as usual.
+static void handleFault(int signal, siginfo_t* info, void* context) {
+  (void)context;
+  char* address = (char*)info->si_addr;
+  char* guard = (char*)vm.stackLimit;
+  if (vm.overflow != NULL && address >= guard && address < guard + pageSize) {
+    siglongjmp(*vm.overflow, JUMP_STACK_OVERFLOW);
+  }
+
+  sigaction(signal, &previousAction, NULL);
+}
+
+// Maps the stack with an inaccessible guard page after it, so pushes
+// never check for overflow. The fault handler runs on the C stack of
+// whichever thread faulted, which is intact since only the VM's stack
+// ran out. With huge pages on, it starts on a huge page boundary.
+void initStack() {
+  pageSize = (size_t)sysconf(_SC_PAGESIZE);
+  size_t mappedSize = mappingSize(STACK_INITIAL);
+  void* stack = usingHugePages()
+      ? mapHugePages(mappedSize)
+      : mmap(NULL, mappedSize, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (stack == NULL || stack == MAP_FAILED) exit(1);
+
+  vm.stack = (Value*)stack;
+  vm.stackLimit = vm.stack + STACK_INITIAL;
+  vm.overflow = NULL;
+  protectGuard();
+  if (stackCount++ > 0) return;
+
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_sigaction = handleFault;
+  action.sa_flags = SA_SIGINFO;
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGSEGV, &action, &previousAction);
+}
+
+void freeStack() {
+  munmap(vm.stack, mappingSize((size_t)(vm.stackLimit - vm.stack)));
+  vm.stack = NULL;
+  vm.stackLimit = NULL;
+  if (--stackCount > 0) return;
+
+  sigaction(SIGSEGV, &previousAction, NULL);
+}
+
+// Makes room for `count` more slots plus the headroom, doubling the
+// stack as needed. mremap() may move it, so the VM's pointers into the
+// stack are relocated; everything else refers to slots by index.
+bool ensureStack(int count) {
+  size_t needed = (size_t)(vm.stackTop - vm.stack) + count + STACK_HEADROOM;
+  size_t capacity = (size_t)(vm.stackLimit - vm.stack);
+  if (needed <= capacity) return true;
+
+  while (capacity < needed) capacity *= 2;
+  if (capacity > STACK_LIMIT) {
+    runtimeError("Stack overflow.");
+    return false;
+  }
+
+  // Open up the guard first, so the whole mapping has one protection.
+  if (mprotect(vm.stackLimit, pageSize, PROT_READ | PROT_WRITE) != 0) {
+    abort();
+  }
+  size_t newSize = mappingSize(capacity);
+  void* stack = mremap(vm.stack,
+                       mappingSize((size_t)(vm.stackLimit - vm.stack)),
+                       newSize, MREMAP_MAYMOVE);
+  if (stack == MAP_FAILED) {
+    protectGuard();
+    runtimeError("Stack overflow.");
+    return false;
+  }
+
+  Value* newStack = (Value*)stack;
+  vm.stackTop = newStack + (vm.stackTop - vm.stack);
+  vm.frameBase = newStack + (vm.frameBase - vm.stack);
+  vm.stack = newStack;
+  vm.stackLimit = newStack + capacity;
+  adviseHugePages(stack, capacity * sizeof(Value));
+  protectGuard();
+  return true;
+}
@@ -0,0 +1,124 @@
+#include <string.h>
+
+#include "memory.h"
+#include "object.h"
+#include "table.h"
+#include "value.h"
+
+#define EMPTY_SLOT (-1)
+
+void initTable(Table* table) {
+  table->count = 0;
+  table->capacity = 0;
+  table->entries = NULL;
+  table->indexCapacity = 0;
+  table->index = NULL;
+}
+
+void freeTable(Table* table) {
+  FREE_ARRAY(Entry, table->entries, table->capacity);
+  FREE_ARRAY(int32_t, table->index, table->indexCapacity);
+  initTable(table);
+}
+
+static uint32_t hashBits(uint64_t bits) {
+  bits ^= bits >> 33;
+  bits *= 0xff51afd7ed558ccdULL;
+  bits ^= bits >> 33;
+  return (uint32_t)bits;
+}
+
+// Integral doubles hash like the equal integer, since valuesEqual()
+// treats 1 and 1.0 as the same key.
+static uint32_t hashNumber(double number) {
+  if (number >= -0x1p63 && number < 0x1p63 &&
+      number == (double)(int64_t)number) {
+    return hashBits((uint64_t)(int64_t)number);
+  }
+
+  uint64_t bits;
+  memcpy(&bits, &number, sizeof(bits));
+  return hashBits(bits);
+}
+
+static uint32_t hashValue(Value value) {
+  if (IS_BOOL(value)) return AS_BOOL(value) ? 1 : 0;
+  if (IS_INT(value)) return hashBits((uint64_t)AS_INT(value));
+  if (IS_NUMBER(value)) return hashNumber(AS_NUMBER(value));
+  if (IS_STRING(value)) return AS_STRING(value)->hash;
+  return (uint32_t)((uintptr_t)AS_OBJ(value) >> 3);
+}
+
+// Returns the index slot holding `key`, or the empty slot where it would
+// be inserted.
+static int32_t* findSlot(Table* table, Value key) {
+  uint32_t mask = (uint32_t)table->indexCapacity - 1;
+  uint32_t slot = hashValue(key) & mask;
+  for (;;) {
+    int32_t* entry = &table->index[slot];
+    if (*entry == EMPTY_SLOT ||
+        valuesEqual(table->entries[*entry].key, key)) {
+      return entry;
+    }
+
+    slot = (slot + 1) & mask;
+  }
+}
+
+// Grows the entry array if it's full and rebuilds the index at twice its
+// size, which keeps the index at most half full. The entries grow first,
+// so if there's no memory for the index the old one still serves, and the
+// next insert tries again.
+static void growTable(Table* table) {
+  if (table->count + 1 > table->capacity) {
+    int capacity = GROW_CAPACITY(table->capacity);
+    table->entries = GROW_ARRAY(Entry, table->entries,
+                                table->capacity, capacity);
+    table->capacity = capacity;
+  }
+
+  int32_t* index = ALLOCATE(int32_t, table->capacity * 2);
+  FREE_ARRAY(int32_t, table->index, table->indexCapacity);
+  table->indexCapacity = table->capacity * 2;
+  table->index = index;
+  memset(table->index, 0xff, sizeof(int32_t) * table->indexCapacity);
+
+  for (int i = 0; i < table->count; i++) {
+    *findSlot(table, table->entries[i].key) = i;
+  }
+}
+
+bool tableGet(Table* table, Value key, Value* value) {
+  if (table->count == 0) return false;
+
+  int32_t* slot = findSlot(table, key);
+  if (*slot == EMPTY_SLOT) return false;
+
+  *value = table->entries[*slot].value;
+  return true;
+}
+
+// Looks the key up before growing, so overwriting an entry never grows a
+// full table.
+bool tableSet(Table* table, Value key, Value value) {
+  int32_t* slot = NULL;
+  if (table->indexCapacity > 0) {
+    slot = findSlot(table, key);
+    if (*slot != EMPTY_SLOT) {
+      table->entries[*slot].value = value;
+      return false;
+    }
+  }
+
+  if (table->count + 1 > table->capacity ||
+      table->indexCapacity < table->capacity * 2) {
+    growTable(table);
+    slot = findSlot(table, key);
+  }
+
+  *slot = table->count;
+  table->entries[table->count].key = key;
+  table->entries[table->count].value = value;
+  table->count++;
+  return true;
+}
@@ -1,6 +1,9 @@
+#include <inttypes.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "memory.h"
+#include "object.h"
 #include "value.h"
 
 void initValueArray(ValueArray* array) {
@@ -11,21 +14,69 @@ void initValueArray(ValueArray* array) {
 
 void writeValueArray(ValueArray* array, Value value) {
   if (array->capacity < array->count + 1) {
-    int oldCapacity = array->capacity;
-    array->capacity = GROW_CAPACITY(oldCapacity);
+    int capacity = GROW_CAPACITY(array->capacity);
     array->values = GROW_ARRAY(Value, array->values,
-                               oldCapacity, array->capacity);
+                               array->capacity, capacity);
+    array->capacity = capacity;
   }
 
   array->values[array->count] = value;
   array->count++;
 }
 
+// Makes room for at least `count` values in one reallocation, stepping
+// the capacity with the same policy writeValueArray() uses.
+void reserveValueArray(ValueArray* array, int count) {
+  if (array->capacity >= count) return;
+
+  int oldCapacity = array->capacity;
+  int capacity = oldCapacity;
+  while (capacity < count) capacity = GROW_CAPACITY(capacity);
+
+  array->values = GROW_ARRAY(Value, array->values, oldCapacity, capacity);
+  array->capacity = capacity;
+}
+
 void freeValueArray(ValueArray* array) {
   FREE_ARRAY(Value, array->values, array->capacity);
   initValueArray(array);
 }
 
+bool valuesEqual(Value a, Value b) {
+  if (IS_NUMERIC(a) && IS_NUMERIC(b) && a.type != b.type) {
+    Value integer = IS_INT(a) ? a : b;
+    double number = IS_INT(a) ? AS_NUMBER(b) : AS_NUMBER(a);
+    return number >= -0x1p63 && number < 0x1p63 &&
+           number == (double)(int64_t)number &&
+           (int64_t)number == AS_INT(integer);
+  }
+
+  if (a.type != b.type) return false;
+  switch (a.type) {
+    case VAL_BOOL: return AS_BOOL(a) == AS_BOOL(b);
+    case VAL_NUMBER: return AS_NUMBER(a) == AS_NUMBER(b);
+    case VAL_INT: return AS_INT(a) == AS_INT(b);
+    case VAL_OBJ: {
+      if (AS_OBJ(a) == AS_OBJ(b)) return true;
+      if (!IS_STRING(a) || !IS_STRING(b)) return false;
+
+      ObjString* aString = AS_STRING(a);
+      ObjString* bString = AS_STRING(b);
+      return aString->length == bString->length &&
+             aString->hash == bString->hash &&
+             memcmp(aString->chars, bString->chars, aString->length) == 0;
+    }
+    default: return false;
+  }
+}
+
 void printValue(Value value) {
-  printf("%g", value);
+  switch (value.type) {
+    case VAL_BOOL:
+      printf(AS_BOOL(value) ? "true" : "false");
+      break;
+    case VAL_NUMBER: printf("%g", AS_NUMBER(value)); break;
+    case VAL_INT: printf("%" PRId64, AS_INT(value)); break;
+    case VAL_OBJ: printObject(value); break;
+  }
 }
@@ -1,9 +1,24 @@
+#include <errno.h>
+#include <math.h>
+#include <poll.h>
+#include <stdarg.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "chunk.h"
 #include "compiler.h"
 #include "common.h"
 #include "debug.h"
+#include "file.h"
+#include "loop.h"
+#include "memory.h"
+#include "module.h"
+#include "native.h"
+#include "number.h"
+#include "object.h"
+#include "reload.h"
+#include "stack.h"
+#include "table.h"
 #include "value.h"
 #include "vm.h"
 
@@ -11,13 +26,42 @@ VM vm;
 
 static void resetStack() {
   vm.stackTop = vm.stack;
+  vm.frameBase = vm.stack;
+  vm.generator = NULL;
+}
+
+// Records the message for the error being raised. The caller returns
+// failure up to run(), which unwinds to a handler or reports it.
+void runtimeError(const char* format, ...) {
+  va_list args;
+  va_start(args, format);
+  vsnprintf(vm.error, ERROR_MAX, format, args);
+  va_end(args);
+  vm.trace[0] = '\0';
 }
 
 void initVM() {
+  vm.bytesAllocated = 0;
+  vm.objectCount = 0;
+  setMemoryLimit(0);
+  vm.echo = true;
+  initStack();
   resetStack();
+  vm.objects = NULL;
+  initTable(&vm.modules);
+  initReload();
+  vm.importDepth = 0;
+  vm.waitMode = WAIT_BLOCK;
+  vm.waitFd = -1;
+  vm.waitProgress = 0;
 }
 
-void freeVM() {}
+void freeVM() {
+  stopReload();
+  freeTable(&vm.modules);
+  freeObjects();
+  freeStack();
+}
 
 void push(Value value) {
   *vm.stackTop = value;
@@ -29,17 +73,508 @@ Value pop() {
   return *vm.stackTop;
 }
 
+static Value peek(int distance) {
+  return vm.stackTop[-1 - distance];
+}
+
+static bool isFalsey(Value value) {
+  return IS_BOOL(value) && !AS_BOOL(value);
+}
+
+static bool checkListIndex(int count, Value index, int* slot) {
+  if (IS_INT(index)) {
+    // One unsigned compare also rejects negative indexes.
+    if ((uint64_t)AS_INT(index) >= (uint64_t)count) {
+      runtimeError("List index out of bounds.");
+      return false;
+    }
+
+    *slot = (int)AS_INT(index);
+    return true;
+  }
+
+  if (!IS_NUMBER(index)) {
+    runtimeError("List index must be a number.");
+    return false;
+  }
+
+  double number = AS_NUMBER(index);
+  if (number < 0 || number >= count || number != (int)number) {
+    runtimeError("List index out of bounds.");
+    return false;
+  }
+
+  *slot = (int)number;
+  return true;
+}
+
+static bool getIndex(Value target, Value index, Value* result) {
+  if (IS_LIST(target)) {
+    ObjList* list = AS_LIST(target);
+    int slot;
+    if (!checkListIndex(list->items.count, index, &slot)) return false;
+    *result = list->items.values[slot];
+    return true;
+  }
+
+  if (IS_VIEW(target)) {
+    ObjView* view = AS_VIEW(target);
+    int slot;
+    if (!checkView(view) || !checkListIndex(view->length, index, &slot)) {
+      return false;
+    }
+    *result = viewElement(view, slot);
+    return true;
+  }
+
+  if (IS_MAP(target)) {
+    if (!tableGet(&AS_MAP(target)->table, index, result)) {
+      runtimeError("Key not found in map.");
+      return false;
+    }
+    return true;
+  }
+
+  runtimeError("Only lists and maps can be indexed.");
+  return false;
+}
+
+static bool setIndex(Value target, Value index, Value value) {
+  if (IS_LIST(target)) {
+    ObjList* list = AS_LIST(target);
+    int slot;
+    if (!checkListIndex(list->items.count, index, &slot)) return false;
+    list->items.values[slot] = value;
+    return true;
+  }
+
+  if (IS_VIEW(target)) {
+    runtimeError("Views are read-only.");
+    return false;
+  }
+
+  if (IS_MAP(target)) {
+    tableSet(&AS_MAP(target)->table, index, value);
+    return true;
+  }
+
+  runtimeError("Only lists and maps can be indexed.");
+  return false;
+}
+
+// The iterator protocol behind OP_FOR_ITER. `slots` holds the iterable,
+// the position reached so far and the loop variable. Stores the next
+// element in the variable, or sets `done` once the iterable runs out.
+static bool iterate(Value* slots, bool* done) {
+  int64_t position = AS_INT(slots[1]);
+  *done = false;
+
+  if (IS_LIST(slots[0])) {
+    ObjList* list = AS_LIST(slots[0]);
+    if (position >= list->items.count) {
+      *done = true;
+      return true;
+    }
+    slots[2] = list->items.values[position];
+  } else if (IS_VIEW(slots[0])) {
+    ObjView* view = AS_VIEW(slots[0]);
+    if (!checkView(view)) return false;
+    if (position >= view->length) {
+      *done = true;
+      return true;
+    }
+    slots[2] = viewElement(view, (int)position);
+  } else if (IS_MAP(slots[0])) {
+    Table* table = &AS_MAP(slots[0])->table;
+    if (position >= table->count) {
+      *done = true;
+      return true;
+    }
+    slots[2] = table->entries[position].key;
+  } else if (IS_STRING(slots[0])) {
+    ObjString* string = AS_STRING(slots[0]);
+    if (position >= string->length) {
+      *done = true;
+      return true;
+    }
+    slots[2] = OBJ_VAL(copyString(string->chars + position, 1));
+  } else if (IS_FILE(slots[0])) {
+    // Files iterate line by line, and the position is a byte offset.
+    if (!nextLine(AS_FILE(slots[0]), &position, &slots[2])) {
+      *done = true;
+      return true;
+    }
+    slots[1] = INT_VAL(position);
+    return true;
+  } else if (IS_STREAM(slots[0])) {
+    return nextStreamLine(AS_STREAM(slots[0]), &slots[2], done);
+  } else if (IS_POLL(slots[0])) {
+    return nextEvent(AS_POLL(slots[0]), &slots[2], done);
+  } else {
+    runtimeError("Can only iterate over lists, views, maps, strings, files "
+                 "and streams.");
+    return false;
+  }
+
+  slots[1] = INT_VAL(position + 1);
+  return true;
+}
+
+// Switches execution into `generator` on behalf of the loop instruction
+// that just read `offset`. The generator's saved window goes back on top
+// of the stack as its frame, and its next value will be stored in
+// `variable`.
+static bool resumeGenerator(ObjGenerator* generator, Value* variable,
+                            uint16_t offset) {
+  if (generator->state == GENERATOR_DONE) {
+    vm.ip += offset;
+    return true;
+  }
+
+  if (generator->state == GENERATOR_RUNNING) {
+    runtimeError("Generator is already running.");
+    return false;
+  }
+
+  int variableSlot = (int)(variable - vm.stack);
+  if (!ensureStack(generator->window.count)) return false;
+
+  generator->state = GENERATOR_RUNNING;
+  generator->caller = vm.generator;
+  generator->callerChunk = vm.chunk;
+  generator->callerBase = (int)(vm.frameBase - vm.stack);
+  generator->variable = variableSlot;
+  generator->resumeIp = vm.ip;
+  generator->exitIp = vm.ip + offset;
+
+  vm.generator = generator;
+  vm.chunk = generator->chunk;
+  vm.frameBase = vm.stackTop;
+  memcpy(vm.stackTop, generator->window.values,
+         sizeof(Value) * generator->window.count);
+  vm.stackTop += generator->window.count;
+  vm.ip = generator->ip;
+  return true;
+}
+
+// Leaves the running generator's frame and continues the loop that
+// resumed it.
+static void suspendGenerator(ObjGenerator* generator, uint8_t* ip) {
+  vm.stackTop = vm.frameBase;
+  vm.frameBase = vm.stack + generator->callerBase;
+  vm.generator = generator->caller;
+  vm.chunk = generator->callerChunk;
+  vm.ip = ip;
+}
+
+// Finds the innermost handler for the instruction that just failed. A
+// generator frame without one is abandoned, leaving the generator done,
+// and the search goes on from the loop that resumed it.
+static bool catchError() {
+  for (;;) {
+    Chunk* chunk = vm.chunk;
+    int instruction = (int)(vm.ip - chunk->code - 1);
+    int body = vm.generator == NULL
+        ? 0 : (int)(vm.generator->body - chunk->code);
+
+    for (int i = 0; i < chunk->handlerCount; i++) {
+      Handler* handler = &chunk->handlers[i];
+      if (handler->body == body && handler->start <= instruction &&
+          instruction < handler->end) {
+        vm.stackTop = vm.frameBase + handler->depth;
+        push(OBJ_VAL(copyString(vm.error, (int)strlen(vm.error))));
+        vm.ip = chunk->code + handler->handler;
+        vm.trace[0] = '\0';
+        return true;
+      }
+    }
+
+    if (vm.generator == NULL) return false;
+    ObjGenerator* generator = vm.generator;
+    generator->state = GENERATOR_DONE;
+    freeValueArray(&generator->window);
+    suspendGenerator(generator, generator->resumeIp);
+  }
+}
+
+// Joins the pieces of an interpolated string with a single allocation.
+// Numbers and bools are formatted into a scratch buffer first, so the
+// total length is known before anything is copied.
+static ObjString* buildString(Value* pieces, int count) {
+  char scratch[UINT8_COUNT * NUMBER_BUFFER_SIZE];
+  int lengths[UINT8_COUNT];
+  int used = 0;
+  size_t total = 0;
+
+  for (int i = 0; i < count; i++) {
+    Value piece = pieces[i];
+    if (IS_STRING(piece)) {
+      lengths[i] = AS_STRING(piece)->length;
+    } else if (IS_INT(piece)) {
+      lengths[i] = formatInteger(AS_INT(piece), scratch + used);
+    } else if (IS_NUMBER(piece)) {
+      lengths[i] = formatNumber(AS_NUMBER(piece), scratch + used);
+    } else if (IS_BOOL(piece)) {
+      lengths[i] = AS_BOOL(piece) ? 4 : 5;
+      memcpy(scratch + used, AS_BOOL(piece) ? "true" : "false", lengths[i]);
+    } else {
+      runtimeError("Can only interpolate strings, numbers and bools.");
+      return NULL;
+    }
+
+    if (!IS_STRING(piece)) used += lengths[i];
+    total += lengths[i];
+  }
+
+  if (total > INT32_MAX) {
+    runtimeError("Interpolated string is too long.");
+    return NULL;
+  }
+
+  char* chars = ALLOCATE(char, total + 1);
+  char* next = chars;
+  const char* formatted = scratch;
+  for (int i = 0; i < count; i++) {
+    if (IS_STRING(pieces[i])) {
+      memcpy(next, AS_STRING(pieces[i])->chars, lengths[i]);
+    } else {
+      memcpy(next, formatted, lengths[i]);
+      formatted += lengths[i];
+    }
+    next += lengths[i];
+  }
+  *next = '\0';
+
+  return takeString(chars, (int)total);
+}
+
+static InterpretResult run(bool raising);
+
+// Runs a module's body the first time it's imported, in a frame of its
+// own on top of the importer's. Every later import shares its value. An
+// error the module doesn't catch becomes an error of the import.
+static bool importModule(ObjString* path, Value* value) {
+  checkReload();
+
+  ObjModule* module;
+  Value entry;
+  if (tableGet(&vm.modules, OBJ_VAL(path), &entry)) {
+    module = AS_MODULE(entry);
+  } else {
+    module = newModule(path);
+    tableSet(&vm.modules, OBJ_VAL(path), OBJ_VAL(module));
+  }
+
+  switch (module->state) {
+    case MODULE_LOADED:
+      *value = module->value;
+      return true;
+    case MODULE_RUNNING:
+      runtimeError("Module \"%s\" imports itself.", path->chars);
+      return false;
+    case MODULE_UNLOADED:
+      if (!loadModule(module)) return false;
+      break;
+    case MODULE_COMPILED:
+      break;
+  }
+
+  if (!ensureStack(0)) return false;
+
+  // The stack may move while the module runs, so the frame is saved by
+  // index.
+  Chunk* chunk = vm.chunk;
+  uint8_t* ip = vm.ip;
+  int frameBase = (int)(vm.frameBase - vm.stack);
+  ObjGenerator* generator = vm.generator;
+
+  vm.chunk = &module->chunk;
+  vm.ip = module->chunk.code;
+  vm.frameBase = vm.stackTop;
+  vm.generator = NULL;
+  module->state = MODULE_RUNNING;
+  vm.importDepth++;
+  InterpretResult result = run(false);
+  vm.importDepth--;
+
+  vm.chunk = chunk;
+  vm.ip = ip;
+  vm.frameBase = vm.stack + frameBase;
+  vm.generator = generator;
+
+  if (result != INTERPRET_OK) {
+    module->state = MODULE_COMPILED;
+    size_t used = strlen(vm.trace);
+    snprintf(vm.trace + used, ERROR_MAX - used, "[line %d] in %s\n",
+             vm.errorLine, path->chars);
+    return false;
+  }
+
+  module->value = pop();
+  module->state = MODULE_LOADED;
+  *value = module->value;
+  return true;
+}
+
+static InterpretResult execute(bool raising);
+
+// Deals with a stream that has to wait for `vm.waitFd` before the
+// instruction that just ran, `length` bytes long, can finish. Returns
+// INTERPRET_OK to run it again now, INTERPRET_SUSPENDED to leave that to
+// resumeChunk(), or an error.
+static InterpretResult waitForStream(int length) {
+  if (vm.waitMode == WAIT_BLOCK) {
+    struct pollfd entry = {vm.waitFd, vm.waitEvents, 0};
+    vm.waitFd = -1;
+    while (poll(&entry, 1, -1) < 0) {
+      if (errno != EINTR) {
+        vm.waitProgress = 0;
+        runtimeError("Could not wait for stream: %s.", strerror(errno));
+        return INTERPRET_RUNTIME_ERROR;
+      }
+    }
+    return INTERPRET_OK;
+  }
+
+  // Only the outermost run's place is all in the VM, as for a host
+  // native suspending it.
+  if (vm.waitMode == WAIT_SUSPEND && vm.importDepth == 0) {
+    vm.waitLength = length;
+    return INTERPRET_SUSPENDED;
+  }
+
+  vm.waitFd = -1;
+  vm.waitProgress = 0;
+  runtimeError("Only the outermost script can wait on a stream.");
+  return INTERPRET_RUNTIME_ERROR;
+}
+
+// Runs the current chunk from `vm.ip`, first raising the error in
+// `vm.error` for the previous instruction if `raising`. A push onto the
+// stack's guard page jumps back here, as does an allocation there's no
+// memory for, and execution goes on by raising an error for the
+// instruction that was running.
+static InterpretResult run(bool raising) {
+  sigjmp_buf overflow;
+  sigjmp_buf* enclosing = vm.overflow;
+  vm.overflow = &overflow;
+
+  InterpretResult result;
+  switch (sigsetjmp(overflow, 1)) {
+    case 0:
+      result = execute(raising);
+      break;
+    case JUMP_STACK_OVERFLOW:
+      runtimeError("Stack overflow.");
+      result = execute(true);
+      break;
+    default:
+      // The allocation has set the error.
+      result = execute(true);
+      break;
+  }
 
-static InterpretResult run() {
+  vm.overflow = enclosing;
+  return result;
+}
+
+static InterpretResult execute(bool raising) {
   #define READ_BYTE() (*vm.ip++)
+  #define READ_SHORT() \
+    (vm.ip += 2, (uint16_t)((vm.ip[-2] << 8) | vm.ip[-1]))
   #define READ_CONSTANT() (vm.chunk->constants.values[READ_BYTE()])
+  #define THROW() goto unwind
 
-  #define BINARY_OP(op) \
+  // Called when an instruction fails with `vm.waitFd` set, so it can run
+  // again once its stream is ready.
+  #define WAIT(length) \
     do { \
-      double b = pop(); \
-      double a = pop(); \
-      push(a op b); \
-    } while (false);
+      InterpretResult waited = waitForStream(length); \
+      if (waited == INTERPRET_SUSPENDED) return waited; \
+      if (waited != INTERPRET_OK) THROW(); \
+      vm.ip -= (length); \
+    } while (false)
+
+  // Collects, or raises the out of memory error, between instructions
+  // once the heap grows past `nextGC`. It's checked after natives and on
+  // each backward jump, since anything that allocates without bound
+  // goes through one or the other.
+  #define CHECK_MEMORY() \
+    do { \
+      if (vm.bytesAllocated > vm.nextGC && !checkMemory()) THROW(); \
+    } while (false)
+
+  #define BINARY_OP(valueType, op) \
+    do { \
+      if (!IS_NUMERIC(peek(0)) || !IS_NUMERIC(peek(1))) { \
+        runtimeError("Operands must be numbers."); \
+        THROW(); \
+      } \
+      Value b = pop(); \
+      Value a = pop(); \
+      push(valueType(TO_DOUBLE(a) op TO_DOUBLE(b))); \
+    } while (false)
+
+  // Integer arithmetic that promotes to a double on overflow. Expects
+  // both operands to be integers.
+  #define INT_OP(checkedOp, op) \
+    do { \
+      int64_t b = AS_INT(pop()); \
+      int64_t a = AS_INT(pop()); \
+      int64_t result; \
+      if (checkedOp(a, b, &result)) { \
+        push(NUMBER_VAL((double)a op (double)b)); \
+      } else { \
+        push(INT_VAL(result)); \
+      } \
+    } while (false)
+
+  // The generic arithmetic instructions rewrite themselves into their
+  // integer-specialized form the first time they see two integers, and
+  // the specialized form rewrites itself back when that stops holding.
+  #define ARITHMETIC_OP(intInstruction, checkedOp, op) \
+    do { \
+      if (IS_INT(peek(0)) && IS_INT(peek(1))) { \
+        vm.ip[-1] = intInstruction; \
+        INT_OP(checkedOp, op); \
+      } else { \
+        BINARY_OP(NUMBER_VAL, op); \
+      } \
+    } while (false)
+
+  #define INT_ARITHMETIC_OP(instruction, checkedOp, op) \
+    do { \
+      if (IS_INT(peek(0)) && IS_INT(peek(1))) { \
+        INT_OP(checkedOp, op); \
+      } else { \
+        vm.ip[-1] = instruction; \
+        BINARY_OP(NUMBER_VAL, op); \
+      } \
+    } while (false)
+
+  #define COMPARISON_OP(op) \
+    do { \
+      if (IS_INT(peek(0)) && IS_INT(peek(1))) { \
+        int64_t b = AS_INT(pop()); \
+        int64_t a = AS_INT(pop()); \
+        push(BOOL_VAL(a op b)); \
+      } else { \
+        BINARY_OP(BOOL_VAL, op); \
+      } \
+    } while (false)
+
+  #define BITWISE_OP(op) \
+    do { \
+      if (!IS_INT(peek(0)) || !IS_INT(peek(1))) { \
+        runtimeError("Operands must be integers."); \
+        THROW(); \
+      } \
+      int64_t b = AS_INT(pop()); \
+      int64_t a = AS_INT(pop()); \
+      push(INT_VAL(a op b)); \
+    } while (false)
+
+  if (raising) THROW();
 
   for (;;) {
 #ifdef DEBUG_TRACE_EXECUTION
@@ -60,41 +595,384 @@ static InterpretResult run() {
         Value constant;
         constant = READ_CONSTANT();
         push(constant);
-        printValue(constant);
-        printf("\n");
+        if (vm.echo) {
+          printValue(constant);
+          printf("\n");
+        }
+        break;
+      }
+      case OP_TRUE: push(BOOL_VAL(true)); break;
+      case OP_FALSE: push(BOOL_VAL(false)); break;
+      case OP_POP_N: vm.stackTop -= READ_BYTE(); break;
+      case OP_SWAP: {
+        Value top = vm.stackTop[-1];
+        vm.stackTop[-1] = vm.stackTop[-2];
+        vm.stackTop[-2] = top;
+        break;
+      }
+      case OP_GET_LOCAL: {
+        uint8_t slot = READ_BYTE();
+        push(vm.frameBase[slot]);
+        break;
+      }
+      case OP_SET_LOCAL: {
+        uint8_t slot = READ_BYTE();
+        vm.frameBase[slot] = peek(0);
+        break;
+      }
+      case OP_EQUAL: {
+        Value b = pop();
+        Value a = pop();
+        push(BOOL_VAL(valuesEqual(a, b)));
+        break;
+      }
+      case OP_GREATER: COMPARISON_OP(>); break;
+      case OP_LESS: COMPARISON_OP(<); break;
+      case OP_ADD:
+        ARITHMETIC_OP(OP_ADD_INT, __builtin_add_overflow, +);
+        break;
+      case OP_SUBTRACT:
+        ARITHMETIC_OP(OP_SUBTRACT_INT, __builtin_sub_overflow, -);
+        break;
+      case OP_MULTIPLY:
+        ARITHMETIC_OP(OP_MULTIPLY_INT, __builtin_mul_overflow, *);
+        break;
+      case OP_ADD_INT:
+        INT_ARITHMETIC_OP(OP_ADD, __builtin_add_overflow, +);
+        break;
+      case OP_SUBTRACT_INT:
+        INT_ARITHMETIC_OP(OP_SUBTRACT, __builtin_sub_overflow, -);
+        break;
+      case OP_MULTIPLY_INT:
+        INT_ARITHMETIC_OP(OP_MULTIPLY, __builtin_mul_overflow, *);
+        break;
+      case OP_DIVIDE: BINARY_OP(NUMBER_VAL, /); break;
+      case OP_INT_DIVIDE:
+      case OP_MODULO: {
+        if (!IS_INT(peek(0)) || !IS_INT(peek(1))) {
+          if (!IS_NUMERIC(peek(0)) || !IS_NUMERIC(peek(1))) {
+            runtimeError("Operands must be numbers.");
+            THROW();
+          }
+
+          double b = TO_DOUBLE(peek(0));
+          double a = TO_DOUBLE(peek(1));
+          vm.stackTop -= 2;
+          push(NUMBER_VAL(instruction == OP_MODULO ? fmod(a, b)
+                                                   : trunc(a / b)));
+          break;
+        }
+
+        int64_t b = AS_INT(pop());
+        int64_t a = AS_INT(pop());
+        if (b == 0) {
+          runtimeError("Integer division by zero.");
+          THROW();
+        }
+
+        if (b == -1) {
+          // Sidesteps the INT64_MIN / -1 overflow.
+          push(instruction == OP_MODULO ? INT_VAL(0) :
+               a == INT64_MIN ? NUMBER_VAL(-(double)a) : INT_VAL(-a));
+        } else {
+          push(INT_VAL(instruction == OP_MODULO ? a % b : a / b));
+        }
+        break;
+      }
+      case OP_NOT:
+        push(BOOL_VAL(isFalsey(pop())));
+        break;
+      case OP_NEGATE:
+        if (IS_INT(peek(0))) {
+          int64_t value = AS_INT(pop());
+          push(value == INT64_MIN ? NUMBER_VAL(-(double)value)
+                                  : INT_VAL(-value));
+          break;
+        }
+        if (!IS_NUMBER(peek(0))) {
+          runtimeError("Operand must be a number.");
+          THROW();
+        }
+        push(NUMBER_VAL(-AS_NUMBER(pop())));
+        break;
+      case OP_BIT_AND: BITWISE_OP(&); break;
+      case OP_BIT_OR: BITWISE_OP(|); break;
+      case OP_BIT_XOR: BITWISE_OP(^); break;
+      case OP_SHIFT_LEFT:
+      case OP_SHIFT_RIGHT: {
+        if (!IS_INT(peek(0)) || !IS_INT(peek(1))) {
+          runtimeError("Operands must be integers.");
+          THROW();
+        }
+
+        int64_t count = AS_INT(pop());
+        int64_t value = AS_INT(pop());
+        if (count < 0 || count > 63) {
+          runtimeError("Shift count must be between 0 and 63.");
+          THROW();
+        }
+
+        push(INT_VAL(instruction == OP_SHIFT_LEFT
+            ? (int64_t)((uint64_t)value << count) : value >> count));
+        break;
+      }
+      case OP_BIT_NOT:
+        if (!IS_INT(peek(0))) {
+          runtimeError("Operand must be an integer.");
+          THROW();
+        }
+        push(INT_VAL(~AS_INT(pop())));
+        break;
+      case OP_BUILD_LIST: {
+        int count = READ_BYTE();
+        ObjList* list = newList(count);
+        vm.stackTop -= count;
+        if (count > 0) {
+          memcpy(list->items.values, vm.stackTop, sizeof(Value) * count);
+        }
+        push(OBJ_VAL(list));
+        break;
+      }
+      case OP_BUILD_MAP: {
+        int count = READ_BYTE();
+        ObjMap* map = newMap();
+        Value* entries = vm.stackTop - count * 2;
+        for (int i = 0; i < count; i++) {
+          tableSet(&map->table, entries[i * 2], entries[i * 2 + 1]);
+        }
+        vm.stackTop = entries;
+        push(OBJ_VAL(map));
+        break;
+      }
+      case OP_BUILD_STRING: {
+        int count = READ_BYTE();
+        ObjString* string = buildString(vm.stackTop - count, count);
+        if (string == NULL) THROW();
+        vm.stackTop -= count;
+        push(OBJ_VAL(string));
+        break;
+      }
+      case OP_LIST_APPEND: {
+        ObjList* list = AS_LIST(vm.frameBase[READ_BYTE()]);
+        writeValueArray(&list->items, pop());
+        break;
+      }
+      case OP_GET_INDEX: {
+        Value element;
+        if (!getIndex(peek(1), peek(0), &element)) {
+          THROW();
+        }
+        vm.stackTop -= 2;
+        push(element);
+        break;
+      }
+      case OP_SET_INDEX: {
+        if (!setIndex(peek(2), peek(1), peek(0))) {
+          THROW();
+        }
+        Value value = pop();
+        vm.stackTop -= 2;
+        push(value);
+        break;
+      }
+      case OP_NATIVE: {
+        Native* native = &natives[READ_BYTE()];
+        int argCount = READ_BYTE();
+        Value result;
+        // Natives hold blocks of their own while they run, so running out
+        // of memory there can't jump back into run() without leaking them.
+        // Spending the reserve has CHECK_MEMORY() raise it afterwards.
+        sigjmp_buf* overflow = vm.overflow;
+        vm.overflow = NULL;
+        bool success = native->function(argCount, vm.stackTop - argCount,
+                                         &result);
+        vm.overflow = overflow;
+        if (!success && vm.waitFd >= 0) {
+          WAIT(3);
+          break;
+        }
+        if (!success) THROW();
+        vm.stackTop -= argCount;
+        push(result);
+        CHECK_MEMORY();
+        break;
+      }
+      case OP_HOST_NATIVE: {
+        ObjString* name = AS_STRING(READ_CONSTANT());
+        int argCount = READ_BYTE();
+        Value result;
+        InterpretResult status = callHostNative(name, argCount, &result);
+        // The arguments stay on the stack until resumeChunk().
+        if (status == INTERPRET_SUSPENDED) return status;
+        if (status != INTERPRET_OK) THROW();
+        vm.stackTop -= argCount;
+        push(result);
+        CHECK_MEMORY();
+        break;
+      }
+      case OP_FOR_RANGE: {
+        Value* slots = vm.frameBase + READ_BYTE();
+        uint16_t offset = READ_SHORT();
+        if (IS_INT(slots[0]) && IS_INT(slots[1])) {
+          if (AS_INT(slots[0]) >= AS_INT(slots[1])) {
+            vm.ip += offset;
+            break;
+          }
+          slots[2] = slots[0];
+          slots[0] = INT_VAL(AS_INT(slots[0]) + 1);
+          break;
+        }
+
+        if (!IS_NUMERIC(slots[0]) || !IS_NUMERIC(slots[1])) {
+          runtimeError("Range bounds must be numbers.");
+          THROW();
+        }
+        if (TO_DOUBLE(slots[0]) >= TO_DOUBLE(slots[1])) {
+          vm.ip += offset;
+          break;
+        }
+        slots[2] = slots[0];
+        slots[0] = NUMBER_VAL(TO_DOUBLE(slots[0]) + 1);
+        break;
+      }
+      case OP_FOR_ITER: {
+        Value* slots = vm.frameBase + READ_BYTE();
+        uint16_t offset = READ_SHORT();
+        if (IS_GENERATOR(slots[0])) {
+          if (!resumeGenerator(AS_GENERATOR(slots[0]), &slots[2], offset)) {
+            THROW();
+          }
+          break;
+        }
+
+        bool done;
+        if (!iterate(slots, &done)) {
+          if (vm.waitFd < 0) THROW();
+          WAIT(4);
+          break;
+        }
+        if (done) vm.ip += offset;
+        break;
+      }
+      case OP_IMPORT: {
+        Value value;
+        if (!importModule(AS_STRING(READ_CONSTANT()), &value)) THROW();
+        push(value);
+        break;
+      }
+      case OP_JUMP_IF_FALSE: {
+        uint16_t offset = READ_SHORT();
+        if (isFalsey(pop())) vm.ip += offset;
+        break;
+      }
+      case OP_LOOP: {
+        uint16_t offset = READ_SHORT();
+        vm.ip -= offset;
+        CHECK_MEMORY();
+        break;
+      }
+      case OP_GENERATOR: {
+        uint16_t offset = READ_SHORT();
+        ObjGenerator* generator = newGenerator(vm.chunk, vm.ip);
+        appendWindow(generator, vm.stackTop - GENERATOR_CAPTURE,
+                     GENERATOR_CAPTURE);
+        vm.stackTop -= GENERATOR_CAPTURE;
+        push(OBJ_VAL(generator));
+        vm.ip += offset;
+        break;
+      }
+      case OP_YIELD: {
+        ObjGenerator* generator = vm.generator;
+        Value value = pop();
+        generator->window.count = 0;
+        appendWindow(generator, vm.frameBase,
+                     (int)(vm.stackTop - vm.frameBase));
+        generator->ip = vm.ip;
+        generator->state = GENERATOR_SUSPENDED;
+
+        suspendGenerator(generator, generator->resumeIp);
+        vm.stack[generator->variable] = value;
+        break;
+      }
+      case OP_GENERATOR_END: {
+        ObjGenerator* generator = vm.generator;
+        generator->state = GENERATOR_DONE;
+        freeValueArray(&generator->window);
+        suspendGenerator(generator, generator->exitIp);
         break;
       }
-      case OP_ADD: BINARY_OP(+); break;
-      case OP_SUBTRACT: BINARY_OP(-); break;
-      case OP_MULTIPLY: BINARY_OP(*); break;
-      case OP_DIVIDE: BINARY_OP(/); break;
-      case OP_NEGATE: push(-pop()); break;
       case OP_RETURN:
+        // A module's value is left on the stack for importModule(), and
+        // a script's for the program embedding the VM.
+        if (vm.importDepth > 0 || !vm.echo) return INTERPRET_OK;
         printValue(pop());
         printf("\n");
         return INTERPRET_OK;
     }
+    continue;
+
+  unwind: {
+      int line = getLine(vm.chunk, (int)(vm.ip - vm.chunk->code - 1));
+      if (catchError()) continue;
+      vm.errorLine = line;
+      if (vm.importDepth > 0) return INTERPRET_RUNTIME_ERROR;
+
+      if (vm.echo) {
+        fprintf(stderr, "%s\n%s[line %d] in script\n", vm.error, vm.trace,
+                line);
+      }
+      resetStack();
+      return INTERPRET_RUNTIME_ERROR;
+    }
   }
 
+  #undef CHECK_MEMORY
+  #undef BITWISE_OP
+  #undef COMPARISON_OP
+  #undef INT_ARITHMETIC_OP
+  #undef ARITHMETIC_OP
+  #undef INT_OP
   #undef BINARY_OP
+  #undef WAIT
+  #undef THROW
   #undef READ_CONSTANT
+  #undef READ_SHORT
   #undef READ_BYTE
 }
 
-InterpretResult interpret(const char* source) {
+InterpretResult interpret(const char* source, const char* path) {
   Chunk chunk;
   initChunk(&chunk);
 
-  if (!compile(source, &chunk)) {
+  if (!compile(source, path, &chunk)) {
     freeChunk(&chunk);
     return INTERPRET_COMPILE_ERROR;
   }
 
-  vm.chunk = &chunk;
-  vm.ip = vm.chunk->code;
-
-  InterpretResult result = run();
-
+  InterpretResult result = interpretChunk(&chunk);
   freeChunk(&chunk);
   return result;
 }
+
+// Runs an already compiled chunk, so its compile can be timed apart.
+InterpretResult interpretChunk(Chunk* chunk) {
+  vm.chunk = chunk;
+  vm.ip = vm.chunk->code;
+  return run(false);
+}
+
+// Goes on with the chunk after a host native suspended it. The caller
+// has replaced the native's arguments with its result, or set the error
+// to raise at the call if `raising`. A stream that was waiting tries
+// again, unless the error is raised there instead.
+InterpretResult resumeChunk(bool raising) {
+  if (vm.waitFd >= 0) {
+    vm.waitFd = -1;
+    if (raising) {
+      vm.waitProgress = 0;
+    } else {
+      vm.ip -= vm.waitLength;
+    }
+  }
+  return run(raising);
+}
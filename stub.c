@@ -0,0 +1,2 @@
+#include <stdlib.h>
+void* reallocate(void* p, size_t o, size_t n){(void)o; if(!n){free(p);return 0;} return realloc(p,n);}
@@ -0,0 +1,1181 @@
+// Tests the embedding API through libclox, as a program using it would.
+// Each test is a function that reports what it found wrong with fail().
+//
+// Usage: bin/api_test [NAME...]
+
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "clox.h"
+
+typedef struct {
+  const char* name;
+  void (*run)();
+} Test;
+
+static const char* current;
+static int failures;
+
+static void fail(const char* format, ...) {
+  va_list args;
+  va_start(args, format);
+  printf("FAIL %s: ", current);
+  vprintf(format, args);
+  printf("\n");
+  va_end(args);
+  failures++;
+}
+
+// Evaluates `source` and checks it finishes with `expected` on top of the
+// stack, which it then pops.
+static void expectInt(CloxVM* vm, const char* source, int64_t expected) {
+  CloxResult result = cloxEval(vm, source, NULL);
+  if (result != CLOX_OK) {
+    fail("%s: %s", source, cloxError(vm));
+    return;
+  }
+  if (cloxType(vm, -1) != CLOX_INT || cloxToInt(vm, -1) != expected) {
+    fail("%s: expected %lld", source, (long long)expected);
+  }
+  cloxPop(vm, 1);
+}
+
+static void expectNumber(CloxVM* vm, const char* source, double expected) {
+  CloxResult result = cloxEval(vm, source, NULL);
+  if (result != CLOX_OK) {
+    fail("%s: %s", source, cloxError(vm));
+    return;
+  }
+  if (cloxType(vm, -1) != CLOX_NUMBER || cloxToNumber(vm, -1) != expected) {
+    fail("%s: expected %g", source, expected);
+  }
+  cloxPop(vm, 1);
+}
+
+static void expectString(CloxVM* vm, const char* source,
+                         const char* expected) {
+  CloxResult result = cloxEval(vm, source, NULL);
+  if (result != CLOX_OK) {
+    fail("%s: %s", source, cloxError(vm));
+    return;
+  }
+  const char* chars = cloxToString(vm, -1, NULL);
+  if (chars == NULL || strcmp(chars, expected) != 0) {
+    fail("%s: expected \"%s\", not \"%s\"", source, expected,
+         chars == NULL ? "" : chars);
+  }
+  cloxPop(vm, 1);
+}
+
+// Multiplies its argument by the int `data` points to.
+static bool scale(CloxVM* vm, int argCount, void* data) {
+  (void)argCount;
+  return cloxPushInt(vm, cloxToInt(vm, 0) * *(int*)data);
+}
+
+static bool answer(CloxVM* vm, int argCount, void* data) {
+  (void)argCount;
+  (void)data;
+  return cloxPushInt(vm, 42);
+}
+
+// Threads and VMs.
+
+#define THREADS 4
+#define THREAD_RUNS 200
+
+typedef struct {
+  int factor;
+  const char* error;
+} Worker;
+
+// Each thread has a VM of its own, but they all take turns in the
+// library, so every call swaps the VMs in and out.
+static void* work(void* argument) {
+  Worker* worker = argument;
+  CloxVM* vm = cloxNewVM(0);
+  if (vm == NULL || !cloxRegisterNative(vm, "scale", 1, scale,
+                                        &worker->factor)) {
+    worker->error = "could not set up the VM";
+    return NULL;
+  }
+
+  for (int i = 0; i < THREAD_RUNS && worker->error == NULL; i++) {
+    CloxResult result = cloxEval(
+        vm, "sum([for (i in range(100)) scale(i)])", NULL);
+    CloxStats stats;
+    cloxStats(vm, &stats);
+    if (result != CLOX_OK) {
+      worker->error = "the script failed";
+    } else if (cloxToInt(vm, -1) != 4950 * worker->factor) {
+      worker->error = "a native saw another VM's data";
+    } else if (stats.stackSize != 1 || stats.objectCount == 0) {
+      worker->error = "the stats are another VM's";
+    }
+    cloxPop(vm, 1);
+  }
+
+  cloxFreeVM(vm);
+  return NULL;
+}
+
+static void testThreads() {
+  pthread_t threads[THREADS];
+  Worker workers[THREADS];
+  for (int i = 0; i < THREADS; i++) {
+    workers[i].factor = i + 1;
+    workers[i].error = NULL;
+    pthread_create(&threads[i], NULL, work, &workers[i]);
+  }
+  for (int i = 0; i < THREADS; i++) {
+    pthread_join(threads[i], NULL);
+    if (workers[i].error != NULL) fail("thread %d: %s", i, workers[i].error);
+  }
+}
+
+// A module compiled by one VM and cached calls its natives by name from
+// another VM that registered them in a different order.
+static void testCachedModule() {
+  char directory[] = "/tmp/clox-api-XXXXXX";
+  if (mkdtemp(directory) == NULL) {
+    fail("could not make a directory");
+    return;
+  }
+  char path[64];
+  char cachePath[64];
+  char source[128];
+  snprintf(path, sizeof(path), "%s/module.lox", directory);
+  snprintf(cachePath, sizeof(cachePath), "%s/module.loxc", directory);
+  snprintf(source, sizeof(source), "import \"%s/module\"", directory);
+
+  FILE* file = fopen(path, "w");
+  fputs("scale(answer())\n", file);
+  fclose(file);
+
+  int two = 2;
+  int three = 3;
+  CloxVM* first = cloxNewVM(0);
+  cloxRegisterNative(first, "answer", 0, answer, NULL);
+  cloxRegisterNative(first, "scale", 1, scale, &two);
+  expectInt(first, source, 84);
+  if (access(cachePath, F_OK) != 0) fail("the module wasn't cached");
+
+  CloxVM* second = cloxNewVM(0);
+  cloxRegisterNative(second, "scale", 1, scale, &three);
+  cloxRegisterNative(second, "answer", 0, answer, NULL);
+  expectInt(second, source, 126);
+
+  // A VM without the natives gets an error, not someone else's native.
+  CloxVM* third = cloxNewVM(0);
+  if (cloxEval(third, source, NULL) != CLOX_RUNTIME_ERROR ||
+      strstr(cloxError(third), "Unknown function.") == NULL) {
+    fail("a VM without the natives ran the module: %s", cloxError(third));
+  }
+
+  cloxFreeVM(first);
+  cloxFreeVM(second);
+  cloxFreeVM(third);
+  unlink(cachePath);
+  unlink(path);
+  rmdir(directory);
+}
+
+static void writeFile(const char* path, const char* text) {
+  FILE* file = fopen(path, "w");
+  fputs(text, file);
+  fclose(file);
+}
+
+// Imports the module in a new VM, which has none loaded yet, so the
+// import compiles it or takes it from the cache.
+static void expectModule(const char* source, int64_t expected) {
+  CloxVM* vm = cloxNewVM(0);
+  expectInt(vm, source, expected);
+  cloxFreeVM(vm);
+}
+
+// A cache is used only while its source keeps the size and mtime it was
+// compiled from, and one that was damaged is compiled again. The source
+// is changed behind the cache's back first, to show it's the cache that
+// runs while it matches.
+static void testStaleCache() {
+  char directory[] = "/tmp/clox-api-XXXXXX";
+  if (mkdtemp(directory) == NULL) {
+    fail("could not make a directory");
+    return;
+  }
+  char path[64];
+  char cachePath[64];
+  char source[128];
+  snprintf(path, sizeof(path), "%s/module.lox", directory);
+  snprintf(cachePath, sizeof(cachePath), "%s/module.loxc", directory);
+  snprintf(source, sizeof(source), "import \"%s/module\"", directory);
+
+  writeFile(path, "1 + 1\n");
+  expectModule(source, 2);
+  struct stat info;
+  if (stat(cachePath, &info) != 0 || stat(path, &info) != 0) {
+    fail("the module wasn't cached");
+  }
+
+  struct timespec times[2] = {info.st_atim, info.st_mtim};
+  writeFile(path, "2 + 2\n");
+  utimensat(AT_FDCWD, path, times, 0);
+  expectModule(source, 2);
+
+  times[1].tv_sec++;
+  utimensat(AT_FDCWD, path, times, 0);
+  expectModule(source, 4);
+
+  writeFile(path, "30 + 30\n");
+  utimensat(AT_FDCWD, path, times, 0);
+  expectModule(source, 60);
+
+  // Flip the cache's last byte, then cut it in half.
+  FILE* cache = fopen(cachePath, "r+b");
+  fseek(cache, -1L, SEEK_END);
+  int last = fgetc(cache);
+  fseek(cache, -1L, SEEK_END);
+  fputc(last ^ 0x01, cache);
+  fclose(cache);
+  expectModule(source, 60);
+
+  if (stat(cachePath, &info) != 0 ||
+      truncate(cachePath, info.st_size / 2) != 0) {
+    fail("could not cut the cache short");
+  }
+  expectModule(source, 60);
+
+  unlink(cachePath);
+  unlink(path);
+  rmdir(directory);
+}
+
+// Two modules that import each other get an error naming the one that
+// was imported again, which the importing script can catch.
+static void testImportCycle() {
+  char directory[] = "/tmp/clox-api-XXXXXX";
+  if (mkdtemp(directory) == NULL) {
+    fail("could not make a directory");
+    return;
+  }
+  char paths[4][64];
+  snprintf(paths[0], sizeof(paths[0]), "%s/a.lox", directory);
+  snprintf(paths[1], sizeof(paths[1]), "%s/b.lox", directory);
+  snprintf(paths[2], sizeof(paths[2]), "%s/a.loxc", directory);
+  snprintf(paths[3], sizeof(paths[3]), "%s/b.loxc", directory);
+  writeFile(paths[0], "import \"b\"\n");
+  writeFile(paths[1], "[1, import \"a\"]\n");
+
+  char source[128];
+  snprintf(source, sizeof(source), "import \"%s/a\"", directory);
+  CloxVM* vm = cloxNewVM(0);
+  if (cloxEval(vm, source, NULL) != CLOX_RUNTIME_ERROR ||
+      strstr(cloxError(vm), "/a.lox\" imports itself.") == NULL) {
+    fail("the cycle wasn't reported: %s", cloxError(vm));
+  }
+
+  snprintf(source, sizeof(source),
+           "try import \"%s/b\" catch (e) 7", directory);
+  expectInt(vm, source, 7);
+  cloxFreeVM(vm);
+
+  for (int i = 0; i < 4; i++) unlink(paths[i]);
+  rmdir(directory);
+}
+
+// Reloading.
+
+typedef struct {
+  const char* path;
+  const char* text;
+} Edit;
+
+// Saves a new version of a module while the script that imported it runs.
+static bool edit(CloxVM* vm, int argCount, void* data) {
+  (void)argCount;
+  Edit* change = data;
+  writeFile(change->path, change->text);
+  return cloxPushBool(vm, true);
+}
+
+// Saves by writing a new file and renaming it over the old one, as many
+// editors do.
+static void renameFile(const char* path, const char* text) {
+  char temporary[80];
+  snprintf(temporary, sizeof(temporary), "%s.new", path);
+  writeFile(temporary, text);
+  rename(temporary, path);
+}
+
+// Under CLOX_RELOAD a saved module is compiled again and the next import
+// runs it, in every VM that loaded it. One that doesn't compile leaves
+// the previous version in place and says why. A VM without the flag
+// keeps what it loaded.
+static void testReload() {
+  char directory[] = "/tmp/clox-api-XXXXXX";
+  if (mkdtemp(directory) == NULL) {
+    fail("could not make a directory");
+    return;
+  }
+  char path[64];
+  char cachePath[64];
+  char source[128];
+  snprintf(path, sizeof(path), "%s/module.lox", directory);
+  snprintf(cachePath, sizeof(cachePath), "%s/module.loxc", directory);
+  snprintf(source, sizeof(source), "import \"%s/module\"", directory);
+  writeFile(path, "1\n");
+
+  CloxVM* first = cloxNewVM(CLOX_RELOAD);
+  CloxVM* second = cloxNewVM(CLOX_RELOAD);
+  CloxVM* fixed = cloxNewVM(0);
+  expectInt(first, source, 1);
+  expectInt(second, source, 1);
+  expectInt(fixed, source, 1);
+
+  writeFile(path, "2\n");
+  expectInt(first, source, 2);
+  expectInt(second, source, 2);
+  expectInt(fixed, source, 1);
+
+  renameFile(path, "3\n");
+  expectInt(first, source, 3);
+
+  writeFile(path, "(\n");
+  expectInt(first, source, 3);
+  if (strstr(cloxReloadError(first), "Keeping the previous version.") ==
+      NULL) {
+    fail("the failed reload wasn't reported: \"%s\"",
+         cloxReloadError(first));
+  }
+
+  cloxFreeVM(first);
+  cloxFreeVM(second);
+  cloxFreeVM(fixed);
+  unlink(cachePath);
+  unlink(path);
+  rmdir(directory);
+}
+
+// A generator the old version made finishes on the old code after the
+// module is saved mid-run, while the next import runs the new version.
+static void testReloadInFlight() {
+  char directory[] = "/tmp/clox-api-XXXXXX";
+  if (mkdtemp(directory) == NULL) {
+    fail("could not make a directory");
+    return;
+  }
+  char path[64];
+  char cachePath[64];
+  char source[256];
+  snprintf(path, sizeof(path), "%s/module.lox", directory);
+  snprintf(cachePath, sizeof(cachePath), "%s/module.loxc", directory);
+  writeFile(path, "(for (x in range(4)) x * 10)\n");
+  snprintf(source, sizeof(source),
+           "stringify([for (old in [import \"%s/module\"])"
+           " for (saved in [edit()])"
+           " [sum(for (x in old) x), sum(for (x in import \"%s/module\") x)]])",
+           directory, directory);
+
+  Edit change = {path, "(for (x in range(4)) x)\n"};
+  CloxVM* vm = cloxNewVM(CLOX_RELOAD);
+  cloxRegisterNative(vm, "edit", 0, edit, &change);
+  expectString(vm, source, "[[60,6]]");
+  cloxFreeVM(vm);
+
+  unlink(cachePath);
+  unlink(path);
+  rmdir(directory);
+}
+
+// The value stack.
+
+// Nests `middle` `depth` times in `open` and `close`, between `before`
+// and `after`. The caller frees the result.
+static char* nest(const char* before, const char* open, int depth,
+                  const char* middle, const char* close, const char* after) {
+  size_t size = strlen(before) + (strlen(open) + strlen(close)) * depth +
+                strlen(middle) + strlen(after) + 1;
+  char* source = malloc(size);
+  char* end = stpcpy(source, before);
+  for (int i = 0; i < depth; i++) end = stpcpy(end, open);
+  end = stpcpy(end, middle);
+  for (int i = 0; i < depth; i++) end = stpcpy(end, close);
+  strcpy(end, after);
+  return source;
+}
+
+static size_t stackCapacity(CloxVM* vm) {
+  CloxStats stats;
+  cloxStats(vm, &stats);
+  return stats.stackCapacity;
+}
+
+// Runs a generated script, which is too long to print, and checks the
+// result is the int `expected`.
+static void expectDeep(CloxVM* vm, const char* what, char* source,
+                       int64_t expected) {
+  if (cloxEval(vm, source, NULL) != CLOX_OK) {
+    fail("%s: %s", what, cloxError(vm));
+  } else {
+    if (cloxType(vm, -1) != CLOX_INT || cloxToInt(vm, -1) != expected) {
+      fail("%s: expected %lld", what, (long long)expected);
+    }
+    cloxPop(vm, 1);
+  }
+  free(source);
+}
+
+// Runs a generated script and checks it fails with `result` and an error
+// containing `message`.
+static void expectDeepError(CloxVM* vm, const char* what, char* source,
+                            CloxResult result, const char* message) {
+  if (cloxEval(vm, source, NULL) != result ||
+      strstr(cloxError(vm), message) == NULL) {
+    fail("%s: \"%s\"", what, cloxError(vm));
+  }
+  free(source);
+}
+
+// One frame can hold far more than the 256 values the stack once had,
+// and entering a frame near the end of the mapping, as a module's does,
+// grows it.
+static void testDeepStack() {
+  char directory[] = "/tmp/clox-api-XXXXXX";
+  if (mkdtemp(directory) == NULL) {
+    fail("could not make a directory");
+    return;
+  }
+  char path[64];
+  char cachePath[64];
+  char import[96];
+  snprintf(path, sizeof(path), "%s/module.lox", directory);
+  snprintf(cachePath, sizeof(cachePath), "%s/module.loxc", directory);
+  snprintf(import, sizeof(import), "sum(import \"%s/module\")", directory);
+  writeFile(path, "[for (x in range(4)) x]\n");
+
+  CloxVM* vm = cloxNewVM(0);
+  expectDeep(vm, "a deep list",
+             nest("len(", "[true, ", 12000, "true", "]", ")"), 2);
+
+  // Each level leaves its left operand on the stack, and uses no
+  // constants, of which a chunk can only hold 256.
+  size_t capacity = stackCapacity(vm);
+  int depth = (int)capacity - 500;
+  expectDeep(vm, "an import deep in the stack",
+             nest("", "len([true]) + (", depth, import, ")", ""),
+             depth + 6);
+  if (stackCapacity(vm) <= capacity) {
+    fail("the stack didn't grow for the module's frame");
+  }
+
+  cloxFreeVM(vm);
+  unlink(cachePath);
+  unlink(path);
+  rmdir(directory);
+}
+
+// Running onto the guard page is a runtime error, which try can catch,
+// and the VM carries on after it. Nesting too deep for the compiler, or
+// loops too deep in the stack for their slots, are compile errors.
+static void testStackOverflow() {
+  CloxVM* vm = cloxNewVM(0);
+  int depth = (int)stackCapacity(vm) + 100;
+  char* source = nest("try ", "[true, ", depth, "true", "]",
+                      " catch (e) e");
+  if (cloxEval(vm, source, NULL) != CLOX_OK ||
+      strcmp(cloxToString(vm, -1, NULL), "Stack overflow.") != 0) {
+    fail("the overflow wasn't caught: %s", cloxError(vm));
+  } else {
+    cloxPop(vm, 1);
+  }
+  free(source);
+
+  expectDeepError(vm, "an overflow",
+                  nest("", "[true, ", depth, "true", "]", ""),
+                  CLOX_RUNTIME_ERROR, "Stack overflow.");
+  expectInt(vm, "1 + 1", 2);
+
+  expectDeepError(vm, "nesting too deep",
+                  nest("", "[true, ", 100000, "true", "]", ""),
+                  CLOX_COMPILE_ERROR, "Expression nested too deeply.");
+  expectDeepError(vm, "a loop past slot 255",
+                  nest("", "[true, ", 300, "[for (x in [1]) x]", "]", ""),
+                  CLOX_COMPILE_ERROR,
+                  "Too many values on the stack in one expression.");
+  expectDeepError(vm, "nested generators",
+                  nest("[for (y in ", "(for (x in ", 2000, "[1]", ") x)",
+                       ") y]"),
+                  CLOX_COMPILE_ERROR, "Error");
+  cloxFreeVM(vm);
+}
+
+// Views.
+
+static double samples[] = {1.5, 2.5, 3.5, 4.5};
+static CloxView* samplesView;
+
+// Pushes a view of `samples`, which release() takes back.
+static bool pushSamples(CloxVM* vm, int argCount, void* data) {
+  (void)argCount;
+  (void)data;
+  samplesView = cloxPushView(vm, CLOX_VIEW_DOUBLE, samples, 4);
+  return samplesView != NULL;
+}
+
+static bool release(CloxVM* vm, int argCount, void* data) {
+  (void)argCount;
+  (void)data;
+  cloxReleaseView(vm, samplesView);
+  return cloxPushBool(vm, true);
+}
+
+static CloxVM* newViewVM() {
+  CloxVM* vm = cloxNewVM(0);
+  cloxRegisterNative(vm, "samples", 0, pushSamples, NULL);
+  cloxRegisterNative(vm, "release", 0, release, NULL);
+  return vm;
+}
+
+// A script that still holds a view after it's released gets an error,
+// and so does the program, which sees it empty.
+static void testReleasedView() {
+  CloxVM* vm = newViewVM();
+  expectString(vm,
+      "[for (v in [samples()]) [release(), try v[0] catch (e) e]][0][1]",
+      "View has been released.");
+
+  CloxView* view = cloxPushView(vm, CLOX_VIEW_DOUBLE, samples, 4);
+  cloxReleaseView(vm, view);
+  double buffer[4];
+  if (cloxType(vm, -1) != CLOX_VIEW || cloxLength(vm, -1) != 0 ||
+      cloxReadNumbers(vm, -1, buffer, 4) != 0) {
+    fail("the program still sees the released view's elements");
+  }
+  // Releasing it again changes nothing.
+  cloxReleaseView(vm, view);
+  cloxPop(vm, 1);
+  cloxFreeVM(vm);
+}
+
+// Collections under a quota, while a script holds a view and while only
+// the pin keeps one, leave it and its memory alone.
+static void testCollectedView() {
+  CloxVM* vm = newViewVM();
+  cloxSetMemoryLimit(vm, 1 << 20);
+
+  // Megabytes of lists go by, so the run only finishes by collecting.
+  const char* garbage = "sum(for (i in range(100000)) len([i, i]))";
+  char source[256];
+  snprintf(source, sizeof(source),
+           "[for (v in [samples()]) [%s, sum(v)]][0][1]", garbage);
+  expectNumber(vm, source, 12);
+  cloxReleaseView(vm, samplesView);
+
+  CloxView* view = cloxPushView(vm, CLOX_VIEW_DOUBLE, samples, 4);
+  cloxPop(vm, 1);
+  expectInt(vm, garbage, 200000);
+  cloxReleaseView(vm, view);
+
+  CloxStats stats;
+  cloxStats(vm, &stats);
+  if (stats.bytesAllocated > 1 << 20) fail("the quota wasn't kept");
+  cloxFreeVM(vm);
+}
+
+// Reading into a buffer shorter than the list fills the buffer and
+// returns the full length, from a list or from a view.
+static void testShortBuffer() {
+  CloxVM* vm = cloxNewVM(0);
+  if (cloxEval(vm, "[1, 2, 3, 4, 5]", NULL) != CLOX_OK) {
+    fail("%s", cloxError(vm));
+    return;
+  }
+  double numbers[3] = {-1, -1, -1};
+  int64_t ints[3] = {-1, -1, -1};
+  if (cloxReadNumbers(vm, -1, numbers, 2) != 5 || numbers[0] != 1 ||
+      numbers[1] != 2 || numbers[2] != -1) {
+    fail("cloxReadNumbers() overran a buffer for a list");
+  }
+  if (cloxReadInts(vm, -1, ints, 2) != 5 || ints[0] != 1 || ints[1] != 2 ||
+      ints[2] != -1) {
+    fail("cloxReadInts() overran a buffer for a list");
+  }
+  cloxPop(vm, 1);
+
+  int64_t data[5] = {10, 20, 30, 40, 50};
+  CloxView* view = cloxPushView(vm, CLOX_VIEW_INT64, data, 5);
+  ints[2] = -1;
+  numbers[2] = -1;
+  if (cloxReadInts(vm, -1, ints, 2) != 5 || ints[0] != 10 ||
+      ints[1] != 20 || ints[2] != -1) {
+    fail("cloxReadInts() overran a buffer for a view");
+  }
+  if (cloxReadNumbers(vm, -1, numbers, 2) != 5 || numbers[0] != 10 ||
+      numbers[1] != 20 || numbers[2] != -1) {
+    fail("cloxReadNumbers() overran a buffer for a view");
+  }
+  cloxReleaseView(vm, view);
+  cloxFreeVM(vm);
+}
+
+// A negative capacity, or a NULL buffer with room for any, is refused. A
+// capacity of 0 asks only for the length.
+static void testBufferCapacity() {
+  CloxVM* vm = cloxNewVM(0);
+  if (cloxEval(vm, "[1, 2, 3]", NULL) != CLOX_OK) {
+    fail("%s", cloxError(vm));
+    return;
+  }
+  double numbers[3];
+  int64_t ints[3];
+  if (cloxReadNumbers(vm, -1, numbers, -1) != -1 ||
+      cloxReadInts(vm, -1, ints, -1) != -1) {
+    fail("a negative capacity was taken");
+  }
+  if (cloxReadNumbers(vm, -1, NULL, 3) != -1 ||
+      cloxReadInts(vm, -1, NULL, 3) != -1) {
+    fail("a NULL buffer was taken");
+  }
+  if (cloxReadNumbers(vm, -1, NULL, 0) != 3 ||
+      cloxReadInts(vm, -1, NULL, 0) != 3) {
+    fail("a capacity of 0 didn't give the length");
+  }
+  cloxFreeVM(vm);
+}
+
+// Suspension.
+
+// Suspends the run until the program has the result for its argument.
+static bool fetch(CloxVM* vm, int argCount, void* data) {
+  (void)argCount;
+  (void)data;
+  return cloxSuspend(vm);
+}
+
+static CloxVM* newFetchVM() {
+  CloxVM* vm = cloxNewVM(0);
+  cloxRegisterNative(vm, "fetch", 1, fetch, NULL);
+  return vm;
+}
+
+// Checks the run is suspended in fetch(`argument`).
+static bool expectFetch(CloxVM* vm, CloxResult result, int64_t argument) {
+  if (result != CLOX_SUSPENDED || !cloxIsSuspended(vm)) {
+    fail("the run wasn't suspended: %s", cloxError(vm));
+    return false;
+  }
+  if (cloxStackSize(vm) != 1 || cloxToInt(vm, 0) != argument) {
+    fail("fetch() didn't leave its argument %lld", (long long)argument);
+    return false;
+  }
+  return true;
+}
+
+// A native suspends in the middle of an expression, and the run goes on
+// from there with the value it's given.
+static void testResumeValue() {
+  CloxVM* vm = newFetchVM();
+  CloxResult result = cloxEval(vm, "1 + fetch(2) * 10", NULL);
+  if (!expectFetch(vm, result, 2)) return;
+
+  if (cloxEval(vm, "1", NULL) != CLOX_RUNTIME_ERROR) {
+    fail("a suspended VM ran another script");
+  }
+  cloxPushInt(vm, 5);
+  if (cloxResume(vm) != CLOX_OK || cloxToInt(vm, -1) != 51) {
+    fail("resumed to the wrong result: %s", cloxError(vm));
+  }
+  if (cloxIsSuspended(vm) || cloxStackSize(vm) != 1) {
+    fail("the finished run left the VM in the wrong state");
+  }
+  cloxFreeVM(vm);
+}
+
+// An error resumed with is raised at the call, where a try can catch it.
+static void testResumeError() {
+  CloxVM* vm = newFetchVM();
+  CloxResult result = cloxEval(
+      vm, "try fetch(1) catch (error) \"caught ${error}\"", NULL);
+  if (!expectFetch(vm, result, 1)) return;
+
+  int length;
+  if (cloxResumeError(vm, "timed out") != CLOX_OK ||
+      cloxToString(vm, -1, &length) == NULL ||
+      strcmp(cloxToString(vm, -1, &length), "caught timed out") != 0) {
+    fail("the try didn't catch the error: %s", cloxError(vm));
+  }
+  cloxPop(vm, 1);
+
+  // Uncaught, it fails the run and leaves the stack as it was.
+  result = cloxEval(vm, "fetch(1) + 1", NULL);
+  if (!expectFetch(vm, result, 1)) return;
+  if (cloxResumeError(vm, "timed out") != CLOX_RUNTIME_ERROR ||
+      strstr(cloxError(vm), "timed out") == NULL ||
+      cloxStackSize(vm) != 0) {
+    fail("the uncaught error didn't fail the run: %s", cloxError(vm));
+  }
+  cloxFreeVM(vm);
+}
+
+#define SUSPENDED_VMS 3
+
+// One thread keeps a run in flight in each of several VMs, answering
+// their calls in turn.
+static void testInterleaved() {
+  CloxVM* vms[SUSPENDED_VMS];
+  CloxResult results[SUSPENDED_VMS];
+  for (int i = 0; i < SUSPENDED_VMS; i++) {
+    vms[i] = newFetchVM();
+    results[i] = cloxEval(vms[i], "fetch(1) + fetch(2) * fetch(3)", NULL);
+  }
+
+  for (int call = 1; call <= 3; call++) {
+    for (int i = 0; i < SUSPENDED_VMS; i++) {
+      if (!expectFetch(vms[i], results[i], call)) return;
+      cloxPushInt(vms[i], call * 10 + i);
+      results[i] = cloxResume(vms[i]);
+    }
+  }
+
+  for (int i = 0; i < SUSPENDED_VMS; i++) {
+    int64_t expected = (10 + i) + (20 + i) * (30 + i);
+    if (results[i] != CLOX_OK || cloxToInt(vms[i], -1) != expected) {
+      fail("VM %d finished wrong: %s", i, cloxError(vms[i]));
+    }
+    cloxFreeVM(vms[i]);
+  }
+}
+
+// Streams.
+
+// Checks the run is suspended on a stream until a descriptor that isn't
+// ready yet is ready for `events`.
+static bool expectWait(CloxVM* vm, CloxResult result, int events) {
+  int waiting;
+  int fd = result == CLOX_SUSPENDED ? cloxWaitFd(vm, &waiting) : -1;
+  if (fd < 0) {
+    fail("the run didn't wait on a stream: %s", cloxError(vm));
+    return false;
+  }
+  if (waiting != events) {
+    fail("the run waited for the wrong event");
+    return false;
+  }
+  struct pollfd entry = {fd, events == CLOX_WRITABLE ? POLLOUT : POLLIN, 0};
+  if (poll(&entry, 1, 0) != 0) {
+    fail("the run waited on a descriptor that was ready");
+    return false;
+  }
+  return true;
+}
+
+// Checks the run finished with a string on top of the stack, which it
+// then pops.
+static void expectResult(CloxVM* vm, CloxResult result,
+                         const char* expected) {
+  if (result != CLOX_OK) {
+    fail("the run didn't finish: %s", cloxError(vm));
+    return;
+  }
+  const char* chars = cloxToString(vm, -1, NULL);
+  if (chars == NULL || strcmp(chars, expected) != 0) {
+    fail("expected %s, not %s", expected, chars == NULL ? "" : chars);
+  }
+  cloxPop(vm, 1);
+}
+
+// Makes a directory for a FIFO or socket, and the path to one in it.
+static bool makeDirectory(char* directory, char* path, size_t size,
+                          const char* name) {
+  strcpy(directory, "/tmp/clox-api-XXXXXX");
+  if (mkdtemp(directory) == NULL) {
+    fail("could not make a directory");
+    return false;
+  }
+  snprintf(path, size, "%s/%s", directory, name);
+  return true;
+}
+
+// A pipe's lines come out as they arrive, a partial one waiting for its
+// end, and the run finishes once the writer closes.
+static void testStreamPipe() {
+  int fds[2];
+  if (pipe(fds) < 0) {
+    fail("could not make a pipe");
+    return;
+  }
+  char source[128];
+  snprintf(source, sizeof(source),
+           "stringify([for (line in stream(\"/dev/fd/%d\")) line])", fds[0]);
+
+  CloxVM* vm = cloxNewVM(0);
+  CloxResult result = cloxEval(vm, source, NULL);
+  if (expectWait(vm, result, CLOX_READABLE)) {
+    if (write(fds[1], "one\ntw", 6) != 6) fail("could not write");
+    result = cloxResume(vm);
+  }
+  if (expectWait(vm, result, CLOX_READABLE)) {
+    if (write(fds[1], "o\nthree", 7) != 7) fail("could not write");
+    close(fds[1]);
+    fds[1] = -1;
+    result = cloxResume(vm);
+  }
+  expectResult(vm, result, "[\"one\",\"two\",\"three\"]");
+
+  if (fds[1] >= 0) close(fds[1]);
+  close(fds[0]);
+  cloxFreeVM(vm);
+}
+
+// Opening a FIFO doesn't wait for a writer, and reading it waits until
+// one has come and gone.
+static void testStreamFifo() {
+  char directory[32];
+  char path[64];
+  if (!makeDirectory(directory, path, sizeof(path), "fifo")) return;
+  if (mkfifo(path, 0600) < 0) {
+    fail("could not make a FIFO");
+    rmdir(directory);
+    return;
+  }
+  char source[128];
+  snprintf(source, sizeof(source),
+           "stringify([for (line in stream(\"%s\")) line])", path);
+
+  CloxVM* vm = cloxNewVM(0);
+  CloxResult result = cloxEval(vm, source, NULL);
+  if (expectWait(vm, result, CLOX_READABLE)) {
+    // With nobody writing yet, the run only waits again.
+    result = cloxResume(vm);
+  }
+  if (expectWait(vm, result, CLOX_READABLE)) {
+    int writer = open(path, O_WRONLY | O_NONBLOCK);
+    if (writer < 0 || write(writer, "first\n", 6) != 6) {
+      fail("could not write the FIFO");
+    }
+    if (writer >= 0) close(writer);
+    result = cloxResume(vm);
+  }
+  expectResult(vm, result, "[\"first\"]");
+
+  cloxFreeVM(vm);
+  unlink(path);
+  rmdir(directory);
+}
+
+// Opens a Unix socket listening at `path`.
+static int listenAt(const char* path) {
+  struct sockaddr_un address;
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  strcpy(address.sun_path, path);
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) return -1;
+  if (bind(fd, (struct sockaddr*)&address, sizeof(address)) < 0 ||
+      listen(fd, 1) < 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+// A script talks to a server on a Unix socket: its request goes out at
+// once, and it waits for the reply.
+static void testStreamSocket() {
+  char directory[32];
+  char path[64];
+  if (!makeDirectory(directory, path, sizeof(path), "socket")) return;
+  int server = listenAt(path);
+  if (server < 0) {
+    fail("could not listen");
+    rmdir(directory);
+    return;
+  }
+  char source[160];
+  snprintf(source, sizeof(source),
+           "stringify([for (s in [connect(\"%s\")]) "
+           "[write(s, \"ping\n\"), [for (line in s) line]]][0])", path);
+
+  CloxVM* vm = cloxNewVM(0);
+  CloxResult result = cloxEval(vm, source, NULL);
+  if (expectWait(vm, result, CLOX_READABLE)) {
+    int client = accept(server, NULL, NULL);
+    char request[16];
+    if (client < 0 || read(client, request, sizeof(request)) != 5 ||
+        memcmp(request, "ping\n", 5) != 0) {
+      fail("the request didn't arrive");
+    }
+    if (client >= 0) {
+      if (write(client, "pong\n", 5) != 5) fail("could not reply");
+      close(client);
+    }
+    result = cloxResume(vm);
+  }
+  expectResult(vm, result, "[5,[\"pong\"]]");
+
+  cloxFreeVM(vm);
+  close(server);
+  unlink(path);
+  rmdir(directory);
+}
+
+#define PAYLOAD_SIZE (1 << 20)
+
+static bool payload(CloxVM* vm, int argCount, void* data) {
+  (void)argCount;
+  (void)data;
+  char* chars = malloc(PAYLOAD_SIZE);
+  memset(chars, 'x', PAYLOAD_SIZE);
+  bool success = cloxPushString(vm, chars, PAYLOAD_SIZE);
+  free(chars);
+  return success;
+}
+
+// A write larger than the socket's buffer waits each time it fills up
+// and goes on from where it stopped, so every byte arrives once.
+static void testStreamWrite() {
+  char directory[32];
+  char path[64];
+  if (!makeDirectory(directory, path, sizeof(path), "socket")) return;
+  int server = listenAt(path);
+  if (server < 0) {
+    fail("could not listen");
+    rmdir(directory);
+    return;
+  }
+  char source[128];
+  snprintf(source, sizeof(source),
+           "[for (s in [connect(\"%s\")]) write(s, payload())][0]", path);
+
+  CloxVM* vm = cloxNewVM(0);
+  cloxRegisterNative(vm, "payload", 0, payload, NULL);
+  CloxResult result = cloxEval(vm, source, NULL);
+  int client = accept(server, NULL, NULL);
+  fcntl(client, F_SETFL, O_NONBLOCK);
+
+  int waits = 0;
+  size_t received = 0;
+  char buffer[64 * 1024];
+  for (;;) {
+    if (result == CLOX_SUSPENDED) {
+      if (!expectWait(vm, result, CLOX_WRITABLE)) break;
+      waits++;
+    }
+    ssize_t count;
+    while ((count = read(client, buffer, sizeof(buffer))) > 0) {
+      for (ssize_t i = 0; i < count; i++) {
+        if (buffer[i] != 'x') fail("a byte arrived changed");
+      }
+      received += (size_t)count;
+    }
+    if (result != CLOX_SUSPENDED) break;
+    result = cloxResume(vm);
+  }
+
+  if (result != CLOX_OK || cloxToInt(vm, -1) != PAYLOAD_SIZE) {
+    fail("the write didn't finish: %s", cloxError(vm));
+  }
+  if (waits == 0) fail("the write never waited");
+  if (received != PAYLOAD_SIZE) {
+    fail("%zu bytes arrived, not %d", received, PAYLOAD_SIZE);
+  }
+
+  close(client);
+  cloxFreeVM(vm);
+  close(server);
+  unlink(path);
+  rmdir(directory);
+}
+
+// A poll waits on all its streams at once and hands out lines in the
+// order they arrive.
+static void testPollStreams() {
+  int first[2];
+  int second[2];
+  if (pipe(first) < 0 || pipe(second) < 0) {
+    fail("could not make pipes");
+    return;
+  }
+  char source[160];
+  snprintf(source, sizeof(source),
+           "stringify([for (event in poll([stream(\"/dev/fd/%d\"), "
+           "stream(\"/dev/fd/%d\")])) event])", first[0], second[0]);
+
+  CloxVM* vm = cloxNewVM(0);
+  CloxResult result = cloxEval(vm, source, NULL);
+  if (expectWait(vm, result, CLOX_READABLE)) {
+    if (write(second[1], "b\n", 2) != 2) fail("could not write");
+    result = cloxResume(vm);
+  }
+  if (expectWait(vm, result, CLOX_READABLE)) {
+    if (write(first[1], "a\n", 2) != 2) fail("could not write");
+    close(first[1]);
+    result = cloxResume(vm);
+  }
+  if (expectWait(vm, result, CLOX_READABLE)) {
+    close(second[1]);
+    result = cloxResume(vm);
+  }
+  expectResult(vm, result, "[[1,\"b\"],[0,\"a\"]]");
+
+  close(first[0]);
+  close(second[0]);
+  cloxFreeVM(vm);
+}
+
+static char nestedSource[128];
+
+// Runs `nestedSource` from inside a native and pushes why it failed.
+static bool nested(CloxVM* vm, int argCount, void* data) {
+  (void)argCount;
+  (void)data;
+  if (cloxEval(vm, nestedSource, NULL) != CLOX_RUNTIME_ERROR) {
+    return cloxRaise(vm, "The nested run didn't fail.");
+  }
+  const char* message = cloxError(vm);
+  return cloxPushString(vm, message, (int)strcspn(message, "\n"));
+}
+
+// A run that can't suspend gets an error rather than waiting inside the
+// library, and a suspended one can be given an error to raise instead of
+// going on.
+static void testStreamErrors() {
+  int fds[2];
+  if (pipe(fds) < 0) {
+    fail("could not make a pipe");
+    return;
+  }
+  snprintf(nestedSource, sizeof(nestedSource),
+           "[for (line in stream(\"/dev/fd/%d\")) line]", fds[0]);
+
+  CloxVM* vm = cloxNewVM(0);
+  cloxRegisterNative(vm, "nested", 0, nested, NULL);
+  expectString(vm, "nested()",
+               "Only the outermost script can wait on a stream.");
+
+  char source[160];
+  snprintf(source, sizeof(source), "try %s catch (error) error",
+           nestedSource);
+  CloxResult result = cloxEval(vm, source, NULL);
+  if (expectWait(vm, result, CLOX_READABLE)) {
+    result = cloxResumeError(vm, "gave up");
+  }
+  expectResult(vm, result, "gave up");
+
+  close(fds[0]);
+  close(fds[1]);
+  cloxFreeVM(vm);
+}
+
+// Documents.
+
+// The exported document calls: edits report the tokens they replaced,
+// tokens come back by kind and offset, and a check reports the first
+// compile error through cloxError().
+static void testDocument() {
+  CloxVM* vm = cloxNewVM(0);
+  CloxDocument* document = cloxNewDocument(vm, "[1, 2]", NULL);
+  if (!cloxCheckDocument(vm, document)) fail("%s", cloxError(vm));
+
+  const char* inserted = ", \"a ${3}\nb\"";
+  CloxTokenRange range;
+  if (!cloxEditDocument(vm, document, 5, 5, inserted, (int)strlen(inserted),
+                        &range) ||
+      range.first != 3 || range.removed != 1 || range.added != 5) {
+    fail("the edit replaced the wrong tokens");
+  }
+  if (cloxDocumentLength(vm, document) != 18 ||
+      cloxDocumentTokenCount(vm, document) != 10) {
+    fail("the edit left the wrong text or tokens");
+  }
+
+  CloxToken token;
+  if (!cloxDocumentToken(vm, document, 5, &token) ||
+      token.kind != CLOX_TOKEN_INTERPOLATION || token.start != 7 ||
+      token.line != 1) {
+    fail("the interpolation isn't where it was typed");
+  }
+  if (!cloxDocumentToken(vm, document, 8, &token) ||
+      token.kind != CLOX_TOKEN_PUNCTUATION || token.line != 2) {
+    fail("the bracket after the multi-line string is on the wrong line");
+  }
+  if (!cloxDocumentToken(vm, document, 9, &token) ||
+      token.kind != CLOX_TOKEN_EOF ||
+      cloxDocumentToken(vm, document, 10, &token)) {
+    fail("the tokens don't end with EOF");
+  }
+  if (!cloxCheckDocument(vm, document)) fail("%s", cloxError(vm));
+
+  if (!cloxEditDocument(vm, document, 0, 1, "(", 1, NULL) ||
+      cloxCheckDocument(vm, document) ||
+      strncmp(cloxError(vm), "[line 1] Error at ','", 21) != 0) {
+    fail("the broken document checked as %s", cloxError(vm));
+  }
+  if (cloxEditDocument(vm, document, 5, 100, "", 0, NULL) ||
+      cloxEditDocument(vm, document, 2, 1, "", 0, NULL)) {
+    fail("an edit outside the text was taken");
+  }
+
+  cloxFreeDocument(vm, document);
+  cloxFreeVM(vm);
+}
+
+static Test tests[] = {
+  {"threads", testThreads},
+  {"cached_module", testCachedModule},
+  {"stale_cache", testStaleCache},
+  {"import_cycle", testImportCycle},
+  {"reload", testReload},
+  {"reload_in_flight", testReloadInFlight},
+  {"deep_stack", testDeepStack},
+  {"stack_overflow", testStackOverflow},
+  {"released_view", testReleasedView},
+  {"collected_view", testCollectedView},
+  {"short_buffer", testShortBuffer},
+  {"buffer_capacity", testBufferCapacity},
+  {"resume_value", testResumeValue},
+  {"resume_error", testResumeError},
+  {"interleaved", testInterleaved},
+  {"stream_pipe", testStreamPipe},
+  {"stream_fifo", testStreamFifo},
+  {"stream_socket", testStreamSocket},
+  {"stream_write", testStreamWrite},
+  {"poll_streams", testPollStreams},
+  {"stream_errors", testStreamErrors},
+  {"document", testDocument},
+};
+
+int main(int argc, const char* argv[]) {
+  int count = (int)(sizeof(tests) / sizeof(tests[0]));
+  int passed = 0;
+  int failed = 0;
+  for (int i = 0; i < count; i++) {
+    bool chosen = argc == 1;
+    for (int j = 1; j < argc; j++) {
+      if (strcmp(argv[j], tests[i].name) == 0) chosen = true;
+    }
+    if (!chosen) continue;
+
+    current = tests[i].name;
+    failures = 0;
+    tests[i].run();
+    if (failures == 0) {
+      passed++;
+    } else {
+      failed++;
+    }
+  }
+
+  printf("%d passed, %d failed.\n", passed, failed);
+  return failed == 0 ? 0 : 1;
+}
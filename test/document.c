@@ -0,0 +1,210 @@
+// Checks that a document's tokens, kept up to date edit by edit, are
+// always the ones a fresh scanToken() pass over its text finds, and that
+// checkDocument() agrees with compiling that text. The edits are random,
+// drawn from fragments that open and close strings, multi-line strings,
+// interpolations and comments, so they land inside all of them.
+//
+// Usage: bin/document_test [--seeds N]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chunk.h"
+#include "compiler.h"
+#include "document.h"
+#include "scanner.h"
+#include "vm.h"
+
+#define DEFAULT_SEEDS 200
+#define SMALL_EDITS 400
+// A few documents are large enough to span many token pages.
+#define LARGE_FRAGMENTS 6000
+#define LARGE_EDITS 60
+
+static const char* fragments[] = {
+  "x", "total", "for", "in", "try", "catch", "nil", " ", "  ", "\n", "\n\n",
+  "1", "12.5", "1.", ".5", "0x1f", "(", ")", "[", "]", "{", "}", ",", ":",
+  "+", "-", "*", "/", "<<", ">=", "==", "!", "~/", "\"",
+  "\"plain\"", "\"two\nlines\"", "\"three\nmore\nlines\"",
+  "\"a ${x} b\"", "\"${", "${", "\"n ${\"in ${y}\"} m\"",
+  "\"open ${[1,\n2]} shut\"", "\"unterminated", "// comment\n", "//",
+  "@", "[for (v in xs) v * 2]", "sum(for (i in range(n)) i)",
+};
+
+#define FRAGMENT_COUNT ((int)(sizeof(fragments) / sizeof(fragments[0])))
+
+// xorshift32, so a seed always makes the same edits.
+static uint32_t state;
+
+static uint32_t nextRandom() {
+  state ^= state << 13;
+  state ^= state >> 17;
+  state ^= state << 5;
+  return state;
+}
+
+static int randomBelow(int bound) {
+  return bound <= 0 ? 0 : (int)(nextRandom() % (uint32_t)bound);
+}
+
+// The text the document should hold, kept by hand.
+typedef struct {
+    char* chars;
+    int length;
+    int capacity;
+} Text;
+
+static void replaceText(Text* text, int start, int end, const char* chars,
+                        int length) {
+  int needed = text->length - (end - start) + length + 1;
+  if (needed > text->capacity) {
+    text->capacity = needed * 2;
+    text->chars = realloc(text->chars, (size_t)text->capacity);
+    if (text->chars == NULL) exit(1);
+  }
+  memmove(text->chars + start + length, text->chars + end,
+          (size_t)(text->length - end + 1));
+  memcpy(text->chars + start, chars, (size_t)length);
+  text->length += length - (end - start);
+}
+
+static int failures = 0;
+
+// Compares every token with a fresh pass of the scanner over `text`.
+static bool sameTokens(Document* document, Text* text, int seed, int edit) {
+  initScanner(text->chars);
+  int count = documentTokenCount(document);
+  for (int i = 0;; i++) {
+    Token expected = scanToken();
+    if (i == count) {
+      printf("FAIL seed %d edit %d: %d tokens, but the scan goes on\n",
+             seed, edit, count);
+      return false;
+    }
+
+    Token token = documentToken(document, i);
+    bool same = token.type == expected.type &&
+                token.line == expected.line &&
+                token.length == expected.length &&
+                memcmp(token.start, expected.start,
+                       (size_t)expected.length) == 0;
+    if (same && token.type != TOKEN_ERROR) {
+      LexToken lexed = documentLexToken(document, i);
+      same = lexed.start == (int)(expected.start - text->chars);
+    }
+    if (!same) {
+      printf("FAIL seed %d edit %d: token %d is '%.*s' on line %d, "
+             "not '%.*s' on line %d\n", seed, edit, i, token.length,
+             token.start, token.line, expected.length, expected.start,
+             expected.line);
+      return false;
+    }
+
+    if (expected.type == TOKEN_EOF) {
+      if (i + 1 != count) {
+        printf("FAIL seed %d edit %d: %d tokens, not %d\n", seed, edit,
+               count, i + 1);
+        return false;
+      }
+      return true;
+    }
+  }
+}
+
+// Compiles `text` from scratch and compares the outcome with the
+// document's check.
+static bool sameCheck(Document* document, Text* text, int seed, int edit) {
+  Chunk chunk;
+  initChunk(&chunk);
+  CompileError error;
+  initScanner(text->chars);
+  bool compiled = compileTokens(scanToken, NULL, &chunk, &error);
+  freeChunk(&chunk);
+
+  bool checked = checkDocument(document);
+  if (checked != compiled ||
+      (!compiled && (strcmp(document->error, error.message) != 0 ||
+                     document->errorLine != error.token.line))) {
+    printf("FAIL seed %d edit %d: checked %s, compiled %s\n", seed, edit,
+           checked ? "clean" : document->error,
+           compiled ? "clean" : error.message);
+    return false;
+  }
+  return true;
+}
+
+static void randomEdit(Document* document, Text* text) {
+  int start = randomBelow(text->length + 1);
+  int end = start;
+  const char* chars = "";
+  switch (randomBelow(3)) {
+    case 0:
+      chars = fragments[randomBelow(FRAGMENT_COUNT)];
+      break;
+    case 1:
+      end = start + randomBelow(text->length - start < 12
+                                ? text->length - start + 1 : 12);
+      break;
+    default:
+      end = start + randomBelow(text->length - start < 6
+                                ? text->length - start + 1 : 6);
+      chars = fragments[randomBelow(FRAGMENT_COUNT)];
+      break;
+  }
+
+  int length = (int)strlen(chars);
+  int before = documentTokenCount(document);
+  TokenRange range = editDocument(document, start, end, chars, length);
+  replaceText(text, start, end, chars, length);
+  if (documentTokenCount(document) != before - range.removed + range.added) {
+    printf("FAIL: the edit's token range doesn't add up\n");
+    failures++;
+  }
+}
+
+static void runSeed(int seed, int fragmentCount, int edits) {
+  state = (uint32_t)seed * 2654435761u + 1;
+  Text text = {calloc(1, 1), 0, 1};
+  if (text.chars == NULL) exit(1);
+  for (int i = 0; i < fragmentCount; i++) {
+    const char* fragment = fragments[randomBelow(FRAGMENT_COUNT)];
+    replaceText(&text, text.length, text.length, fragment,
+                (int)strlen(fragment));
+  }
+
+  Document document;
+  initDocument(&document, text.chars, NULL);
+  for (int edit = 0; edit <= edits; edit++) {
+    if (edit > 0) randomEdit(&document, &text);
+    if (!sameTokens(&document, &text, seed, edit) ||
+        !sameCheck(&document, &text, seed, edit)) {
+      failures++;
+      break;
+    }
+  }
+
+  freeDocument(&document);
+  free(text.chars);
+}
+
+int main(int argc, const char* argv[]) {
+  int seeds = DEFAULT_SEEDS;
+  if (argc == 3 && strcmp(argv[1], "--seeds") == 0) {
+    seeds = atoi(argv[2]);
+  } else if (argc != 1) {
+    fprintf(stderr, "Usage: document_test [--seeds N]\n");
+    return 64;
+  }
+
+  initVM();
+  for (int seed = 1; seed <= seeds; seed++) {
+    bool large = seed % 20 == 0;
+    runSeed(seed, large ? LARGE_FRAGMENTS : 1 + seed % 40,
+            large ? LARGE_EDITS : SMALL_EDITS);
+  }
+  freeVM();
+
+  printf("%d seeds, %d failed.\n", seeds, failures);
+  return failures == 0 ? 0 : 1;
+}